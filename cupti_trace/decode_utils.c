@@ -214,9 +214,7 @@ void
 init_rnnctx(const char *chipset, int use_colors)
 {
 	rnn_init();
-	rnndb = rnn_newdb();
-	rnn_parsefile(rnndb, "root.xml");
-	rnn_prepdb(rnndb);
+	rnndb = rnn_loaddb("root.xml");
 	rnnctx = rnndec_newcontext(rnndb);
 	if (use_colors)
 		rnnctx->colors = &envy_def_colors;
@@ -31,6 +31,23 @@
 #include "nvrm.h"
 
 struct gpu_object *gpu_objects = NULL;
+
+/* (cid, handle) -> object, chained through hash_next in gpu_objects order */
+static struct gpu_object **gpu_object_hash = NULL;
+static uint32_t gpu_object_hash_size = 0;
+static uint32_t gpu_object_count = 0;
+
+/*
+ * All gpu mappings, in a treap ordered by address and augmented with the
+ * maximum end address of each subtree, so that mappings containing an
+ * address can be found in logarithmic time.
+ */
+static struct gpu_mapping *gpu_mapping_index = NULL;
+
+/* live gpu mappings, chained through index.hash_next */
+static struct gpu_mapping **gpu_mapping_hash = NULL;
+static uint32_t gpu_mapping_hash_size = 0;
+static uint32_t gpu_mapping_count = 0;
 static struct cpu_mapping **cpu_mappings = NULL;
 uint32_t max_id = UINT32_MAX;
 static uint32_t preallocated_cpu_mappings = 0;
@@ -102,6 +119,39 @@ static void gpu_object_disconnect_from_parent(struct gpu_object *parent, struct
 		}
 }
 
+static inline uint32_t gpu_object_hash_bucket(uint32_t cid, uint32_t handle)
+{
+	uint32_t h = (cid * 0x9e3779b1) ^ handle;
+	h ^= h >> 15;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return h & (gpu_object_hash_size - 1);
+}
+
+static void gpu_object_hash_rebuild(uint32_t size)
+{
+	struct gpu_object **tails = calloc(size, sizeof(tails[0]));
+	struct gpu_object *obj;
+
+	free(gpu_object_hash);
+	gpu_object_hash = calloc(size, sizeof(gpu_object_hash[0]));
+	gpu_object_hash_size = size;
+
+	/* objects with the same cid and handle must stay newest first */
+	for (obj = gpu_objects; obj != NULL; obj = obj->next)
+	{
+		uint32_t bucket = gpu_object_hash_bucket(obj->cid, obj->handle);
+		obj->hash_next = NULL;
+		if (tails[bucket])
+			tails[bucket]->hash_next = obj;
+		else
+			gpu_object_hash[bucket] = obj;
+		tails[bucket] = obj;
+	}
+
+	free(tails);
+}
+
 struct gpu_object *gpu_object_add(uint32_t fd, uint32_t cid, uint32_t parent, uint32_t handle, uint32_t class_)
 {
 	struct gpu_object *obj = calloc(sizeof(struct gpu_object), 1);
@@ -116,6 +166,16 @@ struct gpu_object *gpu_object_add(uint32_t fd, uint32_t cid, uint32_t parent, ui
 
 	obj->next = gpu_objects;
 	gpu_objects = obj;
+
+	if (++gpu_object_count > gpu_object_hash_size)
+		gpu_object_hash_rebuild(gpu_object_hash_size ? gpu_object_hash_size * 2 : 256);
+	else
+	{
+		uint32_t bucket = gpu_object_hash_bucket(cid, handle);
+		obj->hash_next = gpu_object_hash[bucket];
+		gpu_object_hash[bucket] = obj;
+	}
+
 	return obj;
 }
 
@@ -153,17 +213,205 @@ struct cpu_mapping *gpu_addr_to_cpu_mapping(struct gpu_mapping *gpu_mapping, uin
 struct gpu_object *gpu_object_find(uint32_t cid, uint32_t handle)
 {
 	struct gpu_object *obj;
-	for (obj = gpu_objects; obj != NULL; obj = obj->next)
+	if (!gpu_object_hash)
+		return NULL;
+	for (obj = gpu_object_hash[gpu_object_hash_bucket(cid, handle)]; obj != NULL; obj = obj->hash_next)
 		if (obj->cid == cid && obj->handle == handle)
 			return obj;
 	return NULL;
 }
 
+static inline uint32_t gpu_mapping_hash_bucket(struct gpu_mapping *mapping)
+{
+	uint64_t h = (uintptr_t)mapping;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 32;
+	return h & (gpu_mapping_hash_size - 1);
+}
+
+static void gpu_mapping_hash_add(struct gpu_mapping *mapping)
+{
+	uint32_t bucket;
+
+	if (++gpu_mapping_count > gpu_mapping_hash_size)
+	{
+		struct gpu_mapping **old = gpu_mapping_hash, *m, *next;
+		uint32_t i, old_size = gpu_mapping_hash_size;
+
+		gpu_mapping_hash_size = old_size ? old_size * 2 : 256;
+		gpu_mapping_hash = calloc(gpu_mapping_hash_size, sizeof(gpu_mapping_hash[0]));
+		for (i = 0; i < old_size; i++)
+			for (m = old[i]; m != NULL; m = next)
+			{
+				next = m->index.hash_next;
+				bucket = gpu_mapping_hash_bucket(m);
+				m->index.hash_next = gpu_mapping_hash[bucket];
+				gpu_mapping_hash[bucket] = m;
+			}
+		free(old);
+	}
+
+	bucket = gpu_mapping_hash_bucket(mapping);
+	mapping->index.hash_next = gpu_mapping_hash[bucket];
+	gpu_mapping_hash[bucket] = mapping;
+}
+
+static void gpu_mapping_hash_remove(struct gpu_mapping *mapping)
+{
+	struct gpu_mapping **it = &gpu_mapping_hash[gpu_mapping_hash_bucket(mapping)];
+	while (*it != mapping)
+		it = &(*it)->index.hash_next;
+	*it = mapping->index.hash_next;
+	gpu_mapping_count--;
+}
+
+int gpu_mapping_is_valid(struct gpu_mapping *mapping)
+{
+	struct gpu_mapping *m;
+	if (!gpu_mapping_hash)
+		return 0;
+	for (m = gpu_mapping_hash[gpu_mapping_hash_bucket(mapping)]; m != NULL; m = m->index.hash_next)
+		if (m == mapping)
+			return 1;
+	return 0;
+}
+
+static void gpu_mapping_index_update(struct gpu_mapping *m)
+{
+	m->index.max_end = m->index.end;
+	if (m->index.left && m->index.left->index.max_end > m->index.max_end)
+		m->index.max_end = m->index.left->index.max_end;
+	if (m->index.right && m->index.right->index.max_end > m->index.max_end)
+		m->index.max_end = m->index.right->index.max_end;
+}
+
+static int gpu_mapping_index_before(struct gpu_mapping *a, struct gpu_mapping *b)
+{
+	if (a->index.start != b->index.start)
+		return a->index.start < b->index.start;
+	return (uintptr_t)a < (uintptr_t)b;
+}
+
+static void gpu_mapping_index_split(struct gpu_mapping *t, struct gpu_mapping *key,
+		struct gpu_mapping **left, struct gpu_mapping **right)
+{
+	if (!t)
+	{
+		*left = *right = NULL;
+		return;
+	}
+
+	if (gpu_mapping_index_before(t, key))
+	{
+		gpu_mapping_index_split(t->index.right, key, &t->index.right, right);
+		*left = t;
+	}
+	else
+	{
+		gpu_mapping_index_split(t->index.left, key, left, &t->index.left);
+		*right = t;
+	}
+	gpu_mapping_index_update(t);
+}
+
+static struct gpu_mapping *gpu_mapping_index_merge(struct gpu_mapping *left, struct gpu_mapping *right)
+{
+	if (!left)
+		return right;
+	if (!right)
+		return left;
+
+	if (left->index.priority > right->index.priority)
+	{
+		left->index.right = gpu_mapping_index_merge(left->index.right, right);
+		gpu_mapping_index_update(left);
+		return left;
+	}
+
+	right->index.left = gpu_mapping_index_merge(left, right->index.left);
+	gpu_mapping_index_update(right);
+	return right;
+}
+
+static struct gpu_mapping *gpu_mapping_index_insert(struct gpu_mapping *t, struct gpu_mapping *m)
+{
+	if (!t || m->index.priority > t->index.priority)
+	{
+		gpu_mapping_index_split(t, m, &m->index.left, &m->index.right);
+		gpu_mapping_index_update(m);
+		return m;
+	}
+
+	if (gpu_mapping_index_before(m, t))
+		t->index.left = gpu_mapping_index_insert(t->index.left, m);
+	else
+		t->index.right = gpu_mapping_index_insert(t->index.right, m);
+	gpu_mapping_index_update(t);
+	return t;
+}
+
+static struct gpu_mapping *gpu_mapping_index_remove(struct gpu_mapping *t, struct gpu_mapping *m)
+{
+	if (t == m)
+		return gpu_mapping_index_merge(m->index.left, m->index.right);
+
+	if (gpu_mapping_index_before(m, t))
+		t->index.left = gpu_mapping_index_remove(t->index.left, m);
+	else
+		t->index.right = gpu_mapping_index_remove(t->index.right, m);
+	gpu_mapping_index_update(t);
+	return t;
+}
+
+/* counts (up to 2) mappings of dev containing address, remembers the last one */
+static void gpu_mapping_index_lookup(struct gpu_mapping *t, uint64_t address,
+		struct gpu_object *dev, struct gpu_mapping **found, int *hits)
+{
+	while (t && t->index.max_end > address && *hits < 2)
+	{
+		gpu_mapping_index_lookup(t->index.left, address, dev, found, hits);
+		if (t->index.start > address)
+			return;
+		if (address < t->index.end && nvrm_get_device(t->object) == dev)
+		{
+			*found = t;
+			(*hits)++;
+		}
+		t = t->index.right;
+	}
+}
+
+void gpu_mapping_add(struct gpu_mapping *mapping)
+{
+	static uint32_t seed = 0x6d2b79f5;
+	struct gpu_object *obj = mapping->object;
+
+	mapping->next = obj->gpu_mappings;
+	obj->gpu_mappings = mapping;
+
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	mapping->index.priority = seed;
+	mapping->index.start = mapping->address;
+	mapping->index.end = mapping->address + mapping->length;
+	gpu_mapping_index = gpu_mapping_index_insert(gpu_mapping_index, mapping);
+	gpu_mapping_hash_add(mapping);
+}
+
 struct gpu_mapping *gpu_mapping_find(uint64_t address, struct gpu_object *dev)
 {
 	if (address == 0)
 		return NULL;
 
+	struct gpu_mapping *found = NULL;
+	int hits = 0;
+	gpu_mapping_index_lookup(gpu_mapping_index, address, dev, &found, &hits);
+	if (hits < 2)
+		return found;
+
+	/* overlapping mappings, the first one in object list order wins */
 	struct gpu_object *obj;
 	struct gpu_mapping *gpu_mapping;
 	for (obj = gpu_objects; obj != NULL; obj = obj->next)
@@ -224,6 +472,8 @@ void gpu_mapping_destroy(struct gpu_mapping *gpu_mapping)
 			else
 				obj->gpu_mappings = it->next;
 			it->next = NULL;
+			gpu_mapping_index = gpu_mapping_index_remove(gpu_mapping_index, it);
+			gpu_mapping_hash_remove(it);
 			free(it);
 
 			return;
@@ -264,6 +514,15 @@ void gpu_object_destroy(struct gpu_object *obj)
 
 	free_regions(&obj->written_regions);
 
+	struct gpu_object **hit = &gpu_object_hash[gpu_object_hash_bucket(obj->cid, obj->handle)];
+	while (*hit && *hit != obj)
+		hit = &(*hit)->hash_next;
+	if (*hit)
+	{
+		*hit = obj->hash_next;
+		gpu_object_count--;
+	}
+
 	struct gpu_object *it, *prev = NULL;
 	for (it = gpu_objects; it != NULL; prev = it, it = it->next)
 		if (it == obj)
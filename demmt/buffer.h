@@ -57,6 +57,19 @@ struct gpu_mapping
 	struct gpu_object *object;
 
 	struct gpu_mapping *next;
+
+	/* global address index and set of live mappings, see buffer.c */
+	struct
+	{
+		struct gpu_mapping *left;
+		struct gpu_mapping *right;
+		uint64_t start;
+		uint64_t end;
+		uint64_t max_end;
+		uint32_t priority;
+		struct gpu_mapping *hash_next;
+	}
+	index;
 };
 
 struct gpu_object
@@ -90,6 +103,8 @@ struct gpu_object
 
 	void *class_data;
 	void (*class_data_destroy)(struct gpu_object *gpu_obj);
+
+	struct gpu_object *hash_next;
 };
 
 extern struct gpu_object *gpu_objects;
@@ -106,7 +121,9 @@ struct gpu_object *gpu_object_add(uint32_t fd, uint32_t cid, uint32_t parent, ui
 struct gpu_object *gpu_object_find(uint32_t cid, uint32_t handle);
 void gpu_object_destroy(struct gpu_object *obj);
 
+void gpu_mapping_add(struct gpu_mapping *mapping);
 struct gpu_mapping *gpu_mapping_find(uint64_t address, struct gpu_object *dev);
+int gpu_mapping_is_valid(struct gpu_mapping *mapping);
 void *gpu_mapping_get_data(struct gpu_mapping *mapping, uint64_t address, uint64_t length);
 void gpu_mapping_destroy(struct gpu_mapping *gpu_mapping);
 
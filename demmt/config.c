@@ -23,6 +23,7 @@
  */
 
 #include <fcntl.h>
+#include <getopt.h>
 #include <libgen.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -33,6 +34,7 @@
 #include "object_state.h"
 #include "macro.h"
 #include "nvrm.h"
+#include "shader_cache.h"
 
 int dump_raw_ioctl_data = 0;
 int dump_decoded_ioctl_data = 1;
@@ -62,6 +64,7 @@ int indent_logs = 0;
 int dump_memory_writes = 1;
 int dump_memory_reads = 1;
 int info = 1;
+int format_threads = 1;
 
 #ifdef LIBSECCOMP_AVAILABLE
 int seccomp_level = 2;
@@ -75,7 +78,8 @@ static void usage()
 	fprintf(stderr, "Usage: demmt [OPTION]\n"
 			"Decodes binary trace files generated by Valgrind MMT. Reads standard input\n"
 			"or file passed by -l.\n\n"
-			"  -l file\tuse \"file\" as input (can be compressed by: xz, bzip2, gzip)\n"
+			"  -l file\tuse \"file\" as input (can be compressed by: xz, bzip2, gzip,\n"
+			"         \tzstd)\n"
 			"  -q\t\tprint only the most important data (quiet); shortcut for:\n"
 			"    \t\t-d all -e pb,shader,macro,tsc,tic,cp,classes=all,buffer-usage,\n"
 			"    \t\tnvrm-class-desc\n"
@@ -93,6 +97,18 @@ static void usage()
 			"         \tscripts/mmiotrace/mmt-app-demmt-mmiotrace.sh)\n"
 			"  -x 0/1/2\tdisable/enable loose/enable strict sandboxing (default: 2\n"
 			"          \tif libseccomp is available)\n"
+			"  -j threads, --format-threads threads\n"
+			"         \tformat pushbuffer method values using this many threads,\n"
+			"         \t0 means one per cpu (default: 1); channels are still\n"
+			"         \tdecoded one at a time\n"
+			"  --shader-cache file\n"
+			"         \tkeep disassembled shaders in \"file\" across runs (started\n"
+			"         \tover when envydis changes)\n"
+			"  --shader-export file\n"
+			"         \twrite every unique shader and how many times it was seen\n"
+			"         \tto \"file\" at exit\n"
+			"  --shader-refs\n"
+			"         \tprint only a reference for shaders that were already printed\n"
 			"\n"
 			"  -d msg_type1[,msg_type2[,msg_type3....]] - disable messages\n"
 			"  -e msg_type1[,msg_type2[,msg_type3....]] - enable messages\n"
@@ -426,6 +442,14 @@ static void handle_filter_opt(const char *_arg, int en)
 	free(arg);
 }
 
+/* long options without a short one */
+enum
+{
+	OPT_SHADER_CACHE = 0x100,
+	OPT_SHADER_EXPORT,
+	OPT_SHADER_REFS,
+};
+
 char *read_opts(int argc, char *argv[])
 {
 	char *filename = NULL;
@@ -439,8 +463,17 @@ char *read_opts(int argc, char *argv[])
 	else
 		colors = &envy_null_colors;
 
+	static const struct option long_opts[] =
+	{
+		{ "format-threads", required_argument, NULL, 'j' },
+		{ "shader-cache",   required_argument, NULL, OPT_SHADER_CACHE },
+		{ "shader-export",  required_argument, NULL, OPT_SHADER_EXPORT },
+		{ "shader-refs",    no_argument,       NULL, OPT_SHADER_REFS },
+		{ NULL, 0, NULL, 0 }
+	};
+
 	int c;
-	while ((c = getopt (argc, argv, "m:o:g:qac:l:i:r:he:d:p:s:x:")) != -1)
+	while ((c = getopt_long (argc, argv, "m:o:g:qac:l:i:r:he:d:p:s:x:j:", long_opts, NULL)) != -1)
 	{
 		switch (c)
 		{
@@ -574,6 +607,23 @@ char *read_opts(int argc, char *argv[])
 			case 's':
 				mmt_sync_fd = open(optarg, O_WRONLY);
 				break;
+			case 'j':
+				format_threads = strtol(optarg, NULL, 0);
+				if (format_threads < 0)
+				{
+					fprintf(stderr, "-j accepts only non-negative numbers\n");
+					exit(1);
+				}
+				break;
+			case OPT_SHADER_CACHE:
+				shader_cache_open(optarg);
+				break;
+			case OPT_SHADER_EXPORT:
+				shader_cache_set_export(optarg);
+				break;
+			case OPT_SHADER_REFS:
+				shader_cache_set_refs(1);
+				break;
 		}
 	}
 
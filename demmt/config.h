@@ -32,6 +32,7 @@ extern int dump_memory_writes;
 extern int dump_memory_reads;
 extern int dump_object_tree_on_create_destroy;
 extern int seccomp_level;
+extern int format_threads;
 
 char *read_opts(int argc, char *argv[]);
 
@@ -532,8 +532,7 @@ static void drm_nouveau_gem_new(uint32_t fd, uint32_t cid, uint32_t parent, stru
 	gmapping->address = info->offset;
 	gmapping->length = info->size;
 	gmapping->object = obj;
-	gmapping->next = obj->gpu_mappings;
-	obj->gpu_mappings = gmapping;
+	gpu_mapping_add(gmapping);
 
 	struct cpu_mapping *cmapping = calloc(sizeof(struct cpu_mapping), 1);
 	cmapping->fd = fd;
@@ -42,6 +42,8 @@
 #include "macro.h"
 #include "nvrm.h"
 #include "object_state.h"
+#include "pushbuf.h"
+#include "shader_cache.h"
 #include "util.h"
 #include "log.h"
 
@@ -547,11 +549,9 @@ int main(int argc, char *argv[])
 
 	/* set up an rnn context */
 	rnn_init();
-	rnndb = rnn_newdb();
-	rnn_parsefile(rnndb, "fifo/nv_objects.xml");
+	rnndb = rnn_loaddb("fifo/nv_objects.xml");
 	if (rnndb->estatus)
 		demmt_abort();
-	rnn_prepdb(rnndb);
 	domain = rnn_finddomain(rnndb, "SUBCHAN");
 	if (!domain)
 		demmt_abort();
@@ -565,11 +565,9 @@ int main(int argc, char *argv[])
 		demmt_abort();
 	rnn_prepdb(rnndb_g80_texture);
 
-	rnndb_gf100_shaders = rnn_newdb();
-	rnn_parsefile(rnndb_gf100_shaders, "graph/gf100_shaders.xml");
+	rnndb_gf100_shaders = rnn_loaddb("graph/gf100_shaders.xml");
 	if (rnndb_gf100_shaders->estatus)
 		demmt_abort();
-	rnn_prepdb(rnndb_gf100_shaders);
 
 	gf100_shaders_ctx = rnndec_newcontext(rnndb_gf100_shaders);
 	gf100_shaders_ctx->colors = colors;
@@ -578,11 +576,9 @@ int main(int argc, char *argv[])
 	 */
 	rnndec_varadd(gf100_shaders_ctx, "GF100_SHADER_KIND", "FP");
 
-	rnndb_nvrm_object = rnn_newdb();
-	rnn_parsefile(rnndb_nvrm_object, "../docs/nvrm/rnndb/nvrm_object.xml");
+	rnndb_nvrm_object = rnn_loaddb("../docs/nvrm/rnndb/nvrm_object.xml");
 	if (rnndb_nvrm_object->estatus)
 		demmt_abort();
-	rnn_prepdb(rnndb_nvrm_object);
 
 	tic_domain = rnn_finddomain(rnndb_g80_texture, "TIC");
 	tic2_domain = rnn_finddomain(rnndb_g80_texture, "TIC2");
@@ -599,14 +595,25 @@ int main(int argc, char *argv[])
 
 	if (filename)
 	{
+		FILE *f;
 		close(0);
-		if (open_input(filename) == NULL)
+		/* the sandbox does not allow decompressor threads */
+		f = open_input_threaded(filename, seccomp_level ? 1 : 0);
+		if (f == NULL)
 		{
 			perror("open");
 			exit(1);
 		}
 		free(filename);
+
+		/* compressed traces are decompressed in-process, behind stdio */
+		if (fileno(f) < 0)
+			mmt_set_input(f);
+		else
+			mmt_map_input(0);
 	}
+	else
+		mmt_map_input(0);
 
 	if (pager_enabled)
 	{
@@ -645,6 +652,9 @@ int main(int argc, char *argv[])
 		close(pipe_fds[1]);
 	}
 
+	/* after fork, before the sandbox */
+	pushbuf_start_formatters(format_threads);
+
 #ifdef LIBSECCOMP_AVAILABLE
 	if (seccomp_level)
 	{
@@ -672,6 +682,22 @@ int main(int argc, char *argv[])
 			exit(1);
 		seccomp_syscall_priority(ctx, SCMP_SYS(write), 255);
 
+		if (shader_cache_fileno() >= 0)
+		{
+			rc = seccomp_rule_add_exact(ctx, SCMP_ACT_ALLOW, SCMP_SYS(write), 1,
+					SCMP_A0(SCMP_CMP_EQ, shader_cache_fileno()));
+			if (rc != 0)
+				exit(1);
+		}
+
+		if (shader_cache_export_fileno() >= 0)
+		{
+			rc = seccomp_rule_add_exact(ctx, SCMP_ACT_ALLOW, SCMP_SYS(write), 1,
+					SCMP_A0(SCMP_CMP_EQ, shader_cache_export_fileno()));
+			if (rc != 0)
+				exit(1);
+		}
+
 		rc = seccomp_rule_add_exact(ctx, SCMP_ACT_ALLOW, SCMP_SYS(rt_sigreturn), 0);
 		if (rc != 0)
 			exit(1);
@@ -685,6 +711,10 @@ int main(int argc, char *argv[])
 		if (rc != 0)
 			exit(1);
 
+		rc = seccomp_rule_add_exact(ctx, SCMP_ACT_ALLOW, SCMP_SYS(madvise), 0);
+		if (rc != 0)
+			exit(1);
+
 		rc = seccomp_rule_add_exact(ctx, SCMP_ACT_ALLOW, SCMP_SYS(brk), 0);
 		if (rc != 0)
 			exit(1);
@@ -701,12 +731,35 @@ int main(int argc, char *argv[])
 		if (rc != 0)
 			exit(1);
 
+		if (format_threads != 1)
+		{
+			rc = seccomp_rule_add_exact(ctx, SCMP_ACT_ALLOW, SCMP_SYS(futex), 0);
+			if (rc != 0)
+				exit(1);
+
+			/* malloc grows per-thread arenas with mprotect */
+			rc = seccomp_rule_add_exact(ctx, SCMP_ACT_ALLOW, SCMP_SYS(mprotect), 0);
+			if (rc != 0)
+				exit(1);
+		}
+
 		rc = seccomp_rule_add_exact(ctx, SCMP_ACT_ALLOW, SCMP_SYS(ioctl), 2,
 				SCMP_A0(SCMP_CMP_EQ, 1),
 				SCMP_A1(SCMP_CMP_EQ, 0x5401/*TCGETS*/));
 		if (rc != 0)
 			exit(1);
 
+		/* formatting threads are already running, the filter must cover them too */
+		if (format_threads != 1)
+		{
+			rc = seccomp_attr_set(ctx, SCMP_FLTATR_CTL_TSYNC, 1);
+			if (rc != 0)
+			{
+				fprintf(stderr, "seccomp_attr_set(TSYNC) failed with error: %d\n", rc);
+				exit(1);
+			}
+		}
+
 		rc = seccomp_load(ctx);
 		if (rc != 0)
 		{
@@ -719,6 +772,7 @@ int main(int argc, char *argv[])
 #endif
 
 	mmt_decode(&demmt_funcs.base, NULL);
+	shader_cache_close();
 	fflush(stdout);
 
 	fini_macrodis();
@@ -271,6 +271,8 @@ struct mmt_txt_nvidia_state
 
 int main()
 {
+	mmt_map_input(0);
+
 	if (PRINT_DATA)
 		mmt_decode(&txt_nvidia_funcs.base, &mmt_txt_nv_state);
 	else
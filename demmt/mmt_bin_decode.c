@@ -29,10 +29,24 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-unsigned char mmt_buf[MMT_BUF_SIZE];
-unsigned int mmt_idx = 0;
-static unsigned int len = 0;
+static unsigned char mmt_static_buf[MMT_BUF_SIZE];
+unsigned char *mmt_buf = mmt_static_buf;
+uint64_t mmt_idx = 0;
+static uint64_t len = 0;
+
+/* when set, input is read through stdio instead of from fd 0 */
+static FILE *input = NULL;
+
+/* set when the whole input is mmapped and decoded in place */
+static int mapped = 0;
+/* part of the mapping which was already returned to the kernel */
+static uint64_t released = 0;
+
+/* how much of consumed input we keep mapped before dropping it */
+#define MMT_RELEASE_CHUNK (64 * 1024 * 1024)
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
@@ -50,10 +64,74 @@ struct mmt_buf *find_ptr(uint64_t ptr, struct mmt_memory_dump *args, int argc)
 	return NULL;
 }
 
+void mmt_set_input(FILE *f)
+{
+	input = f;
+}
+
+int mmt_map_input(int fd)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return -1;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	mmt_buf = map;
+	mmt_idx = 0;
+	len = st.st_size;
+	mapped = 1;
+	released = 0;
+
+	return 0;
+}
+
+static void *report_eof(int eof_allowed)
+{
+	fflush(stdout);
+	if (eof_allowed)
+		fprintf(stderr, "EOF\n");
+	else
+		fprintf(stderr, "unexpected EOF\n");
+	fflush(stderr);
+
+	if (!eof_allowed)
+		exit(1);
+
+	return NULL;
+}
+
+/*
+ * Nothing holds pointers into the input across messages, so pages we have
+ * already decoded can be dropped. This keeps RSS bounded on huge traces.
+ */
+static void release_consumed(void)
+{
+	static uint64_t pgsize = 0;
+	uint64_t end;
+
+	if (!pgsize)
+		pgsize = sysconf(_SC_PAGESIZE);
+
+	end = mmt_idx & ~(pgsize - 1);
+	if (end - released < MMT_RELEASE_CHUNK)
+		return;
+
+	madvise(mmt_buf + released, end - released, MADV_DONTNEED);
+	released = end;
+}
+
 void *mmt_load_data_with_prefix(unsigned int sz, unsigned int pfx, int eof_allowed)
 {
 	if (pfx + mmt_idx + sz <= len)
 		return mmt_buf + pfx + mmt_idx;
+	if (mapped)
+		return report_eof(eof_allowed);
 	if (pfx + sz > MMT_BUF_SIZE)
 	{
 		fflush(stdout);
@@ -71,26 +149,22 @@ void *mmt_load_data_with_prefix(unsigned int sz, unsigned int pfx, int eof_allow
 
 	while (pfx + mmt_idx + sz > len)
 	{
-		int r = read(0, mmt_buf + len, MMT_BUF_SIZE - len);
+		ssize_t r;
+		if (input)
+		{
+			r = fread(mmt_buf + len, 1, MMT_BUF_SIZE - len, input);
+			if (r == 0 && ferror(input))
+				r = -1;
+		}
+		else
+			r = read(0, mmt_buf + len, MMT_BUF_SIZE - len);
 		if (r < 0)
 		{
 			perror("read");
 			exit(1);
 		}
 		else if (r == 0)
-		{
-			fflush(stdout);
-			if (eof_allowed)
-				fprintf(stderr, "EOF\n");
-			else
-				fprintf(stderr, "unexpected EOF\n");
-			fflush(stderr);
-
-			if (!eof_allowed)
-				exit(1);
-
-			return NULL;
-		}
+			return report_eof(eof_allowed);
 		len += r;
 	}
 
@@ -104,12 +178,14 @@ void *mmt_load_data(unsigned int sz)
 
 void *mmt_load_initial_data()
 {
+	if (mapped)
+		release_consumed();
 	return mmt_load_data_with_prefix(1, 0, 1);
 }
 
 void mmt_dump_next()
 {
-	unsigned int i, limit = MIN(mmt_idx + 50, len);
+	uint64_t i, limit = MIN(mmt_idx + 50, len);
 	for (i = mmt_idx; i < limit; ++i)
 		fprintf(stderr, "%02x ", mmt_buf[i]);
 	fprintf(stderr, "\n");
@@ -132,7 +208,8 @@ void mmt_check_eor(unsigned int size)
 
 void mmt_buf_check_sanity(struct mmt_buf *buf)
 {
-	if (buf->len < MMT_BUF_SIZE)
+	/* in mapped mode message size is limited only by the input size */
+	if (mapped || buf->len < MMT_BUF_SIZE)
 		return;
 
 	fflush(stdout);
@@ -183,7 +260,7 @@ void mmt_decode(const struct mmt_decode_funcs *funcs, void *state)
 		{
 			unsigned int len = 0;
 			while (mmt_buf[mmt_idx + len] != 10)
-				if (mmt_load_data(++len) == NULL)
+				if (mmt_load_data(++len + 1) == NULL)
 					return;
 
 			if (funcs->msg)
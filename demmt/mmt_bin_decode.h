@@ -2,11 +2,14 @@
 #define MMT_BIN_DECODE_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define MMT_BUF_SIZE 64 * 1024
-extern unsigned char mmt_buf[MMT_BUF_SIZE];
-extern unsigned int mmt_idx;
+extern unsigned char *mmt_buf;
+extern uint64_t mmt_idx;
 
+void mmt_set_input(FILE *f);
+int mmt_map_input(int fd);
 void mmt_check_eor(unsigned int sz);
 void *mmt_load_data(unsigned int sz);
 void *mmt_load_data_with_prefix(unsigned int sz, unsigned int pfx, int eof_allowed);
@@ -661,8 +661,7 @@ static void handle_nvrm_ioctl_vspace_map(uint32_t fd, struct nvrm_ioctl_vspace_m
 		obj->length = s->size;
 	}
 	mapping->object = obj;
-	mapping->next = obj->gpu_mappings;
-	obj->gpu_mappings = mapping;
+	gpu_mapping_add(mapping);
 }
 
 static void handle_nvrm_ioctl_vspace_unmap(uint32_t fd, struct nvrm_ioctl_vspace_unmap *s)
@@ -41,7 +41,7 @@ void decode_gf100_2d_terse(struct gpu_object *, struct pushbuf_decode_state *pst
 void decode_gf100_3d_init(struct gpu_object *);
 void decode_gf100_3d_terse(struct gpu_object *, struct pushbuf_decode_state *pstate);
 void decode_gf100_3d_verbose(struct gpu_object *, struct pushbuf_decode_state *pstate);
-void gf100_3d_disassemble(uint8_t *data, struct region *reg,
+void gf100_3d_disassemble(uint8_t *data, struct regions *regions,
 		uint32_t start_id, const struct disisa *isa, struct varinfo *var);
 void decode_gf100_p_header(int idx, uint32_t *data, struct rnndomain *header_domain);
 
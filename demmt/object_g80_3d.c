@@ -27,6 +27,7 @@
 #include "log.h"
 #include "nvrm.h"
 #include "object.h"
+#include "shader_cache.h"
 
 struct gf80_3d_data
 {
@@ -52,43 +53,41 @@ struct gf80_3d_data
 	struct mthd2addr *addresses;
 };
 
-static void __g80_3d_disassemble(uint8_t *data, struct region *reg,
+static void __g80_3d_disassemble(uint8_t *data, struct regions *regions,
 		const char *mode, int32_t offset, uint32_t start_id,
 		struct varinfo *var)
 {
-	mmt_debug("%s_start id 0x%08x\n", mode, start_id);
-	for ( ; reg != NULL; reg = reg->next)
-	{
-		if (reg->start != start_id + offset)
-			continue;
+	struct region *reg = regions_find(regions, start_id + offset);
 
-		if (MMT_DEBUG)
-		{
-			uint32_t x;
-			mmt_debug("CODE: %s", "");
-			for (x = reg->start; x < reg->end; x += 4)
-				mmt_debug_cont("0x%08x ", *(uint32_t *)(data + x));
-			mmt_debug_cont("%s\n", "");
-		}
+	mmt_debug("%s_start id 0x%08x\n", mode, start_id);
+	if (!reg || reg->start != start_id + offset)
+		return;
 
-		envydis(isa_g80, stdout, data + reg->start, start_id,
-				reg->end - reg->start, var, 0, NULL, 0, colors);
-		break;
+	if (MMT_DEBUG)
+	{
+		uint32_t x;
+		mmt_debug("CODE: %s", "");
+		for (x = reg->start; x < reg->end; x += 4)
+			mmt_debug_cont("0x%08x ", *(uint32_t *)(data + x));
+		mmt_debug_cont("%s\n", "");
 	}
+
+	shader_disassemble(isa_g80, var, data + reg->start, start_id,
+			reg->end - reg->start);
 }
 
 void g80_3d_disassemble(struct pushbuf_decode_state *pstate,
 		struct addr_n_buf *anb, const char *mode, uint32_t start_id)
 {
 	uint8_t *data = NULL;
-	struct region *reg;
+	struct regions *regions;
 	int32_t offset = 0;
 
 	struct gpu_mapping *m = anb->gpu_mapping;
 	if (m)
 	{
 		data = gpu_mapping_get_data(m, m->address, 0);
-		reg = m->object->written_regions.head;
+		regions = &m->object->written_regions;
 		offset = anb->address - m->address;
 	}
 	if (data)
@@ -112,7 +111,7 @@ void g80_3d_disassemble(struct pushbuf_decode_state *pstate,
 
 		varinfo_set_mode(var, mode);
 
-		__g80_3d_disassemble(data, reg, mode, offset, start_id, var);
+		__g80_3d_disassemble(data, regions, mode, offset, start_id, var);
 
 		varinfo_del(var);
 	}
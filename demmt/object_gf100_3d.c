@@ -29,6 +29,7 @@
 #include "macro.h"
 #include "nvrm.h"
 #include "object.h"
+#include "shader_cache.h"
 
 struct gf100_3d_data
 {
@@ -163,45 +164,41 @@ void decode_gf100_3d_terse(struct gpu_object *obj, struct pushbuf_decode_state *
 	{ }
 }
 
-void gf100_3d_disassemble(uint8_t *data, struct region *reg,
+void gf100_3d_disassemble(uint8_t *data, struct regions *regions,
 		uint32_t start_id, const struct disisa *isa, struct varinfo *var)
 {
-	for (; reg != NULL; reg = reg->next)
-	{
-		if (reg->start != start_id)
-			continue;
+	struct region *reg = regions_find(regions, start_id);
+	if (!reg || reg->start != start_id)
+		return;
+
+	uint32_t x;
+	x = *(uint32_t *)(data + reg->start);
+	int program = (x >> 10) & 0x7;
+	if (!gf100_p_dump(program))
+		return;
+
+	struct rnndomain *header_domain = gf100_p_header_domain(program);
+	gf100_set_kind_variant(program);
+	mmt_printf("HEADER:%s\n", "");
+	if (header_domain)
+		for (x = 0; x < 20; ++x)
+			decode_gf100_p_header(x, (uint32_t *)(data + reg->start), header_domain);
+	else
+		for (x = reg->start; x < reg->start + 20 * 4; x += 4)
+			mmt_printf("0x%08x\n", *(uint32_t *)(data + x));
 
+	mmt_printf("CODE:%s\n", "");
+	if (MMT_DEBUG)
+	{
 		uint32_t x;
-		x = *(uint32_t *)(data + reg->start);
-		int program = (x >> 10) & 0x7;
-		if (!gf100_p_dump(program))
-			break;
-
-		struct rnndomain *header_domain = gf100_p_header_domain(program);
-		gf100_set_kind_variant(program);
-		mmt_printf("HEADER:%s\n", "");
-		if (header_domain)
-			for (x = 0; x < 20; ++x)
-				decode_gf100_p_header(x, (uint32_t *)(data + reg->start), header_domain);
-		else
-			for (x = reg->start; x < reg->start + 20 * 4; x += 4)
-				mmt_printf("0x%08x\n", *(uint32_t *)(data + x));
-
-		mmt_printf("CODE:%s\n", "");
-		if (MMT_DEBUG)
-		{
-			uint32_t x;
-			mmt_debug("%s", "");
-			for (x = reg->start + 20 * 4; x < reg->end; x += 4)
-				mmt_debug_cont("0x%08x ", *(uint32_t *)(data + x));
-			mmt_debug_cont("%s\n", "");
-		}
-
-		envydis(isa, stdout, data + reg->start + 20 * 4, 0,
-				reg->end - reg->start - 20 * 4, var, 0, NULL, 0, colors);
-
-		break;
+		mmt_debug("%s", "");
+		for (x = reg->start + 20 * 4; x < reg->end; x += 4)
+			mmt_debug_cont("0x%08x ", *(uint32_t *)(data + x));
+		mmt_debug_cont("%s\n", "");
 	}
+
+	shader_disassemble(isa, var, data + reg->start + 20 * 4, 0,
+			reg->end - reg->start - 20 * 4);
 }
 
 void decode_gf100_3d_verbose(struct gpu_object *obj, struct pushbuf_decode_state *pstate)
@@ -240,7 +237,7 @@ void decode_gf100_3d_verbose(struct gpu_object *obj, struct pushbuf_decode_state
 					code = NULL;// FIXME
 
 				if (code)
-					gf100_3d_disassemble(code, m->object->written_regions.head,
+					gf100_3d_disassemble(code, &m->object->written_regions,
 							data, isa_gf100, var);
 			}
 
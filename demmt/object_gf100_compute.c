@@ -28,6 +28,7 @@
 #include "log.h"
 #include "nvrm.h"
 #include "object.h"
+#include "shader_cache.h"
 
 struct gf100_compute_data
 {
@@ -142,16 +143,11 @@ void decode_gf100_compute_verbose(struct gpu_object *obj, struct pushbuf_decode_
 		mmt_printf("CODE:%s\n", "");
 		if (code)
 		{
-			struct region *reg;
-			for (reg = m->object->written_regions.head; reg != NULL; reg = reg->next)
-			{
-				if (reg->start != start_id + code_addr - m->address)
-					continue;
-
-				envydis(isa_gf100, stdout, code + reg->start, 0,
-						reg->end - reg->start, var, 0, NULL, 0, colors);
-				break;
-			}
+			uint64_t start = start_id + code_addr - m->address;
+			struct region *reg = regions_find(&m->object->written_regions, start);
+			if (reg && reg->start == start)
+				shader_disassemble(isa_gf100, var, code + reg->start, 0,
+						reg->end - reg->start);
 		}
 
 		if (var)
@@ -255,7 +255,7 @@ void decode_gk104_3d_verbose(struct gpu_object *obj, struct pushbuf_decode_state
 					code = NULL;// FIXME
 
 				if (code)
-					gf100_3d_disassemble(code, m->object->written_regions.head,
+					gf100_3d_disassemble(code, &m->object->written_regions,
 							data, isa, var);
 			}
 
@@ -26,6 +26,7 @@
 #include "config.h"
 #include "nvrm.h"
 #include "object.h"
+#include "shader_cache.h"
 
 struct gk104_compute_data
 {
@@ -183,15 +184,13 @@ void decode_gk104_compute_verbose(struct gpu_object *obj, struct pushbuf_decode_
 
 			mmt_printf("CODE:%s\n", "");
 			if (code)
-				for (reg = m->object->written_regions.head; reg != NULL; reg = reg->next)
-				{
-					if (reg->start != start_id + code_addr - m->address)
-						continue;
-
-					envydis(isa, stdout, code + reg->start, 0,
-							reg->end - reg->start, var, 0, NULL, 0, colors);
-					break;
-				}
+			{
+				uint64_t start = start_id + code_addr - m->address;
+				reg = regions_find(&m->object->written_regions, start);
+				if (reg && reg->start == start)
+					shader_disassemble(isa, var, code + reg->start, 0,
+							reg->end - reg->start);
+			}
 
 			if (var)
 				varinfo_del(var);
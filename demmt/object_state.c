@@ -51,17 +51,6 @@ void demmt_cleanup_isas()
 		ed_freeisa(isa_gm107);
 }
 
-static int is_mapping_valid(struct gpu_mapping *m)
-{
-	struct gpu_object *obj;
-	struct gpu_mapping *gpu_mapping;
-	for (obj = gpu_objects; obj != NULL; obj = obj->next)
-		for (gpu_mapping = obj->gpu_mappings; gpu_mapping != NULL; gpu_mapping = gpu_mapping->next)
-			if (m == gpu_mapping)
-				return 1;
-	return 0;
-}
-
 struct rnndeccontext *create_g80_texture_ctx(struct gpu_object *obj)
 {
 	struct rnndeccontext *texture_ctx = rnndec_newcontext(rnndb_g80_texture);
@@ -222,7 +211,7 @@ static void anb_set_low(struct addr_n_buf *s, uint32_t data, const char *usage,
 	if (s->prev_gpu_mapping)
 	{
 		struct gpu_mapping *m = s->prev_gpu_mapping;
-		if (usage && is_mapping_valid(m))
+		if (usage && gpu_mapping_is_valid(m))
 		{
 			int i;
 			struct gpu_object *obj2 = m->object;
@@ -25,8 +25,11 @@
 
 #define _GNU_SOURCE
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "buffer.h"
 #include "config.h"
@@ -82,6 +85,8 @@ struct fifo_state *get_fifo_state(struct gpu_object *fifo)
 
 struct obj **get_subchans(struct pushbuf_decode_state *pstate)
 {
+	if (pstate->scan_subchans)
+		return pstate->scan_subchans;
 	return get_fifo_state(pstate->fifo)->subchans;
 }
 
@@ -131,6 +136,7 @@ void pushbuf_add_object(uint32_t handle, uint32_t class, struct gpu_object *gpu_
 		obj->name = 0;
 		obj->ctx = rnndec_newcontext(rnndb);
 		obj->ctx->colors = colors;
+		rnndec_memo_enable(obj->ctx, 1024);
 		obj->decoder = demmt_get_decoder(class);
 		obj->gpu_object = gpu_obj;
 		if (obj->decoder)
@@ -167,7 +173,7 @@ void pushbuf_add_object_name(uint32_t handle, uint32_t name, struct gpu_object *
 	mmt_error("pushbuf_add_object_name(0x%08x, 0x%08x): no object\n", handle, name);
 }
 
-static struct obj *get_object(uint32_t handle, struct gpu_object *gpu_obj)
+static struct obj *find_object(uint32_t handle, struct gpu_object *gpu_obj)
 {
 	struct obj *objs = get_all_objects(gpu_obj);
 	int i;
@@ -182,6 +188,15 @@ static struct obj *get_object(uint32_t handle, struct gpu_object *gpu_obj)
 		if (objs[i].name == handle)
 			return &objs[i];
 
+	return NULL;
+}
+
+static struct obj *get_object(uint32_t handle, struct gpu_object *gpu_obj)
+{
+	struct obj *obj = find_object(handle, gpu_obj);
+	if (obj || handle == 0)
+		return obj;
+
 	if (nvrm_get_chipset(gpu_obj) >= 0xc0)
 	{
 		if (demmt_get_fdtype(gpu_obj->fd) == FDDRM)
@@ -203,6 +218,14 @@ static struct obj *get_object(uint32_t handle, struct gpu_object *gpu_obj)
 	return NULL;
 }
 
+/* the pre-scan must not create objects, the real pass will do it */
+static struct obj *lookup_object(struct pushbuf_decode_state *state, uint32_t handle)
+{
+	if (state->scan_subchans)
+		return find_object(handle, state->fifo);
+	return get_object(handle, state->fifo);
+}
+
 static void decode_header(struct pushbuf_decode_state *state, char *output)
 {
 	struct obj *obj = current_subchan_object(state);
@@ -229,8 +252,169 @@ static void decode_header(struct pushbuf_decode_state *state, char *output)
 				state->subchan, subchannel_desc, state->addr, incr);
 }
 
-void decode_method_raw(int mthd, uint32_t data, struct obj *obj, char *dec_obj,
-		char *dec_mthd, char *dec_val)
+/*
+ * Formatting method values with rnndec is the most expensive part of
+ * pushbuffer decoding, but everything else (subchannel bindings, object
+ * decoders, output) depends on trace order. So, when more than one thread
+ * was requested, every segment is first pre-scanned with a private copy of
+ * the decoder state, values of all methods found are formatted by a pool of
+ * threads, and the serial pass picks them up in decode_method. Formatting
+ * depends only on the object's rnndec context (which doesn't change after
+ * the object is created), the method and its data, so a pre-scan that gets
+ * out of sync with the real pass only costs time, never changes the output.
+ *
+ * Only the formatting is offloaded.  Channels are still decoded one after
+ * another on the main thread, as object decoders read GPU memory shared
+ * between them and their output is interleaved with the method stream.
+ */
+#define PRERENDER_MIN_COMMANDS 64
+#define PRERENDER_CHUNK 32
+#define PRERENDER_RESYNC 16
+
+struct prerendered_mthd
+{
+	struct obj *obj;
+	uint32_t handle;
+	int mthd;
+	uint32_t data;
+	struct rnndecaddrinfo *ai;
+	char *val;
+};
+
+static struct prerendered_mthd *prerendered;
+static int prerenderednum, prerenderedmax, prerendered_pos;
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+	int threads;
+	unsigned int generation;
+	int running;
+	int next;
+}
+pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 1 };
+
+static void render_prerendered(void)
+{
+	int i, j;
+	while ((i = __sync_fetch_and_add(&pool.next, PRERENDER_CHUNK)) < prerenderednum)
+		for (j = i; j < i + PRERENDER_CHUNK && j < prerenderednum; j++)
+		{
+			struct prerendered_mthd *p = &prerendered[j];
+			p->val = rnndec_decodeval(p->obj->ctx, p->ai->typeinfo, p->data, p->ai->width);
+		}
+}
+
+static void *pushbuf_worker(void *arg)
+{
+	unsigned int seen = 0;
+
+	pthread_mutex_lock(&pool.lock);
+	while (1)
+	{
+		while (pool.generation == seen)
+			pthread_cond_wait(&pool.wake, &pool.lock);
+		seen = pool.generation;
+		pthread_mutex_unlock(&pool.lock);
+
+		render_prerendered();
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.running == 0)
+			pthread_cond_signal(&pool.idle);
+	}
+
+	return NULL;
+}
+
+/* must be called before sandboxing, which forbids creation of threads */
+void pushbuf_start_formatters(int threads)
+{
+	int i;
+
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (i = 1; i < threads; i++)
+	{
+		pthread_t thr;
+		if (pthread_create(&thr, NULL, pushbuf_worker, NULL))
+			break;
+		pthread_detach(thr);
+	}
+
+	pool.threads = i;
+}
+
+static void render_all_prerendered(void)
+{
+	pthread_mutex_lock(&pool.lock);
+	pool.next = 0;
+	pool.running = pool.threads - 1;
+	pool.generation++;
+	pthread_cond_broadcast(&pool.wake);
+	pthread_mutex_unlock(&pool.lock);
+
+	render_prerendered();
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.running)
+		pthread_cond_wait(&pool.idle, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void reset_prerendered(void)
+{
+	int i;
+	for (i = 0; i < prerenderednum; i++)
+		free(prerendered[i].val);
+	prerenderednum = prerendered_pos = 0;
+}
+
+/*
+ * The pre-scan may see methods the real pass doesn't (or the other way
+ * around), so look a few entries ahead before giving up and resume from
+ * the match, otherwise one stray entry would make every later method in
+ * the segment miss.
+ */
+static struct prerendered_mthd *take_prerendered(struct obj *obj, int mthd, uint32_t data)
+{
+	int i;
+
+	for (i = prerendered_pos; i < prerenderednum && i < prerendered_pos + PRERENDER_RESYNC; i++)
+	{
+		struct prerendered_mthd *p = &prerendered[i];
+		if (p->obj == obj && p->handle == obj->handle && p->mthd == mthd && p->data == data)
+		{
+			prerendered_pos = i + 1;
+			return p;
+		}
+	}
+
+	return NULL;
+}
+
+static struct rnndecaddrinfo *decode_addr_cached(struct obj *obj, int mthd)
+{
+	int bucket = (mthd * (mthd + 3)) % ADDR_CACHE_SIZE;
+	struct cache_entry *entry = obj->cache[bucket];
+	while (entry && entry->mthd != mthd)
+		entry = entry->next;
+	if (entry)
+		return entry->info;
+
+	entry = malloc(sizeof(struct cache_entry));
+	entry->mthd = mthd;
+	entry->info = rnndec_decodeaddr(obj->ctx, domain, mthd, 1);
+	entry->next = obj->cache[bucket];
+	obj->cache[bucket] = entry;
+	return entry->info;
+}
+
+static void __decode_method_raw(int mthd, uint32_t data, struct obj *obj, char *dec_obj,
+		char *dec_mthd, char *dec_val, struct prerendered_mthd *pre)
 {
 	/* get an object name */
 	if (obj && obj->desc)
@@ -241,34 +425,22 @@ void decode_method_raw(int mthd, uint32_t data, struct obj *obj, char *dec_obj,
 	/* get the method name and value */
 	if (obj)
 	{
-		char *tmp;
-		struct rnndecaddrinfo *ai;
-		int bucket = (mthd * (mthd + 3)) % ADDR_CACHE_SIZE;
-		struct cache_entry *entry = obj->cache[bucket];
-		while (entry && entry->mthd != mthd)
-			entry = entry->next;
-		if (entry)
-			ai = entry->info;
-		else
-		{
-			entry = malloc(sizeof(struct cache_entry));
-			entry->mthd = mthd;
-			entry->info = ai = rnndec_decodeaddr(obj->ctx, domain, mthd, 1);
-			entry->next = obj->cache[bucket];
-			obj->cache[bucket] = entry;
-		}
+		struct rnndecaddrinfo *ai = decode_addr_cached(obj, mthd);
 
 		strcpy(dec_mthd,  ai->name);
 		if (dec_val)
 		{
-			tmp = rnndec_decodeval(obj->ctx, ai->typeinfo, data, ai->width);
-			if (tmp)
+			if (pre)
 			{
-				strcpy(dec_val, tmp);
-				free(tmp);
+				strcpy(dec_val, pre->val);
+				free(pre->val);
+				pre->val = NULL;
 			}
 			else
-				sprintf(dec_val, "%s0x%x%s", colors->err, data, colors->reset);
+			{
+				/* only the main thread gets here */
+				strcpy(dec_val, rnndec_decodeval_memo(obj->ctx, ai->typeinfo, data, ai->width));
+			}
 		}
 	}
 	else
@@ -279,17 +451,33 @@ void decode_method_raw(int mthd, uint32_t data, struct obj *obj, char *dec_obj,
 	}
 }
 
+void decode_method_raw(int mthd, uint32_t data, struct obj *obj, char *dec_obj,
+		char *dec_mthd, char *dec_val)
+{
+	__decode_method_raw(mthd, data, obj, dec_obj, dec_mthd, dec_val, NULL);
+}
+
 static void decode_method(struct pushbuf_decode_state *state, char *output)
 {
 	struct obj *obj = current_subchan_object(state);
-	static char dec_obj[1000], dec_mthd[1000], dec_val[1000];
-	if (!decode_pb)
+	char dec_obj[1000], dec_mthd[1000], dec_val[1000];
+	if (!decode_pb || state->scan_subchans)
 	{
+		if (state->scan_subchans && obj && state->mthd != 0)
+		{
+			struct prerendered_mthd p = { obj, obj->handle, state->mthd, state->mthd_data,
+					decode_addr_cached(obj, state->mthd), NULL };
+			ADDARRAY(prerendered, p);
+		}
 		output[0] = 0;
 		return;
 	}
 
-	decode_method_raw(state->mthd, state->mthd_data, obj, dec_obj, dec_mthd, dec_val);
+	if (state->mthd == 0)
+		__decode_method_raw(state->mthd, state->mthd_data, obj, dec_obj, dec_mthd, NULL, NULL);
+	else
+		__decode_method_raw(state->mthd, state->mthd_data, obj, dec_obj, dec_mthd, dec_val,
+				take_prerendered(obj, state->mthd, state->mthd_data));
 
 	if (state->mthd == 0)
 		sprintf(output, "  %s mapped to subchannel %d", dec_obj, state->subchan);
@@ -359,7 +547,8 @@ uint64_t pushbuf_decode(struct pushbuf_decode_state *state, uint32_t data, char
 					return 0;
 				}
 
-				mmt_log("unusual, old-style inc mthd%s\n", "");
+				if (!state->scan_subchans)
+					mmt_log("unusual, old-style inc mthd%s\n", "");
 			}
 			else if (mode == 2)
 			{
@@ -373,7 +562,8 @@ uint64_t pushbuf_decode(struct pushbuf_decode_state *state, uint32_t data, char
 					return 0;
 				}
 
-				mmt_log("unusual, old-style non-inc mthd%s\n", "");
+				if (!state->scan_subchans)
+					mmt_log("unusual, old-style non-inc mthd%s\n", "");
 			}
 			else
 			{
@@ -460,7 +650,8 @@ uint64_t pushbuf_decode(struct pushbuf_decode_state *state, uint32_t data, char
 		}
 
 		state->mthd = state->addr;
-		decode_header(state, output);
+		if (!state->scan_subchans)
+			decode_header(state, output);
 		if (chipset >= 0xe0 && subchans[state->subchan] == NULL)
 		{
 			uint32_t handle = 0;
@@ -520,9 +711,9 @@ uint64_t pushbuf_decode(struct pushbuf_decode_state *state, uint32_t data, char
 			}
 
 			if (handle)
-				subchans[state->subchan] = get_object(handle, state->fifo);
+				subchans[state->subchan] = lookup_object(state, handle);
 		}
-		if (subchans[state->subchan] == NULL && state->addr != 0)
+		if (subchans[state->subchan] == NULL && state->addr != 0 && !state->scan_subchans)
 			mmt_log("subchannel %d does not have bound object and first command does not bind it\n", state->subchan);
 	}
 	else
@@ -534,14 +725,14 @@ uint64_t pushbuf_decode(struct pushbuf_decode_state *state, uint32_t data, char
 		if (state->addr == 0)
 		{
 			if (subchans[state->subchan] == NULL)
-				subchans[state->subchan] = get_object(data, state->fifo);
+				subchans[state->subchan] = lookup_object(state, data);
 			else
 			{
 				if (data != subchans[state->subchan]->handle)
 				{
 					if (safe)
-						subchans[state->subchan] = get_object(data, state->fifo);
-					else
+						subchans[state->subchan] = lookup_object(state, data);
+					else if (!state->scan_subchans)
 						mmt_log("subchannel %d is already taken\n", state->subchan);
 				}
 			}
@@ -561,11 +752,30 @@ uint64_t pushbuf_decode(struct pushbuf_decode_state *state, uint32_t data, char
 	return 0;
 }
 
+static void pushbuf_prerender(struct pushbuf_decode_state *pstate, uint32_t *cur, uint32_t *end)
+{
+	struct pushbuf_decode_state scan = *pstate;
+	struct obj *subchans[8];
+	char output[1024];
+
+	memcpy(subchans, get_subchans(pstate), sizeof(subchans));
+	scan.scan_subchans = subchans;
+	for (; cur < end; cur++)
+		if (pushbuf_decode(&scan, *cur, output, 1))
+			break;
+
+	render_all_prerendered();
+}
+
 static uint64_t __pushbuf_print(struct pushbuf_decode_state *pstate, uint32_t *cur, uint32_t *end, uint64_t gpu_address, int commands)
 {
 	char cmdoutput[1024];
 	uint64_t nextaddr;
 
+	reset_prerendered();
+	if (pool.threads > 1 && decode_pb && end - cur >= PRERENDER_MIN_COMMANDS)
+		pushbuf_prerender(pstate, cur, end);
+
 	while (cur < end)
 	{
 		uint32_t cmd = *cur;
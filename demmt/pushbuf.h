@@ -62,6 +62,9 @@ struct pushbuf_decode_state
 	uint32_t mthd_data;
 
 	struct gpu_object *fifo;
+
+	/* private copy of subchannel bindings used by the pre-scan, see pushbuf.c */
+	struct obj **scan_subchans;
 };
 
 struct ib_decode_state
@@ -102,6 +105,8 @@ void user_decode_end(struct user_decode_state *state);
 void decode_method_raw(int mthd, uint32_t data, struct obj *obj, char *dec_obj,
 		char *dec_mthd, char *dec_val);
 
+void pushbuf_start_formatters(int threads);
+
 struct obj **get_subchans(struct pushbuf_decode_state *pstate);
 struct obj *current_subchan_object(struct pushbuf_decode_state *pstate);
 
@@ -23,6 +23,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "region.h"
 #include "log.h"
 
@@ -71,119 +72,136 @@ static int regions_are_sane(struct regions *regions)
 	return 1;
 }
 
-static int range_in_regions(struct regions *regions, uint32_t start, uint32_t len)
+/* returns the location of the link to the region following pred (NULL: list head) on given level */
+static struct region **region_link(struct regions *regions, struct region *pred, int level)
 {
-	struct region *cur = regions->head;
+	if (level == 0)
+		return pred ? &pred->next : &regions->head;
+	return pred ? &pred->skip[level - 1] : &regions->skip_head[level - 1];
+}
 
-	while (cur)
-	{
-		if (start >= cur->start && start + len <= cur->end)
-			return 1;
+/* returns the last region starting below addr, optionally storing such regions for every level in preds */
+static struct region *regions_search(struct regions *regions, uint32_t addr, struct region **preds)
+{
+	struct region *pred = NULL, *next;
+	int level;
 
-		cur = cur->next;
+	for (level = regions->height - 1; level >= 0; level--)
+	{
+		while ((next = *region_link(regions, pred, level)) && next->start < addr)
+			pred = next;
+		if (preds)
+			preds[level] = pred;
 	}
 
-	return 0;
+	return pred;
 }
 
-static void drop_region(struct region *reg, struct regions *parent)
+struct region *regions_find(struct regions *regions, uint32_t addr)
 {
-	struct region *prev = reg->prev;
-	struct region *next = reg->next;
-	mmt_debug("dropping entry <0x%08x, 0x%08x>\n", reg->start, reg->end);
-	free(reg);
-	if (prev)
-		prev->next = next;
-	else
-	{
-		mmt_debug("new head is at <0x%08x, 0x%08x>\n", next->start, next->end);
-		parent->head = next;
-	}
+	struct region *pred = regions_search(regions, addr, NULL);
+	struct region *next = pred ? pred->next : regions->head;
+
+	if (next && next->start == addr)
+		return next;
+	if (pred && addr < pred->end)
+		return pred;
+	return NULL;
+}
 
-	if (next)
-		next->prev = prev;
-	else
-	{
-		mmt_debug("new last is at <0x%08x, 0x%08x>\n", prev->start, prev->end);
-		parent->last = prev;
-	}
+static int random_height(void)
+{
+	static uint32_t seed = 0x2545f491;
+	uint32_t r;
+	int height = 1;
+
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	for (r = seed; height < REGIONS_MAX_HEIGHT && (r & 3) == 0; r >>= 2)
+		height++;
+
+	return height;
 }
 
-static void maybe_merge_with_next(struct region *cur, struct regions *parent)
+static struct region *insert_region(struct regions *regions, uint32_t start, uint32_t end, struct region **preds)
 {
-	// next exists?
-	if (!cur->next)
-		return;
+	int height = random_height();
+	struct region *reg = malloc(sizeof(*reg) + (height - 1) * sizeof(reg->skip[0]));
+	int level;
 
-	// next starts after this one?
-	if (cur->next->start > cur->end)
-		return;
+	mmt_debug("adding new entry <0x%08x, 0x%08x>\n", start, end);
+	reg->start = start;
+	reg->end = end;
+	reg->height = height;
 
-	// now next starts within this one
+	for (level = regions->height; level < height; level++)
+		preds[level] = NULL;
+	if (height > regions->height)
+		regions->height = height;
 
-	// next ends within this one?
-	if (cur->next->end <= cur->end)
+	for (level = 0; level < height; level++)
 	{
-		// drop next one
-		drop_region(cur->next, parent);
-
-		// and see if next^2 should be merged
-		maybe_merge_with_next(cur, parent);
+		struct region **link = region_link(regions, preds[level], level);
+		if (level == 0)
+			reg->next = *link;
+		else
+			reg->skip[level - 1] = *link;
+		*link = reg;
 	}
-	else
-	{
-		// now next ends after this one
 
-		// extend current end
-		mmt_debug("extending entry <0x%08x, 0x%08x> right to 0x%08x\n",
-				cur->start, cur->end, cur->next->end);
-		cur->end = cur->next->end;
+	reg->prev = preds[0];
+	if (reg->next)
+		reg->next->prev = reg;
+	else
+		regions->last = reg;
 
-		// and drop next entry
-		drop_region(cur->next, parent);
-	}
+	return reg;
 }
 
-static void maybe_merge_with_previous(struct region *cur, struct regions *parent)
+/* preds[level] must be the region preceding reg on every level reg is linked at */
+static void drop_region(struct regions *regions, struct region *reg, struct region **preds)
 {
-	// previous exists?
-	if (!cur->prev)
-		return;
+	int level;
 
-	// previous ends before start of this one?
-	if (cur->prev->end < cur->start)
-		return;
+	mmt_debug("dropping entry <0x%08x, 0x%08x>\n", reg->start, reg->end);
+	for (level = 0; level < reg->height; level++)
+		*region_link(regions, preds[level], level) = level ? reg->skip[level - 1] : reg->next;
 
-	// now previous ends within this one
+	if (reg->next)
+		reg->next->prev = reg->prev;
+	else
+		regions->last = reg->prev;
 
-	// previous starts within this one?
-	if (cur->prev->start >= cur->start)
-	{
-		// just drop previous entry
-		drop_region(cur->prev, parent);
+	free(reg);
+}
 
-		// and see if previous^2 should be merged
-		maybe_merge_with_previous(cur, parent);
-	}
-	else
-	{
-		// now previous starts before this one
+/* absorbs regions which start within (or right after) cur */
+static void merge_with_following(struct regions *regions, struct region *cur, struct region **preds)
+{
+	struct region *next;
+	int level;
 
-		// extend current start
-		mmt_debug("extending entry <0x%08x, 0x%08x> left to 0x%08x\n",
-				cur->start, cur->end, cur->prev->start);
-		cur->start = cur->prev->start;
+	/* above cur's height the predecessors of following regions are the same as cur's */
+	for (level = 0; level < cur->height; level++)
+		preds[level] = cur;
 
-		// and drop previous entry
-		drop_region(cur->prev, parent);
+	while ((next = cur->next) && next->start <= cur->end)
+	{
+		if (next->end > cur->end)
+		{
+			mmt_debug("extending entry <0x%08x, 0x%08x> right to 0x%08x\n",
+					cur->start, cur->end, next->end);
+			cur->end = next->end;
+		}
+		drop_region(regions, next, preds);
 	}
 }
 
 void free_regions(struct regions *regions)
 {
 	struct region *cur = regions->head, *next;
-	if (!cur)
-		return;
 
 	while (cur)
 	{
@@ -192,116 +210,61 @@ void free_regions(struct regions *regions)
 		cur = next;
 	}
 
-	regions->head = NULL;
-	regions->last = NULL;
+	memset(regions, 0, sizeof(*regions));
 }
 
-static void __regions_add_range(struct regions *regions, uint32_t start, uint32_t len)
+int regions_add_range(struct regions *regions, uint32_t start, uint32_t len)
 {
-	struct region *cur = regions->head;
+	struct region *preds[REGIONS_MAX_HEIGHT];
+	struct region *cur = regions->last;
+	uint32_t end = start + len;
 
-	if (cur == NULL)
-	{
-		regions->head = cur = malloc(sizeof(struct region));
-		cur->start = start;
-		cur->end = start + len;
-		cur->prev = NULL;
-		cur->next = NULL;
-		regions->last = cur;
-		return;
-	}
-
-	struct region *last_reg = regions->last;
-	if (start == last_reg->end)
-	{
-		mmt_debug("extending last entry <0x%08x, 0x%08x> right by %d\n",
-				last_reg->start, last_reg->end, len);
-		last_reg->end += len;
-		return;
-	}
-
-	if (start > last_reg->end)
-	{
-		mmt_debug("adding last entry <0x%08x, 0x%08x> after <0x%08x, 0x%08x>\n",
-				start, start + len, last_reg->start, last_reg->end);
-		cur = malloc(sizeof(struct region));
-		cur->start = start;
-		cur->end = start + len;
-		cur->prev = last_reg;
-		cur->next = NULL;
-		last_reg->next = cur;
-		regions->last = cur;
-		return;
-	}
+	if (len == 0)
+		return 1;
 
-	if (start + len > last_reg->end)
+	/* sequential writes just extend the last region */
+	if (cur && start >= cur->start && start <= cur->end)
 	{
-		mmt_debug("extending last entry <0x%08x, 0x%08x> right to 0x%08x\n",
-				last_reg->start, last_reg->end, start + len);
-		last_reg->end = start + len;
-		if (start < last_reg->start)
+		if (end > cur->end)
 		{
-			mmt_debug("... and extending last entry <0x%08x, 0x%08x> left to 0x%08x\n",
-					last_reg->start, last_reg->end, start);
-			last_reg->start = start;
-			maybe_merge_with_previous(last_reg, regions);
+			mmt_debug("extending last entry <0x%08x, 0x%08x> right to 0x%08x\n",
+					cur->start, cur->end, end);
+			cur->end = end;
 		}
-		return;
+		return 1;
 	}
 
-
-	while (start + len > cur->end) // if we will ever crash on cur being NULL then it means we screwed up earlier
+	cur = regions_search(regions, start, preds);
+	if (cur && cur->end >= start)
 	{
-		if (cur->end == start) // optimization
-		{
-			mmt_debug("extending entry <0x%08x, 0x%08x> by %d\n", cur->start, cur->end, len);
-			cur->end += len;
-			maybe_merge_with_next(cur, regions);
-			return;
-		}
-		cur = cur->next;
+		// starts within (or right after) previous one
+		if (end > cur->end)
+			cur->end = end;
 	}
-
-	// now it ends before end of current
-
-	// does it start in this one?
-	if (start >= cur->start)
-		return;
-
-	// does it end before start of current one?
-	if (start + len < cur->start)
+	else
 	{
-		mmt_debug("adding new entry <0x%08x, 0x%08x> before <0x%08x, 0x%08x>\n",
-				start, start + len, cur->start, cur->end);
-		struct region *tmp = malloc(sizeof(struct region));
-		tmp->start = start;
-		tmp->end = start + len;
-		tmp->prev = cur->prev;
-		tmp->next = cur;
-		if (cur->prev)
-			cur->prev->next = tmp;
+		cur = cur ? cur->next : regions->head;
+		if (cur && cur->start <= end)
+		{
+			// ends within (or right before) next one
+			mmt_debug("extending entry <0x%08x, 0x%08x> left to 0x%08x\n",
+					cur->start, cur->end, start);
+			cur->start = start;
+			if (end > cur->end)
+				cur->end = end;
+		}
 		else
-			regions->head = tmp;
-		cur->prev = tmp;
-		maybe_merge_with_previous(tmp, regions);
-		return;
+			cur = insert_region(regions, start, end, preds);
 	}
 
-	// now it ends in current and starts before
-	cur->start = start;
-	maybe_merge_with_previous(cur, regions);
-}
-
-int regions_add_range(struct regions *regions, uint32_t start, uint32_t len)
-{
-	__regions_add_range(regions, start, len);
+	merge_with_following(regions, cur, preds);
 
-	if (!regions_are_sane(regions))
+	if (MMT_DEBUG && !regions_are_sane(regions))
 		return 0;
 
-	if (!range_in_regions(regions, start, len))
+	if (start < cur->start || end > cur->end)
 	{
-		mmt_error("region <0x%08x, 0x%08x> was not added!\n", start, start + len);
+		mmt_error("region <0x%08x, 0x%08x> was not added!\n", start, end);
 		return 0;
 	}
 
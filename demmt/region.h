@@ -3,22 +3,45 @@
 
 #include <stdint.h>
 
+/*
+ * Sorted, non-overlapping set of written ranges, kept as a skip list.
+ * Level 0 is an ordinary doubly linked list (prev/next), so regions can
+ * still be iterated in address order from regions_first.
+ */
+#define REGIONS_MAX_HEIGHT 16
+
 struct region
 {
 	struct region *prev;
 	uint32_t start;
 	uint32_t end;
 	struct region *next;
+
+	int height;
+	/* next region on skip list levels 1 .. height - 1 */
+	struct region *skip[];
 };
 
 struct regions
 {
 	struct region *head;
 	struct region *last;
+
+	int height;
+	/* first region on skip list levels 1 .. REGIONS_MAX_HEIGHT - 1 */
+	struct region *skip_head[REGIONS_MAX_HEIGHT - 1];
 };
 
 void dump_regions(struct regions *regions);
 void free_regions(struct regions *regions);
 int regions_add_range(struct regions *regions, uint32_t start, uint32_t len);
 
+static inline struct region *regions_first(struct regions *regions)
+{
+	return regions->head;
+}
+
+/* returns the region containing addr or NULL */
+struct region *regions_find(struct regions *regions, uint32_t addr);
+
 #endif
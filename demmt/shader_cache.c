@@ -0,0 +1,475 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE // for dladdr
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "dis.h"
+#include "log.h"
+#include "object.h"
+#include "shader_cache.h"
+
+/*
+ * Shader disassembly cache.
+ *
+ * The same few hundred programs get bound over and over in a typical
+ * trace, so the rendered disassembly is kept per (ISA, variant, start
+ * address, colors, code bytes) and just printed again when they come back.
+ * The code is kept too and compared on lookup, so a hash collision can't
+ * print the wrong shader.
+ *
+ * --shader-cache keeps the rendered text in a file across runs.  Entries
+ * are only ever appended.  The first line holds a hash of the binary the
+ * disassembler was loaded from, and a file written by any other build is
+ * started over, as its listings may no longer be what envydis prints.
+ *
+ * --shader-export writes every unique shader seen in the run at exit,
+ * with the number of times it was seen, always without colors.
+ *
+ * --shader-refs prints just a reference for shaders already printed.
+ */
+
+#define STORE_MAGIC "# demmt shader cache "
+#define STORE_VERSION 2
+
+/*
+ * Limits for entries read back from the file, anything over them is taken
+ * as a broken entry.  No shader comes anywhere near that much code, and no
+ * listing has more than a line per code byte, each shorter than that.
+ */
+#define STORE_MAX_CODELEN (16 << 20)
+#define STORE_MAX_TEXT_PER_BYTE 1024
+
+struct shader
+{
+	uint64_t hash;
+	char *desc;
+	uint8_t *code;
+	uint32_t codelen;
+	uint32_t start;
+	char *text;
+	size_t textlen;
+
+	/* seen in this run */
+	uint64_t count;
+	const struct disisa *isa;
+	struct varinfo *var;
+	int num;
+
+	struct shader *next;
+};
+
+static struct shader **buckets;
+static int buckets_mask = -1;
+static int shaders_num;
+
+/* in order of first use, for the export */
+static struct shader **seen;
+static int seennum;
+static int seenmax;
+
+static FILE *store_file;
+static FILE *export_file;
+static int show_refs;
+
+static uint64_t shader_hash(const void *data, size_t len, uint64_t h)
+{
+	const uint8_t *p = data;
+	uint64_t w;
+
+	h ^= len * 0x9e3779b97f4a7c15ull;
+	for (; len >= 8; p += 8, len -= 8)
+	{
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdull;
+		h ^= h >> 32;
+	}
+	for (; len; p++, len--)
+	{
+		h = (h ^ *p) * 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 29;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	return h;
+}
+
+static const char *isa_name(const struct disisa *isa)
+{
+	if (isa == isa_g80)
+		return "g80";
+	if (isa == isa_gf100)
+		return "gf100";
+	if (isa == isa_gk110)
+		return "gk110";
+	if (isa == isa_gm107)
+		return "gm107";
+	return "unknown";
+}
+
+/* everything that changes the text other than the code itself */
+static void shader_describe(char *buf, size_t size, const struct disisa *isa,
+		struct varinfo *var, uint32_t start)
+{
+	struct vardata *data = var->data;
+	size_t pos = 0;
+	int i;
+
+	pos += snprintf(buf + pos, size - pos, "%s", isa_name(isa));
+	for (i = 0; i < data->varsetsnum && pos < size; ++i)
+		if (var->variants[i] != -1)
+			pos += snprintf(buf + pos, size - pos, " %s", data->variants[var->variants[i]].name);
+	for (i = 0; i < data->modesetsnum && pos < size; ++i)
+		if (var->modes[i] != -1)
+			pos += snprintf(buf + pos, size - pos, " %s", data->modes[var->modes[i]].name);
+	for (i = 0; i < MASK_SIZE(data->featuresnum) && pos < size; ++i)
+		pos += snprintf(buf + pos, size - pos, " %08x", var->fmask[i]);
+	if (pos < size)
+		snprintf(buf + pos, size - pos, " @%x%s", start,
+				colors == &envy_null_colors ? "" : " colors");
+}
+
+static struct shader *shader_find(uint64_t hash, const char *desc,
+		const uint8_t *code, uint32_t codelen)
+{
+	struct shader *s;
+
+	if (!buckets)
+		return NULL;
+	for (s = buckets[hash & buckets_mask]; s; s = s->next)
+		if (s->hash == hash && s->codelen == codelen &&
+				!strcmp(s->desc, desc) && !memcmp(s->code, code, codelen))
+			return s;
+	return NULL;
+}
+
+static struct shader *shader_add(uint64_t hash, const char *desc,
+		const uint8_t *code, uint32_t codelen)
+{
+	struct shader *s = calloc(1, sizeof(*s));
+	int i;
+
+	if (shaders_num >= buckets_mask)
+	{
+		int oldsize = buckets_mask + 1;
+		struct shader **old = buckets;
+
+		buckets_mask = oldsize ? oldsize * 2 - 1 : 255;
+		buckets = calloc(buckets_mask + 1, sizeof(*buckets));
+		for (i = 0; i < oldsize; ++i)
+			while (old[i])
+			{
+				struct shader *o = old[i];
+				old[i] = o->next;
+				o->next = buckets[o->hash & buckets_mask];
+				buckets[o->hash & buckets_mask] = o;
+			}
+		free(old);
+	}
+
+	s->hash = hash;
+	s->desc = strdup(desc);
+	s->code = malloc(codelen);
+	memcpy(s->code, code, codelen);
+	s->codelen = codelen;
+	s->next = buckets[hash & buckets_mask];
+	buckets[hash & buckets_mask] = s;
+	shaders_num++;
+	return s;
+}
+
+static void shader_store(struct shader *s)
+{
+	fprintf(store_file, "%016" PRIx64 " %u %zu %s\n", s->hash, s->codelen, s->textlen, s->desc);
+	fwrite(s->code, 1, s->codelen, store_file);
+	fwrite(s->text, 1, s->textlen, store_file);
+	fflush(store_file);
+}
+
+static char *render(const struct disisa *isa, struct varinfo *var,
+		const uint8_t *code, uint32_t start, int num,
+		const struct envy_colors *cols, size_t *len)
+{
+	char *text = NULL;
+	FILE *f = open_memstream(&text, len);
+
+	ed_dis_listing(isa, var, f, code, start, num, cols);
+	fclose(f);
+	return text;
+}
+
+void shader_disassemble(const struct disisa *isa, struct varinfo *var,
+		const uint8_t *code, uint32_t start, int num)
+{
+	char desc[512];
+	uint32_t codelen = num * ed_getcstride(isa, var);
+	uint64_t hash;
+	struct shader *s;
+
+	shader_describe(desc, sizeof(desc), isa, var, start);
+	hash = shader_hash(code, codelen, shader_hash(desc, strlen(desc), 0));
+
+	s = shader_find(hash, desc, code, codelen);
+	if (s && s->count && show_refs)
+	{
+		s->count++;
+		mmt_printf("SHADER %016" PRIx64 " (repeated)\n", hash);
+		return;
+	}
+
+	if (!s)
+	{
+		s = shader_add(hash, desc, code, codelen);
+		s->text = render(isa, var, code, start, num, colors, &s->textlen);
+		if (store_file)
+			shader_store(s);
+	}
+
+	if (!s->count++)
+	{
+		/* keep what's needed to render it again for the export */
+		s->isa = isa;
+		s->var = varinfo_new(var->data);
+		memcpy(s->var->fmask, var->fmask, MASK_SIZE(var->data->featuresnum) * sizeof(*var->fmask));
+		memcpy(s->var->variants, var->variants, var->data->varsetsnum * sizeof(*var->variants));
+		memcpy(s->var->modes, var->modes, var->data->modesetsnum * sizeof(*var->modes));
+		s->start = start;
+		s->num = num;
+		ADDARRAY(seen, s);
+	}
+
+	if (show_refs)
+		mmt_printf("SHADER %016" PRIx64 ":\n", hash);
+	fwrite(s->text, 1, s->textlen, stdout);
+}
+
+static void shader_load(FILE *f)
+{
+	char line[1024];
+	uint64_t hash;
+	uint32_t codelen;
+	size_t textlen;
+	int desc;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		struct shader *s;
+		size_t len = strlen(line);
+		uint8_t *code;
+		char *text;
+
+		if (len == 0 || line[len - 1] != '\n' ||
+				sscanf(line, "%" SCNx64 " %u %zu %n", &hash, &codelen, &textlen, &desc) != 3)
+			break;
+		line[len - 1] = 0;
+		if (codelen > STORE_MAX_CODELEN || textlen > (size_t)codelen * STORE_MAX_TEXT_PER_BYTE)
+			break;
+
+		code = malloc(codelen);
+		text = malloc(textlen);
+		if (!code || !text ||
+				fread(code, 1, codelen, f) != codelen || fread(text, 1, textlen, f) != textlen ||
+				shader_hash(code, codelen, shader_hash(line + desc, strlen(line + desc), 0)) != hash)
+		{
+			free(code);
+			free(text);
+			break;
+		}
+
+		if (shader_find(hash, line + desc, code, codelen))
+			free(text);
+		else
+		{
+			s = shader_add(hash, line + desc, code, codelen);
+			s->text = text;
+			s->textlen = textlen;
+		}
+		free(code);
+	}
+
+	if (!feof(f))
+		fprintf(stderr, "shader cache: ignoring the rest of the file after a broken entry\n");
+}
+
+/*
+ * Identifies the disassembler build by hashing the file envydis lives in:
+ * demmt itself when it's linked in statically, the shared library
+ * otherwise.  Returns 0 when the file can't be read.
+ */
+static uint64_t envydis_build_hash(void)
+{
+	Dl_info dis, self;
+	const char *path;
+	uint8_t buf[0x10000];
+	uint64_t h = 0;
+	size_t len;
+	FILE *f;
+
+	if (!dladdr((void *)envydis, &dis) || !dladdr((void *)envydis_build_hash, &self))
+		return 0;
+	/* dladdr names the main program by argv[0], which may not be a path */
+	path = dis.dli_fbase == self.dli_fbase ? "/proc/self/exe" : dis.dli_fname;
+	f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	while ((len = fread(buf, 1, sizeof(buf), f)))
+		h = shader_hash(buf, len, h);
+	if (ferror(f))
+		h = 0;
+	fclose(f);
+	return h;
+}
+
+void shader_cache_open(const char *path)
+{
+	char header[128], line[128];
+
+	snprintf(header, sizeof(header), STORE_MAGIC "v%d %016" PRIx64 "\n",
+			STORE_VERSION, envydis_build_hash());
+
+	store_file = fopen(path, "a+");
+	if (!store_file)
+	{
+		perror("fopen");
+		exit(1);
+	}
+
+	if (fgets(line, sizeof(line), store_file))
+	{
+		if (strncmp(line, STORE_MAGIC, strlen(STORE_MAGIC)))
+		{
+			fprintf(stderr, "%s is not a demmt shader cache\n", path);
+			exit(1);
+		}
+		if (!strcmp(line, header))
+			shader_load(store_file);
+		else if (ftruncate(fileno(store_file), 0))
+		{
+			perror("ftruncate");
+			exit(1);
+		}
+		else
+			fprintf(stderr, "shader cache: written by another envydis build, starting over\n");
+	}
+
+	/* anything written from now on goes at the end */
+	fseek(store_file, 0, SEEK_END);
+	if (ftell(store_file) == 0)
+	{
+		fputs(header, store_file);
+		fflush(store_file);
+	}
+}
+
+void shader_cache_set_export(const char *path)
+{
+	export_file = fopen(path, "w");
+	if (!export_file)
+	{
+		perror("fopen");
+		exit(1);
+	}
+	/* before the sandbox, which doesn't allow what stdio needs for the first write */
+	fprintf(export_file, "# demmt shader export v1\n");
+	fprintf(export_file, "# SHADER hash times-seen bytes isa [variant] [mode] feature-mask @start\n");
+}
+
+void shader_cache_set_refs(int en)
+{
+	show_refs = en;
+}
+
+int shader_cache_fileno()
+{
+	return store_file ? fileno(store_file) : -1;
+}
+
+int shader_cache_export_fileno()
+{
+	return export_file ? fileno(export_file) : -1;
+}
+
+static void shader_export(struct shader *s)
+{
+	char *text = s->text;
+	size_t textlen = s->textlen;
+	int desclen = strlen(s->desc);
+
+	if (colors != &envy_null_colors)
+	{
+		text = render(s->isa, s->var, s->code, s->start, s->num, &envy_null_colors, &textlen);
+		/* the description without the colors flag */
+		desclen -= strlen(" colors");
+	}
+
+	fprintf(export_file, "SHADER %016" PRIx64 " %" PRIu64 " %u %.*s\n", s->hash, s->count, s->codelen, desclen, s->desc);
+	fwrite(text, 1, textlen, export_file);
+	fprintf(export_file, "\n");
+
+	if (text != s->text)
+		free(text);
+}
+
+void shader_cache_close()
+{
+	struct shader *s;
+	int i;
+
+	if (export_file)
+	{
+		for (i = 0; i < seennum; ++i)
+			shader_export(seen[i]);
+		/* the sandbox does not allow close(), the file is closed on exit */
+		fflush(export_file);
+	}
+	if (store_file)
+		fflush(store_file);
+
+	for (i = 0; i <= buckets_mask; ++i)
+		while (buckets[i])
+		{
+			s = buckets[i];
+			buckets[i] = s->next;
+			if (s->var)
+				varinfo_del(s->var);
+			free(s->desc);
+			free(s->code);
+			free(s->text);
+			free(s);
+		}
+	free(buckets);
+	buckets = NULL;
+	buckets_mask = -1;
+	shaders_num = 0;
+	free(seen);
+	seen = NULL;
+	seennum = seenmax = 0;
+}
@@ -0,0 +1,21 @@
+#ifndef DEMMT_SHADER_CACHE_H
+#define DEMMT_SHADER_CACHE_H
+
+#include <stdint.h>
+
+struct disisa;
+struct varinfo;
+
+/* disassembles a shader to stdout like envydis does, through the cache */
+void shader_disassemble(const struct disisa *isa, struct varinfo *var,
+		const uint8_t *code, uint32_t start, int num);
+
+void shader_cache_open(const char *path);
+void shader_cache_set_export(const char *path);
+void shader_cache_set_refs(int en);
+/* writes the export and frees everything, before the ISAs go away */
+void shader_cache_close();
+int shader_cache_fileno();
+int shader_cache_export_fileno();
+
+#endif
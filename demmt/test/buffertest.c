@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Checks the gpu object hash, the gpu mapping address index and the set of
+ * live mappings against plain walks of the object lists, while objects and
+ * mappings are randomly created and destroyed.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "buffer.h"
+#include "buffer_decode.h"
+#include "nvrm.h"
+
+#define DEVICE_CLASS 0x80
+#define DEVICES 3
+#define ROUNDS 4000
+
+int indent_logs = 0;
+int mmt_sync_fd = -1;
+
+/* stand-ins for the parts of demmt buffer.c depends on */
+enum mmt_fd_type demmt_get_fdtype(int fd)
+{
+	return FDUNK;
+}
+
+void buffer_decode_register_write(struct cpu_mapping *mapping, uint32_t start, uint32_t len)
+{
+}
+
+struct gpu_object *nvrm_get_device(struct gpu_object *obj)
+{
+	while (obj)
+	{
+		if (obj->class_ == DEVICE_CLASS)
+			return obj;
+		obj = obj->parent_object;
+	}
+
+	return NULL;
+}
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t max)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % max;
+}
+
+/* the lookups as they were done before the index existed */
+static struct gpu_object *slow_object_find(uint32_t cid, uint32_t handle)
+{
+	struct gpu_object *obj;
+	for (obj = gpu_objects; obj != NULL; obj = obj->next)
+		if (obj->cid == cid && obj->handle == handle)
+			return obj;
+	return NULL;
+}
+
+static struct gpu_mapping *slow_mapping_find(uint64_t address, struct gpu_object *dev)
+{
+	struct gpu_object *obj;
+	struct gpu_mapping *m;
+
+	if (address == 0)
+		return NULL;
+	for (obj = gpu_objects; obj != NULL; obj = obj->next)
+	{
+		if (nvrm_get_device(obj) != dev)
+			continue;
+		for (m = obj->gpu_mappings; m != NULL; m = m->next)
+			if (address >= m->address && address < m->address + m->length)
+				return m;
+	}
+	return NULL;
+}
+
+static int object_count(void)
+{
+	struct gpu_object *obj;
+	int n = 0;
+	for (obj = gpu_objects; obj != NULL; obj = obj->next)
+		n++;
+	return n;
+}
+
+static struct gpu_object *random_object(int class_)
+{
+	struct gpu_object *obj;
+	int n = 0, pick;
+
+	for (obj = gpu_objects; obj != NULL; obj = obj->next)
+		if (!class_ || obj->class_ == class_)
+			n++;
+	if (!n)
+		return NULL;
+
+	pick = rnd(n);
+	for (obj = gpu_objects; obj != NULL; obj = obj->next)
+		if ((!class_ || obj->class_ == class_) && pick-- == 0)
+			return obj;
+	return NULL;
+}
+
+static void add_mapping(struct gpu_object *obj)
+{
+	struct gpu_mapping *m = calloc(1, sizeof(*m));
+
+	/* a small address space, so that mappings overlap now and then */
+	m->address = (uint64_t)rnd(0x400) << 12;
+	m->length = (uint64_t)(rnd(16) + 1) << 12;
+	m->object = obj;
+	gpu_mapping_add(m);
+}
+
+static int check(void)
+{
+	struct gpu_object *obj, *devs[DEVICES + 1] = { NULL };
+	struct gpu_mapping *m;
+	int i, ndevs = 0;
+
+	for (obj = gpu_objects; obj != NULL; obj = obj->next)
+	{
+		if (gpu_object_find(obj->cid, obj->handle) != slow_object_find(obj->cid, obj->handle))
+		{
+			fprintf(stderr, "gpu_object_find(%u, 0x%x) failed\n", obj->cid, obj->handle);
+			return 1;
+		}
+		for (m = obj->gpu_mappings; m != NULL; m = m->next)
+			if (!gpu_mapping_is_valid(m))
+			{
+				fprintf(stderr, "live mapping 0x%" PRIx64 " is not valid\n", m->address);
+				return 1;
+			}
+		if (obj->class_ == DEVICE_CLASS && ndevs < DEVICES)
+			devs[ndevs++] = obj;
+	}
+	if (gpu_object_find(7, 0xdead) != NULL)
+	{
+		fprintf(stderr, "found a nonexistent object\n");
+		return 1;
+	}
+
+	/* devs[ndevs] is NULL: mappings of objects which lost their device */
+	for (i = 0; i <= ndevs; i++)
+	{
+		uint64_t address;
+		for (address = 0; address < (0x410 << 12); address += 0x1000)
+			if (gpu_mapping_find(address, devs[i]) != slow_mapping_find(address, devs[i]))
+			{
+				fprintf(stderr, "gpu_mapping_find(0x%" PRIx64 ") failed\n", address);
+				return 1;
+			}
+	}
+
+	return 0;
+}
+
+int main()
+{
+	uint32_t handle = 1;
+	int i;
+
+	for (i = 0; i < DEVICES; i++)
+		gpu_object_add(0, i % 2, 0, handle++, DEVICE_CLASS);
+
+	for (i = 0; i < ROUNDS; i++)
+	{
+		struct gpu_object *obj, *parent;
+		int op = rnd(10);
+
+		if (op < 3 || object_count() < 8)
+		{
+			parent = random_object(DEVICE_CLASS);
+			if (!parent)
+				parent = gpu_object_add(0, 0, 0, handle++, DEVICE_CLASS);
+			/* reuse handles once in a while, the newest object must win */
+			obj = gpu_object_add(0, parent->cid, parent->handle,
+					rnd(4) ? handle++ : rnd(handle) + 1, 0x50);
+			add_mapping(obj);
+		}
+		else if (op < 6)
+		{
+			obj = random_object(0x50);
+			if (obj)
+				add_mapping(obj);
+		}
+		else if (op < 8)
+		{
+			obj = random_object(0x50);
+			if (obj && obj->gpu_mappings)
+				gpu_mapping_destroy(obj->gpu_mappings);
+		}
+		else if (op < 9 || rnd(8))
+		{
+			obj = random_object(0x50);
+			if (obj)
+				gpu_object_destroy(obj);
+		}
+		else
+		{
+			/* orphans the children, whose device becomes NULL */
+			obj = random_object(DEVICE_CLASS);
+			if (obj)
+				gpu_object_destroy(obj);
+		}
+
+		if (i % 8 == 0 && check())
+			return 1;
+	}
+
+	if (check())
+		return 1;
+
+	while (gpu_objects)
+		gpu_object_destroy(gpu_objects);
+
+	return 0;
+}
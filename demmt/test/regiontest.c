@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Checks the written-region skip list against a plain bitmap of written
+ * bytes, after every insertion of a pseudo-random range.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "region.h"
+
+int indent_logs = 0;
+int mmt_sync_fd = -1;
+
+#define SPACE 4096
+#define ROUNDS 20
+
+static uint8_t written[SPACE];
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t max)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % max;
+}
+
+static int check(struct regions *regions)
+{
+	struct region *cur, *prev = NULL;
+	uint32_t addr = 0;
+	int level;
+
+	for (cur = regions_first(regions); cur; prev = cur, cur = cur->next)
+	{
+		if (cur->prev != prev)
+		{
+			fprintf(stderr, "bad prev link at <0x%x, 0x%x>\n", cur->start, cur->end);
+			return 1;
+		}
+		if (cur->start >= cur->end || (prev && prev->end >= cur->start))
+		{
+			fprintf(stderr, "bad region <0x%x, 0x%x>\n", cur->start, cur->end);
+			return 1;
+		}
+		for (; addr < cur->end; addr++)
+			if (written[addr] != (addr >= cur->start))
+			{
+				fprintf(stderr, "region <0x%x, 0x%x> does not match at 0x%x\n",
+						cur->start, cur->end, addr);
+				return 1;
+			}
+	}
+	for (; addr < SPACE; addr++)
+		if (written[addr])
+		{
+			fprintf(stderr, "0x%x written, but not in any region\n", addr);
+			return 1;
+		}
+	if (regions->last != prev)
+	{
+		fprintf(stderr, "bad last region\n");
+		return 1;
+	}
+
+	for (level = 1; level < regions->height; level++)
+	{
+		struct region *pred = NULL;
+		for (cur = regions->skip_head[level - 1]; cur; pred = cur, cur = cur->skip[level - 1])
+			if (cur->height <= level || (pred && pred->start >= cur->start))
+			{
+				fprintf(stderr, "bad skip list level %d at <0x%x, 0x%x>\n",
+						level, cur->start, cur->end);
+				return 1;
+			}
+	}
+
+	for (addr = 0; addr < SPACE; addr++)
+	{
+		cur = regions_find(regions, addr);
+		if (written[addr] ? !cur || addr < cur->start || addr >= cur->end : cur != NULL)
+		{
+			fprintf(stderr, "regions_find(0x%x) failed\n", addr);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int main()
+{
+	struct regions regions;
+	int round, i;
+
+	for (round = 0; round < ROUNDS; round++)
+	{
+		memset(&regions, 0, sizeof(regions));
+		memset(written, 0, sizeof(written));
+
+		for (i = 0; i < 400; i++)
+		{
+			uint32_t len = rnd(round & 1 ? 64 : 8) + 1;
+			uint32_t start;
+
+			/* mix in sequential writes, which take a separate path */
+			if (i % 5 == 4 && regions.last && regions.last->end + len <= SPACE)
+				start = regions.last->end - rnd(2);
+			else
+				start = rnd(SPACE - len);
+
+			if (!regions_add_range(&regions, start, len))
+			{
+				fprintf(stderr, "regions_add_range(0x%x, 0x%x) failed\n", start, len);
+				return 1;
+			}
+			memset(written + start, 1, len);
+
+			if (check(&regions))
+				return 1;
+		}
+
+		free_regions(&regions);
+	}
+
+	return 0;
+}
@@ -32,6 +32,13 @@ struct iasctx {
 	struct litem **atoms;
 	int atomsnum;
 	int atomsmax;
+	/* the words that can satisfy N() and C() atoms, for pruning */
+	const char **names;
+	int namesnum;
+	int namesmax;
+	const char **cmds;
+	int cmdsnum;
+	int cmdsmax;
 };
 
 struct matches *emptymatches() {
@@ -48,6 +55,11 @@ struct matches *alwaysmatches(int lpos) {
 
 struct matches *catmatches(struct matches *a, struct matches *b) {
 	int i;
+	if (!a->mnum) {
+		free(a->m);
+		free(a);
+		return b;
+	}
 	for (i = 0; i < b->mnum; i++)
 		ADDARRAY(a->m, b->m[i]);
 	free(b->m);
@@ -56,8 +68,7 @@ struct matches *catmatches(struct matches *a, struct matches *b) {
 }
 
 struct matches *mergematches(struct match a, struct matches *b) {
-	struct matches *res = emptymatches();
-	int i, j;
+	int i, j, k = 0;
 	for (i = 0; i < b->mnum; i++) {
 		for (j = 0; j < MAXOPLEN; j++) {
 			ull cmask = a.m[j] & b->m[i].m[j];
@@ -65,24 +76,24 @@ struct matches *mergematches(struct match a, struct matches *b) {
 				break;
 		}
 		if (j == MAXOPLEN) {
-			struct match nm = b->m[i];
-			if (!nm.oplen)
-				nm.oplen = a.oplen;
+			struct match *nm = &b->m[k];
+			if (i != k)
+				*nm = b->m[i];
+			if (!nm->oplen)
+				nm->oplen = a.oplen;
 			for (j = 0; j < MAXOPLEN; j++) {
-				nm.a[j] |= a.a[j];
-				nm.m[j] |= a.m[j];
+				nm->a[j] |= a.a[j];
+				nm->m[j] |= a.m[j];
 			}
-			int j;
-			assert (a.nrelocs + nm.nrelocs <= 8);
+			assert (a.nrelocs + nm->nrelocs <= 8);
 			for (j = 0; j < a.nrelocs; j++)
-				nm.relocs[nm.nrelocs + j] = a.relocs[j];
-			nm.nrelocs += a.nrelocs;
-			ADDARRAY(res->m, nm);
+				nm->relocs[nm->nrelocs + j] = a.relocs[j];
+			nm->nrelocs += a.nrelocs;
+			k++;
 		}
 	}
-	free(b->m);
-	free(b);
-	return res;
+	b->mnum = k;
+	return b;
 }
 
 static inline ull bf_(int s, int l, ull *a, ull *m) {
@@ -257,12 +268,38 @@ struct matches *tabdesc (struct iasctx *ctx, struct match m, const struct atom *
 	return res;
 }
 
+static int haveword(const char **words, int wordsnum, const char *str) {
+	int i;
+	for (i = 0; i < wordsnum; i++)
+		if (!strcmp(words[i], str))
+			return 1;
+	return 0;
+}
+
+/*
+ * An encoding can only match if every word it spells out appears somewhere
+ * in the instruction, and if it isn't one of the catch-all unknown entries.
+ * Checking that up front is much cheaper than matching the operands in front
+ * of a mnemonic that isn't there.
+ */
+static int atoms_possible(struct iasctx *ctx, const struct atom *atoms) {
+	for (; atoms->fun_as; atoms++) {
+		if (atoms->fun_as == atomunk_a)
+			return 0;
+		if (atoms->fun_as == atomname_a && !haveword(ctx->names, ctx->namesnum, atoms->arg))
+			return 0;
+		if (atoms->fun_as == atomcmd_a && !haveword(ctx->cmds, ctx->cmdsnum, atoms->arg))
+			return 0;
+	}
+	return 1;
+}
+
 struct matches *atomtab_a APROTO {
 	const struct insn *tab = v;
 	struct matches *res = emptymatches();
 	int i;
 	for (i = 0; ; i++) {
-		if (var_ok(tab[i].fmask, tab[i].ptype, ctx->varinfo)) {
+		if (var_ok(tab[i].fmask, tab[i].ptype, ctx->varinfo) && atoms_possible(ctx, tab[i].atoms)) {
 			struct match sm = { 0, .a = {tab[i].val}, .m = {tab[i].mask}, .lpos = spos };
 			struct matches *subm = tabdesc(ctx, sm, tab[i].atoms);
 			if (subm)
@@ -679,6 +716,7 @@ void convert_mods(struct iasctx *ctx, struct easm_mods *mods) {
 		li->type = LITEM_NAME;
 		li->str = mods->mods[i]->str;
 		ADDARRAY(ctx->atoms, li);
+		ADDARRAY(ctx->names, li->str);
 	}
 }
 
@@ -697,6 +735,7 @@ void convert_sinsn(struct iasctx *ctx, struct easm_sinsn *sinsn) {
 	li->type = LITEM_NAME;
 	li->str = sinsn->str;
 	ADDARRAY(ctx->atoms, li);
+	ADDARRAY(ctx->names, li->str);
 	for (i = 0; i < sinsn->operandsnum; i++) {
 		convert_operand(ctx, sinsn->operands[i]);
 	}
@@ -725,6 +764,8 @@ void convert_expr_top(struct iasctx *ctx, struct easm_expr *expr) {
 		li->type = LITEM_EXPR;
 		li->expr = expr;
 		ADDARRAY(ctx->atoms, li);
+		if (expr->type == EASM_EXPR_LABEL)
+			ADDARRAY(ctx->cmds, expr->str);
 	}
 }
 
@@ -748,5 +789,12 @@ struct matches *do_as(const struct disisa *isa, struct varinfo *varinfo, struct
 		if (m->m[i].lpos == ctx->atomsnum) {
 			ADDARRAY(res->m, m->m[i]);
 		}
+	free(m->m);
+	free(m);
+	for (i = 0; i < ctx->atomsnum; i++)
+		free(ctx->atoms[i]);
+	free(ctx->atoms);
+	free(ctx->names);
+	free(ctx->cmds);
 	return res;
 }
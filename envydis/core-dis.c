@@ -25,10 +25,138 @@
 #include "dis-intern.h"
 #include "easm.h"
 #include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*
+ * Everything decoding an instruction allocates, from the atoms to the easm
+ * tree, comes from a bump arena belonging to the envydis call.  It's reset
+ * once the instruction has been printed, the chunks are kept for the next
+ * one.  Arrays in the arena grow by moving to a new block and leaving the
+ * old one behind.
+ */
+
+#define DA_CHUNK 0x10000
+
+struct dachunk {
+	struct dachunk *next;
+	size_t size;
+	ull data[];
+};
+
+struct disarena {
+	struct dachunk *first;
+	struct dachunk *cur;
+	size_t pos;
+};
+
+static void *da_alloc(struct disarena *da, size_t size) {
+	char *res;
+	size = (size + 7) & ~(size_t)7;
+	if (!da->cur || da->pos + size > da->cur->size) {
+		struct dachunk *next = da->cur ? da->cur->next : da->first;
+		if (!next || next->size < size) {
+			struct dachunk *nc = malloc(sizeof *nc + max(size, DA_CHUNK));
+			nc->size = max(size, DA_CHUNK);
+			nc->next = next;
+			if (da->cur)
+				da->cur->next = nc;
+			else
+				da->first = nc;
+			next = nc;
+		}
+		da->cur = next;
+		da->pos = 0;
+	}
+	res = (char *)da->cur->data + da->pos;
+	da->pos += size;
+	memset(res, 0, size);
+	return res;
+}
+
+static void da_reset(struct disarena *da) {
+	da->cur = 0;
+	da->pos = 0;
+}
+
+static void da_free(struct disarena *da) {
+	while (da->first) {
+		struct dachunk *next = da->first->next;
+		free(da->first);
+		da->first = next;
+	}
+	da->cur = 0;
+}
+
+static char *da_printf(struct disarena *da, const char *fmt, ...) {
+	va_list ap;
+	int len;
+	char *res;
+	va_start(ap, fmt);
+	len = vsnprintf(0, 0, fmt, ap);
+	va_end(ap);
+	res = da_alloc(da, len + 1);
+	va_start(ap, fmt);
+	vsnprintf(res, len + 1, fmt, ap);
+	va_end(ap);
+	return res;
+}
+
+static void da_grow(struct disarena *da, void *parr, int *pmax, size_t esize) {
+	void **arr = parr;
+	int nmax = *pmax ? *pmax * 2 : 4;
+	void *narr = da_alloc(da, nmax * esize);
+	if (*pmax)
+		memcpy(narr, *arr, *pmax * esize);
+	*arr = narr;
+	*pmax = nmax;
+}
+
+#define DA_ADDARRAY(da, a, e) \
+	do { \
+	if ((a ## num) >= (a ## max)) \
+		da_grow((da), &(a), &(a ## max), sizeof *(a)); \
+	(a)[(a ## num)++] = (e); \
+	} while(0)
+
+static struct easm_expr *dexpr(struct disarena *da, enum easm_expr_type type) {
+	struct easm_expr *res = da_alloc(da, sizeof *res);
+	res->type = type;
+	return res;
+}
+
+static struct easm_expr *dexpr_bin(struct disarena *da, enum easm_expr_type type, struct easm_expr *e1, struct easm_expr *e2) {
+	struct easm_expr *res = dexpr(da, type);
+	res->e1 = e1;
+	res->e2 = e2;
+	return res;
+}
+
+static struct easm_expr *dexpr_un(struct disarena *da, enum easm_expr_type type, struct easm_expr *e1) {
+	struct easm_expr *res = dexpr(da, type);
+	res->e1 = e1;
+	return res;
+}
+
+static struct easm_expr *dexpr_num(struct disarena *da, enum easm_expr_type type, uint64_t num) {
+	struct easm_expr *res = dexpr(da, type);
+	res->num = num;
+	return res;
+}
+
+static struct easm_expr *dexpr_str(struct disarena *da, enum easm_expr_type type, char *str) {
+	struct easm_expr *res = dexpr(da, type);
+	res->str = str;
+	return res;
+}
 
 struct disctx {
 	const struct disisa *isa;
 	struct varinfo *varinfo;
+	struct disarena *arena;
+	/* the decision tree cache to use, see dt_threadcache */
+	struct dtcache **dtcache;
 	int oplen;
 	struct litem **atoms;
 	int atomsnum;
@@ -83,7 +211,7 @@ ull getbf(const struct bitfield *bf, ull *a, ull *m) {
 	return res;
 }
 
-struct easm_expr *getrbf(const struct rbitfield *bf, ull *a, ull *m) {
+static struct easm_expr *getrbf(struct disctx *ctx, const struct rbitfield *bf, ull *a, ull *m) {
 	ull res = 0;
 	int pos = bf->shr;
 	int i;
@@ -107,40 +235,387 @@ struct easm_expr *getrbf(const struct rbitfield *bf, ull *a, ull *m) {
 			break;
 	}
 	if (bf->pcrel) {
-		struct easm_expr *expr = easm_expr_simple(EASM_EXPR_POS);
+		struct easm_expr *expr = dexpr(ctx->arena, EASM_EXPR_POS);
 		if (bf->pospreadd)
-			expr = easm_expr_bin(EASM_EXPR_ADD, expr, easm_expr_num(EASM_EXPR_NUM, bf->pospreadd));
+			expr = dexpr_bin(ctx->arena, EASM_EXPR_ADD, expr, dexpr_num(ctx->arena, EASM_EXPR_NUM, bf->pospreadd));
 		if (bf->shr)
-			expr = easm_expr_bin(EASM_EXPR_AND, expr, easm_expr_num(EASM_EXPR_NUM, -(1ull << bf->shr)));
-		expr = easm_expr_bin(EASM_EXPR_ADD, expr, easm_expr_num(EASM_EXPR_NUM, res));
+			expr = dexpr_bin(ctx->arena, EASM_EXPR_AND, expr, dexpr_num(ctx->arena, EASM_EXPR_NUM, -(1ull << bf->shr)));
+		expr = dexpr_bin(ctx->arena, EASM_EXPR_ADD, expr, dexpr_num(ctx->arena, EASM_EXPR_NUM, res));
 		if (bf->addend)
-			expr = easm_expr_bin(EASM_EXPR_ADD, expr, easm_expr_num(EASM_EXPR_NUM, bf->addend));
+			expr = dexpr_bin(ctx->arena, EASM_EXPR_ADD, expr, dexpr_num(ctx->arena, EASM_EXPR_NUM, bf->addend));
 		return expr;
 	} else {
 		res += bf->addend;
-		return easm_expr_num(EASM_EXPR_NUM, res);
+		return dexpr_num(ctx->arena, EASM_EXPR_NUM, res);
 	}
 }
 
 #define GETBF(bf) getbf(bf, a, m)
-#define GETRBF(bf) getrbf(bf, a, m)
+#define GETRBF(bf) getrbf(ctx, bf, a, m)
 
-static inline struct litem *makeli(struct easm_expr *e) {
-	struct litem *li = calloc(sizeof *li, 1);
+static inline struct litem *makeli(struct disctx *ctx, struct easm_expr *e) {
+	struct litem *li = da_alloc(ctx->arena, sizeof *li);
 	li->type = LITEM_EXPR;
 	li->expr = e;
 	return li;
 }
 
-void atomtab_d DPROTO {
-	const struct insn *tab = v;
+/*
+ * Compiled tables
+ *
+ * Scanning a table linearly for every instruction gets slow for the big
+ * ISAs, so each table is turned into a decision tree for the variant in
+ * use.  The trees are built lazily, as instructions come in: a node knows
+ * which opcode bits are already fixed on the way to it, and the entry
+ * where the scan would continue.  When it's first reached, it looks for
+ * the first entry still possible there.  If that entry's mask is all fixed
+ * bits, the node is a leaf.  Otherwise it dispatches on the entry's
+ * remaining bits through a small hash (one child per value seen), or just
+ * tests the entry if it has too many of them to be worth it.
+ *
+ * Only the entries a linear scan would look at for the same opcode are
+ * ever read, so unterminated tables that rely on the outer tables to
+ * filter the opcode keep working.  The val/mask pairs read so far are
+ * kept in a compact array, so that building new nodes doesn't have to
+ * walk the big table entries again.
+ *
+ * Building the trees isn't thread safe, so threads decoding in parallel
+ * each get a cache of their own.
+ */
+
+#define DT_HASH_BITS 16
+
+struct dtkid {
+	ull key;
+	struct dtnode *node;
+};
+
+/* an op of a leaf's entry, with the table to walk for subtables */
+struct dtop {
+	dfun fun;
+	const void *arg;
+	struct dttab *sub;
+};
+
+struct dtnode {
+	enum {
+		DT_NEW,
+		DT_LEAF,
+		DT_HASH,
+		DT_TEST,
+	} kind;
+	struct dttab *tab;
+	ull fixmask;
+	ull fixval;
+	/* the result for leaves, the entry to start from for the rest */
+	int idx;
+	/* DT_HASH */
+	ull bits;
+	struct dtkid *kids;
+	int kidsnum;
+	int kidsmask;
+	/* DT_TEST: [0] for no match, [1] for match */
+	struct dtnode *test[2];
+	/* DT_LEAF: the entry's ops, without the empty slots */
+	ull mask;
+	struct dtop *ops;
+	int opsnum;
+};
+
+struct dtent {
+	ull val;
+	ull mask;
+	/* can't match, for this variant or at all */
+	int never;
+};
+
+/* a table, for one set of variant flags */
+struct dttab {
+	const struct insn *insns;
+	uint32_t fmask;
+	int mode;
+	struct dtnode *root;
+	/* the entries read so far */
+	struct dtent *ents;
+	int entsnum;
+	int entsmax;
+	/* leaves are shared by all the paths ending at the same entry */
+	struct dtnode **leaves;
+	int leavesmax;
+};
+
+struct dtcache {
+	struct dttab **tabs;
+	int tabsnum;
+	int tabsmask;
+};
+
+static struct dtnode *dt_newnode(struct dttab *tab, ull fixmask, ull fixval, int idx) {
+	struct dtnode *node = calloc(sizeof *node, 1);
+	node->tab = tab;
+	node->fixmask = fixmask;
+	node->fixval = fixval;
+	node->idx = idx;
+	return node;
+}
+
+/* leaves are freed with their table */
+static void dt_freenode(struct dtnode *node) {
+	int i;
+	if (!node || node->kind == DT_LEAF)
+		return;
+	for (i = 0; i <= node->kidsmask && node->kids; i++)
+		dt_freenode(node->kids[i].node);
+	dt_freenode(node->test[0]);
+	dt_freenode(node->test[1]);
+	free(node->kids);
+	free(node);
+}
+
+/* the keys are opcode bits, often all at the top, so mix them properly */
+static inline uint32_t dt_hash(ull key) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	return key;
+}
+
+static struct dttab *dt_gettab(struct disctx *ctx, const struct insn *insns) {
+	struct dtcache *dc = *ctx->dtcache;
+	struct varinfo *varinfo = ctx->varinfo;
+	/* all var_ok looks at */
+	uint32_t fmask = varinfo->data->featuresnum ? varinfo->fmask[0] : 0;
+	int mode = varinfo->data->modesetsnum ? varinfo->modes[0] : -1;
+	struct dttab *tab;
+	uint32_t i;
+	if (!dc)
+		dc = *ctx->dtcache = calloc(sizeof *dc, 1);
+	if (dc->tabsnum * 2 >= dc->tabsmask) {
+		struct dttab **old = dc->tabs;
+		int oldsize = old ? dc->tabsmask + 1 : 0, j;
+		dc->tabsmask = oldsize ? oldsize * 2 - 1 : 63;
+		dc->tabs = calloc(sizeof *dc->tabs, dc->tabsmask + 1);
+		for (j = 0; j < oldsize; j++) {
+			if (!old[j])
+				continue;
+			for (i = dt_hash((uintptr_t)old[j]->insns ^ old[j]->fmask); dc->tabs[i & dc->tabsmask]; i++);
+			dc->tabs[i & dc->tabsmask] = old[j];
+		}
+		free(old);
+	}
+	for (i = dt_hash((uintptr_t)insns ^ fmask); (tab = dc->tabs[i & dc->tabsmask]); i++)
+		if (tab->insns == insns && tab->fmask == fmask && tab->mode == mode)
+			return tab;
+	tab = calloc(sizeof *tab, 1);
+	tab->insns = insns;
+	tab->fmask = fmask;
+	tab->mode = mode;
+	tab->root = dt_newnode(tab, 0, 0, 0);
+	dc->tabs[i & dc->tabsmask] = tab;
+	dc->tabsnum++;
+	return tab;
+}
+
+static void dt_freedc(struct dtcache *dc) {
+	int i, j;
+	if (!dc)
+		return;
+	for (i = 0; i <= dc->tabsmask && dc->tabs; i++) {
+		struct dttab *tab = dc->tabs[i];
+		if (!tab)
+			continue;
+		dt_freenode(tab->root);
+		for (j = 0; j < tab->leavesmax; j++) {
+			if (!tab->leaves[j])
+				continue;
+			free(tab->leaves[j]->ops);
+			free(tab->leaves[j]);
+		}
+		free(tab->leaves);
+		free(tab->ents);
+		free(tab);
+	}
+	free(dc->tabs);
+	free(dc);
+}
+
+/*
+ * The trees grow while decoding, so they are never shared between threads.
+ * Each thread keeps its own per ISA, reused across envydis calls, and they
+ * are freed when the thread exits.
+ */
+struct dtthread {
+	const struct disisa *isa;
+	struct dtcache *dc;
+	struct dtthread *next;
+};
+
+static pthread_key_t dt_key;
+static pthread_once_t dt_once = PTHREAD_ONCE_INIT;
+
+static void dt_freethread(void *arg) {
+	struct dtthread *t = arg, *next;
+	for (; t; t = next) {
+		next = t->next;
+		dt_freedc(t->dc);
+		free(t);
+	}
+}
+
+static void dt_mkkey(void) {
+	pthread_key_create(&dt_key, dt_freethread);
+}
+
+static struct dtcache **dt_threadcache(const struct disisa *isa) {
+	struct dtthread *head, *t;
+	pthread_once(&dt_once, dt_mkkey);
+	head = pthread_getspecific(dt_key);
+	for (t = head; t; t = t->next)
+		if (t->isa == isa)
+			return &t->dc;
+	t = calloc(sizeof *t, 1);
+	t->isa = isa;
+	t->next = head;
+	pthread_setspecific(dt_key, t);
+	return &t->dc;
+}
+
+/* only the calling thread's trees, the others go when their threads exit */
+void dt_freecache(struct disisa *isa) {
+	struct dtthread *head, *t, **pt;
+	pthread_once(&dt_once, dt_mkkey);
+	head = pthread_getspecific(dt_key);
+	for (pt = &head; (t = *pt); pt = &t->next)
+		if (t->isa == isa) {
+			*pt = t->next;
+			dt_freedc(t->dc);
+			free(t);
+			break;
+		}
+	pthread_setspecific(dt_key, head);
+}
+
+/* returns the node to use instead, different if it turned out to be a leaf */
+static struct dtnode *dt_expand(struct disctx *ctx, struct dtnode *node) {
+	struct dttab *tab = node->tab;
+	const struct insn *insn;
+	struct dtent *ent;
+	ull bits;
+	int i, n = 0;
+	/* skip the entries that can't match anymore */
+	while (1) {
+		if (node->idx == tab->entsnum) {
+			struct dtent nent;
+			insn = &tab->insns[tab->entsnum];
+			nent.val = insn->val;
+			nent.mask = insn->mask;
+			nent.never = (nent.val & ~nent.mask) || !var_ok(insn->fmask, insn->ptype, ctx->varinfo);
+			ADDARRAY(tab->ents, nent);
+		}
+		ent = &tab->ents[node->idx];
+		if (!ent->never && !((ent->val ^ node->fixval) & ent->mask & node->fixmask))
+			break;
+		node->idx++;
+	}
+	bits = ent->mask & ~node->fixmask;
+	if (bits && __builtin_popcountll(bits) <= DT_HASH_BITS) {
+		node->kind = DT_HASH;
+		node->bits = bits;
+		return node;
+	} else if (bits) {
+		node->kind = DT_TEST;
+		node->mask = ent->mask;
+		node->test[0] = dt_newnode(tab, node->fixmask, node->fixval, node->idx + 1);
+		node->test[1] = dt_newnode(tab, node->fixmask | ent->mask, node->fixval | ent->val, node->idx);
+		return node;
+	}
+	if (node->idx >= tab->leavesmax) {
+		int oldmax = tab->leavesmax;
+		tab->leavesmax = max(tab->entsmax, node->idx + 1);
+		tab->leaves = realloc(tab->leaves, sizeof *tab->leaves * tab->leavesmax);
+		memset(tab->leaves + oldmax, 0, sizeof *tab->leaves * (tab->leavesmax - oldmax));
+	}
+	if (tab->leaves[node->idx]) {
+		struct dtnode *leaf = tab->leaves[node->idx];
+		free(node);
+		return leaf;
+	}
+	tab->leaves[node->idx] = node;
+	node->kind = DT_LEAF;
+	insn = &tab->insns[node->idx];
+	node->mask = insn->mask;
+	for (i = 0; i < ARRAY_SIZE(insn->atoms); i++)
+		if (insn->atoms[i].fun_dis)
+			n++;
+	node->ops = calloc(sizeof *node->ops, n);
+	for (i = 0; i < ARRAY_SIZE(insn->atoms); i++) {
+		struct dtop *op = &node->ops[node->opsnum];
+		if (!insn->atoms[i].fun_dis)
+			continue;
+		op->fun = insn->atoms[i].fun_dis;
+		op->arg = insn->atoms[i].arg;
+		if (op->fun == atomtab_d)
+			op->sub = dt_gettab(ctx, op->arg);
+		node->opsnum++;
+	}
+	return node;
+}
+
+/* returns the slot of the child, valid until the next lookup here */
+static struct dtnode **dt_getkid(struct dtnode *node, ull key) {
+	uint32_t i;
+	if (node->kids) {
+		for (i = dt_hash(key); node->kids[i & node->kidsmask].node; i++)
+			if (node->kids[i & node->kidsmask].key == key)
+				return &node->kids[i & node->kidsmask].node;
+	}
+	if (node->kidsnum * 2 >= node->kidsmask) {
+		struct dtkid *old = node->kids;
+		int oldsize = old ? node->kidsmask + 1 : 0, j;
+		node->kidsmask = oldsize ? oldsize * 2 - 1 : 3;
+		node->kids = calloc(sizeof *node->kids, node->kidsmask + 1);
+		for (j = 0; j < oldsize; j++) {
+			if (!old[j].node)
+				continue;
+			for (i = dt_hash(old[j].key); node->kids[i & node->kidsmask].node; i++);
+			node->kids[i & node->kidsmask] = old[j];
+		}
+		free(old);
+	}
+	for (i = dt_hash(key); node->kids[i & node->kidsmask].node; i++);
+	node->kids[i & node->kidsmask].key = key;
+	node->kids[i & node->kidsmask].node = dt_newnode(node->tab, node->fixmask | node->bits, node->fixval | key, node->idx);
+	node->kidsnum++;
+	return &node->kids[i & node->kidsmask].node;
+}
+
+static void dt_run(struct disctx *ctx, ull *a, ull *m, struct dttab *tab) {
+	struct dtnode **slot = &tab->root;
+	struct dtnode *node;
 	int i;
-	while ((a[0]&tab->mask) != tab->val || !var_ok(tab->fmask, tab->ptype, ctx->varinfo))
-		tab++;
-	m[0] |= tab->mask;
-	for (i = 0; i < ARRAY_SIZE(tab->atoms); i++)
-		if (tab->atoms[i].fun_dis)
-			tab->atoms[i].fun_dis (ctx, a, m, tab->atoms[i].arg);
+	while (1) {
+		node = *slot;
+		if (node->kind == DT_NEW)
+			node = *slot = dt_expand(ctx, node);
+		if (node->kind == DT_LEAF)
+			break;
+		else if (node->kind == DT_HASH)
+			slot = dt_getkid(node, a[0] & node->bits);
+		else
+			slot = &node->test[(a[0] & node->mask) == tab->ents[node->idx].val];
+	}
+	m[0] |= node->mask;
+	for (i = 0; i < node->opsnum; i++) {
+		const struct dtop *op = &node->ops[i];
+		if (op->sub)
+			dt_run(ctx, a, m, op->sub);
+		else
+			op->fun (ctx, a, m, op->arg);
+	}
+}
+
+void atomtab_d DPROTO {
+	dt_run(ctx, a, m, dt_gettab(ctx, v));
 }
 
 void atomopl_d DPROTO {
@@ -152,61 +627,61 @@ void atomendmark_d DPROTO {
 }
 
 void atomsestart_d DPROTO {
-	struct litem *li = calloc(sizeof *li, 1);
+	struct litem *li = da_alloc(ctx->arena, sizeof *li);
 	li->type = LITEM_SESTART;
-	ADDARRAY(ctx->atoms, li);
+	DA_ADDARRAY(ctx->arena, ctx->atoms, li);
 }
 
 void atomseend_d DPROTO {
-	struct litem *li = calloc(sizeof *li, 1);
+	struct litem *li = da_alloc(ctx->arena, sizeof *li);
 	li->type = LITEM_SEEND;
-	ADDARRAY(ctx->atoms, li);
+	DA_ADDARRAY(ctx->arena, ctx->atoms, li);
 }
 
 void atomname_d DPROTO {
-	struct litem *li = calloc(sizeof *li, 1);
+	struct litem *li = da_alloc(ctx->arena, sizeof *li);
 	li->type = LITEM_NAME;
-	li->str = strdup(v);
-	ADDARRAY(ctx->atoms, li);
+	li->str = (char *)v;
+	DA_ADDARRAY(ctx->arena, ctx->atoms, li);
 }
 
 void atomcmd_d DPROTO {
-	struct litem *li = makeli(easm_expr_str(EASM_EXPR_LABEL, strdup(v)));
-	ADDARRAY(ctx->atoms, li);
+	struct litem *li = makeli(ctx, dexpr_str(ctx->arena, EASM_EXPR_LABEL, (char *)v));
+	DA_ADDARRAY(ctx->arena, ctx->atoms, li);
 }
 
 void atomunk_d DPROTO {
-	struct litem *li = calloc(sizeof *li, 1);
+	struct litem *li = da_alloc(ctx->arena, sizeof *li);
 	li->type = LITEM_NAME;
-	li->str = strdup(v);
+	li->str = (char *)v;
 	li->isunk = 1;
-	ADDARRAY(ctx->atoms, li);
+	DA_ADDARRAY(ctx->arena, ctx->atoms, li);
 }
 
 void atomimm_d DPROTO {
 	const struct bitfield *bf = v;
-	struct easm_expr *expr = easm_expr_num(EASM_EXPR_NUM, GETBF(bf));
-	ADDARRAY(ctx->atoms, makeli(expr));
+	struct easm_expr *expr = dexpr_num(ctx->arena, EASM_EXPR_NUM, GETBF(bf));
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 void atomrimm_d DPROTO {
 	const struct rbitfield *bf = v;
 	struct easm_expr *expr = GETRBF(bf);
-	ADDARRAY(ctx->atoms, makeli(expr));
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 void atomctarg_d DPROTO {
 	const struct rbitfield *bf = v;
 	struct easm_expr *expr = GETRBF(bf);
 	expr->special = EASM_SPEC_CTARG;
-	ADDARRAY(ctx->atoms, makeli(expr));
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 void atombtarg_d DPROTO {
 	const struct rbitfield *bf = v;
 	struct easm_expr *expr = GETRBF(bf);
 	expr->special = EASM_SPEC_BTARG;
-	ADDARRAY(ctx->atoms, makeli(expr));
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 void atomign_d DPROTO {
@@ -228,15 +703,15 @@ static struct easm_expr *printreg (struct disctx *ctx, ull *a, ull *m, const str
 			if (num == reg->specials[i].num) {
 				switch (reg->specials[i].mode) {
 					case SR_NAMED:
-						expr = easm_expr_str(EASM_EXPR_REG, strdup(reg->specials[i].name));
+						expr = dexpr_str(ctx->arena, EASM_EXPR_REG, (char *)reg->specials[i].name);
 						expr->special = EASM_SPEC_REGSP;
 						return expr;
 					case SR_ZERO:
 						return 0;
 					case SR_ONE:
-						return easm_expr_num(EASM_EXPR_NUM, 1);
+						return dexpr_num(ctx->arena, EASM_EXPR_NUM, 1);
 					case SR_DISCARD:
-						return easm_expr_simple(EASM_EXPR_DISCARD);
+						return dexpr(ctx->arena, EASM_EXPR_DISCARD);
 				}
 			}
 		}
@@ -253,10 +728,10 @@ static struct easm_expr *printreg (struct disctx *ctx, ull *a, ull *m, const str
 	}
 	char *str;
 	if (reg->bf)
-		str = aprintf("%s%lld%s", reg->name, num, suf);
+		str = da_printf(ctx->arena, "%s%lld%s", reg->name, num, suf);
 	else
-		str = aprintf("%s%s", reg->name, suf);
-	expr = easm_expr_str(EASM_EXPR_REG, str);
+		str = da_printf(ctx->arena, "%s%s", reg->name, suf);
+	expr = dexpr_str(ctx->arena, EASM_EXPR_REG, str);
 	if (reg->cool)
 		expr->special = EASM_SPEC_REGSP;
 	if (reg->always_special)
@@ -267,13 +742,13 @@ static struct easm_expr *printreg (struct disctx *ctx, ull *a, ull *m, const str
 void atomreg_d DPROTO {
 	const struct reg *reg = v;
 	struct easm_expr *expr = printreg(ctx, a, m, reg);
-	if (!expr) expr = easm_expr_num(EASM_EXPR_NUM, 0);
-	ADDARRAY(ctx->atoms, makeli(expr));
+	if (!expr) expr = dexpr_num(ctx->arena, EASM_EXPR_NUM, 0);
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 void atomdiscard_d DPROTO {
-	struct easm_expr *expr = easm_expr_simple(EASM_EXPR_DISCARD);
-	ADDARRAY(ctx->atoms, makeli(expr));
+	struct easm_expr *expr = dexpr(ctx->arena, EASM_EXPR_DISCARD);
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 void atommem_d DPROTO {
@@ -290,7 +765,7 @@ void atommem_d DPROTO {
 			pexpr = imm;
 		} else {
 			if (expr) {
-				expr = easm_expr_bin(EASM_EXPR_ADD, expr, imm);
+				expr = dexpr_bin(ctx->arena, EASM_EXPR_ADD, expr, imm);
 			} else {
 				expr = imm;
 			}
@@ -301,34 +776,34 @@ void atommem_d DPROTO {
 		if (sexpr) {
 			if (mem->reg2shr) {
 				uint64_t num = 1ull << mem->reg2shr;
-				struct easm_expr *ssexpr = easm_expr_num(EASM_EXPR_NUM, num);
-				sexpr = easm_expr_bin(EASM_EXPR_MUL, sexpr, ssexpr);
+				struct easm_expr *ssexpr = dexpr_num(ctx->arena, EASM_EXPR_NUM, num);
+				sexpr = dexpr_bin(ctx->arena, EASM_EXPR_MUL, sexpr, ssexpr);
 			}
 			if (expr)
-				expr = easm_expr_bin(EASM_EXPR_ADD, expr, sexpr);
+				expr = dexpr_bin(ctx->arena, EASM_EXPR_ADD, expr, sexpr);
 			else
 				expr = sexpr;
 		}
 	}
-	if (!expr) expr = easm_expr_num(EASM_EXPR_NUM, 0);
+	if (!expr) expr = dexpr_num(ctx->arena, EASM_EXPR_NUM, 0);
 	if (mem->name) {
 		struct easm_expr *nex;
 		if (pexpr)
-			nex = easm_expr_bin(type, expr, pexpr);
+			nex = dexpr_bin(ctx->arena, type, expr, pexpr);
 		else
-			nex = easm_expr_un(type, expr);
+			nex = dexpr_un(ctx->arena, type, expr);
 		if (mem->idx)
-			nex->str = aprintf("%s%lld", mem->name, GETBF(mem->idx));
+			nex->str = da_printf(ctx->arena, "%s%lld", mem->name, GETBF(mem->idx));
 		else
-			nex->str = strdup(mem->name);
-		nex->mods = calloc(sizeof *nex->mods, 1);
+			nex->str = (char *)mem->name;
+		nex->mods = da_alloc(ctx->arena, sizeof *nex->mods);
 		expr = nex;
 	} else if (type != EASM_EXPR_MEM) {
 		abort();
 	}
 	if (mem->literal && expr->type == EASM_EXPR_MEM)
 		expr->special = EASM_SPEC_LITERAL;
-	ADDARRAY(ctx->atoms, makeli(expr));
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 void atomvec_d DPROTO {
@@ -343,31 +818,31 @@ void atomvec_d DPROTO {
 	for (i = 0; i < cnt; i++) {
 		struct easm_expr *sexpr;
 		if (mask & 1ull<<i) {
-			char *name = aprintf("%s%lld", vec->name,  base + k++);
-			sexpr = easm_expr_str(EASM_EXPR_REG, name);
+			char *name = da_printf(ctx->arena, "%s%lld", vec->name,  base + k++);
+			sexpr = dexpr_str(ctx->arena, EASM_EXPR_REG, name);
 			if (vec->cool)
 				sexpr->special = EASM_SPEC_REGSP;
 		} else {
-			sexpr = easm_expr_simple(EASM_EXPR_DISCARD);
+			sexpr = dexpr(ctx->arena, EASM_EXPR_DISCARD);
 		}
 		if (expr)
-			expr = easm_expr_bin(EASM_EXPR_VEC, expr, sexpr);
+			expr = dexpr_bin(ctx->arena, EASM_EXPR_VEC, expr, sexpr);
 		else
 			expr = sexpr;
 	}
 	if (!expr)
-		expr = easm_expr_simple(EASM_EXPR_ZVEC);
-	ADDARRAY(ctx->atoms, makeli(expr));
+		expr = dexpr(ctx->arena, EASM_EXPR_ZVEC);
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 void atombf_d DPROTO {
 	const struct bitfield *bf = v;
 	uint64_t num1 = GETBF(&bf[0]);
 	uint64_t num2 = num1 + GETBF(&bf[1]);
-	struct easm_expr *expr = easm_expr_bin(EASM_EXPR_VEC,
-			easm_expr_num(EASM_EXPR_NUM, num1),
-			easm_expr_num(EASM_EXPR_NUM, num2));
-	ADDARRAY(ctx->atoms, makeli(expr));
+	struct easm_expr *expr = dexpr_bin(ctx->arena, EASM_EXPR_VEC,
+			dexpr_num(ctx->arena, EASM_EXPR_NUM, num1),
+			dexpr_num(ctx->arena, EASM_EXPR_NUM, num2));
+	DA_ADDARRAY(ctx->arena, ctx->atoms, makeli(ctx, expr));
 }
 
 struct dis_op_chunk {
@@ -376,14 +851,7 @@ struct dis_op_chunk {
 };
 
 struct dis_res {
-	enum dis_status {
-		DIS_STATUS_OK = 0,
-		DIS_STATUS_EOF = 0x1,		/* EOF in the middle of an opcode */
-		DIS_STATUS_UNK_FORM = 0x2,	/* failed to determine instruction format - opcode length uncertain */
-		DIS_STATUS_UNK_INSN = 0x4,	/* failed to determine instruction name - unknown opcode or due to one of the above errors */
-		DIS_STATUS_UNK_OPERAND = 0x8,	/* failed to determine instruction operands */
-		DIS_STATUS_UNUSED_BITS = 0x10,	/* instruction decoded, but unused bitfields have non-default values */
-	} status;
+	enum dis_status status;
 	uint32_t oplen;
 	struct dis_op_chunk *chunks;
 	int chunksnum;
@@ -396,13 +864,6 @@ struct dis_res {
 //	uint32_t *umask;
 };
 
-static void dis_del_res(struct dis_res *dres)
-{
-	easm_del_insn(dres->insn);
-
-	free(dres);
-}
-
 static struct easm_sinsn *dis_parse_sinsn(struct disctx *ctx, enum dis_status *status, int *spos);
 
 static struct easm_expr *dis_parse_expr(struct disctx *ctx, enum dis_status *status, int *spos) {
@@ -412,36 +873,37 @@ static struct easm_expr *dis_parse_expr(struct disctx *ctx, enum dis_status *sta
 		return ctx->atoms[(*spos)++]->expr;
 	if (ctx->atoms[(*spos)++]->type != LITEM_SESTART)
 		abort();
-	struct easm_expr *res = easm_expr_sinsn(dis_parse_sinsn(ctx, status, spos));
+	struct easm_expr *res = dexpr(ctx->arena, EASM_EXPR_SINSN);
+	res->sinsn = dis_parse_sinsn(ctx, status, spos);
 	if (ctx->atoms[(*spos)++]->type != LITEM_SEEND)
 		abort();
 	return res;
 }
 
 static struct easm_sinsn *dis_parse_sinsn(struct disctx *ctx, enum dis_status *status, int *spos) {
-	struct easm_sinsn *res = calloc(sizeof *res, 1);
+	struct easm_sinsn *res = da_alloc(ctx->arena, sizeof *res);
 	res->str = ctx->atoms[*spos]->str;
 	res->isunk = ctx->atoms[*spos]->isunk;
 	if (res->isunk)
 		*status |= DIS_STATUS_UNK_INSN;
 	if (ctx->atoms[(*spos)++]->type != LITEM_NAME)
 		abort();
-	struct easm_mods *mods = calloc (sizeof *mods, 1);
+	struct easm_mods *mods = da_alloc(ctx->arena, sizeof *mods);
 	while (*spos < ctx->atomsnum && ctx->atoms[*spos]->type != LITEM_SEEND) {
 		if (ctx->atoms[*spos]->type == LITEM_NAME) {
-			struct easm_mod *mod = calloc(sizeof *mod, 1);
+			struct easm_mod *mod = da_alloc(ctx->arena, sizeof *mod);
 			mod->str = ctx->atoms[*spos]->str;
 			mod->isunk = ctx->atoms[*spos]->isunk;
 			if (mod->isunk)
 				*status |= DIS_STATUS_UNK_OPERAND;
-			ADDARRAY(mods->mods, mod);
+			DA_ADDARRAY(ctx->arena, mods->mods, mod);
 			(*spos)++;
 		} else {
-			struct easm_operand *op = calloc (sizeof *op, 1);
+			struct easm_operand *op = da_alloc(ctx->arena, sizeof *op);
 			op->mods = mods;
-			mods = calloc (sizeof *mods, 1);
-			ADDARRAY(op->exprs, dis_parse_expr(ctx, status, spos));
-			ADDARRAY(res->operands, op);
+			mods = da_alloc(ctx->arena, sizeof *mods);
+			DA_ADDARRAY(ctx->arena, op->exprs, dis_parse_expr(ctx, status, spos));
+			DA_ADDARRAY(ctx->arena, res->operands, op);
 		}
 	}
 	res->mods = mods;
@@ -449,22 +911,77 @@ static struct easm_sinsn *dis_parse_sinsn(struct disctx *ctx, enum dis_status *s
 }
 
 static struct easm_subinsn *dis_parse_subinsn(struct disctx *ctx, enum dis_status *status, int *spos) {
-	struct easm_subinsn *res = calloc(sizeof *res, 1);
+	struct easm_subinsn *res = da_alloc(ctx->arena, sizeof *res);
 	while (ctx->atoms[*spos]->type != LITEM_NAME)
-		ADDARRAY(res->prefs, dis_parse_expr(ctx, status, spos));
+		DA_ADDARRAY(ctx->arena, res->prefs, dis_parse_expr(ctx, status, spos));
 	res->sinsn = dis_parse_sinsn(ctx, status, spos);
 	return res;
 }
 
 static struct easm_insn *dis_parse_insn(struct disctx *ctx, enum dis_status *status) {
 	int spos = 0;
-	struct easm_insn *res = calloc(sizeof *res, 1);
-	ADDARRAY(res->subinsns, dis_parse_subinsn(ctx, status, &spos));
+	struct easm_insn *res = da_alloc(ctx->arena, sizeof *res);
+	DA_ADDARRAY(ctx->arena, res->subinsns, dis_parse_subinsn(ctx, status, &spos));
 	if (spos != ctx->atomsnum)
 		abort();
 	return res;
 }
 
+/*
+ * An instruction as seen by a marking walk.  Only its length and whether it
+ * ends a block are kept, it's decoded again when printed.
+ */
+struct disop {
+	uint32_t pos;
+	uint8_t oplen;
+	uint8_t endmark;
+	/* the marks it made, following those of the chunk's previous ones */
+	uint16_t marksnum;
+};
+
+/* a mark made by an instruction, applied once it's known to be on the path */
+struct dismark {
+	ull ptr;
+	int m;
+};
+
+/* a piece of the code decoded ahead of the walks, see dis_parallel */
+struct dischunk {
+	struct disop *ops;
+	int opsnum;
+	int opsmax;
+	struct dismark *marks;
+	int marksnum;
+	int marksmax;
+	/* the printed instructions, textpos[i] to textpos[i+1] for ops[i] */
+	char *text;
+	size_t textsize;
+	size_t *textpos;
+	int rendered;
+};
+
+/* where a walk is in the chunks */
+struct dischunkpos {
+	int chunk;
+	int op;
+	int mark;
+};
+
+/*
+ * Per-thread decoding state.  Worker 0 is the envydis call itself and uses
+ * its thread's decision tree cache, the others have their own.
+ */
+struct disworker {
+	struct decoctx *ctx;
+	struct disarena arena;
+	struct dtcache **dtcache;
+	struct dtcache *owndtcache;
+	/* the marks of the instruction being decoded */
+	struct dismark *marks;
+	int marksnum;
+	int marksmax;
+};
+
 struct decoctx {
 	const struct disisa *isa;
 	struct varinfo *varinfo;
@@ -476,12 +993,29 @@ struct decoctx {
 	struct label *labels;
 	int labelsnum;
 	int labelsmax;
+	/* the instructions the labelled walk went through, hashed by position */
+	struct disop *ops;
+	int opsnum;
+	int opsmask;
+	const struct envy_colors *cols;
+	struct disworker *workers;
+	int workersnum;
+	struct dischunk *chunks;
+	int chunksnum;
+	/* the next chunk to be decoded or printed by a worker */
+	int chunknext;
+	/* the chunks before this one have been printed and freed */
+	int chunkprinted;
+	pthread_mutex_t chunklock;
+	pthread_cond_t chunkcond;
+	pthread_t *threads;
 };
 
-struct dis_res *do_dis(struct decoctx *deco, uint32_t cur) {
+static struct dis_res *do_dis(struct disworker *w, uint32_t cur) {
+	struct decoctx *deco = w->ctx;
 	struct disctx c = { 0 };
 	struct disctx *ctx = &c;
-	struct dis_res *res = calloc(sizeof *res, 1);
+	struct dis_res *res = da_alloc(&w->arena, sizeof *res);
 	int i;
 	int stride = ed_getcstride(deco->isa, deco->varinfo);
 	for (i = 0; i < MAXOPLEN*8 && cur + i/stride < deco->codesz; i++) {
@@ -489,6 +1023,8 @@ struct dis_res *do_dis(struct decoctx *deco, uint32_t cur) {
 	}
 	ctx->isa = deco->isa;
 	ctx->varinfo = deco->varinfo;
+	ctx->arena = &w->arena;
+	ctx->dtcache = w->dtcache;
 	if (deco->isa->tsched && (cur % deco->isa->schedpos) == 0)
 		atomtab_d (ctx, res->a, res->m, deco->isa->tsched);
 	else
@@ -504,10 +1040,6 @@ struct dis_res *do_dis(struct decoctx *deco, uint32_t cur) {
 	/* XXX unused status */
 	res->insn = dis_parse_insn(ctx, &res->status);
 
-	for (i = 0; i < ctx->atomsnum; ++i)
-		free(ctx->atoms[i]);
-	free(ctx->atoms);
-
 	return res;
 }
 
@@ -517,57 +1049,57 @@ static void mark(struct decoctx *ctx, uint32_t ptr, int m) {
 	ctx->marks[ptr - ctx->codebase] |= m;
 }
 
+static void dis_mark(struct disworker *w, ull ptr, int m) {
+	struct dismark dm = { ptr, m };
+	ADDARRAY(w->marks, dm);
+}
+
 static int is_nr_mark(struct decoctx *ctx, uint32_t ptr) {
 	if (ptr < ctx->codebase || ptr >= ctx->codebase + ctx->codesz)
 		return 0;
 	return ctx->marks[ptr - ctx->codebase] & 0x40;
 }
 
-char *deco_label(struct decoctx *ctx, uint64_t val) {
+static char *deco_label(struct decoctx *ctx, uint64_t val) {
 	int i;
 	for (i = 0; i < ctx->labelsnum; i++)
 		if (ctx->labels[i].val == val && ctx->labels[i].name)
-			return strdup(ctx->labels[i].name);
+			return (char *)ctx->labels[i].name;
 	return 0;
 }
 
-static void dis_pp_sinsn(struct decoctx *deco, struct dis_res *dres, struct easm_sinsn *sinsn, uint64_t pos);
+static void dis_pp_sinsn(struct disworker *w, struct dis_res *dres, struct easm_sinsn *sinsn, uint64_t pos);
 
-static void dis_pp_expr(struct decoctx *deco, struct dis_res *dres, struct easm_expr *expr, uint64_t pos) {
+static void dis_pp_expr(struct disworker *w, struct dis_res *dres, struct easm_expr *expr, uint64_t pos) {
+	struct decoctx *deco = w->ctx;
 	if (expr->e1)
-		dis_pp_expr(deco, dres, expr->e1, pos);
+		dis_pp_expr(w, dres, expr->e1, pos);
 	if (expr->e2)
-		dis_pp_expr(deco, dres, expr->e2, pos);
+		dis_pp_expr(w, dres, expr->e2, pos);
 	if (expr->sinsn)
-		dis_pp_sinsn(deco, dres, expr->sinsn, pos);
+		dis_pp_sinsn(w, dres, expr->sinsn, pos);
 	easm_substpos_expr(expr, pos);
-	if (easm_cfold_expr(expr)) {
+	if (easm_cfold_expr_keep(expr)) {
 		if (expr->special == EASM_SPEC_CTARG) {
-			mark(deco, expr->num, 2);
+			dis_mark(w, expr->num, 2);
 			expr->alabel = deco_label(deco, expr->num);
 			if (is_nr_mark(deco, expr->num))
 				dres->endmark = 1;
 		} else if (expr->special == EASM_SPEC_BTARG) {
-			mark(deco, expr->num, 1);
+			dis_mark(w, expr->num, 1);
 			expr->alabel = deco_label(deco, expr->num);
 		}
 		if (expr->num & 1ull << 63 && !expr->special) {
 			expr->type = EASM_EXPR_NEG;
-			expr->e1 = easm_expr_num(EASM_EXPR_NUM, -expr->num);
+			expr->e1 = dexpr_num(&w->arena, EASM_EXPR_NUM, -expr->num);
 			expr->num = 0;
 		}
 	}
 	if (expr->type == EASM_EXPR_ADD && expr->e1->type == EASM_EXPR_NUM && expr->e1->num == 0) {
-		struct easm_expr *oe2 = expr->e2;
-		free(expr->e1);
-		*expr = *oe2;
-		free(oe2);
+		*expr = *expr->e2;
 	}
 	if ((expr->type == EASM_EXPR_ADD || expr->type == EASM_EXPR_SUB) && expr->e2->type == EASM_EXPR_NUM && expr->e2->num == 0) {
-		struct easm_expr *oe1 = expr->e1;
-		free(expr->e2);
-		*expr = *oe1;
-		free(oe1);
+		*expr = *expr->e1;
 	}
 	if (expr->type == EASM_EXPR_ADD && expr->e2->type == EASM_EXPR_NUM && expr->e2->num & 1ull << 63) {
 		expr->e2->num = -expr->e2->num;
@@ -578,7 +1110,7 @@ static void dis_pp_expr(struct decoctx *deco, struct dis_res *dres, struct easm_
 			expr->special = EASM_SPEC_NONE;
 		} else {
 			ull ptr = expr->e1->num;
-			mark(deco, ptr, 0x10);
+			dis_mark(w, ptr, 0x10);
 			if (ptr < deco->codebase || ptr > deco->codebase + deco->codesz) {
 				expr->special = EASM_SPEC_NONE;
 			} else {
@@ -594,28 +1126,459 @@ static void dis_pp_expr(struct decoctx *deco, struct dis_res *dres, struct easm_
 	}
 }
 
-static void dis_pp_sinsn(struct decoctx *deco, struct dis_res *dres, struct easm_sinsn *sinsn, uint64_t pos) {
+static void dis_pp_sinsn(struct disworker *w, struct dis_res *dres, struct easm_sinsn *sinsn, uint64_t pos) {
 	int i, j;
 	for (i = 0; i < sinsn->operandsnum; i++)
 		for (j = 0; j < sinsn->operands[i]->exprsnum; j++)
-			dis_pp_expr(deco, dres, sinsn->operands[i]->exprs[j], pos);
+			dis_pp_expr(w, dres, sinsn->operands[i]->exprs[j], pos);
 }
 
-static void dis_pp_subinsn(struct decoctx *deco, struct dis_res *dres, struct easm_subinsn *subinsn, uint64_t pos) {
+static void dis_pp_subinsn(struct disworker *w, struct dis_res *dres, struct easm_subinsn *subinsn, uint64_t pos) {
 	int i;
 	for (i = 0; i < subinsn->prefsnum; i++)
-		dis_pp_expr(deco, dres, subinsn->prefs[i], pos);
-	dis_pp_sinsn(deco, dres, subinsn->sinsn, pos);
+		dis_pp_expr(w, dres, subinsn->prefs[i], pos);
+	dis_pp_sinsn(w, dres, subinsn->sinsn, pos);
 }
 
-static void dis_pp_insn(struct decoctx *deco, struct dis_res *dres, struct easm_insn *insn, uint64_t pos) {
+static void dis_pp_insn(struct disworker *w, struct dis_res *dres, struct easm_insn *insn, uint64_t pos) {
 	int i;
 	for (i = 0; i < insn->subinsnsnum; i++)
-		dis_pp_subinsn(deco, dres, insn->subinsns[i], pos);
+		dis_pp_subinsn(w, dres, insn->subinsns[i], pos);
+}
+
+static void dis_dopp(struct disworker *w, struct dis_res *dres, uint64_t pos) {
+	dis_pp_insn(w, dres, dres->insn, pos);
+}
+
+/* decodes and post-processes the instruction at cur */
+static struct dis_res *dis_insn(struct disworker *w, uint32_t cur) {
+	struct dis_res *dres = do_dis(w, cur);
+	int i;
+	dis_dopp(w, dres, cur + w->ctx->codebase);
+	if (!(dres->status & DIS_STATUS_UNK_FORM)) {
+		/* leave just the bits nothing looked at */
+		for (i = dres->oplen; i < MAXOPLEN * 8; i++)
+			dres->a[i/8] &= ~(0xffull << (i & 7) * 8);
+		for (i = 0; i < MAXOPLEN; i++) {
+			dres->a[i] &= ~dres->m[i];
+			if (dres->a[i])
+				dres->status |= DIS_STATUS_UNUSED_BITS;
+		}
+	}
+	return dres;
+}
+
+/* prints the instruction and whatever went wrong decoding it */
+static void dis_print_res(struct decoctx *ctx, FILE *out, const struct envy_colors *cols, struct dis_res *dres, uint32_t cur) {
+	const struct disisa *isa = ctx->isa;
+	int stride = ed_getcstride(ctx->isa, ctx->varinfo);
+	uint32_t num = ctx->codesz;
+	int i, j;
+
+	easm_print_insn(out, cols, dres->insn);
+
+	if (dres->status & DIS_STATUS_UNK_FORM) {
+		fprintf (out, " %s[unknown op length]%s", cols->err, cols->reset);
+	} else if (dres->status & DIS_STATUS_UNUSED_BITS) {
+		fprintf (out, " %s[unknown:", cols->err);
+		for (i = 0; i < dres->oplen || i == 0; i += isa->opunit) {
+			fprintf (out, " ");
+			for (j = isa->opunit*stride - 1; j >= 0; j--)
+				if (cur+i+j >= num)
+					fprintf (out, "??");
+				else
+					fprintf (out, "%02llx", (dres->a[(i+j)/8] >> ((i + j)&7) * 8) & 0xff);
+		}
+		fprintf (out, "]");
+	}
+	if (dres->status & DIS_STATUS_EOF) {
+		fprintf (out, " %s[incomplete]%s", cols->err, cols->reset);
+	}
+	if (dres->status & DIS_STATUS_UNK_INSN) {
+		fprintf (out, " %s[unknown instruction]%s", cols->err, cols->reset);
+	}
+	if (dres->status & DIS_STATUS_UNK_OPERAND) {
+		fprintf (out, " %s[unknown operand]%s", cols->err, cols->reset);
+	}
+	fprintf (out, "%s\n", cols->reset);
+}
+
+/* prints a data word or string marked by a label or a literal load, returns the position after it */
+static uint32_t dis_print_data(struct decoctx *ctx, FILE *out, const struct envy_colors *cols, uint32_t cur, int mark) {
+	const uint8_t *code = ctx->code;
+	uint32_t num = ctx->codesz;
+	int i;
+	if (ed_getcbsz(ctx->isa, ctx->varinfo) != 8)
+		abort();
+	fprintf (out, "%s%08x:%s", cols->mem, cur + ctx->codebase, cols->reset);
+	if (mark & 0x80) {
+		uint8_t val = code[cur];
+		fprintf (out, " %s%02x\n", cols->num, val);
+		cur += 1;
+	} else if (mark & 0x100) {
+		uint16_t val = 0;
+		for (i = 0; i < 2 && cur + i < num; i++) {
+			val |= code[cur + i] << i*8;
+		}
+		fprintf (out, " %s%04x\n", cols->num, val);
+		cur += 2;
+	} else if (mark & 0x10) {
+		uint32_t val = 0;
+		for (i = 0; i < 4 && cur + i < num; i++) {
+			val |= code[cur + i] << i*8;
+		}
+		fprintf (out, " %s%08x\n", cols->num, val);
+		cur += 4;
+	} else {
+		fprintf (out, " %s\"", cols->num);
+		while (code[cur]) {
+			switch (code[cur]) {
+				case '\n':
+					fprintf (out, "\\n");
+					break;
+				case '\\':
+					fprintf (out, "\\\\");
+					break;
+				case '\"':
+					fprintf (out, "\\\"");
+					break;
+				default:
+					fprintf (out, "%c", code[cur]);
+					break;
+			}
+			cur++;
+		}
+		cur++;
+		fprintf (out, "\"\n");
+	}
+	return cur;
+}
+
+/* prints the address, opcode bytes and target columns in front of an instruction */
+static void dis_print_prefix(struct decoctx *ctx, FILE *out, const struct envy_colors *cols, uint32_t cur, uint32_t oplen, int mark, int quiet) {
+	const struct disisa *isa = ctx->isa;
+	const uint8_t *code = ctx->code;
+	uint32_t start = ctx->codebase;
+	uint32_t num = ctx->codesz;
+	int stride = ed_getcstride(isa, ctx->varinfo);
+	int i, j;
+	switch (mark & 3) {
+		case 0:
+			if (!quiet)
+				fprintf (out, "%s%08x:%s", cols->reset, cur + start, cols->reset);
+			break;
+		case 1:
+			fprintf (out, "%s%08x:%s", cols->btarg, cur + start, cols->reset);
+			break;
+		case 2:
+			fprintf (out, "%s%08x:%s", cols->ctarg, cur + start, cols->reset);
+			break;
+		case 3:
+			fprintf (out, "%s%08x:%s", cols->bctarg, cur + start, cols->reset);
+			break;
+	}
+
+	if (!quiet) {
+		for (i = 0; i < isa->maxoplen; i += isa->opunit) {
+			fprintf (out, " ");
+			for (j = isa->opunit*stride - 1; j >= 0; j--)
+				if (i+j/stride && i+j/stride >= oplen) {
+					fprintf (out, "  ");
+				} else if (cur+i+j/stride >= num) {
+					fprintf (out, "%s??", cols->err);
+				} else {
+					fprintf (out, "%s%02x", cols->reset, code[(cur + i)*stride + j]);
+				}
+		}
+		fprintf (out, "  ");
+
+		if (mark & 2)
+			fprintf (out, "%sC", cols->ctarg);
+		else
+			fprintf (out, " ");
+		if (mark & 1)
+			fprintf (out, "%sB", cols->btarg);
+		else
+			fprintf (out, " ");
+		fprintf(out, " ");
+	} else if (quiet == 1) {
+		if (mark)
+			fprintf (out, "\n");
+	}
+}
+
+static void dis_apply_marks(struct decoctx *ctx, const struct dismark *dm, int num) {
+	int i;
+	for (i = 0; i < num; i++)
+		mark(ctx, dm[i].ptr, dm[i].m);
+}
+
+/* decodes the instruction at cur for a marking walk and applies its marks */
+static void dis_markop(struct disworker *w, uint32_t cur, struct disop *op) {
+	struct dis_res *dres;
+	w->marksnum = 0;
+	dres = dis_insn(w, cur);
+	dis_apply_marks(w->ctx, w->marks, w->marksnum);
+	op->pos = cur;
+	op->oplen = dres->oplen;
+	op->endmark = dres->endmark;
+	da_reset(&w->arena);
+}
+
+/*
+ * Returns the instruction at cur for the labelled walk, which goes over the
+ * code as many times as it takes to find everything reachable.  Only the
+ * first time round is it decoded and marked, the walk keeps just the
+ * instructions it has been through.
+ */
+static struct disop dis_labelled_op(struct decoctx *ctx, uint32_t cur) {
+	struct disop *op;
+	uint32_t i;
+	if (ctx->ops) {
+		for (i = dt_hash(cur); (op = &ctx->ops[i & ctx->opsmask])->oplen; i++)
+			if (op->pos == cur)
+				return *op;
+	}
+	if (ctx->opsnum * 2 >= ctx->opsmask) {
+		struct disop *old = ctx->ops;
+		int oldsize = old ? ctx->opsmask + 1 : 0, j;
+		ctx->opsmask = oldsize ? oldsize * 2 - 1 : 255;
+		ctx->ops = calloc(sizeof *ctx->ops, ctx->opsmask + 1);
+		for (j = 0; j < oldsize; j++) {
+			if (!old[j].oplen)
+				continue;
+			for (i = dt_hash(old[j].pos); ctx->ops[i & ctx->opsmask].oplen; i++);
+			ctx->ops[i & ctx->opsmask] = old[j];
+		}
+		free(old);
+	}
+	for (i = dt_hash(cur); ctx->ops[i & ctx->opsmask].oplen; i++);
+	op = &ctx->ops[i & ctx->opsmask];
+	dis_markop(&ctx->workers[0], cur, op);
+	ctx->opsnum++;
+	return *op;
+}
+
+/*
+ * Parallel decoding, for input without labels.  The code is cut into
+ * chunks, aligned well enough for any ISA's instruction and scheduling
+ * blocks, and the threads decode them speculatively, each starting at its
+ * chunk's start.  Only the lengths and the marks are kept.  The marking walk
+ * afterwards goes through the code in order as usual, and uses whatever was
+ * decoded at the right offset.  Where a chunk was started off an
+ * instruction boundary, which only happens with variable length ISAs, the
+ * walk decodes the few instructions it takes to get back in step.
+ *
+ * Then the threads print the chunks, a few ahead of the printing walk, and
+ * the walk frees each chunk once past it.
+ */
+
+#define DIS_CHUNK 0x4000
+/* how many chunks each thread may print ahead of the printing walk */
+#define DIS_AHEAD 4
+
+static void dis_decode_chunk(struct disworker *w, struct dischunk *ch, uint32_t start) {
+	struct decoctx *ctx = w->ctx;
+	struct dis_res *dres;
+	struct disop op;
+	uint32_t cur;
+	int i;
+	for (cur = start; cur < start + DIS_CHUNK && cur < ctx->codesz; cur += op.oplen) {
+		w->marksnum = 0;
+		dres = dis_insn(w, cur);
+		op.pos = cur;
+		op.oplen = dres->oplen;
+		op.endmark = dres->endmark;
+		op.marksnum = w->marksnum;
+		ADDARRAY(ch->ops, op);
+		for (i = 0; i < w->marksnum; i++)
+			ADDARRAY(ch->marks, w->marks[i]);
+		da_reset(&w->arena);
+	}
+}
+
+static void dis_render_chunk(struct disworker *w, struct dischunk *ch) {
+	struct decoctx *ctx = w->ctx;
+	FILE *text = open_memstream(&ch->text, &ch->textsize);
+	int i;
+	ch->textpos = malloc((ch->opsnum + 1) * sizeof *ch->textpos);
+	for (i = 0; i < ch->opsnum; i++) {
+		ch->textpos[i] = ftell(text);
+		w->marksnum = 0;
+		dis_print_res(ctx, text, ctx->cols, dis_insn(w, ch->ops[i].pos), ch->ops[i].pos);
+		da_reset(&w->arena);
+	}
+	ch->textpos[i] = ftell(text);
+	fclose(text);
+}
+
+static void dis_free_chunk(struct dischunk *ch) {
+	free(ch->ops);
+	free(ch->marks);
+	free(ch->text);
+	free(ch->textpos);
+	memset(ch, 0, sizeof *ch);
+}
+
+static void *dis_decode_worker(void *arg) {
+	struct disworker *w = arg;
+	struct decoctx *ctx = w->ctx;
+	int c;
+	while (1) {
+		pthread_mutex_lock(&ctx->chunklock);
+		c = ctx->chunknext;
+		if (c < ctx->chunksnum)
+			ctx->chunknext++;
+		pthread_mutex_unlock(&ctx->chunklock);
+		if (c >= ctx->chunksnum)
+			return 0;
+		dis_decode_chunk(w, &ctx->chunks[c], c * DIS_CHUNK);
+	}
+}
+
+static void *dis_render_worker(void *arg) {
+	struct disworker *w = arg;
+	struct decoctx *ctx = w->ctx;
+	int c;
+	while (1) {
+		pthread_mutex_lock(&ctx->chunklock);
+		while (ctx->chunknext < ctx->chunksnum && ctx->chunknext >= ctx->chunkprinted + DIS_AHEAD * ctx->workersnum)
+			pthread_cond_wait(&ctx->chunkcond, &ctx->chunklock);
+		c = ctx->chunknext;
+		if (c < ctx->chunksnum)
+			ctx->chunknext++;
+		pthread_mutex_unlock(&ctx->chunklock);
+		if (c >= ctx->chunksnum)
+			return 0;
+		dis_render_chunk(w, &ctx->chunks[c]);
+		pthread_mutex_lock(&ctx->chunklock);
+		ctx->chunks[c].rendered = 1;
+		pthread_cond_broadcast(&ctx->chunkcond);
+		pthread_mutex_unlock(&ctx->chunklock);
+	}
+}
+
+/* decodes all chunks, on the calling thread too */
+static void dis_parallel(struct decoctx *ctx) {
+	int i, started;
+	ctx->chunksnum = CEILDIV(ctx->codesz, DIS_CHUNK);
+	ctx->chunks = calloc(ctx->chunksnum, sizeof *ctx->chunks);
+	ctx->threads = calloc(ctx->workersnum, sizeof *ctx->threads);
+	pthread_mutex_init(&ctx->chunklock, 0);
+	pthread_cond_init(&ctx->chunkcond, 0);
+	for (started = 1; started < ctx->workersnum; started++)
+		if (pthread_create(&ctx->threads[started], 0, dis_decode_worker, &ctx->workers[started]))
+			break;
+	dis_decode_worker(&ctx->workers[0]);
+	for (i = 1; i < started; i++)
+		pthread_join(ctx->threads[i], 0);
+}
+
+/* starts the threads printing the chunks, the calling thread is the walk */
+static void dis_render_start(struct decoctx *ctx) {
+	int i, started;
+	ctx->chunknext = 0;
+	for (started = 1; started < ctx->workersnum; started++)
+		if (pthread_create(&ctx->threads[started], 0, dis_render_worker, &ctx->workers[started]))
+			break;
+	ctx->workersnum = started;
+	if (started == 1) {
+		/* no one to print them, the walk decodes everything itself */
+		for (i = 0; i < ctx->chunksnum; i++)
+			dis_free_chunk(&ctx->chunks[i]);
+		free(ctx->chunks);
+		ctx->chunks = 0;
+	}
+}
+
+/* frees the chunks before c, once their threads are done with them */
+static void dis_release_chunks(struct decoctx *ctx, int c) {
+	pthread_mutex_lock(&ctx->chunklock);
+	while (ctx->chunkprinted < c) {
+		while (!ctx->chunks[ctx->chunkprinted].rendered)
+			pthread_cond_wait(&ctx->chunkcond, &ctx->chunklock);
+		dis_free_chunk(&ctx->chunks[ctx->chunkprinted++]);
+	}
+	pthread_cond_broadcast(&ctx->chunkcond);
+	pthread_mutex_unlock(&ctx->chunklock);
+}
+
+static void dis_render_finish(struct decoctx *ctx) {
+	int i;
+	if (ctx->chunks) {
+		dis_release_chunks(ctx, ctx->chunksnum);
+		for (i = 1; i < ctx->workersnum; i++)
+			pthread_join(ctx->threads[i], 0);
+		free(ctx->chunks);
+	}
+	if (ctx->threads) {
+		pthread_cond_destroy(&ctx->chunkcond);
+		pthread_mutex_destroy(&ctx->chunklock);
+		free(ctx->threads);
+	}
+}
+
+/* returns the instruction a chunk has at cur, if it was decoded at the right offset */
+static struct disop *dis_chunk_op(struct decoctx *ctx, struct dischunkpos *cp, uint32_t cur) {
+	struct dischunk *ch;
+	if (cur / DIS_CHUNK != cp->chunk) {
+		cp->chunk = cur / DIS_CHUNK;
+		cp->op = 0;
+		cp->mark = 0;
+	}
+	ch = &ctx->chunks[cp->chunk];
+	while (cp->op < ch->opsnum && ch->ops[cp->op].pos < cur)
+		cp->mark += ch->ops[cp->op++].marksnum;
+	if (cp->op < ch->opsnum && ch->ops[cp->op].pos == cur)
+		return &ch->ops[cp->op];
+	return 0;
+}
+
+/* the marking walk without labels, which goes through everything in order */
+static void dis_next_op(struct decoctx *ctx, struct dischunkpos *cp, uint32_t cur, struct disop *op) {
+	struct disop *cop = ctx->chunks ? dis_chunk_op(ctx, cp, cur) : 0;
+	if (cop) {
+		dis_apply_marks(ctx, ctx->chunks[cp->chunk].marks + cp->mark, cop->marksnum);
+		*op = *cop;
+	} else {
+		dis_markop(&ctx->workers[0], cur, op);
+	}
 }
 
-void dis_dopp(struct decoctx *deco, struct dis_res *dres, uint64_t pos) {
-	dis_pp_insn(deco, dres, dres->insn, pos);
+/*
+ * Gets the instruction at cur ready for the printing walk and applies its
+ * marks.  If a thread has printed it already, its text is returned,
+ * otherwise it's decoded here and the caller prints the result.
+ */
+static struct dis_res *dis_print_op(struct decoctx *ctx, struct dischunkpos *cp, uint32_t cur, struct disop *op, const char **text, size_t *textlen) {
+	struct disworker *w = &ctx->workers[0];
+	struct dis_res *dres;
+	if (ctx->chunks) {
+		struct dischunk *ch = &ctx->chunks[cur / DIS_CHUNK];
+		struct disop *cop;
+		if (cur / DIS_CHUNK != cp->chunk) {
+			dis_release_chunks(ctx, cur / DIS_CHUNK);
+			pthread_mutex_lock(&ctx->chunklock);
+			while (!ch->rendered)
+				pthread_cond_wait(&ctx->chunkcond, &ctx->chunklock);
+			pthread_mutex_unlock(&ctx->chunklock);
+		}
+		cop = dis_chunk_op(ctx, cp, cur);
+		if (cop) {
+			dis_apply_marks(ctx, ch->marks + cp->mark, cop->marksnum);
+			*op = *cop;
+			*text = ch->text + ch->textpos[cp->op];
+			*textlen = ch->textpos[cp->op + 1] - ch->textpos[cp->op];
+			return 0;
+		}
+	}
+	w->marksnum = 0;
+	dres = dis_insn(w, cur);
+	dis_apply_marks(ctx, w->marks, w->marksnum);
+	op->pos = cur;
+	op->oplen = dres->oplen;
+	op->endmark = dres->endmark;
+	return dres;
 }
 
 /*
@@ -626,6 +1589,11 @@ void dis_dopp(struct decoctx *deco, struct dis_res *dres, uint64_t pos) {
  */
 
 void envydis (const struct disisa *isa, FILE *out, uint8_t *code, uint32_t start, int num, struct varinfo *varinfo, int quiet, struct label *labels, int labelsnum, const struct envy_colors *cols)
+{
+	envydis_threads(isa, out, code, start, num, varinfo, quiet, labels, labelsnum, cols, 1);
+}
+
+void envydis_threads (const struct disisa *isa, FILE *out, uint8_t *code, uint32_t start, int num, struct varinfo *varinfo, int quiet, struct label *labels, int labelsnum, const struct envy_colors *cols, int threads)
 {
 	struct decoctx c = { 0 };
 	struct decoctx *ctx = &c;
@@ -639,8 +1607,26 @@ void envydis (const struct disisa *isa, FILE *out, uint8_t *code, uint32_t start
 	ctx->isa = isa;
 	ctx->labels = labels;
 	ctx->labelsnum = labelsnum;
+	ctx->cols = cols;
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	/* with labels, only the code reachable from them is decoded */
+	if (labels)
+		threads = 1;
+	if (threads > CEILDIV(num, DIS_CHUNK))
+		threads = CEILDIV(num, DIS_CHUNK);
+	if (threads < 1)
+		threads = 1;
+	ctx->workers = calloc(threads, sizeof *ctx->workers);
+	ctx->workersnum = threads;
+	for (i = 0; i < threads; i++) {
+		struct disworker *w = &ctx->workers[i];
+		w->ctx = ctx;
+		w->dtcache = i ? &w->owndtcache : dt_threadcache(isa);
+	}
+	if (threads > 1)
+		dis_parallel(ctx);
 	int stride = ed_getcstride(ctx->isa, ctx->varinfo);
-	int cbsz = ed_getcbsz(ctx->isa, ctx->varinfo);
 	if (labels) {
 		for (i = 0; i < labelsnum; i++) {
 			mark(ctx, labels[i].val, labels[i].type);
@@ -665,29 +1651,28 @@ void envydis (const struct disisa *isa, FILE *out, uint8_t *code, uint32_t start
 					ctx->marks[cur] |= 8;
 				}
 				if (active) {
-					struct dis_res *dres = do_dis(ctx, cur);
-					dis_dopp(ctx, dres, cur + start);
-					if (dres->oplen && !dres->endmark && !(ctx->marks[cur] & 4))
-						cur += dres->oplen;
+					struct disop op = dis_labelled_op(ctx, cur);
+					if (!op.endmark && !(ctx->marks[cur] & 4))
+						cur += op.oplen;
 					else
 						active = 0;
-					dis_del_res(dres);
 				} else {
 					cur++;
 				}
 			}
 		} while (!done);
+		free(ctx->ops);
 	} else {
+		struct dischunkpos cp = { -1 };
 		while (cur < num) {
-			struct dis_res *dres = do_dis(ctx, cur);
-			dis_dopp(ctx, dres, cur + start);
-			if (dres->oplen)
-				cur += dres->oplen;
-			else
-				cur++;
-			dis_del_res(dres);
+			struct disop op;
+			dis_next_op(ctx, &cp, cur, &op);
+			cur += op.oplen;
 		}
 	}
+	if (ctx->chunks)
+		dis_render_start(ctx);
+	struct dischunkpos cp = { -1 };
 	cur = 0;
 	int active = 0;
 	int skip = 0, nonzero = 0;
@@ -720,49 +1705,7 @@ void envydis (const struct disisa *isa, FILE *out, uint8_t *code, uint32_t start
 				skip = 0;
 				nonzero = 0;
 			}
-			if (cbsz != 8)
-				abort();
-			fprintf (out, "%s%08x:%s", cols->mem, cur + start, cols->reset);
-			if (mark & 0x80) {
-				uint8_t val = code[cur];
-				fprintf (out, " %s%02x\n", cols->num, val);
-				cur += 1;
-			} else if (mark & 0x100) {
-				uint16_t val = 0;
-				for (i = 0; i < 2 && cur + i < num; i++) {
-					val |= code[cur + i] << i*8;
-				}
-				fprintf (out, " %s%04x\n", cols->num, val);
-				cur += 2;
-			} else if (mark & 0x10) {
-				uint32_t val = 0;
-				for (i = 0; i < 4 && cur + i < num; i++) {
-					val |= code[cur + i] << i*8;
-				}
-				fprintf (out, " %s%08x\n", cols->num, val);
-				cur += 4;
-			} else {
-				fprintf (out, " %s\"", cols->num);
-				while (code[cur]) {
-					switch (code[cur]) {
-						case '\n':
-							fprintf (out, "\\n");
-							break;
-						case '\\':
-							fprintf (out, "\\\\");
-							break;
-						case '\"':
-							fprintf (out, "\\\"");
-							break;
-						default:
-							fprintf (out, "%c", code[cur]);
-							break;
-					}
-					cur++;
-				}
-				cur++;
-				fprintf (out, "\"\n");
-			}
+			cur = dis_print_data(ctx, out, cols, cur, mark);
 			continue;
 		}
 		if (!active && mark & 7)
@@ -783,98 +1726,159 @@ void envydis (const struct disisa *isa, FILE *out, uint8_t *code, uint32_t start
 			skip = 0;
 			nonzero = 0;
 		}
-		struct dis_res *dres = do_dis(ctx, cur);
-		dis_dopp(ctx, dres, cur + start);
+		struct disop op;
+		const char *text = 0;
+		size_t textlen = 0;
+		struct dis_res *dres = dis_print_op(ctx, &cp, cur, &op, &text, &textlen);
 
-		if (dres->endmark || mark & 4)
+		if (op.endmark || mark & 4)
 			active = 0;
 
 		if (mark & 2 && !ctx->names[cur])
 			fprintf (out, "\n");
-		switch (mark & 3) {
-			case 0:
-				if (!quiet)
-					fprintf (out, "%s%08x:%s", cols->reset, cur + start, cols->reset);
-				break;
-			case 1:
-				fprintf (out, "%s%08x:%s", cols->btarg, cur + start, cols->reset);
-				break;
-			case 2:
-				fprintf (out, "%s%08x:%s", cols->ctarg, cur + start, cols->reset);
-				break;
-			case 3:
-				fprintf (out, "%s%08x:%s", cols->bctarg, cur + start, cols->reset);
-				break;
-		}
-
-		if (!quiet) {
-			for (i = 0; i < isa->maxoplen; i += isa->opunit) {
-				fprintf (out, " ");
-				for (j = isa->opunit*stride - 1; j >= 0; j--)
-					if (i+j/stride && i+j/stride >= dres->oplen) {
-						fprintf (out, "  ");
-					} else if (cur+i+j/stride >= num) {
-						fprintf (out, "%s??", cols->err);
-					} else {
-						fprintf (out, "%s%02x", cols->reset, code[(cur + i)*stride + j]);
-					}
-			}
-			fprintf (out, "  ");
+		dis_print_prefix(ctx, out, cols, cur, op.oplen, mark, quiet);
 
-			if (mark & 2)
-				fprintf (out, "%sC", cols->ctarg);
-			else
-				fprintf (out, " ");
-			if (mark & 1)
-				fprintf (out, "%sB", cols->btarg);
-			else
-				fprintf (out, " ");
-			fprintf(out, " ");
-		} else if (quiet == 1) {
-			if (mark)
-				fprintf (out, "\n");
+		if (dres) {
+			dis_print_res(ctx, out, cols, dres, cur);
+			da_reset(&ctx->workers[0].arena);
+		} else {
+			fwrite(text, 1, textlen, out);
 		}
+		cur += op.oplen;
+	}
+	dis_render_finish(ctx);
+	for (i = 0; i < threads; i++) {
+		struct disworker *w = &ctx->workers[i];
+		da_free(&w->arena);
+		free(w->marks);
+		dt_freedc(w->owndtcache);
+	}
+	free(ctx->workers);
+	free(ctx->marks);
+	free(ctx->names);
+}
 
-		easm_print_insn(out, cols, dres->insn);
+/*
+ * Instruction-level interface.  Uses the same decoding as envydis, just
+ * one instruction at a time and with the marks reported as targets.
+ */
 
-		if (dres->status & DIS_STATUS_UNK_FORM) {
-			fprintf (out, " %s[unknown op length]%s", cols->err, cols->reset);
-		} else {
-			int fl = 0;
-			for (i = dres->oplen; i < MAXOPLEN * 8; i++)
-				dres->a[i/8] &= ~(0xffull << (i & 7) * 8);
-			for (i = 0; i < MAXOPLEN; i++) {
-				dres->a[i] &= ~dres->m[i];
-				if (dres->a[i])
-					fl = 1;
-			}
-			if (fl) {
-				fprintf (out, " %s[unknown:", cols->err);
-				for (i = 0; i < dres->oplen || i == 0; i += isa->opunit) {
-					fprintf (out, " ");
-					for (j = isa->opunit*stride - 1; j >= 0; j--)
-						if (cur+i+j >= num)
-							fprintf (out, "??");
-						else
-							fprintf (out, "%02llx", (dres->a[(i+j)/8] >> ((i + j)&7) * 8) & 0xff);
-				}
-				fprintf (out, "]");
-			}
-		}
-		if (dres->status & DIS_STATUS_EOF) {
-			fprintf (out, " %s[incomplete]%s", cols->err, cols->reset);
-		}
-		if (dres->status & DIS_STATUS_UNK_INSN) {
-			fprintf (out, " %s[unknown instruction]%s", cols->err, cols->reset);
+struct ed_dis {
+	struct decoctx ctx;
+	struct disworker w;
+	uint32_t cur;
+	/* the last instruction returned */
+	struct dis_res *dres;
+	uint32_t dcur;
+	struct ed_insn insn;
+	struct ed_target *targets;
+	int targetsnum;
+	int targetsmax;
+};
+
+struct ed_dis *ed_dis_new(const struct disisa *isa, struct varinfo *varinfo, const uint8_t *code, uint32_t start, int num, const struct label *labels, int labelsnum) {
+	struct ed_dis *dis = calloc(sizeof *dis, 1);
+	struct decoctx *ctx = &dis->ctx;
+	int i;
+	ctx->isa = isa;
+	ctx->varinfo = varinfo;
+	ctx->code = (uint8_t *)code;
+	ctx->codebase = start;
+	ctx->codesz = num;
+	ctx->labels = (struct label *)labels;
+	ctx->labelsnum = labelsnum;
+	ctx->marks = calloc(num, sizeof *ctx->marks);
+	ctx->workers = &dis->w;
+	ctx->workersnum = 1;
+	dis->w.ctx = ctx;
+	dis->w.dtcache = &dis->w.owndtcache;
+	for (i = 0; i < labelsnum; i++)
+		mark(ctx, labels[i].val, labels[i].type);
+	return dis;
+}
+
+const struct ed_insn *ed_dis_next(struct ed_dis *dis) {
+	struct decoctx *ctx = &dis->ctx;
+	struct disworker *w = &dis->w;
+	struct ed_insn *insn = &dis->insn;
+	int i;
+	if (dis->cur >= ctx->codesz)
+		return 0;
+	da_reset(&w->arena);
+	w->marksnum = 0;
+	dis->targetsnum = 0;
+	dis->dres = dis_insn(w, dis->cur);
+	dis->dcur = dis->cur;
+	for (i = 0; i < w->marksnum; i++) {
+		if (w->marks[i].m & 3) {
+			struct ed_target t = { w->marks[i].ptr, w->marks[i].m };
+			ADDARRAY(dis->targets, t);
 		}
-		if (dres->status & DIS_STATUS_UNK_OPERAND) {
-			fprintf (out, " %s[unknown operand]%s", cols->err, cols->reset);
+	}
+	insn->pos = dis->cur + ctx->codebase;
+	insn->len = dis->dres->oplen;
+	insn->status = dis->dres->status;
+	insn->name = dis->dres->insn->subinsns[0]->sinsn->str;
+	insn->insn = dis->dres->insn;
+	insn->targets = dis->targets;
+	insn->targetsnum = dis->targetsnum;
+	insn->endmark = dis->dres->endmark;
+	dis->cur += dis->dres->oplen;
+	return insn;
+}
+
+void ed_dis_print(struct ed_dis *dis, FILE *out, const struct envy_colors *cols) {
+	if (dis->dres)
+		dis_print_res(&dis->ctx, out, cols, dis->dres, dis->dcur);
+}
+
+void ed_dis_free(struct ed_dis *dis) {
+	da_free(&dis->w.arena);
+	free(dis->w.marks);
+	dt_freedc(dis->w.owndtcache);
+	free(dis->targets);
+	free(dis->ctx.marks);
+	free(dis);
+}
+
+/*
+ * Prints the same listing envydis gives for code without labels, going
+ * through it once to find the branch and call targets and then again to
+ * print it.
+ */
+void ed_dis_listing(const struct disisa *isa, struct varinfo *varinfo, FILE *out, const uint8_t *code, uint32_t start, int num, const struct envy_colors *cols) {
+	struct ed_dis *dis = ed_dis_new(isa, varinfo, code, start, num, 0, 0);
+	struct decoctx *ctx = &dis->ctx;
+	struct disworker *w = &dis->w;
+	struct dis_res *dres;
+	uint32_t cur;
+	int active = 0;
+	for (cur = 0; cur < num; cur += dres->oplen) {
+		w->marksnum = 0;
+		dres = dis_insn(w, cur);
+		dis_apply_marks(ctx, w->marks, w->marksnum);
+		da_reset(&w->arena);
+	}
+	cur = 0;
+	while (cur < num) {
+		int mark = ctx->marks[cur];
+		if (mark & 0x1b0 && !active) {
+			cur = dis_print_data(ctx, out, cols, cur, mark);
+			continue;
 		}
-		fprintf (out, "%s\n", cols->reset);
+		if (mark & 7)
+			active = 1;
+		w->marksnum = 0;
+		dres = dis_insn(w, cur);
+		dis_apply_marks(ctx, w->marks, w->marksnum);
+		if (dres->endmark || mark & 4)
+			active = 0;
+		if (mark & 2)
+			fprintf (out, "\n");
+		dis_print_prefix(ctx, out, cols, cur, dres->oplen, mark, 0);
+		dis_print_res(ctx, out, cols, dres, cur);
 		cur += dres->oplen;
-
-		dis_del_res(dres);
+		da_reset(&w->arena);
 	}
-	free(ctx->marks);
-	free(ctx->names);
+	ed_dis_free(dis);
 }
@@ -80,6 +80,7 @@ void ed_freeisa(const struct disisa *isa) {
 	if (!isa->prepdone)
 		return;
 	vardata_del(isa->vardata);
+	dt_freecache((struct disisa *)isa);
 	((struct disisa *)isa)->prepdone = 0;
 }
 
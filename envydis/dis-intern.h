@@ -40,7 +40,9 @@
  * Each table is scanned linearly until a matching entry is found, then all
  * ops in this entry are executed. Length of a table is not checked, so they
  * need either a terminator showing '???' for unknown stuff, or match all
- * possible values.
+ * possible values. The disassembler actually walks decision trees built
+ * from the tables (see core-dis.c), but the result is the same as that of
+ * the linear scan.
  *
  * A single op is supposed to decode some field of the instruction and print
  * it. In the table, an op is just a function pointer plus a void* that gets
@@ -221,6 +223,7 @@ struct litem {
 #define T(x) atomtab_a, atomtab_d, tab ## x
 struct matches *atomtab_a APROTO;
 void atomtab_d DPROTO;
+void dt_freecache(struct disisa *isa);
 
 #define OP1B atomopl_a, atomopl_d, op1blen
 #define OP2B atomopl_a, atomopl_d, op2blen
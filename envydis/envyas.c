@@ -50,12 +50,25 @@
  * Refer to docs/envydis/index.rst for ISA details
  */
 
+/* what an instruction was last resolved with, so that it's only redone
+ * when its encoding, position or one of its relocation labels changes */
+struct asinsn {
+	const struct match *m;
+	ull pos;
+	ull val[MAXOPLEN];
+	int *deps;
+	int depsnum;
+	int depsmax;
+};
+
 struct asctx {
 	const struct disisa *isa;
 	struct varinfo *varinfo;
 	struct label *labels;
 	int labelsnum;
 	int labelsmax;
+	/* per label, whether the last layout pass changed its value */
+	char *lmoved;
 	struct symtab *symtab;
 	const char *cur_global_label;
 	uint32_t pos;
@@ -63,6 +76,7 @@ struct asctx {
 	int sectionsnum;
 	int sectionsmax;
 	struct matches *im;
+	struct asinsn *ai;
 };
 
 enum envyas_ofmt {
@@ -259,26 +273,171 @@ int envyas_process(struct asctx *ctx, struct easm_file *file) {
 	return 0;
 }
 
+static void adddeps(struct asctx *ctx, struct asinsn *ai, const struct easm_expr *expr) {
+	int res;
+	if (expr->type == EASM_EXPR_LABEL) {
+		if (symtab_get(ctx->symtab, expr->str, 0, &res) != -1)
+			ADDARRAY(ai->deps, res);
+		return;
+	}
+	if (expr->e1)
+		adddeps(ctx, ai, expr->e1);
+	if (expr->e2)
+		adddeps(ctx, ai, expr->e2);
+}
+
+static int insn_moved(struct asctx *ctx, struct asinsn *ai, const struct match *m, ull pos) {
+	int i;
+	if (ai->m != m || ai->pos != pos)
+		return 1;
+	for (i = 0; i < ai->depsnum; i++)
+		if (ctx->lmoved[ai->deps[i]])
+			return 1;
+	return 0;
+}
+
+/*
+ * Walks the file with the current encoding choices.  Without wren, resolves
+ * the instructions that moved, falling back to the next encoding for those
+ * that no longer fit and clearing *allok.  With wren, emits the code.
+ */
+static int envyas_place(struct asctx *ctx, struct easm_file *file, int wren, int *allok) {
+	int i, j;
+	int stride = ed_getcstride(ctx->isa, ctx->varinfo);
+	int cursect = 0;
+	ctx->cur_global_label = NULL;
+	for (j = 0; j < ctx->sectionsnum; j++)
+		ctx->sections[j].pos = 0;
+	for (i = 0; i < file->linesnum; i++) {
+		struct easm_directive *direct = file->lines[i]->directive;
+		struct section *sect = &ctx->sections[cursect];
+		switch (file->lines[i]->type) {
+			case EASM_LINE_INSN: {
+				struct asinsn *ai = &ctx->ai[i];
+				const struct match *m = &ctx->im[i].m[0];
+				ull pos = sect->pos / stride + sect->base;
+				if (!wren && insn_moved(ctx, ai, m, pos)) {
+					if (!resolve(ctx, ai->val, *m, pos)) {
+						sect->pos += m->oplen * stride;
+						ctx->im[i].m++;
+						ctx->im[i].mnum--;
+						if (!ctx->im[i].mnum) {
+							fprintf (stderr, LOC_FORMAT(file->lines[i]->loc, "Relocation failed\n"));
+							return 1;
+						}
+						*allok = 0;
+						break;
+					}
+					ai->m = m;
+					ai->pos = pos;
+					ai->depsnum = 0;
+					for (j = 0; j < m->nrelocs; j++)
+						adddeps(ctx, ai, m->relocs[j].expr);
+				}
+				if (ctx->isa->i_need_g80as_hack) {
+					if (m->oplen == 8 && (sect->pos & 7)) {
+						j = i - 1;
+						while (j != -1ull && file->lines[j]->type == EASM_LINE_LABEL)
+							j--;
+						assert (j != -1ull && file->lines[j]->type == EASM_LINE_INSN);
+						if (ctx->im[j].m[0].oplen == 4) {
+							if (ctx->im[j].mnum == 1) {
+								fprintf (stderr, LOC_FORMAT(file->lines[j]->loc, "No long form to pair this instruction\n"));
+								return 1;
+							}
+							ctx->im[j].m++;
+							ctx->im[j].mnum--;
+						}
+						*allok = 0;
+						sect->pos &= ~7ull, sect->pos += 8;
+					}
+				}
+				if (wren) {
+					extend(sect, m->oplen * stride);
+					for (j = 0; j < m->oplen * stride; j++)
+						sect->code[sect->pos++] = ai->val[j>>3] >> (8*(j&7));
+				} else {
+					sect->pos += m->oplen * stride;
+				}
+				break;
+			}
+			case EASM_LINE_LABEL:
+				if (file->lines[i]->lname[0] != '_')
+					ctx->cur_global_label = file->lines[i]->lname;
+				break;
+			case EASM_LINE_DIRECTIVE: {
+				ull oldpos = sect->pos;
+				if (!strcmp(direct->str, "section")) {
+					for (j = 0; j < ctx->sectionsnum; j++)
+						if (!strcmp(ctx->sections[j].name, direct->params[0]->str))
+							break;
+					cursect = j;
+					break;
+				} else if (!strcmp(direct->str, "align")) {
+					ull num = direct->params[0]->num;
+					sect->pos += num - 1;
+					sect->pos /= num;
+					sect->pos *= num;
+				} else if (!strcmp(direct->str, "size")) {
+					ull num = direct->params[0]->num;
+					if (sect->pos > num) {
+						fprintf (stderr, LOC_FORMAT(direct->loc, "Section '%s' exceeds .size by %llu bytes\n"), sect->name, sect->pos - num);
+						return 1;
+					}
+					sect->pos = num;
+				} else if (!strcmp(direct->str, "skip")) {
+					ull num = direct->params[0]->num;
+					sect->pos += num;
+				} else if (!strcmp(direct->str, "equ")) {
+					/* nothing to be done */
+					break;
+				} else if (!donum(sect, direct, ctx, wren)) {
+					fprintf (stderr, LOC_FORMAT(direct->loc, "Unknown directive .%s\n"), direct->str);
+					return 1;
+				} else {
+					break;
+				}
+				if (wren) {
+					extend(sect, 0);
+					for (j = oldpos; j < sect->pos; j++)
+						sect->code[j] = 0;
+				}
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Picks the encodings.  Every instruction starts with its first candidate;
+ * each pass lays the file out with the current choices and moves the ones
+ * that don't resolve at their new position to the next candidate, until
+ * nothing changes.  Label lookup is only done on the first pass, and only
+ * the instructions whose position or targets moved are resolved again, so
+ * a pass that shifts a handful of branches costs little more than walking
+ * the lines.
+ */
 int envyas_layout(struct asctx *ctx, struct easm_file *file) {
 	int i, j;
 	int allok = 1;
 	int stride = ed_getcstride(ctx->isa, ctx->varinfo);
+	int pass = 0;
 	ctx->symtab = symtab_new();
+	ctx->ai = calloc(sizeof *ctx->ai, file->linesnum);
+	struct section def = { "default" };
+	def.first_label = -1;
+	ADDARRAY(ctx->sections, def);
 	do {
-		symtab_del(ctx->symtab);
-		ctx->symtab = symtab_new();
 		allok = 1;
-		ctx->labelsnum = 0;
+		int curlabel = 0;
 		ctx->cur_global_label = NULL;
 		for (i = 0; i < ctx->sectionsnum; i++)
-			free(ctx->sections[i].code);
-		ctx->sectionsnum = 0;
+			ctx->sections[i].pos = 0;
 		int cursect = 0;
-		struct section def = { "default" };
-		def.first_label = -1;
-		ADDARRAY(ctx->sections, def);
 		for (i = 0; i < file->linesnum; i++) {
 			struct easm_directive *direct = file->lines[i]->directive;
+			ull val;
 			switch (file->lines[i]->type) {
 				case EASM_LINE_INSN:
 					if (ctx->isa->i_need_g80as_hack) {
@@ -288,6 +447,12 @@ int envyas_layout(struct asctx *ctx, struct easm_file *file) {
 					ctx->sections[cursect].pos += ctx->im[i].m[0].oplen * stride;
 					break;
 				case EASM_LINE_LABEL:
+					val = ctx->sections[cursect].pos / stride + ctx->sections[cursect].base;
+					if (pass) {
+						ctx->lmoved[curlabel] = ctx->labels[curlabel].val != val;
+						ctx->labels[curlabel++].val = val;
+						break;
+					}
 					if (file->lines[i]->lname[0] == '_' && file->lines[i]->lname[1] != '_') {
 						char *full_label = expand_local_label(file->lines[i]->lname, ctx->cur_global_label);
 						free(file->lines[i]->lname);
@@ -300,11 +465,12 @@ int envyas_layout(struct asctx *ctx, struct easm_file *file) {
 						fprintf (stderr, LOC_FORMAT(file->lines[i]->loc, "Label %s redeclared!\n"), file->lines[i]->lname);
 						return 1;
 					}
-					struct label l = { file->lines[i]->lname, ctx->sections[cursect].pos / stride + ctx->sections[cursect].base };
+					struct label l = { file->lines[i]->lname, val };
 					if (ctx->sections[cursect].first_label < 0)
 						ctx->sections[cursect].first_label = ctx->labelsnum;
 					ctx->sections[cursect].last_label = ctx->labelsnum;
 					ADDARRAY(ctx->labels, l);
+					curlabel++;
 					break;
 				case EASM_LINE_DIRECTIVE:
 					if (!strcmp(direct->str, "section")) {
@@ -367,6 +533,12 @@ int envyas_layout(struct asctx *ctx, struct easm_file *file) {
 						ull num = direct->params[0]->num;
 						ctx->sections[cursect].pos += num;
 					} else if (!strcmp(direct->str, "equ")) {
+						if (pass) {
+							val = calc(direct->params[1], ctx);
+							ctx->lmoved[curlabel] = ctx->labels[curlabel].val != val;
+							ctx->labels[curlabel++].val = val;
+							break;
+						}
 						if (direct->paramsnum != 2
 							|| direct->params[0]->type != EASM_EXPR_LABEL
 							|| !easm_isimm(direct->params[1])) {
@@ -385,6 +557,7 @@ int envyas_layout(struct asctx *ctx, struct easm_file *file) {
 						}
 						struct label l = { direct->params[0]->str, num , /* Distinguish .equ labels from regular labels */ 1 };
 						ADDARRAY(ctx->labels, l);
+						curlabel++;
 					} else if (!donum(&ctx->sections[cursect], direct, ctx, 0)) {
 						fprintf (stderr, LOC_FORMAT(direct->loc, "Unknown directive .%s\n"), direct->str);
 						return 1;
@@ -392,91 +565,13 @@ int envyas_layout(struct asctx *ctx, struct easm_file *file) {
 					break;
 			}
 		}
-		cursect = 0;
-		ctx->cur_global_label = NULL;
-		for (j = 0; j < ctx->sectionsnum; j++)
-			ctx->sections[j].pos = 0;
-		ull val[MAXOPLEN];
-		for (i = 0; i < file->linesnum; i++) {
-			struct easm_directive *direct = file->lines[i]->directive;
-			switch (file->lines[i]->type) {
-				case EASM_LINE_INSN:
-					if (!resolve(ctx, val, ctx->im[i].m[0], ctx->sections[cursect].pos / stride + ctx->sections[cursect].base)) {
-						ctx->sections[cursect].pos += ctx->im[i].m[0].oplen * stride;
-						ctx->im[i].m++;
-						ctx->im[i].mnum--;
-						if (!ctx->im[i].mnum) {
-							fprintf (stderr, LOC_FORMAT(file->lines[i]->loc, "Relocation failed\n"));
-							return 1;
-						}
-						allok = 0;
-					} else {
-						if (ctx->isa->i_need_g80as_hack) {
-							if (ctx->im[i].m[0].oplen == 8 && (ctx->sections[cursect].pos & 7)) {
-								j = i - 1;
-								while (j != -1ull && file->lines[j]->type == EASM_LINE_LABEL)
-									j--;
-								assert (j != -1ull && file->lines[j]->type == EASM_LINE_INSN);
-								if (ctx->im[j].m[0].oplen == 4) {
-									ctx->im[j].m++;
-									ctx->im[j].mnum--;
-								}
-								allok = 0;
-								ctx->sections[cursect].pos &= ~7ull, ctx->sections[cursect].pos += 8;
-							}
-						}
-						extend(&ctx->sections[cursect], ctx->im[i].m[0].oplen * stride);
-						for (j = 0; j < ctx->im[i].m[0].oplen * stride; j++)
-							ctx->sections[cursect].code[ctx->sections[cursect].pos++] = val[j>>3] >> (8*(j&7));
-					}
-					break;
-				case EASM_LINE_LABEL:
-					if (file->lines[i]->lname[0] != '_')
-						ctx->cur_global_label = file->lines[i]->lname;
-					break;
-				case EASM_LINE_DIRECTIVE:
-					if (!strcmp(direct->str, "section")) {
-						for (j = 0; j < ctx->sectionsnum; j++)
-							if (!strcmp(ctx->sections[j].name, direct->params[0]->str))
-								break;
-						cursect = j;
-					} else if (!strcmp(direct->str, "align")) {
-						ull num = direct->params[0]->num;
-						ull oldpos = ctx->sections[cursect].pos;
-						ctx->sections[cursect].pos += num - 1;
-						ctx->sections[cursect].pos /= num;
-						ctx->sections[cursect].pos *= num;
-						extend(&ctx->sections[cursect], 0);
-						for (j = oldpos; j < ctx->sections[cursect].pos; j++)
-							ctx->sections[cursect].code[j] = 0;
-					} else if (!strcmp(direct->str, "size")) {
-						ull num = direct->params[0]->num;
-						ull oldpos = ctx->sections[cursect].pos;
-						if (ctx->sections[cursect].pos > num) {
-							fprintf (stderr, LOC_FORMAT(direct->loc, "Section '%s' exceeds .size by %llu bytes\n"), ctx->sections[cursect].name, ctx->sections[cursect].pos - num);
-							return 1;
-						}
-						ctx->sections[cursect].pos = num;
-						extend(&ctx->sections[cursect], 0);
-						for (j = oldpos; j < ctx->sections[cursect].pos; j++)
-							ctx->sections[cursect].code[j] = 0;
-					} else if (!strcmp(direct->str, "skip")) {
-						ull num = direct->params[0]->num;
-						ull oldpos = ctx->sections[cursect].pos;
-						ctx->sections[cursect].pos += num;
-						extend(&ctx->sections[cursect], 0);
-						for (j = oldpos; j < ctx->sections[cursect].pos; j++)
-							ctx->sections[cursect].code[j] = 0;
-					} else if (!strcmp(direct->str, "equ")) {
-						/* nothing to be done */
-					} else if (!donum(&ctx->sections[cursect], direct, ctx, 1)) {
-						fprintf (stderr, LOC_FORMAT(direct->loc, "Unknown directive .%s\n"), direct->str);
-						return 1;
-					}
-			}
-		}
+		if (!pass)
+			ctx->lmoved = calloc(ctx->labelsnum ? ctx->labelsnum : 1, 1);
+		pass++;
+		if (envyas_place(ctx, file, 0, &allok))
+			return 1;
 	} while (!allok);
-	return 0;
+	return envyas_place(ctx, file, 1, &allok);
 }
 
 int envyas_output(struct asctx *ctx, enum envyas_ofmt ofmt, const char *outname, int stride) {
@@ -54,6 +54,9 @@
  *  -n           Disable color escape sequences in output
  *  -q           Disable printing address + opcodes
  *
+ *  -j <num>     Decode using this many threads (0 - one per CPU, default 1),
+ *               only used without labels
+ *
  * Refer to docs/envydis/index.rst for ISA details
  */
 
@@ -74,6 +77,7 @@ int main(int argc, char **argv) {
 	int featnamesnum = 0;
 	int featnamesmax = 0;
 	int wsz = 0;
+	int threads = 1;
 	const struct envy_colors *cols = &envy_def_colors;
 	argv[0] = basename(argv[0]);
 	int len = strlen(argv[0]);
@@ -85,7 +89,7 @@ int main(int argc, char **argv) {
 	}
 	int c;
 	unsigned base = 0, skip = 0, limit = 0;
-	while ((c = getopt (argc, argv, "b:d:l:m:V:O:F:wWinqu:M:S:")) != -1)
+	while ((c = getopt (argc, argv, "b:d:l:m:V:O:F:wWinqu:M:S:j:")) != -1)
 		switch (c) {
 			case 'b':
 				sscanf(optarg, "%x", &base);
@@ -111,6 +115,13 @@ int main(int argc, char **argv) {
 			case 'q':
 				quiet = 1;
 				break;
+			case 'j':
+				threads = strtol(optarg, 0, 0);
+				if (threads < 0) {
+					fprintf (stderr, "Invalid thread count \"%s\"!\n", optarg);
+					return 1;
+				}
+				break;
 			case 'n':
 				cols = &envy_null_colors;
 				break;
@@ -290,6 +301,6 @@ int main(int argc, char **argv) {
 	cnt /= ed_getcstride(isa, var);
 	if (limit && limit < cnt)
 		cnt = limit;
-	envydis (isa, stdout, code+skip, base, cnt, var, quiet, labels, labelsnum, cols);
+	envydis_threads (isa, stdout, code+skip, base, cnt, var, quiet, labels, labelsnum, cols, threads);
 	return 0;
 }
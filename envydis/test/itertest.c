@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks that the instruction iterator sees the same instructions as
+ * envydis: random code goes through both, each instruction the iterator
+ * returns has to match its line of the listing, and ed_dis_listing has to
+ * print the same listing as envydis does for unlabelled code.
+ */
+
+#include "dis.h"
+#include "util.h"
+#include "var.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CODESZ 0x4000
+#define START 0x1000
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+/*
+ * Checks every instruction the iterator returns against its line in the
+ * listing: the address has to start it, the printed instruction end it.
+ */
+static int check_insns(const struct disisa *isa, struct varinfo *var, const char *name, const uint8_t *code, int num, char *list) {
+	const struct ed_insn *insn;
+	struct ed_dis *dis = ed_dis_new(isa, var, code, START, num, 0, 0);
+	char *line = list, *text = 0, addr[16];
+	size_t textlen, linelen;
+	FILE *f;
+	int res = 0;
+	while (!res && (insn = ed_dis_next(dis))) {
+		while (*line == '\n')
+			line++;
+		linelen = strcspn(line, "\n");
+		f = open_memstream(&text, &textlen);
+		ed_dis_print(dis, f, &envy_null_colors);
+		fclose(f);
+		snprintf(addr, sizeof addr, "%08x:", insn->pos);
+		/* the printed text includes the newline */
+		if (strncmp(line, addr, strlen(addr)) || linelen + 1 < textlen ||
+				memcmp(line + linelen + 1 - textlen, text, textlen)) {
+			fprintf(stderr, "%s: the iterator differs from envydis at %s\n", name, addr);
+			res = 1;
+		}
+		line += linelen;
+		free(text);
+		text = 0;
+	}
+	ed_dis_free(dis);
+	return res;
+}
+
+static int check(const char *name, const char *variant) {
+	const struct disisa *isa = ed_getisa(name);
+	struct varinfo *var = varinfo_new(isa->vardata);
+	uint8_t *code = malloc(CODESZ);
+	char *exp = 0, *got = 0;
+	size_t explen, gotlen, i;
+	FILE *f;
+	int num, res = 0;
+	if (variant && varinfo_set_variant(var, variant))
+		return 1;
+	for (i = 0; i < CODESZ; i++)
+		code[i] = rnd();
+	num = CODESZ / ed_getcstride(isa, var);
+	f = open_memstream(&exp, &explen);
+	envydis(isa, f, code, START, num, var, 0, 0, 0, &envy_def_colors);
+	fclose(f);
+	f = open_memstream(&got, &gotlen);
+	ed_dis_listing(isa, var, f, code, START, num, &envy_def_colors);
+	fclose(f);
+	if (explen != gotlen || memcmp(exp, got, explen)) {
+		for (i = 0; i < explen && i < gotlen && exp[i] == got[i]; i++);
+		fprintf(stderr, "%s: ed_dis_listing differs from envydis at byte %zu\n", name, i);
+		res = 1;
+	}
+	free(exp);
+	free(got);
+	exp = 0;
+	f = open_memstream(&exp, &explen);
+	envydis(isa, f, code, START, num, var, 0, 0, 0, &envy_null_colors);
+	fclose(f);
+	res |= check_insns(isa, var, name, code, num, exp);
+	free(exp);
+	free(code);
+	varinfo_del(var);
+	ed_freeisa(isa);
+	return res;
+}
+
+int main() {
+	int res = 0;
+	res |= check("g80", 0);
+	res |= check("gf100", 0);
+	res |= check("gm107", 0);
+	res |= check("falcon", "fuc5");
+	return res;
+}
@@ -31,6 +31,8 @@
 #include <inttypes.h>
 #include <stdio.h>
 
+struct easm_insn;
+
 struct disisa {
 	struct insn *troot;
 	int maxoplen;
@@ -63,5 +65,59 @@ static inline int ed_getcstride(const struct disisa *isa, struct varinfo *varinf
 }
 
 void envydis (const struct disisa *isa, FILE *out, uint8_t *code, uint32_t start, int num, struct varinfo *varinfo, int quiet, struct label *labels, int labelsnum, const struct envy_colors *cols);
+/* same, but decodes on this many threads (0 - one per CPU) when there are no labels */
+void envydis_threads (const struct disisa *isa, FILE *out, uint8_t *code, uint32_t start, int num, struct varinfo *varinfo, int quiet, struct label *labels, int labelsnum, const struct envy_colors *cols, int threads);
+
+/*
+ * Instruction-level interface, for callers that want to look at the
+ * instructions instead of text.  The code is decoded in order from the
+ * start, one instruction per call, without envydis' passes following
+ * branches, skipping what's not reached and printing literal pools as
+ * data.  Labels are used for naming targets and for noreturn calls only.
+ *
+ * Each iterator has its own decision tree cache and shares no state with
+ * anything else, so iterators may be used from different threads.
+ */
+
+enum dis_status {
+	DIS_STATUS_OK = 0,
+	DIS_STATUS_EOF = 0x1,		/* EOF in the middle of an opcode */
+	DIS_STATUS_UNK_FORM = 0x2,	/* failed to determine instruction format - opcode length uncertain */
+	DIS_STATUS_UNK_INSN = 0x4,	/* failed to determine instruction name - unknown opcode or due to one of the above errors */
+	DIS_STATUS_UNK_OPERAND = 0x8,	/* failed to determine instruction operands */
+	DIS_STATUS_UNUSED_BITS = 0x10,	/* instruction decoded, but unused bitfields have non-default values */
+};
+
+struct ed_target {
+	uint64_t addr;
+	/* 1 - branch, 2 - call */
+	int type;
+};
+
+struct ed_insn {
+	/* address, start included, and length in code units */
+	uint32_t pos;
+	uint32_t len;
+	enum dis_status status;
+	/* the name of the (first) instruction, as printed */
+	const char *name;
+	/* positions substituted and constants folded, as printed */
+	struct easm_insn *insn;
+	struct ed_target *targets;
+	int targetsnum;
+	/* execution doesn't continue with the next instruction */
+	int endmark;
+};
+
+struct ed_dis;
+
+struct ed_dis *ed_dis_new(const struct disisa *isa, struct varinfo *varinfo, const uint8_t *code, uint32_t start, int num, const struct label *labels, int labelsnum);
+/* returns NULL at the end, the result is valid until the next call */
+const struct ed_insn *ed_dis_next(struct ed_dis *dis);
+/* prints the instruction last returned like envydis does, sans address and opcode */
+void ed_dis_print(struct ed_dis *dis, FILE *out, const struct envy_colors *cols);
+void ed_dis_free(struct ed_dis *dis);
+/* prints the whole code the way envydis does when it's given no labels */
+void ed_dis_listing(const struct disisa *isa, struct varinfo *varinfo, FILE *out, const uint8_t *code, uint32_t start, int num, const struct envy_colors *cols);
 
 #endif
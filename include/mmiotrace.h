@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef MMIOTRACE_H
+#define MMIOTRACE_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/*
+ * mmiotrace reader, for both the text format written by the kernel and the
+ * binary one written by mmiotrace2bin.  The binary format keeps only the
+ * fields of R/W lines that the decoders use, everything else is passed
+ * through as text, so both give the same records.
+ */
+
+enum mmiotrace_type {
+	/* anything that isn't a read or a write, in line */
+	MMIOTRACE_LINE,
+	MMIOTRACE_READ,
+	MMIOTRACE_WRITE,
+};
+
+struct mmiotrace_rec {
+	enum mmiotrace_type type;
+	/* in bytes */
+	int width;
+	double timestamp;
+	uint64_t addr;
+	uint64_t value;
+	/* the whole line including the newline, valid until the next read;
+	 * NULL only for accesses stored in binary form */
+	const char *line;
+	size_t linelen;
+};
+
+struct mmiotrace;
+
+/* file may be compressed, NULL means stdin */
+struct mmiotrace *mmiotrace_open(const char *file, int threads);
+/* returns 1 if a record was read, 0 at the end, -1 on a corrupt binary file */
+int mmiotrace_read(struct mmiotrace *mt, struct mmiotrace_rec *rec);
+void mmiotrace_close(struct mmiotrace *mt);
+
+struct mmiotrace_writer;
+
+struct mmiotrace_writer *mmiotrace_writer_new(FILE *out);
+void mmiotrace_write(struct mmiotrace_writer *w, const struct mmiotrace_rec *rec);
+/* flushes the pending block and frees the writer, returns nonzero on error */
+int mmiotrace_writer_finish(struct mmiotrace_writer *w);
+
+#endif
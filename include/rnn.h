@@ -68,6 +68,9 @@ struct rnndb {
 	int filesnum;
 	int filesmax;
 	int estatus;
+	/* set when the db lives in a mapped cache file, see rnncache.c */
+	void *cachemap;
+	size_t cachesize;
 };
 
 struct rnnvarset {
@@ -226,4 +229,9 @@ struct rnnbitset *rnn_findbitset (struct rnndb *db, const char *name);
 struct rnndomain *rnn_finddomain (struct rnndb *db, const char *name);
 struct rnnspectype *rnn_findspectype (struct rnndb *db, const char *name);
 
+struct rnndb *rnn_loaddb (char *file);
+char *rnn_cachefile (const char *file);
+struct rnndb *rnn_loadcache (const char *cachefile, const char *rootfile);
+int rnn_writecache (struct rnndb *db, const char *cachefile);
+
 #endif
@@ -33,12 +33,34 @@ struct rnndecvariant {
 	int variant;
 };
 
+struct rnndecstate;
+struct rnndecmemo;
+
+/*
+ * Growable string the _buf decoding functions append to.  Start with it
+ * zeroed, reset len to 0 to reuse it, free str when done.
+ */
+struct rnndecbuf {
+	char *str;
+	size_t len;
+	size_t max;
+};
+
 struct rnndeccontext {
 	struct rnndb *db;
 	struct rnndecvariant **vars;
 	int varsnum;
 	int varsmax;
 	const struct envy_colors *colors;
+	/* compiled address lookup tables, one set per variant combination seen */
+	struct rnndecstate **states;
+	int statesnum;
+	int statesmax;
+	struct rnndecstate *state;
+	/* rendered value cache, see rnndec_memo_enable */
+	struct rnndecmemo *memo;
+	/* rnndec_decodeval_memo's result while the cache is off */
+	struct rnndecbuf scratch;
 };
 
 struct rnndecaddrinfo {
@@ -47,8 +69,26 @@ struct rnndecaddrinfo {
 	char *name;
 };
 
+#define RNNDEC_MAX_INDICES 8
+
+struct rnndecaddr {
+	/* matched register, NULL if the address fell in an array gap or nowhere */
+	struct rnndelem *reg;
+	struct rnntypeinfo *typeinfo;
+	int width;
+	/* array and stripe indices from outermost in, only the first RNNDEC_MAX_INDICES are stored */
+	uint64_t indices[RNNDEC_MAX_INDICES];
+	int indicesnum;
+	/* leftover offset inside the register or array element */
+	uint64_t offset;
+	/* points into the buffer, valid until the next append to it */
+	char *name;
+};
+
 struct rnndeccontext *rnndec_newcontext(struct rnndb *db);
 void rnndec_freecontext(struct rnndeccontext *ctx);
+/* copies the variants and colors only, so the copy can be used from another thread */
+struct rnndeccontext *rnndec_clonecontext(struct rnndeccontext *ctx);
 int rnndec_varadd(struct rnndeccontext *ctx, char *varset, char *variant);
 int rnndec_varaddvalue(struct rnndeccontext *ctx, char *varset, uint64_t value);
 int rnndec_varmod(struct rnndeccontext *ctx, char *varset, char *variant);
@@ -56,5 +96,19 @@ int rnndec_varmatch(struct rnndeccontext *ctx, struct rnnvarinfo *vi);
 char *rnndec_decodeval(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64_t value, int width);
 struct rnndecaddrinfo *rnndec_decodeaddr(struct rnndeccontext *ctx, struct rnndomain *domain, uint64_t addr, int write);
 void rnndec_free_decaddrinfo(struct rnndecaddrinfo *a);
+void rnndec_bufprintf(struct rnndecbuf *buf, const char *fmt, ...);
+char *rnndec_decodeval_buf(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64_t value, int width, struct rnndecbuf *buf);
+int rnndec_decodeaddr_buf(struct rnndeccontext *ctx, struct rnndomain *domain, uint64_t addr, int write, struct rnndecbuf *buf, struct rnndecaddr *res);
+
+/*
+ * Remembers the last rendering of each (type, value, width) in the current
+ * variants, in a direct-mapped table of the given size (0 turns it off).
+ * The returned string belongs to the context and is only valid until the
+ * next rnndec_decodeval_memo call on it, with the cache on or off.  Not
+ * thread safe - keep it to the thread owning the context; plain
+ * rnndec_decodeval never touches the cache.
+ */
+void rnndec_memo_enable(struct rnndeccontext *ctx, int entries);
+char *rnndec_decodeval_memo(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64_t value, int width);
 
 #endif
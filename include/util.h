@@ -117,7 +117,15 @@ void print_escaped_astr(FILE *out, struct astr *astr);
 
 char *aprintf(const char *format, ...);
 
+/*
+ * Opens a trace for reading.  Compressed files (.gz, .bz2, .xz, .zst) are
+ * decompressed in-process when the library was built with support for
+ * the format, or through an external zcat-like tool otherwise.
+ * threads is the number of decompressor threads (xz only), 0 means one
+ * per CPU; open_input uses a single thread.
+ */
 FILE *open_input(const char *filename);
+FILE *open_input_threaded(const char *filename, int threads);
 
 #ifdef NDEBUG
 #undef assert
@@ -26,6 +26,9 @@
 #define VSTREAM_H
 
 #include <inttypes.h>
+#include <stdio.h>
+
+struct vs_vlc_cache;
 
 struct bitstream {
 	enum vs_dir {
@@ -48,6 +51,33 @@ struct bitstream {
 		VS_VC1,
 	} type;
 	int hasbyte;
+	/* H.262/H.264 decode: the current NAL with emulation prevention bytes
+	 * already stripped, read by vs_u & co. while rbspvalid is set.
+	 * escapes[] are rbsp indices of the bytes that followed a stripped
+	 * 03, to map back to bytepos. */
+	int rbspvalid;
+	uint8_t *rbsp;
+	int rbspnum;
+	int rbspmax;
+	int rbspstart;
+	uint64_t rbspbit;
+	int *escapes;
+	int escapesnum;
+	int escapesmax;
+	/* vs_vlc lookup tables, built on first use of each table */
+	struct vs_vlc_cache *vlccache;
+	/* decode: where to get the data past bytesnum from, NULL if there's
+	 * no more.  bytes is then a window, the data before bytepos gets
+	 * dropped between NALs. */
+	int (*readfn)(void *arg, uint8_t *buf, int len);
+	void *readarg;
+	/* stream offset of bytes[0] */
+	uint64_t bytesbase;
+	/* the window data from this stream offset on is kept even when
+	 * behind bytepos */
+	uint64_t keepoff;
+	/* vs_fork: the parent stream has more data past bytesnum */
+	int forkcut;
 };
 
 enum vs_align_byte_mode {
@@ -74,9 +104,39 @@ int vs_has_more_data(struct bitstream *str);
 int vs_infer(struct bitstream *str, uint32_t *val, uint32_t ival);
 int vs_infers(struct bitstream *str, int32_t *val, int32_t ival);
 int vs_search_start(struct bitstream *str);
+/* for decoders reading ahead: vs_try_u reads like vs_u and returns 1 if
+ * that can be done without any checks failing, otherwise reads nothing
+ * and returns 0.  vs_unread puts back bits read by vs_try_u, as long as
+ * nothing else was read since. */
+int vs_try_u(struct bitstream *str, uint32_t *val, int size);
+void vs_unread(struct bitstream *str, int size);
 
 struct bitstream *vs_new_encode(enum vs_type type);
 struct bitstream *vs_new_decode(enum vs_type type, uint8_t *bytes, int bytesnum);
+/* readfn returns the number of bytes read, 0 at the end or < 0 on error */
+struct bitstream *vs_new_decode_source(enum vs_type type, int (*readfn)(void *arg, uint8_t *buf, int len), void *arg);
+struct bitstream *vs_new_decode_fd(enum vs_type type, int fd);
 void vs_destroy(struct bitstream *str);
 
+/*
+ * For parsing NALs in parallel: vs_fork makes an independent bitstream
+ * reading the rest of str's current NAL from a copy, with bytesbase set
+ * to where the copy starts.  vs_skip_nal then moves str to the end of the
+ * NAL, as reading it up to its trailing bits would, and vs_nal_done tells
+ * if the fork did end up in such a place.  If it didn't, vs_join moves
+ * str to wherever the fork stopped; str's keepoff has to keep the window
+ * data from the fork's bytesbase on for that.  A fork only gets the bytes
+ * up to a little past the NAL, vs_fork_cut tells if it ran out of them, in
+ * which case it didn't read what str would have.
+ */
+struct bitstream *vs_fork(struct bitstream *str);
+void vs_skip_nal(struct bitstream *str);
+int vs_nal_done(struct bitstream *str);
+int vs_fork_cut(struct bitstream *fork);
+void vs_join(struct bitstream *str, struct bitstream *fork);
+
+/* where the vstream functions report errors, per thread, stderr if NULL */
+FILE *vs_errfile(void);
+void vs_set_errfile(FILE *file);
+
 #endif
@@ -23,52 +23,14 @@
  */
 
 #include "nva.h"
+#include "util.h"
+#include "mmiotrace.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <inttypes.h>
 #include <string.h>
 #include <malloc.h>
 
-FILE *open_input(char *filename) {
-	const char * const tab[][2] = {
-		{ ".gz", "zcat" },
-		{ ".Z", "zcat" },
-		{ ".bz2", "bzcat" },
-		{ ".xz", "xzcat" },
-	};
-	int i;
-	int flen = strlen(filename);
-	for (i = 0; i < sizeof tab / sizeof tab[0]; i++) {
-		int elen = strlen(tab[i][0]);
-		if (flen > elen && !strcmp(filename + flen - elen, tab[i][0])) {
-			fprintf (stderr, "Compressed trace detected, trying to decompress...\n");
-			char *cmd = malloc(flen + strlen(tab[i][1]) + 2);
-			FILE *res;
-			strcpy(cmd, tab[i][1]);
-			strcat(cmd, " ");
-			strcat(cmd, filename);
-			res = popen(cmd, "r");
-			free(cmd);
-			return res;
-		}
-	}
-	return fopen(filename, "r");
-}
-
-int parse_line(const char *line, size_t len, uint32_t *reg, uint32_t *val)
-{
-	unsigned int size, useless;
-	float time;
-
-	if (line[0] != 'W')
-		return 0;
-
-	sscanf(line + 2, "%u %f %u %x %x", &size, &time, &useless, reg, val);
-	*reg &= 0xffffff;
-
-	return 1;
-}
-
 int main(int argc, char **argv) {
 	if (nva_init()) {
 		fprintf (stderr, "PCI init failure!\n");
@@ -112,8 +74,8 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	FILE *f = open_input(argv[optind]);
-	if (!f) {
+	struct mmiotrace *mt = mmiotrace_open(argv[optind], 0);
+	if (!mt) {
 		fprintf(stderr, "couldn't open '%s' for reading\n", argv[optind]);
 		return 1;
 	}
@@ -122,11 +84,11 @@ int main(int argc, char **argv) {
 		printf("limit the replay to registers in the range [%x:%x]\n",
 		       mmio_start, mmio_end);
 
-	char *buf = NULL;
-	size_t len, cur = 0, reg_writes = -1;
+	struct mmiotrace_rec rec = { 0 };
+	size_t cur = 0, reg_writes = -1;
 
-	while (getline(&buf, &len, f) > 0) {
-		uint32_t reg, val;
+	while (mmiotrace_read(mt, &rec) > 0) {
+		uint32_t reg = rec.addr & 0xffffff, val = rec.value;
 		if (cur >= start) {
 			if (reg_writes == (size_t) -1) {
 				if (steps < (size_t) -1) {
@@ -138,7 +100,7 @@ int main(int argc, char **argv) {
 					printf("replay from line %zu to the end\n", cur);
 			}
 
-			if (parse_line(buf, len, &reg, &val) &&
+			if (rec.type == MMIOTRACE_WRITE &&
 				reg >= mmio_start && reg <= mmio_end)
 			{
 				nva_wr32(cnum, reg, val);
@@ -157,6 +119,7 @@ int main(int argc, char **argv) {
 		cur++;
 	}
 	printf("\n");
+	mmiotrace_close(mt);
 
 	return 0;
 }
@@ -110,7 +110,9 @@ pretty_header(struct state *s, struct ent *e)
 static void
 pretty_method(struct state *s, struct ent *e, uint32_t x)
 {
-	struct rnndecaddrinfo *ai;
+	/* reused across calls, so that decoding doesn't allocate */
+	static struct rnndecbuf objbuf, addrbuf, valbuf;
+	struct rnndecaddr ai;
 	const struct envy_colors *col = s->colors;
 	struct dma *dma = &s->dma;
 	struct obj *obj = s->subchan[dma->subchan];
@@ -118,26 +120,29 @@ pretty_method(struct state *s, struct ent *e, uint32_t x)
 	char *dec_addr = NULL;
 	char *dec_val = NULL;
 
+	objbuf.len = addrbuf.len = valbuf.len = 0;
+
 	/* get an object name */
 	if (obj && obj->name)
-		asprintf(&dec_obj, "%s%s%s", col->rname,
+		rnndec_bufprintf(&objbuf, "%s%s%s", col->rname,
 			 obj->name, col->reset);
 	else
-		asprintf(&dec_obj, "%sOBJ%X%s", col->err,
+		rnndec_bufprintf(&objbuf, "%sOBJ%X%s", col->err,
 			 (obj ? obj->class : 0), col->reset);
+	dec_obj = objbuf.str;
 
 	/* get the method name and value */
 	if (obj) {
-		ai = rnndec_decodeaddr(obj->ctx, s->dom, dma->addr, true);
-
-		dec_addr = ai->name;
-		dec_val = rnndec_decodeval(obj->ctx, ai->typeinfo, x,
-					   ai->width);
+		rnndec_decodeaddr_buf(obj->ctx, s->dom, dma->addr, true,
+				      &addrbuf, &ai);
 
-		free(ai);
+		dec_addr = ai.name;
+		dec_val = rnndec_decodeval_buf(obj->ctx, ai.typeinfo, x,
+					       ai.width, &valbuf);
 	} else {
-		asprintf(&dec_addr, "%s0x%x%s", col->err, dma->addr,
+		rnndec_bufprintf(&addrbuf, "%s0x%x%s", col->err, dma->addr,
 			 col->reset);
+		dec_addr = addrbuf.str;
 	}
 
 	/* write it */
@@ -149,10 +154,6 @@ pretty_method(struct state *s, struct ent *e, uint32_t x)
 		s->op.print(".%s = %s\n", dec_addr, dec_val);
 	else
 		s->op.print(".%s\n", dec_addr);
-
-	free(dec_val);
-	free(dec_addr);
-	free(dec_obj);
 }
 
 static void
@@ -416,9 +417,7 @@ main(int argc, char *argv[])
 
 	/* set up an rnn context */
 	rnn_init();
-	s.db = rnn_newdb();
-	rnn_parsefile(s.db, "fifo/nv_objects.xml");
-	rnn_prepdb(s.db);
+	s.db = rnn_loaddb("fifo/nv_objects.xml");
 	s.dom = rnn_finddomain(s.db, "SUBCHAN");
 
 	/* insert objects specified in the command line */
@@ -23,6 +23,7 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include "rnn.h"
 #include "rnndec.h"
 #include "var.h"
@@ -30,14 +31,21 @@
 #include "util.h"
 #include "nvhw/chipset.h"
 #include "seq.h"
+#include "mmiotrace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
 
 int sleep_disabled = 0;
 
+/* where the tracking pass prints to, stdout unless decoding with threads */
+static FILE *out;
+static struct rnndomain *mmiodom;
+
 struct i2c_ctx {
 	int last;
 	int aok;
@@ -60,6 +68,9 @@ struct cctx {
 	uint8_t hwsq[0x200];
 	struct mpage **pages;
 	int pagesnum, pagesmax;
+	/* open addressing table over pages, by tag */
+	struct mpage **pagehash;
+	uint64_t pagehashmask;
 	uint64_t bar0, bar0l, bar1, bar1l, bar2, bar2l;
 	struct i2c_ctx i2cb[10];
 	int crx0, crx1;
@@ -82,19 +93,173 @@ struct mpage {
 	uint32_t contents[0x1000/4];
 };
 
+static uint64_t pagehash (uint64_t tag) {
+	return (tag >> 12) * 0x9e3779b97f4a7c15ull >> 20;
+}
+
+static void addpage (struct cctx *ctx, struct mpage *pg) {
+	uint64_t i;
+	ADDARRAY(ctx->pages, pg);
+	/* keep the load under a half, rebuild from the page list when it grows */
+	if (ctx->pagesnum * 2 > ctx->pagehashmask) {
+		int j;
+		uint64_t size = ctx->pagehashmask ? (ctx->pagehashmask + 1) * 2 : 1024;
+		free(ctx->pagehash);
+		ctx->pagehash = calloc(sizeof *ctx->pagehash, size);
+		ctx->pagehashmask = size - 1;
+		for (j = 0; j < ctx->pagesnum - 1; j++) {
+			for (i = pagehash(ctx->pages[j]->tag); ctx->pagehash[i & ctx->pagehashmask]; i++);
+			ctx->pagehash[i & ctx->pagehashmask] = ctx->pages[j];
+		}
+	}
+	for (i = pagehash(pg->tag); ctx->pagehash[i & ctx->pagehashmask]; i++);
+	ctx->pagehash[i & ctx->pagehashmask] = pg;
+}
+
 uint32_t *findmem (struct cctx *ctx, uint64_t addr) {
-	int i;
 	uint64_t tag = addr & ~0xfffull;
-	for (i = 0; i < ctx->pagesnum; i++) {
-		if (tag == ctx->pages[i]->tag)
-			return &ctx->pages[i]->contents[(addr&0xfff)/4];
+	uint64_t i;
+	if (ctx->pagehash) {
+		for (i = pagehash(tag); ctx->pagehash[i & ctx->pagehashmask]; i++) {
+			struct mpage *pg = ctx->pagehash[i & ctx->pagehashmask];
+			if (pg->tag == tag)
+				return &pg->contents[(addr&0xfff)/4];
+		}
 	}
 	struct mpage *pg = calloc (sizeof *pg, 1);
 	pg->tag = tag;
-	ADDARRAY(ctx->pages, pg);
+	addpage(ctx, pg);
 	return &pg->contents[(addr&0xfff)/4];
 }
 
+/*
+ * Memory shadow images, so that a later trace can be decoded on top of the
+ * instance memory state built up by an earlier one.  The file is a header
+ * followed by, for every card, its RAMIN pointers and its nonzero pages:
+ *
+ *	"DEMMIOMEM\0\0\0\0\0\0\1"
+ *	uint64 cards
+ *	per card: uint64 praminbase, ramins, fakechan, pages
+ *	          per page: uint64 tag, uint32 contents[0x400]
+ *
+ * All in host byte order.  Cards are matched up by their order of appearance
+ * in the traces.
+ */
+static const char memimage_magic[16] = "DEMMIOMEM\0\0\0\0\0\0\1";
+
+struct memimage_card {
+	uint64_t praminbase, ramins, fakechan;
+	struct mpage **pages;
+	int pagesnum, pagesmax;
+};
+
+static struct memimage_card *memimage;
+static int memimagenum, memimagemax;
+
+static int mpage_empty (struct mpage *pg) {
+	int i;
+	for (i = 0; i < 0x400; i++)
+		if (pg->contents[i])
+			return 0;
+	return 1;
+}
+
+static int save_memimage (const char *file) {
+	FILE *f = fopen(file, "wb");
+	uint64_t hdr[4];
+	int i, j;
+	if (!f) {
+		perror(file);
+		return 1;
+	}
+	fwrite(memimage_magic, sizeof memimage_magic, 1, f);
+	hdr[0] = cctxnum;
+	fwrite(hdr, sizeof hdr[0], 1, f);
+	for (i = 0; i < cctxnum; i++) {
+		struct cctx *cc = &cctx[i];
+		hdr[0] = cc->praminbase;
+		hdr[1] = cc->ramins;
+		hdr[2] = cc->fakechan;
+		hdr[3] = 0;
+		for (j = 0; j < cc->pagesnum; j++)
+			hdr[3] += !mpage_empty(cc->pages[j]);
+		fwrite(hdr, sizeof hdr, 1, f);
+		for (j = 0; j < cc->pagesnum; j++)
+			if (!mpage_empty(cc->pages[j]))
+				fwrite(cc->pages[j], sizeof *cc->pages[j], 1, f);
+	}
+	if (fclose(f)) {
+		perror(file);
+		return 1;
+	}
+	return 0;
+}
+
+static int load_memimage (const char *file) {
+	FILE *f = fopen(file, "rb");
+	char magic[sizeof memimage_magic];
+	uint64_t hdr[4], cards, i, j;
+	if (!f) {
+		perror(file);
+		return 1;
+	}
+	if (fread(magic, sizeof magic, 1, f) != 1 || memcmp(magic, memimage_magic, sizeof magic) || fread(&cards, sizeof cards, 1, f) != 1)
+		goto bad;
+	for (i = 0; i < cards; i++) {
+		struct memimage_card card = { 0 };
+		if (fread(hdr, sizeof hdr, 1, f) != 1)
+			goto bad;
+		card.praminbase = hdr[0];
+		card.ramins = hdr[1];
+		card.fakechan = hdr[2];
+		for (j = 0; j < hdr[3]; j++) {
+			struct mpage *pg = malloc(sizeof *pg);
+			if (fread(pg, sizeof *pg, 1, f) != 1) {
+				free(pg);
+				goto bad;
+			}
+			ADDARRAY(card.pages, pg);
+		}
+		ADDARRAY(memimage, card);
+	}
+	fclose(f);
+	return 0;
+bad:
+	fprintf(stderr, "%s: not a valid memory image\n", file);
+	fclose(f);
+	return 1;
+}
+
+/* gives a newly found card the state saved for it, if any */
+static void apply_memimage (struct cctx *cc, int cci) {
+	struct memimage_card *card;
+	int i;
+	if (cci >= memimagenum)
+		return;
+	card = &memimage[cci];
+	cc->praminbase = card->praminbase;
+	cc->ramins = card->ramins;
+	cc->fakechan = card->fakechan;
+	for (i = 0; i < card->pagesnum; i++)
+		addpage(cc, card->pages[i]);
+	free(card->pages);
+	card->pages = NULL;
+	card->pagesnum = 0;
+}
+
+/* scratch buffers for decoding, the strings are valid until the next decode */
+static struct rnndecbuf namebuf;
+
+static char *decode_addr (struct cctx *cc, struct rnndomain *dom, uint64_t addr, int write, struct rnndecaddr *ai) {
+	namebuf.len = 0;
+	rnndec_decodeaddr_buf(cc->ctx, dom, addr, write, &namebuf, ai);
+	return ai->name;
+}
+
+static char *decode_val (struct cctx *cc, struct rnndecaddr *ai, uint64_t value) {
+	return rnndec_decodeval_memo(cc->ctx, ai->typeinfo, value, ai->width);
+}
+
 int i2c_bus_num (uint64_t addr) {
 	switch (addr) {
 		case 0xe138:
@@ -126,9 +291,9 @@ void doi2cr (struct cctx *cc, struct i2c_ctx *ctx, int byte) {
 	if (ctx->pend) {
 		if (ctx->bits == 8) {
 			if (byte & 2)
-				printf ("- ");
+				fprintf (out, "- ");
 			else
-				printf ("+ ");
+				fprintf (out, "+ ");
 			if (!ctx->aok) {
 				ctx->aok = 1;
 				ctx->wr = !(ctx->b&1);
@@ -140,7 +305,7 @@ void doi2cr (struct cctx *cc, struct i2c_ctx *ctx, int byte) {
 			ctx->b |= (byte & 2) >> 1;
 			ctx->bits++;
 			if (ctx->bits == 8) {
-				printf ("<%02x", ctx->b);
+				fprintf (out, "<%02x", ctx->b);
 			}
 		}
 		ctx->pend = 0;
@@ -155,7 +320,7 @@ void doi2cw (struct cctx *cc, struct i2c_ctx *ctx, int byte) {
 	}
 	if ((byte & 1) && !(ctx->last & 1)) {
 		if (ctx->pend) {
-			printf ("\nI2C LOST!\n");
+			fprintf (out, "\nI2C LOST!\n");
 			doi2cr(cc, ctx, 0);
 			ctx->pend = 0;
 		}
@@ -165,9 +330,9 @@ void doi2cw (struct cctx *cc, struct i2c_ctx *ctx, int byte) {
 				ctx->pend = 1;
 			} else {
 				if (byte & 2)
-					printf ("- ");
+					fprintf (out, "- ");
 				else
-					printf ("+ ");
+					fprintf (out, "+ ");
 				ctx->bits = 0;
 				ctx->b = 0;
 			}
@@ -177,7 +342,7 @@ void doi2cw (struct cctx *cc, struct i2c_ctx *ctx, int byte) {
 				ctx->b |= (byte & 2) >> 1;
 				ctx->bits++;
 				if (ctx->bits == 8) {
-					printf (">%02x", ctx->b);
+					fprintf (out, ">%02x", ctx->b);
 				}
 			} else {
 				ctx->pend = 1;
@@ -186,7 +351,7 @@ void doi2cw (struct cctx *cc, struct i2c_ctx *ctx, int byte) {
 	}
 	if ((byte & 1) && !(byte & 2) && (ctx->last & 2)) {
 		/* data went low with high clock - start bit */
-		printf ("START ");
+		fprintf (out, "START ");
 		ctx->bits = 0;
 		ctx->b = 0;
 		ctx->aok = 0;
@@ -196,7 +361,7 @@ void doi2cw (struct cctx *cc, struct i2c_ctx *ctx, int byte) {
 	}
 	if ((byte & 1) && (byte & 2) && !(ctx->last & 2)) {
 		/* data went high with high clock - stop bit */
-		printf ("STOP\n");
+		fprintf (out, "STOP\n");
 		cc->i2cip = -1;
 		ctx->bits = 0;
 		ctx->b = 0;
@@ -210,7 +375,7 @@ void doi2cw (struct cctx *cc, struct i2c_ctx *ctx, int byte) {
 
 static void print_help() {
 	fprintf(stderr,
-		"Usage: demmio [-a <NVXXX>|-c|-f <file>|-h]\n"
+		"Usage: demmio [-a <NVXXX>|-c|-f <file>|-j <threads>|-l <file>|-s <file>|--stats[=csv]|-h]\n"
 		"\n"
 		"Decodes MMIO traces using rnndb\n"
 		"\n"
@@ -218,15 +383,879 @@ static void print_help() {
 		"\t-a <gen>  Specify the chipset variant to use (autodetected by default)\n"
 		"\t-c        Disable colors\n"
 		"\t-f <file> Specify the file to read from (defaults to stdin)\n"
+		"\t-j <num>  Parse and decode using this many threads (0 - one per CPU, default 1)\n"
+		"\t-l <file> Start with the memory shadow saved by -s\n"
+		"\t-s <file> Save the memory shadow (RAMIN pointers and pages) at the end\n"
+		"\t--stats[=csv]\n"
+		"\t          Instead of decoding, print access counts, polling loops and\n"
+		"\t          timing per register and per area, as a table or as CSV\n"
 		"\t-h        Show this help message\n");
 }
 
+/*
+ * Input comes from the mmiotrace library, in batches of records.  Lines
+ * that aren't accesses are copied into the batch, to be passed through.
+ */
+#define BATCH_RECS 0x8000
+
+struct mmtrec {
+	enum {
+		REC_LINE,
+		REC_PCIDEV,
+		REC_ACCESS,
+	} type;
+	char rw;
+	int width;
+	double timestamp;
+	uint64_t addr;
+	uint64_t value;
+	/* the line, for REC_LINE and REC_PCIDEV */
+	size_t start;
+	size_t len;
+};
+
+struct mmtbatch {
+	char *text;
+	size_t textnum, textmax;
+	struct mmtrec *recs;
+	int recsnum, recsmax;
+	struct mmtbatch *next;
+};
+
+/* set when the input ended in an error rather than cleanly */
+static int input_failed;
+
+/* returns the next batch of records, NULL at the end of input */
+static struct mmtbatch *read_batch(struct mmiotrace *mt) {
+	struct mmtbatch *batch = calloc(sizeof *batch, 1);
+	struct mmiotrace_rec mr;
+	int res = 1;
+	while (batch->recsnum < BATCH_RECS && (res = mmiotrace_read(mt, &mr)) > 0) {
+		struct mmtrec rec;
+		if (mr.type == MMIOTRACE_LINE) {
+			rec.type = strncmp(mr.line, "PCIDEV ", 7) ? REC_LINE : REC_PCIDEV;
+			rec.start = batch->textnum;
+			rec.len = mr.linelen;
+			if (batch->textnum + mr.linelen > batch->textmax) {
+				batch->textmax = (batch->textnum + mr.linelen) * 2;
+				batch->text = realloc(batch->text, batch->textmax);
+			}
+			memcpy(batch->text + batch->textnum, mr.line, mr.linelen);
+			batch->textnum += mr.linelen;
+		} else {
+			rec.type = REC_ACCESS;
+			rec.rw = mr.type == MMIOTRACE_WRITE ? 'W' : 'R';
+			rec.width = mr.width;
+			rec.timestamp = mr.timestamp;
+			rec.addr = mr.addr;
+			rec.value = mr.value;
+		}
+		ADDARRAY(batch->recs, rec);
+	}
+	if (res < 0 && !input_failed) {
+		fprintf(stderr, "truncated or corrupt trace\n");
+		input_failed = 1;
+	}
+	if (!batch->recsnum) {
+		free(batch);
+		return NULL;
+	}
+	return batch;
+}
+
+/*
+ * Output.  With threads, the tracking pass writes its output into chunks
+ * and only notes down the plain MMIO accesses, which are the bulk of any
+ * trace and the only part needing rnndec.  Worker threads then format
+ * these into the chunk, each with its own rnndec contexts, and finished
+ * chunks are written out in order.
+ */
+#define MAX_PENDING_CHUNKS(workers) (2 * (workers) + 2)
+
+struct mmioacc {
+	size_t pos;
+	struct rnndeccontext *ctx;
+	int cci;
+	char rw;
+	int width;
+	double timestamp;
+	uint64_t addr;
+	uint64_t value;
+};
+
+struct outchunk {
+	char *text;
+	size_t textlen;
+	FILE *f;
+	struct mmioacc *accs;
+	int accsnum, accsmax;
+	struct rnndecbuf res;
+	int done;
+	struct outchunk *next;
+};
+
+struct worker {
+	struct rnndeccontext **ctxs;
+	int ctxsnum, ctxsmax;
+	struct rnndecbuf namebuf;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	pthread_cond_t batches;
+	int workers;
+	/* output chunks, oldest first, and the first one not taken by a worker */
+	struct outchunk *head, *tail, *todo;
+	int pending;
+	/* parsed input, filled by the reader thread */
+	struct mmtbatch *bhead, *btail;
+	int bpending;
+	int beof;
+} pipeline = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static struct outchunk *chunk;
+
+static void format_mmio(struct rnndeccontext *ctx, struct rnndecbuf *res, struct rnndecbuf *namebuf, const struct mmioacc *acc) {
+	const char *dir = acc->rw == 'W' ? "<=" : "=>";
+	struct rnndecaddr ai;
+	namebuf->len = 0;
+	rnndec_decodeaddr_buf(ctx, mmiodom, acc->addr, acc->rw == 'W', namebuf, &ai);
+	if (acc->width == 32 && ai.width == 8) {
+		/* 32-bit write to 8-bit location - split it up */
+		int b;
+		int cnt = 0;
+		for (b = 0; b < 4; b++) {
+			namebuf->len = 0;
+			rnndec_decodeaddr_buf(ctx, mmiodom, acc->addr+b, acc->rw == 'W', namebuf, &ai);
+			char *decoded_val = rnndec_decodeval_memo(ctx, ai.typeinfo, acc->value >> b * 8 & 0xff, ai.width);
+			if (b == 0) {
+				size_t start = res->len;
+				rnndec_bufprintf(res, "[%d] %lf MMIO%d %c 0x%06"PRIx64" 0x%08"PRIx64" ", acc->cci, acc->timestamp, acc->width, acc->rw, acc->addr, acc->value);
+				cnt = res->len - start;
+			} else {
+				rnndec_bufprintf(res, "%*s", cnt, "");
+			}
+			rnndec_bufprintf(res, "%s %s %s\n", ai.name, dir, decoded_val);
+		}
+	} else {
+		char *decoded_val = rnndec_decodeval_memo(ctx, ai.typeinfo, acc->value, ai.width);
+		rnndec_bufprintf(res, "[%d] %lf MMIO%d %c 0x%06"PRIx64" 0x%08"PRIx64" %s %s %s\n", acc->cci, acc->timestamp, acc->width, acc->rw, acc->addr, acc->value, ai.name, dir, decoded_val);
+	}
+}
+
+static void put_mmio(struct cctx *cc, int cci, double timestamp, char rw, int width, uint64_t addr, uint64_t value) {
+	struct mmioacc acc = { 0, cc->ctx, cci, rw, width, timestamp, addr, value };
+	if (chunk) {
+		fflush(chunk->f);
+		acc.pos = chunk->textlen;
+		ADDARRAY(chunk->accs, acc);
+	} else {
+		static struct rnndecbuf res;
+		res.len = 0;
+		format_mmio(cc->ctx, &res, &namebuf, &acc);
+		fwrite(res.str, 1, res.len, out);
+	}
+}
+
+static void format_chunk(struct worker *w, struct outchunk *c) {
+	size_t pos = 0;
+	int i;
+	for (i = 0; i < c->accsnum; i++) {
+		struct mmioacc *acc = &c->accs[i];
+		struct rnndeccontext **pctx;
+		/* the variants only change while no chunks are in flight */
+		while (acc->cci >= w->ctxsnum) {
+			struct rnndeccontext *nctx = NULL;
+			ADDARRAY(w->ctxs, nctx);
+		}
+		pctx = &w->ctxs[acc->cci];
+		if (*pctx && (*pctx)->varsnum != acc->ctx->varsnum) {
+			rnndec_freecontext(*pctx);
+			*pctx = NULL;
+		}
+		if (!*pctx) {
+			*pctx = rnndec_clonecontext(acc->ctx);
+			rnndec_memo_enable(*pctx, 4096);
+		}
+		rnndec_bufprintf(&c->res, "%.*s", (int)(acc->pos - pos), c->text + pos);
+		pos = acc->pos;
+		format_mmio(*pctx, &c->res, &w->namebuf, acc);
+	}
+	rnndec_bufprintf(&c->res, "%.*s", (int)(c->textlen - pos), c->text + pos);
+}
+
+static void *format_worker(void *arg) {
+	struct worker w = { 0 };
+	pthread_mutex_lock(&pipeline.lock);
+	while (1) {
+		struct outchunk *c;
+		while (!pipeline.todo)
+			pthread_cond_wait(&pipeline.work, &pipeline.lock);
+		c = pipeline.todo;
+		pipeline.todo = c->next;
+		pthread_mutex_unlock(&pipeline.lock);
+
+		format_chunk(&w, c);
+
+		pthread_mutex_lock(&pipeline.lock);
+		c->done = 1;
+		pthread_cond_broadcast(&pipeline.done);
+	}
+	return NULL;
+}
+
+/* writes out finished chunks, waiting until at most max are left */
+static void flush_chunks(int max) {
+	pthread_mutex_lock(&pipeline.lock);
+	while (pipeline.head && (pipeline.head->done || pipeline.pending > max)) {
+		struct outchunk *c = pipeline.head;
+		if (!c->done) {
+			pthread_cond_wait(&pipeline.done, &pipeline.lock);
+			continue;
+		}
+		pipeline.head = c->next;
+		if (!pipeline.head)
+			pipeline.tail = NULL;
+		pipeline.pending--;
+		pthread_mutex_unlock(&pipeline.lock);
+		fwrite(c->res.str, 1, c->res.len, stdout);
+		free(c->res.str);
+		free(c->text);
+		free(c->accs);
+		free(c);
+		pthread_mutex_lock(&pipeline.lock);
+	}
+	pthread_mutex_unlock(&pipeline.lock);
+}
+
+static void start_chunk(void) {
+	chunk = calloc(sizeof *chunk, 1);
+	chunk->f = open_memstream(&chunk->text, &chunk->textlen);
+	out = chunk->f;
+}
+
+static void submit_chunk(int max) {
+	fclose(chunk->f);
+	pthread_mutex_lock(&pipeline.lock);
+	if (pipeline.tail)
+		pipeline.tail->next = chunk;
+	else
+		pipeline.head = chunk;
+	pipeline.tail = chunk;
+	if (!pipeline.todo)
+		pipeline.todo = chunk;
+	pipeline.pending++;
+	pthread_cond_signal(&pipeline.work);
+	pthread_mutex_unlock(&pipeline.lock);
+	chunk = NULL;
+	flush_chunks(max);
+}
+
+/* called before changing a card's variants, which the workers copy */
+static void drain_chunks(void) {
+	if (!chunk)
+		return;
+	submit_chunk(0);
+	start_chunk();
+}
+
+static void *reader_thread(void *arg) {
+	struct mmiotrace *mt = arg;
+	struct mmtbatch *batch;
+	do {
+		batch = read_batch(mt);
+		pthread_mutex_lock(&pipeline.lock);
+		while (pipeline.bpending >= 4)
+			pthread_cond_wait(&pipeline.batches, &pipeline.lock);
+		if (batch) {
+			if (pipeline.btail)
+				pipeline.btail->next = batch;
+			else
+				pipeline.bhead = batch;
+			pipeline.btail = batch;
+			pipeline.bpending++;
+		} else {
+			pipeline.beof = 1;
+		}
+		pthread_cond_broadcast(&pipeline.batches);
+		pthread_mutex_unlock(&pipeline.lock);
+	} while (batch);
+	return NULL;
+}
+
+static struct mmtbatch *next_batch(struct mmiotrace *mt) {
+	struct mmtbatch *batch;
+	if (!pipeline.workers)
+		return read_batch(mt);
+	pthread_mutex_lock(&pipeline.lock);
+	while (!pipeline.bhead && !pipeline.beof)
+		pthread_cond_wait(&pipeline.batches, &pipeline.lock);
+	batch = pipeline.bhead;
+	if (batch) {
+		pipeline.bhead = batch->next;
+		if (!pipeline.bhead)
+			pipeline.btail = NULL;
+		pipeline.bpending--;
+		pthread_cond_broadcast(&pipeline.batches);
+	}
+	pthread_mutex_unlock(&pipeline.lock);
+	return batch;
+}
+
+static void start_threads(int threads, struct mmiotrace *mt) {
+	pthread_t thr;
+	int i;
+	if (threads == 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 1)
+		return;
+	for (i = 0; i < threads - 1; i++) {
+		if (pthread_create(&thr, NULL, format_worker, NULL))
+			break;
+		pthread_detach(thr);
+	}
+	if (!i)
+		return;
+	if (pthread_create(&thr, NULL, reader_thread, mt))
+		return;
+	pthread_detach(thr);
+	pipeline.workers = i;
+}
+
+static char *variant = NULL;
+static unsigned long chip = 0;
+static struct rnndomain *crdom;
+static const struct envy_colors *colors;
+static const struct disisa *ctx_isa, *hwsq_isa;
+static struct varinfo *ctx_var_nv40, *ctx_var_g80;
+static struct varinfo *hwsq_var_nv17, *hwsq_var_nv41, *hwsq_var_g80;
+
+static void do_pcidev(struct rnndb *db, const char *text, size_t len) {
+	uint64_t bar[4], len_[4], pciid;
+	char line[1024];
+	int i;
+	if (len >= sizeof line)
+		len = sizeof line - 1;
+	memcpy(line, text, len);
+	line[len] = 0;
+	sscanf (line, "%*s %*s %"SCNx64" %*s %"SCNx64" %"SCNx64" %"SCNx64" %"SCNx64" %*s %*s %*s %"SCNx64" %"SCNx64" %"SCNx64" %"SCNx64"", &pciid, &bar[0], &bar[1], &bar[2], &bar[3], &len_[0], &len_[1], &len_[2], &len_[3]);
+	if ((pciid >> 16) == 0x10de && bar[0] && (bar[0] & 0xf) == 0 && bar[1] && (bar[1] & 0x1) == 0x0) {
+		struct cctx nc = { 0 };
+		nc.bar0 = bar[0], nc.bar0l = len_[0];
+		nc.bar1 = bar[1], nc.bar1l = len_[1];
+		if (bar[2])
+			nc.bar2 = bar[2], nc.bar2l = len_[2];
+		else
+			nc.bar2 = bar[3], nc.bar2l = len_[3];
+		nc.bar0 &= ~0xf;
+		nc.bar1 &= ~0xf;
+		nc.bar2 &= ~0xf;
+		nc.i2cip = -1;
+		nc.ctx = rnndec_newcontext(db);
+		nc.ctx->colors = colors;
+		rnndec_memo_enable(nc.ctx, 4096);
+		/* The user may have manually specified the chipset */
+		if (variant)
+			rnndec_varadd(nc.ctx, "chipset", variant);
+		else if (chip)
+			rnndec_varaddvalue(nc.ctx, "chipset", chip);
+		for (i = 0; i < 10; i++)
+			nc.i2cb[i].last = 7;
+		apply_memimage(&nc, cctxnum);
+		ADDARRAY(cctx, nc);
+	}
+}
+
+static void do_access(const struct mmtrec *rec) {
+	static double timestamp_old = 0;
+	double timestamp = rec->timestamp;
+	uint64_t addr = rec->addr, value = rec->value;
+	int width = rec->width * 8;
+	char rw = rec->rw;
+	int skip = 0;
+	int cci;
+
+	/* Add a SLEEP line when two mmio accesses are more distant than 100µs */
+	if (!sleep_disabled && timestamp_old > 0 && (timestamp - timestamp_old) > 0.0001)
+		fprintf(out, "SLEEP %lfms\n", (timestamp - timestamp_old)*1000.0);
+	timestamp_old = timestamp;
+
+	for (cci = 0; cci < cctxnum; cci++) {
+		struct cctx *cc = &cctx[cci];
+		if (cc->bar0 && addr >= cc->bar0 && addr < cc->bar0+cc->bar0l) {
+			addr -= cc->bar0;
+			if (cc->hwsqip && addr != cc->hwsqnext) {
+				struct varinfo *var = hwsq_var_nv17;
+				if (cc->chipset.chipset >= 0x41)
+					var = hwsq_var_nv41;
+				if (cc->chipset.card_type == 0x50)
+					var = hwsq_var_g80;
+				envydis(hwsq_isa, out, cc->hwsq, 0, cc->hwsqnext & 0x3fc, var, 0, 0, 0, colors);
+				cc->hwsqip = 0;
+			}
+			/* Seq */
+			if (cc->seq.action == SEQ_SKIP && addr != 0x10a1c4) {
+				cc->seq.action = SEQ_NONE;
+			} else if (cc->seq.action == SEQ_PRINT && addr != 0x10a1c4) {
+				seq_print(out, cc->seq.script, cc->seq.len, cc->ctx, mmiodom);
+				cc->seq.len = 0;
+				cc->seq.action = SEQ_NONE;
+			}
+
+			if (!cc->chipset.chipset) {
+				if (!variant && !chip && addr == 0) {
+					parse_pmc_id(value, &cc->chipset);
+					if (cc->chipset.chipset) {
+						drain_chunks();
+						rnndec_varaddvalue(cc->ctx, "chipset",
+								   cc->chipset.chipset);
+					}
+				}
+			} else if (cc->chipset.card_type >= 0x50 && addr == 0x1700) {
+				cc->praminbase = value << 16;
+			} else if (cc->chipset.card_type == 0x50 && addr == 0x1704) {
+				cc->fakechan = (value & 0xfffffff) << 12;
+			} else if (cc->chipset.card_type == 0x50 && addr == 0x170c) {
+				cc->ramins = (value & 0xffff) << 4;
+			} else if (cc->chipset.card_type >= 0xc0 && addr == 0x1714) {
+				cc->ramins = (value & 0xfffffff) << 12;
+			} else if (addr == 0x6013d4) {
+				cc->crx0 = value & 0xff;
+			} else if (addr == 0x6033d4) {
+				cc->crx1 = value & 0xff;
+			} else if (addr == 0x6013d5) {
+				struct rnndecaddr ai;
+				decode_addr(cc, crdom, cc->crx0, rw == 'W', &ai);
+				char *decoded_val = decode_val(cc, &ai, value);
+				fprintf (out, "[%d] %lf HEAD0 %c     0x%02x       0x%02"PRIx64" %s %s %s\n", cci, timestamp, rw, cc->crx0, value, ai.name, rw=='W'?"<=":"=>", decoded_val);
+				skip = 1;
+			} else if (addr == 0x6033d5) {
+				struct rnndecaddr ai;
+				decode_addr(cc, crdom, cc->crx1, rw == 'W', &ai);
+				char *decoded_val = decode_val(cc, &ai, value);
+				fprintf (out, "[%d] %lf HEAD1 %c     0x%02x       0x%02"PRIx64" %s %s %s\n", cci, timestamp, rw, cc->crx1, value, ai.name, rw=='W'?"<=":"=>", decoded_val);
+				skip = 1;
+			} else if (cc->chipset.card_type >= 0x50 && (addr & 0xfff000) == 0xe000) {
+				int bus = i2c_bus_num(addr);
+				if (bus != -1) {
+					if (cc->i2cip != bus) {
+						if (cc->i2cip != -1)
+							fprintf (out, "\n");
+						struct rnndecaddr ai;
+						decode_addr(cc, mmiodom, addr, rw == 'W', &ai);
+						fprintf (out, "[%d] I2C      0x%06"PRIx64"            %s ", cci, addr, ai.name);
+						cc->i2cip = bus;
+					}
+					if (rw == 'R') {
+						doi2cr(cc, &cc->i2cb[bus], value);
+					} else {
+						doi2cw(cc, &cc->i2cb[bus], value);
+					}
+					skip = 1;
+				}
+			} else if ((addr & 0xfff000) == 0x9000 && (cc->i2cip != -1)) {
+				/* ignore PTIMER meddling during I2C */
+				skip = 1;
+			} else if (addr == 0x1400 || addr == 0x80000 || (addr == cc->hwsqnext && cc->hwsqip)) {
+				if (!cc->hwsqip) {
+					struct rnndecaddr ai;
+					decode_addr(cc, mmiodom, addr, rw == 'W', &ai);
+					fprintf (out, "[%d] HWSQ     0x%06"PRIx64"            %s\n", cci, addr, ai.name);
+				}
+				cc->hwsq[(addr & 0x1fc) + 0] = value;
+				cc->hwsq[(addr & 0x1fc) + 1] = value >> 8;
+				cc->hwsq[(addr & 0x1fc) + 2] = value >> 16;
+				cc->hwsq[(addr & 0x1fc) + 3] = value >> 24;
+				cc->hwsqip = 1;
+				cc->hwsqnext = addr + 4;
+				skip = 1;
+			} else if (addr == 0x10a1c4) {
+				if (cc->seq.action == SEQ_NONE) {
+					/* Crude test whether this vaguely looks like an opcode..
+					 * print will do a more thorough check */
+					if ((value & 0xfc00ffc0) == 0 && value != 0) {
+						cc->seq.action = SEQ_PRINT;
+					} else {
+						cc->seq.action = SEQ_SKIP;
+					}
+				}
+
+				if(cc->seq.action == SEQ_PRINT) {
+					if (cc->seq.len < 2048) {
+						cc->seq.script[cc->seq.len] = value;
+						cc->seq.len++;
+					} else {
+						fprintf(out, "[%d] PDAEMON  %06"PRIx64" Script too long, skipping\n", cci, addr);
+						cc->seq.len = 0;
+						cc->seq.action = SEQ_SKIP;
+					}
+				}
+			} else if (addr == 0x400324 && cc->chipset.card_type >= 0x40 && cc->chipset.card_type <= 0x50) {
+				cc->ctxpos = value;
+			} else if (addr == 0x400328 && cc->chipset.card_type >= 0x40 && cc->chipset.card_type <= 0x50) {
+				uint8_t param[4];
+				param[0] = value;
+				param[1] = value >> 8;
+				param[2] = value >> 16;
+				param[3] = value >> 24;
+				struct rnndecaddr ai;
+				decode_addr(cc, mmiodom, addr, rw == 'W', &ai);
+				fprintf (out, "[%d] MMIO%d %c 0x%06"PRIx64" 0x%08"PRIx64" %s %s ", cci, width, rw, addr, value, ai.name, rw=='W'?"<=":"=>");
+				envydis(ctx_isa, out, param, cc->ctxpos, 1, (cc->chipset.card_type == 0x50 ? ctx_var_g80 : ctx_var_nv40), 0, 0, 0, colors);
+				cc->ctxpos++;
+				skip = 1;
+			}
+			if (!skip && (cc->i2cip != -1)) {
+				fprintf (out, "\n");
+				cc->i2cip = -1;
+			}
+			if (cc->chipset.card_type >= 0x50 && addr >= 0x700000 && addr < 0x800000) {
+				addr -= 0x700000;
+				addr += cc->praminbase;
+				fprintf (out, "[%d] %lf, MEM%d %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, rw=='W'?"<=":"=>", value);
+				*findmem(cc, addr) = value;
+			} else if (!skip) {
+				put_mmio(cc, cci, timestamp, rw, width, addr, value);
+			}
+		} else if (cc->bar1 && addr >= cc->bar1 && addr < cc->bar1+cc->bar1l) {
+			addr -= cc->bar1;
+			fprintf (out, "[%d] %lf, FB%d %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, rw=='W'?"<=":"=>", value);
+		} else if (cc->bar2 && addr >= cc->bar2 && addr < cc->bar2+cc->bar2l) {
+			addr -= cc->bar2;
+			if (cc->chipset.card_type >= 0xc0) {
+				uint64_t pd = *findmem(cc, cc->ramins + 0x200);
+				uint64_t pt = *findmem(cc, pd + 4);
+				pt &= 0xfffffff0;
+				pt <<= 8;
+				uint64_t pg = *findmem(cc, pt + (addr/0x1000) * 8);
+				pg &= 0xfffffff0;
+				pg <<= 8;
+				pg += (addr&0xfff);
+				*findmem(cc, pg) = value;
+//				fprintf (out, "%"PRIx64" %"PRIx64" %"PRIx64" %"PRIx64"\n", ramins, pd, pt, pg);
+				fprintf (out, "[%d] %lf RAMIN%d %"PRIx64" %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, pg, rw=='W'?"<=":"=>", value);
+			} else if (cc->chipset.card_type == 0x50) {
+				uint64_t paddr = addr;
+				paddr += *findmem(cc, cc->fakechan + cc->ramins + 8);
+				paddr += (uint64_t)(*findmem(cc, cc->fakechan + cc->ramins + 12) >> 24) << 32;
+				uint64_t pt = *findmem(cc, cc->fakechan + (cc->chipset.chipset == 0x50 ? 0x1400 : 0x200) + ((paddr >> 29) << 3));
+//				fprintf (out, "%#"PRIx64" PT: %#"PRIx64" %#"PRIx64" ", paddr, fakechan + 0x200 + ((paddr >> 29) << 3), pt);
+				uint32_t div = (pt & 2 ? 0x1000 : 0x10000);
+				pt &= 0xfffff000;
+				uint64_t pg = *findmem(cc, pt + ((paddr&0x1ffff000)/div) * 8);
+				uint64_t pgh = *findmem(cc, pt + ((paddr&0x1ffff000)/div) * 8 + 4);
+//				fprintf (out, "PG: %#"PRIx64" %#"PRIx64"\n", pt + ((paddr&0x1ffff000)/div) * 8, pgh << 32 | pg);
+				pg &= 0xfffff000;
+				pg |= (pgh & 0xff) << 32;
+				pg += (paddr & (div-1));
+				*findmem(cc, pg) = value;
+//				fprintf (out, "%"PRIx64" %"PRIx64" %"PRIx64" %"PRIx64"\n", ramins, pd, pt, pg);
+				fprintf (out, "[%d] %lf RAMIN%d %"PRIx64" %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, pg, rw=='W'?"<=":"=>", value);
+			} else {
+				fprintf (out, "[%d] %lf RAMIN%d %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, rw=='W'?"<=":"=>", value);
+			}
+		}
+	}
+}
+
+/*
+ * Statistics mode.  Instead of decoding every access, count them per
+ * register and per top-level area of the MMIO space, and look for polling
+ * loops: at least POLL_MIN back-to-back reads of one register returning
+ * the same value.  The names are decoded only once per register, when
+ * printing the tables.
+ */
+#define STATS_VALUES 4
+#define POLL_MIN 3
+
+struct regstat {
+	int used;
+	int cci;
+	uint64_t addr;
+	uint64_t reads, writes;
+	/* the first STATS_VALUES distinct values seen, and how often */
+	uint64_t vals[STATS_VALUES];
+	uint64_t valcnt[STATS_VALUES];
+	int valsnum;
+	uint64_t otherval;
+	double first, last, gapmax;
+	uint64_t polls, pollreads;
+	double polltime;
+	char *name;
+	const char *area;
+	int arealen;
+};
+
+struct cardstat {
+	/* the access before this one, for polling detection */
+	int hasprev;
+	uint64_t prevaddr;
+	uint64_t prevval;
+	int prevread;
+	int run;
+	double runstart;
+	uint64_t bar1r, bar1w, bar2r, bar2w;
+};
+
+static struct {
+	struct regstat *regs;
+	uint64_t mask;
+	uint64_t num;
+	struct cardstat *cards;
+	int cardsnum, cardsmax;
+	double first, last;
+	uint64_t accesses;
+} stats;
+
+static struct regstat *stats_reg(int cci, uint64_t addr) {
+	uint64_t i;
+	if (stats.num * 2 >= stats.mask) {
+		struct regstat *old = stats.regs;
+		uint64_t oldsize = stats.mask ? stats.mask + 1 : 0, j;
+		stats.mask = oldsize ? oldsize * 2 - 1 : 4095;
+		stats.regs = calloc(sizeof *stats.regs, stats.mask + 1);
+		for (j = 0; j < oldsize; j++) {
+			if (!old[j].used)
+				continue;
+			for (i = pagehash(old[j].addr << 12) ^ old[j].cci; stats.regs[i & stats.mask].used; i++);
+			stats.regs[i & stats.mask] = old[j];
+		}
+		free(old);
+	}
+	for (i = pagehash(addr << 12) ^ cci; stats.regs[i & stats.mask].used; i++) {
+		struct regstat *rs = &stats.regs[i & stats.mask];
+		if (rs->addr == addr && rs->cci == cci)
+			return rs;
+	}
+	struct regstat *rs = &stats.regs[i & stats.mask];
+	rs->used = 1;
+	rs->cci = cci;
+	rs->addr = addr;
+	stats.num++;
+	return rs;
+}
+
+static void stats_endrun(struct cardstat *cs, int cci, double timestamp) {
+	if (cs->run >= POLL_MIN) {
+		struct regstat *rs = stats_reg(cci, cs->prevaddr);
+		rs->polls++;
+		rs->pollreads += cs->run;
+		rs->polltime += timestamp - cs->runstart;
+	}
+	cs->run = 0;
+}
+
+static void stats_access(const struct mmtrec *rec) {
+	uint64_t addr = rec->addr;
+	int cci;
+	if (!stats.accesses++)
+		stats.first = rec->timestamp;
+	stats.last = rec->timestamp;
+	for (cci = 0; cci < cctxnum; cci++) {
+		struct cctx *cc = &cctx[cci];
+		struct cardstat *cs;
+		while (cci >= stats.cardsnum) {
+			struct cardstat ncs = { 0 };
+			ADDARRAY(stats.cards, ncs);
+		}
+		cs = &stats.cards[cci];
+		if (cc->bar0 && addr >= cc->bar0 && addr < cc->bar0+cc->bar0l) {
+			uint64_t reg = addr - cc->bar0;
+			struct regstat *rs;
+			int i;
+			if (!cc->chipset.chipset && !variant && !chip && reg == 0) {
+				parse_pmc_id(rec->value, &cc->chipset);
+				if (cc->chipset.chipset)
+					rnndec_varaddvalue(cc->ctx, "chipset", cc->chipset.chipset);
+			}
+			rs = stats_reg(cci, reg);
+			if (rec->rw == 'R')
+				rs->reads++;
+			else
+				rs->writes++;
+			if (rs->reads + rs->writes == 1) {
+				rs->first = rec->timestamp;
+			} else if (rec->timestamp - rs->last > rs->gapmax) {
+				rs->gapmax = rec->timestamp - rs->last;
+			}
+			rs->last = rec->timestamp;
+			for (i = 0; i < rs->valsnum && rs->vals[i] != rec->value; i++);
+			if (i < rs->valsnum) {
+				rs->valcnt[i]++;
+			} else if (i < STATS_VALUES) {
+				rs->vals[i] = rec->value;
+				rs->valcnt[i] = 1;
+				rs->valsnum++;
+			} else {
+				rs->otherval++;
+			}
+			if (rec->rw == 'R' && cs->hasprev && cs->prevaddr == reg && cs->prevread && cs->prevval == rec->value) {
+				cs->run++;
+			} else {
+				if (cs->hasprev)
+					stats_endrun(cs, cci, rec->timestamp);
+				cs->run = 1;
+				cs->runstart = rec->timestamp;
+			}
+			cs->hasprev = 1;
+			cs->prevaddr = reg;
+			cs->prevval = rec->value;
+			cs->prevread = rec->rw == 'R';
+		} else if (cc->bar1 && addr >= cc->bar1 && addr < cc->bar1+cc->bar1l) {
+			if (rec->rw == 'R')
+				cs->bar1r++;
+			else
+				cs->bar1w++;
+		} else if (cc->bar2 && addr >= cc->bar2 && addr < cc->bar2+cc->bar2l) {
+			if (rec->rw == 'R')
+				cs->bar2r++;
+			else
+				cs->bar2w++;
+		}
+	}
+}
+
+static int cmp_regs_by_area(const void *a, const void *b) {
+	const struct regstat *ra = *(const struct regstat **)a, *rb = *(const struct regstat **)b;
+	int res;
+	if (ra->cci != rb->cci)
+		return ra->cci - rb->cci;
+	res = strncmp(ra->area, rb->area, min(ra->arealen, rb->arealen));
+	if (res)
+		return res;
+	return ra->arealen - rb->arealen;
+}
+
+static int cmp_regs_by_count(const void *a, const void *b) {
+	const struct regstat *ra = *(const struct regstat **)a, *rb = *(const struct regstat **)b;
+	uint64_t ca = ra->reads + ra->writes, cb = rb->reads + rb->writes;
+	if (ca != cb)
+		return ca < cb ? 1 : -1;
+	if (ra->cci != rb->cci)
+		return ra->cci - rb->cci;
+	return ra->addr < rb->addr ? -1 : ra->addr > rb->addr;
+}
+
+static void print_values(struct regstat *rs) {
+	int i;
+	for (i = 0; i < rs->valsnum; i++)
+		printf("%s0x%"PRIx64":%"PRIu64, i ? " " : "", rs->vals[i], rs->valcnt[i]);
+	if (rs->otherval)
+		printf(" other:%"PRIu64, rs->otherval);
+}
+
+static void print_stats(int csv) {
+	struct regstat **regs = malloc(sizeof *regs * (stats.num + 1));
+	uint64_t i, n = 0, j;
+	int cci;
+	/* finish the runs still going at the end */
+	for (cci = 0; cci < stats.cardsnum; cci++)
+		if (stats.cards[cci].hasprev)
+			stats_endrun(&stats.cards[cci], cci, stats.last);
+	for (i = 0; stats.regs && i <= stats.mask; i++) {
+		struct regstat *rs = &stats.regs[i];
+		struct rnndecaddr ai;
+		if (!rs->used)
+			continue;
+		rs->name = strdup(decode_addr(&cctx[rs->cci], mmiodom, rs->addr, !rs->reads, &ai));
+		/* the area is the top-level name, up to the first separator */
+		if (ai.reg) {
+			rs->area = rs->name;
+			rs->arealen = strcspn(rs->name, ".[+(");
+		} else {
+			rs->area = "(unknown)";
+			rs->arealen = strlen(rs->area);
+		}
+		regs[n++] = rs;
+	}
+
+	if (csv)
+		printf("kind,card,address,name,reads,writes,polls,poll_reads,poll_time_us,avg_gap_us,max_gap_us,values\n");
+	else
+		printf("%"PRIu64" accesses over %lfs, %"PRIu64" registers\n\n", stats.accesses, stats.last - stats.first, n);
+
+	/* areas, in order of accesses, with the card's BAR1 and BAR2 accesses added as areas */
+	struct {
+		int cci;
+		const char *name;
+		int namelen;
+		uint64_t regs, reads, writes, polls, pollreads;
+		double polltime;
+	} *areas = NULL;
+	int areasnum = 0, areasmax = 0, k, l;
+	qsort(regs, n, sizeof *regs, cmp_regs_by_area);
+	for (i = 0; i < n; i = j) {
+		typeof(*areas) area = { regs[i]->cci, regs[i]->area, regs[i]->arealen };
+		for (j = i; j < n && !cmp_regs_by_area(&regs[i], &regs[j]); j++) {
+			area.regs++;
+			area.reads += regs[j]->reads;
+			area.writes += regs[j]->writes;
+			area.polls += regs[j]->polls;
+			area.pollreads += regs[j]->pollreads;
+			area.polltime += regs[j]->polltime;
+		}
+		ADDARRAY(areas, area);
+	}
+	for (cci = 0; cci < stats.cardsnum; cci++) {
+		struct cardstat *cs = &stats.cards[cci];
+		typeof(*areas) bar1 = { cci, "BAR1", 4, 0, cs->bar1r, cs->bar1w };
+		typeof(*areas) bar2 = { cci, "BAR2", 4, 0, cs->bar2r, cs->bar2w };
+		if (cs->bar1r + cs->bar1w)
+			ADDARRAY(areas, bar1);
+		if (cs->bar2r + cs->bar2w)
+			ADDARRAY(areas, bar2);
+	}
+	/* a plain insertion sort, there are few areas */
+	for (k = 1; k < areasnum; k++) {
+		typeof(*areas) tmp = areas[k];
+		for (l = k; l > 0 && areas[l-1].reads + areas[l-1].writes < tmp.reads + tmp.writes; l--)
+			areas[l] = areas[l-1];
+		areas[l] = tmp;
+	}
+	if (!csv)
+		printf("card area                       regs       reads      writes   polls  poll reads  poll time\n");
+	for (k = 0; k < areasnum; k++) {
+		if (csv)
+			printf("area,%d,,%.*s,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%.0lf,,,\n", areas[k].cci, areas[k].namelen, areas[k].name, areas[k].reads, areas[k].writes, areas[k].polls, areas[k].pollreads, areas[k].polltime * 1e6);
+		else
+			printf("[%d]  %-24.*s %6"PRIu64" %11"PRIu64" %11"PRIu64" %7"PRIu64" %11"PRIu64" %9.3lfms\n", areas[k].cci, areas[k].namelen, areas[k].name, areas[k].regs, areas[k].reads, areas[k].writes, areas[k].polls, areas[k].pollreads, areas[k].polltime * 1e3);
+	}
+
+	qsort(regs, n, sizeof *regs, cmp_regs_by_count);
+	if (!csv)
+		printf("\ncard address        reads      writes   polls  poll reads  poll time  avg gap     max gap     name / values\n");
+	for (i = 0; i < n; i++) {
+		struct regstat *rs = regs[i];
+		uint64_t cnt = rs->reads + rs->writes;
+		double avg = cnt > 1 ? (rs->last - rs->first) / (cnt - 1) : 0;
+		if (csv) {
+			printf("reg,%d,0x%06"PRIx64",%s,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%.0lf,%.1lf,%.0lf,", rs->cci, rs->addr, rs->name, rs->reads, rs->writes, rs->polls, rs->pollreads, rs->polltime * 1e6, avg * 1e6, rs->gapmax * 1e6);
+		} else {
+			printf("[%d]  0x%06"PRIx64" %11"PRIu64" %11"PRIu64" %7"PRIu64" %11"PRIu64" %9.3lfms %9.1lfus %9.0lfus %s ", rs->cci, rs->addr, rs->reads, rs->writes, rs->polls, rs->pollreads, rs->polltime * 1e3, avg * 1e6, rs->gapmax * 1e6, rs->name);
+		}
+		print_values(rs);
+		printf("\n");
+	}
+	for (i = 0; i < n; i++)
+		free(regs[i]->name);
+	free(regs);
+	free(areas);
+}
+
 int main(int argc, char **argv) {
 	char *file = NULL;
-	char *variant = NULL;
-	unsigned long chip = 0;
+	char *loadmem = NULL, *savemem = NULL;
+	int threads = 1;
+	int stats_mode = 0;
 	int c,use_colors=1;
-	while ((c = getopt (argc, argv, "f:ca:h")) != -1) {
+	static const struct option long_options[] = {
+		{ "stats", optional_argument, NULL, 'S' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	while ((c = getopt_long (argc, argv, "f:ca:j:l:s:S::h", long_options, NULL)) != -1) {
 		switch (c) {
 			case 'a':
 				chip = strtoull(optarg, NULL, 16);
@@ -245,6 +1274,33 @@ int main(int argc, char **argv) {
 				use_colors = 0;
 				break;
 			}
+			case 'j':{
+				threads = strtol(optarg, NULL, 0);
+				if (threads < 0) {
+					fprintf(stderr, "-j accepts only non-negative numbers\n");
+					return 1;
+				}
+				break;
+			}
+			case 'l':{
+				loadmem = optarg;
+				break;
+			}
+			case 's':{
+				savemem = optarg;
+				break;
+			}
+			case 'S':{
+				if (!optarg)
+					stats_mode = 1;
+				else if (!strcmp(optarg, "csv"))
+					stats_mode = 2;
+				else {
+					fprintf(stderr, "Unknown stats format %s\n", optarg);
+					return 1;
+				}
+				break;
+			}
 			case 'h':{
 				print_help();
 				return 0;
@@ -256,286 +1312,78 @@ int main(int argc, char **argv) {
 	}
 	rnn_init();
 
-	struct rnndb *db = rnn_newdb();
-	rnn_parsefile (db, "nv_mmio.xml");
-	rnn_prepdb (db);
-	struct rnndomain *mmiodom = rnn_finddomain(db, "NV_MMIO");
-	struct rnndomain *crdom = rnn_finddomain(db, "NV_CR");
-	FILE *fin = (file==NULL) ? stdin : open_input(file);
-	if (!fin) {
+	struct rnndb *db = rnn_loaddb ("nv_mmio.xml");
+	mmiodom = rnn_finddomain(db, "NV_MMIO");
+	crdom = rnn_finddomain(db, "NV_CR");
+	struct mmiotrace *mt = mmiotrace_open(file, 0);
+	if (!mt) {
 		fprintf (stderr, "Failed to open input file!\n");
 		return 1;
 	}
+	if (loadmem && load_memimage(loadmem))
+		return 1;
 
-	char line[1024];
-	int i;
-	const struct disisa *ctx_isa = ed_getisa("ctx");
-	struct varinfo *ctx_var_nv40 = varinfo_new(ctx_isa->vardata);
-	struct varinfo *ctx_var_g80 = varinfo_new(ctx_isa->vardata);
+	ctx_isa = ed_getisa("ctx");
+	ctx_var_nv40 = varinfo_new(ctx_isa->vardata);
+	ctx_var_g80 = varinfo_new(ctx_isa->vardata);
 	varinfo_set_variant(ctx_var_nv40, "nv40");
 	varinfo_set_variant(ctx_var_g80, "g80");
-	const struct disisa *hwsq_isa = ed_getisa("hwsq");
-	struct varinfo *hwsq_var_nv17 = varinfo_new(hwsq_isa->vardata);
-	struct varinfo *hwsq_var_nv41 = varinfo_new(hwsq_isa->vardata);
-	struct varinfo *hwsq_var_g80 = varinfo_new(hwsq_isa->vardata);
+	hwsq_isa = ed_getisa("hwsq");
+	hwsq_var_nv17 = varinfo_new(hwsq_isa->vardata);
+	hwsq_var_nv41 = varinfo_new(hwsq_isa->vardata);
+	hwsq_var_g80 = varinfo_new(hwsq_isa->vardata);
 	varinfo_set_variant(hwsq_var_nv17, "nv17");
 	varinfo_set_variant(hwsq_var_nv41, "nv41");
 	varinfo_set_variant(hwsq_var_g80, "g80");
-	const struct envy_colors *colors = use_colors ? &envy_def_colors : &envy_null_colors;
-	while (1) {
-		/* yes, static buffer. but mmiotrace lines are bound to have sane length anyway. */
-		if (!fgets(line, sizeof(line), fin))
-			break;
-		if (!strncmp(line, "PCIDEV ", 7)) {
-			uint64_t bar[4], len[4], pciid;
-			sscanf (line, "%*s %*s %"SCNx64" %*s %"SCNx64" %"SCNx64" %"SCNx64" %"SCNx64" %*s %*s %*s %"SCNx64" %"SCNx64" %"SCNx64" %"SCNx64"", &pciid, &bar[0], &bar[1], &bar[2], &bar[3], &len[0], &len[1], &len[2], &len[3]);
-			if ((pciid >> 16) == 0x10de && bar[0] && (bar[0] & 0xf) == 0 && bar[1] && (bar[1] & 0x1) == 0x0) {
-				struct cctx nc = { 0 };
-				nc.bar0 = bar[0], nc.bar0l = len[0];
-				nc.bar1 = bar[1], nc.bar1l = len[1];
-				if (bar[2])
-					nc.bar2 = bar[2], nc.bar2l = len[2];
-				else
-					nc.bar2 = bar[3], nc.bar2l = len[3];
-				nc.bar0 &= ~0xf;
-				nc.bar1 &= ~0xf;
-				nc.bar2 &= ~0xf;
-				nc.i2cip = -1;
-				nc.ctx = rnndec_newcontext(db);
-				nc.ctx->colors = colors;
-				for (i = 0; i < 10; i++)
-					nc.i2cb[i].last = 7;
-				ADDARRAY(cctx, nc);
-			}
-			printf ("%s", line);
-		} else if (!strncmp(line, "W ", 2) || !strncmp(line, "R ", 2)) {
-			int skip = 0;
-			static double timestamp, timestamp_old = 0;
-			uint64_t addr, value;
-			int width;
-			int cci;
-			sscanf (line, "%*s %d %lf %*d %"SCNx64" %"SCNx64, &width, &timestamp, &addr, &value);
-			width *= 8;
-
-			/* Add a SLEEP line when two mmio accesses are more distant than 100µs */
-			if (!sleep_disabled && timestamp_old > 0 && (timestamp - timestamp_old) > 0.0001)
-				printf("SLEEP %lfms\n", (timestamp - timestamp_old)*1000.0);
-			timestamp_old = timestamp;
-
-			for (cci = 0; cci < cctxnum; cci++) {
-				struct cctx *cc = &cctx[cci];
-				if (cc->bar0 && addr >= cc->bar0 && addr < cc->bar0+cc->bar0l) {
-					addr -= cc->bar0;
-					if (cc->hwsqip && addr != cc->hwsqnext) {
-						struct varinfo *var = hwsq_var_nv17;
-						if (cc->chipset.chipset >= 0x41)
-							var = hwsq_var_nv41;
-						if (cc->chipset.card_type == 0x50)
-							var = hwsq_var_g80;
-						envydis(hwsq_isa, stdout, cc->hwsq, 0, cc->hwsqnext & 0x3fc, var, 0, 0, 0, colors);
-						cc->hwsqip = 0;
-					}
-					/* Seq */
-					if (cc->seq.action == SEQ_SKIP && addr != 0x10a1c4) {
-						cc->seq.action = SEQ_NONE;
-					} else if (cc->seq.action == SEQ_PRINT && addr != 0x10a1c4) {
-						seq_print(cc->seq.script, cc->seq.len, cc->ctx, mmiodom);
-						cc->seq.len = 0;
-						cc->seq.action = SEQ_NONE;
-					}
+	colors = use_colors && !stats_mode ? &envy_def_colors : &envy_null_colors;
+	/* counting is cheap, there's nothing for the workers to do */
+	if (stats_mode)
+		threads = 1;
 
-					if (!cc->chipset.chipset) {
-						/* The user may have manually specified this */
-						if (variant) {
-							rnndec_varadd(cc->ctx, "chipset", variant);
-						} else if (chip) {
-							rnndec_varaddvalue(cc->ctx, "chipset", chip);
-						} else if (addr == 0) {
-							parse_pmc_id(value, &cc->chipset);
-							if (cc->chipset.chipset)
-								rnndec_varaddvalue(cc->ctx, "chipset",
-										   cc->chipset.chipset);
-						}
-					} else if (cc->chipset.card_type >= 0x50 && addr == 0x1700) {
-						cc->praminbase = value << 16;
-					} else if (cc->chipset.card_type == 0x50 && addr == 0x1704) {
-						cc->fakechan = (value & 0xfffffff) << 12;
-					} else if (cc->chipset.card_type == 0x50 && addr == 0x170c) {
-						cc->ramins = (value & 0xffff) << 4;
-					} else if (cc->chipset.card_type >= 0xc0 && addr == 0x1714) {
-						cc->ramins = (value & 0xfffffff) << 12;
-					} else if (addr == 0x6013d4) {
-						cc->crx0 = value & 0xff;
-					} else if (addr == 0x6033d4) {
-						cc->crx1 = value & 0xff;
-					} else if (addr == 0x6013d5) {
-						struct rnndecaddrinfo *ai = rnndec_decodeaddr(cc->ctx, crdom, cc->crx0, line[0] == 'W');
-						char *decoded_val = rnndec_decodeval(cc->ctx, ai->typeinfo, value, ai->width);
-						printf ("[%d] %lf HEAD0 %c     0x%02x       0x%02"PRIx64" %s %s %s\n", cci, timestamp, line[0], cc->crx0, value, ai->name, line[0]=='W'?"<=":"=>", decoded_val);
-						rnndec_free_decaddrinfo(ai);
-						free(decoded_val);
-						skip = 1;
-					} else if (addr == 0x6033d5) {
-						struct rnndecaddrinfo *ai = rnndec_decodeaddr(cc->ctx, crdom, cc->crx1, line[0] == 'W');
-						char *decoded_val = rnndec_decodeval(cc->ctx, ai->typeinfo, value, ai->width);
-						printf ("[%d] %lf HEAD1 %c     0x%02x       0x%02"PRIx64" %s %s %s\n", cci, timestamp, line[0], cc->crx1, value, ai->name, line[0]=='W'?"<=":"=>", decoded_val);
-						rnndec_free_decaddrinfo(ai);
-						free(decoded_val);
-						skip = 1;
-					} else if (cc->chipset.card_type >= 0x50 && (addr & 0xfff000) == 0xe000) {
-						int bus = i2c_bus_num(addr);
-						if (bus != -1) {
-							if (cc->i2cip != bus) {
-								if (cc->i2cip != -1)
-									printf ("\n");
-								struct rnndecaddrinfo *ai = rnndec_decodeaddr(cc->ctx, mmiodom, addr, line[0] == 'W');
-								printf ("[%d] I2C      0x%06"PRIx64"            %s ", cci, addr, ai->name);
-								rnndec_free_decaddrinfo(ai);
-								cc->i2cip = bus;
-							}
-							if (line[0] == 'R') {
-								doi2cr(cc, &cc->i2cb[bus], value);
-							} else {
-								doi2cw(cc, &cc->i2cb[bus], value);
-							}
-							skip = 1;
-						}
-					} else if ((addr & 0xfff000) == 0x9000 && (cc->i2cip != -1)) {
-						/* ignore PTIMER meddling during I2C */
-						skip = 1;
-					} else if (addr == 0x1400 || addr == 0x80000 || (addr == cc->hwsqnext && cc->hwsqip)) {
-						if (!cc->hwsqip) {
-							struct rnndecaddrinfo *ai = rnndec_decodeaddr(cc->ctx, mmiodom, addr, line[0] == 'W');
-							printf ("[%d] HWSQ     0x%06"PRIx64"            %s\n", cci, addr, ai->name);
-							rnndec_free_decaddrinfo(ai);
-						}
-						cc->hwsq[(addr & 0x1fc) + 0] = value;
-						cc->hwsq[(addr & 0x1fc) + 1] = value >> 8;
-						cc->hwsq[(addr & 0x1fc) + 2] = value >> 16;
-						cc->hwsq[(addr & 0x1fc) + 3] = value >> 24;
-						cc->hwsqip = 1;
-						cc->hwsqnext = addr + 4;
-						skip = 1;
-					} else if (addr == 0x10a1c4) {
-						if (cc->seq.action == SEQ_NONE) {
-							/* Crude test whether this vaguely looks like an opcode..
-							 * print will do a more thorough check */
-							if ((value & 0xfc00ffc0) == 0 && value != 0) {
-								cc->seq.action = SEQ_PRINT;
-							} else {
-								cc->seq.action = SEQ_SKIP;
-							}
-						}
-
-						if(cc->seq.action == SEQ_PRINT) {
-							if (cc->seq.len < 2048) {
-								cc->seq.script[cc->seq.len] = value;
-								cc->seq.len++;
-							} else {
-								printf("[%d] PDAEMON  %06"PRIx64" Script too long, skipping\n", cci, addr);
-								cc->seq.len = 0;
-								cc->seq.action = SEQ_SKIP;
-							}
-						}
-					} else if (addr == 0x400324 && cc->chipset.card_type >= 0x40 && cc->chipset.card_type <= 0x50) {
-						cc->ctxpos = value;
-					} else if (addr == 0x400328 && cc->chipset.card_type >= 0x40 && cc->chipset.card_type <= 0x50) {
-						uint8_t param[4];
-						param[0] = value;
-						param[1] = value >> 8;
-						param[2] = value >> 16;
-						param[3] = value >> 24;
-						struct rnndecaddrinfo *ai = rnndec_decodeaddr(cc->ctx, mmiodom, addr, line[0] == 'W');
-						printf ("[%d] MMIO%d %c 0x%06"PRIx64" 0x%08"PRIx64" %s %s ", cci, width, line[0], addr, value, ai->name, line[0]=='W'?"<=":"=>");
-						envydis(ctx_isa, stdout, param, cc->ctxpos, 1, (cc->chipset.card_type == 0x50 ? ctx_var_g80 : ctx_var_nv40), 0, 0, 0, colors);
-						cc->ctxpos++;
-						rnndec_free_decaddrinfo(ai);
-						skip = 1;
-					}
-					if (!skip && (cc->i2cip != -1)) {
-						printf ("\n");
-						cc->i2cip = -1;
-					}
-					if (cc->chipset.card_type >= 0x50 && addr >= 0x700000 && addr < 0x800000) {
-						addr -= 0x700000;
-						addr += cc->praminbase;
-						printf ("[%d] %lf, MEM%d %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, line[0]=='W'?"<=":"=>", value);
-						*findmem(cc, addr) = value;
-					} else if (!skip) {
-						struct rnndecaddrinfo *ai = rnndec_decodeaddr(cc->ctx, mmiodom, addr, line[0] == 'W');
-						if (width == 32 && ai->width == 8) {
-							/* 32-bit write to 8-bit location - split it up */
-							int b;
-							rnndec_free_decaddrinfo(ai);
-							int cnt;
-							for (b = 0; b < 4; b++) {
-								struct rnndecaddrinfo *ai = rnndec_decodeaddr(cc->ctx, mmiodom, addr+b, line[0] == 'W');
-								char *decoded_val = rnndec_decodeval(cc->ctx, ai->typeinfo, value >> b * 8 & 0xff, ai->width);
-								if (b == 0) {
-									printf ("[%d] %lf MMIO%d %c 0x%06"PRIx64" 0x%08"PRIx64" %n%s %s %s\n", cci, timestamp, width, line[0], addr, value, &cnt, ai->name, line[0]=='W'?"<=":"=>", decoded_val);
-								} else {
-									int c;
-									for (c = 0; c < cnt; c++)
-										printf(" ");
-									printf ("%s %s %s\n", ai->name, line[0]=='W'?"<=":"=>", decoded_val);
-								}
-								rnndec_free_decaddrinfo(ai);
-								free(decoded_val);
-							}
-						} else {
-							char *decoded_val = rnndec_decodeval(cc->ctx, ai->typeinfo, value, ai->width);
-							printf ("[%d] %lf MMIO%d %c 0x%06"PRIx64" 0x%08"PRIx64" %s %s %s\n", cci, timestamp, width, line[0], addr, value, ai->name, line[0]=='W'?"<=":"=>", decoded_val);
-							free(ai->name);
-							free(ai);
-							free(decoded_val);
-						}
-					}
-				} else if (cc->bar1 && addr >= cc->bar1 && addr < cc->bar1+cc->bar1l) {
-					addr -= cc->bar1;
-					printf ("[%d] %lf, FB%d %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, line[0]=='W'?"<=":"=>", value);
-				} else if (cc->bar2 && addr >= cc->bar2 && addr < cc->bar2+cc->bar2l) {
-					addr -= cc->bar2;
-					if (cc->chipset.card_type >= 0xc0) {
-						uint64_t pd = *findmem(cc, cc->ramins + 0x200);
-						uint64_t pt = *findmem(cc, pd + 4);
-						pt &= 0xfffffff0;
-						pt <<= 8;
-						uint64_t pg = *findmem(cc, pt + (addr/0x1000) * 8);
-						pg &= 0xfffffff0;
-						pg <<= 8;
-						pg += (addr&0xfff);
-						*findmem(cc, pg) = value;
-	//					printf ("%"PRIx64" %"PRIx64" %"PRIx64" %"PRIx64"\n", ramins, pd, pt, pg);
-						printf ("[%d] %lf RAMIN%d %"PRIx64" %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, pg, line[0]=='W'?"<=":"=>", value);
-					} else if (cc->chipset.card_type == 0x50) {
-						uint64_t paddr = addr;
-						paddr += *findmem(cc, cc->fakechan + cc->ramins + 8);
-						paddr += (uint64_t)(*findmem(cc, cc->fakechan + cc->ramins + 12) >> 24) << 32;
-						uint64_t pt = *findmem(cc, cc->fakechan + (cc->chipset.chipset == 0x50 ? 0x1400 : 0x200) + ((paddr >> 29) << 3));
-	//					printf ("%#"PRIx64" PT: %#"PRIx64" %#"PRIx64" ", paddr, fakechan + 0x200 + ((paddr >> 29) << 3), pt);
-						uint32_t div = (pt & 2 ? 0x1000 : 0x10000);
-						pt &= 0xfffff000;
-						uint64_t pg = *findmem(cc, pt + ((paddr&0x1ffff000)/div) * 8);
-						uint64_t pgh = *findmem(cc, pt + ((paddr&0x1ffff000)/div) * 8 + 4);
-	//					printf ("PG: %#"PRIx64" %#"PRIx64"\n", pt + ((paddr&0x1ffff000)/div) * 8, pgh << 32 | pg);
-						pg &= 0xfffff000;
-						pg |= (pgh & 0xff) << 32;
-						pg += (paddr & (div-1));
-						*findmem(cc, pg) = value;
-	//					printf ("%"PRIx64" %"PRIx64" %"PRIx64" %"PRIx64"\n", ramins, pd, pt, pg);
-						printf ("[%d] %lf RAMIN%d %"PRIx64" %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, pg, line[0]=='W'?"<=":"=>", value);
-					} else {
-						printf ("[%d] %lf RAMIN%d %"PRIx64" %s %"PRIx64"\n", cci, timestamp, width, addr, line[0]=='W'?"<=":"=>", value);
-					}
-				}
+	struct mmtbatch *batch;
+	out = stdout;
+	start_threads(threads, mt);
+	while ((batch = next_batch(mt))) {
+		int i;
+		if (pipeline.workers)
+			start_chunk();
+		for (i = 0; i < batch->recsnum; i++) {
+			struct mmtrec *rec = &batch->recs[i];
+			switch (rec->type) {
+				case REC_ACCESS:
+					if (stats_mode)
+						stats_access(rec);
+					else
+						do_access(rec);
+					break;
+				case REC_PCIDEV:
+					do_pcidev(db, batch->text + rec->start, rec->len);
+					if (!stats_mode)
+						fwrite(batch->text + rec->start, 1, rec->len, out);
+					break;
+				case REC_LINE:
+					if (!stats_mode)
+						fwrite(batch->text + rec->start, 1, rec->len, out);
+					break;
 			}
-		} else {
-			printf ("%s", line);
 		}
+		if (pipeline.workers)
+			submit_chunk(MAX_PENDING_CHUNKS(pipeline.workers));
+		free(batch->text);
+		free(batch->recs);
+		free(batch);
 	}
+	if (pipeline.workers)
+		flush_chunks(0);
+	if (stats_mode)
+		print_stats(stats_mode == 2);
+	fflush(stdout);
+	if (savemem && save_memimage(savemem))
+		return 1;
 
+	mmiotrace_close(mt);
 	rnn_freedb(db);
 	rnn_fini();
 
-	return 0;
+	return input_failed;
 }
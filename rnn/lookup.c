@@ -57,8 +57,6 @@ int main(int argc, char **argv) {
 	if (argc < 2) {
 		usage();
 	}
-	struct rnndb *db = rnn_newdb();
-
 	/* Arguments parsing */
 	while ((c = getopt (argc, argv, "f:a:d:e:b:c")) != -1) {
 		switch (c) {
@@ -93,8 +91,7 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	rnn_parsefile (db, file);
-	rnn_prepdb (db);
+	struct rnndb *db = rnn_loaddb (file);
 	vc = rnndec_newcontext(db);
 	if(colors)
 		vc->colors = &envy_def_colors;
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "rnn.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+void usage()
+{
+	printf ("Usage:\n"
+			"\tmkrnncache file.xml...\n"
+			"\n"
+			"Precompiles the given databases into the first directory of $RNN_CACHE.\n"
+		);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	int i, ret = 0;
+	rnn_init();
+	if (argc < 2) {
+		usage();
+	}
+	for (i = 1; i < argc; i++) {
+		char *cachefile = rnn_cachefile(argv[i]);
+		if (!cachefile) {
+			fprintf (stderr, "RNN_CACHE is empty, not caching anything.\n");
+			ret = 1;
+			break;
+		}
+		char *slash = strrchr(cachefile, '/');
+		if (slash) {
+			*slash = 0;
+			if (mkdir(cachefile, 0777) && errno != EEXIST) {
+				perror(cachefile);
+				free(cachefile);
+				ret = 1;
+				break;
+			}
+			*slash = '/';
+		}
+		struct rnndb *db = rnn_newdb();
+		rnn_parsefile (db, argv[i]);
+		rnn_prepdb (db);
+		if (db->estatus || rnn_writecache(db, cachefile))
+			ret = 1;
+		rnn_freedb(db);
+		free(cachefile);
+	}
+	rnn_fini();
+	return ret;
+}
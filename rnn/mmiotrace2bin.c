@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mmiotrace.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char **argv) {
+	struct mmiotrace *mt;
+	struct mmiotrace_writer *w;
+	struct mmiotrace_rec rec;
+	FILE *out;
+	int res;
+	if (argc != 3) {
+		fprintf(stderr, "Usage: mmiotrace2bin <input> <output>\n"
+				"Converts a text mmiotrace (possibly compressed, - for stdin) to the\n"
+				"binary format read by demmio and nvammiotracereplay.\n");
+		return 1;
+	}
+	mt = mmiotrace_open(strcmp(argv[1], "-") ? argv[1] : NULL, 0);
+	if (!mt) {
+		perror(argv[1]);
+		return 1;
+	}
+	out = strcmp(argv[2], "-") ? fopen(argv[2], "wb") : stdout;
+	if (!out) {
+		perror(argv[2]);
+		return 1;
+	}
+	w = mmiotrace_writer_new(out);
+	while ((res = mmiotrace_read(mt, &rec)) > 0)
+		mmiotrace_write(w, &rec);
+	if (res < 0)
+		fprintf(stderr, "%s: truncated or corrupt trace\n", argv[1]);
+	if (mmiotrace_writer_finish(w) || (out != stdout && fclose(out))) {
+		perror(argv[2]);
+		return 1;
+	}
+	mmiotrace_close(mt);
+	return res < 0;
+}
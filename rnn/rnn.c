@@ -35,6 +35,7 @@
 #include <limits.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <sys/mman.h>
 #include "rnn.h"
 #include "rnn/rnn_path.h"
 #include "util.h"
@@ -1472,6 +1473,11 @@ static void freegroup(struct rnngroup *group) {
 void rnn_freedb (struct rnndb *db) {
 	int i;
 
+	if (db->cachemap) {
+		munmap(db->cachemap, db->cachesize);
+		return;
+	}
+
 	for (i = 0; i < db->enumsnum; i++)
 		freeenum(db->enums[i]);
 	free(db->enums);
@@ -0,0 +1,679 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Precompiled rnndb databases.
+ *
+ * A cache file is a snapshot of a prepared struct rnndb: every object
+ * reachable from the db is laid out in a single blob, pointers are stored
+ * as blob offsets and listed in a relocation table.  Loading is a private
+ * mmap of the file followed by adding the mapping base to every listed
+ * pointer, so no XML is touched at all.  The header records every source
+ * file the db was built from by its name relative to RNN_PATH, its size and
+ * a hash of its contents, and the cache is ignored as soon as any of them
+ * no longer matches what RNN_PATH finds.  That keeps the cache valid when
+ * it's installed together with the XML, wherever they end up.
+ *
+ * RNN_CACHE is a colon-separated list of directories like RNN_PATH.  The
+ * first cache that is fresh gets loaded, mkrnncache writes to the first
+ * directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rnn.h"
+#include "rnn/rnn_path.h"
+#include "util.h"
+
+#define RNNCACHE_MAGIC "RNNCACHE"
+#define RNNCACHE_VERSION 2
+
+struct rnncache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t layout;
+	uint64_t size;
+	uint64_t db;
+	uint64_t relocs;
+	uint64_t relocsnum;
+	uint64_t sources;
+	uint64_t sourcesnum;
+};
+
+struct rnncache_source {
+	/* relative to the RNN_PATH directory it was found in */
+	uint64_t name;
+	uint64_t size;
+	uint64_t hash;
+};
+
+/* changes whenever the in-memory representation of the db does */
+static uint32_t cache_layout(void) {
+	static const size_t sizes[] = {
+		sizeof(void *), sizeof(int), sizeof(uint64_t),
+		sizeof(struct rnnauthor), sizeof(struct rnncopyright),
+		sizeof(struct rnndb), sizeof(struct rnnvarset),
+		sizeof(struct rnnvarinfo), sizeof(struct rnnenum),
+		sizeof(struct rnnvalue), sizeof(struct rnntypeinfo),
+		sizeof(struct rnnbitset), sizeof(struct rnnbitfield),
+		sizeof(struct rnndomain), sizeof(struct rnngroup),
+		sizeof(struct rnndelem), sizeof(struct rnnspectype),
+	};
+	uint32_t res = 0x12345678;
+	int i;
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+		res = res * 31 + sizes[i];
+	return res;
+}
+
+struct cachewriter {
+	uint8_t *data;
+	size_t len;
+	size_t max;
+	uint64_t *relocs;
+	int relocsnum;
+	int relocsmax;
+	/* object address -> blob offset, so that shared objects stay shared */
+	struct {
+		const void *ptr;
+		uint64_t off;
+	} *map;
+	size_t mapsize;
+	size_t mapnum;
+	/* contents -> blob offset, equal strings and variant masks are stored once */
+	struct {
+		uint64_t off;
+		size_t len;
+	} *blobs;
+	size_t blobssize;
+	size_t blobsnum;
+};
+
+static uint64_t cw_reserve(struct cachewriter *cw, size_t size, size_t align) {
+	uint64_t off = (cw->len + align - 1) & ~(align - 1);
+	if (off + size > cw->max) {
+		size_t nmax = cw->max ? cw->max : 0x10000;
+		while (off + size > nmax)
+			nmax *= 2;
+		cw->data = realloc(cw->data, nmax);
+		cw->max = nmax;
+	}
+	memset(cw->data + cw->len, 0, off + size - cw->len);
+	cw->len = off + size;
+	return off;
+}
+
+static size_t cw_hash(const void *ptr, size_t size) {
+	uintptr_t v = (uintptr_t)ptr;
+	v ^= v >> 17;
+	v *= 0x9e3779b1;
+	return (v ^ v >> 13) & (size - 1);
+}
+
+static int cw_find(struct cachewriter *cw, const void *ptr, uint64_t *off) {
+	size_t i;
+	if (!cw->mapsize)
+		return 0;
+	for (i = cw_hash(ptr, cw->mapsize); cw->map[i].ptr; i = (i + 1) & (cw->mapsize - 1))
+		if (cw->map[i].ptr == ptr) {
+			*off = cw->map[i].off;
+			return 1;
+		}
+	return 0;
+}
+
+static void cw_remember(struct cachewriter *cw, const void *ptr, uint64_t off) {
+	size_t i;
+	if (cw->mapnum * 2 >= cw->mapsize) {
+		size_t osize = cw->mapsize;
+		__typeof__(cw->map) omap = cw->map;
+		cw->mapsize = osize ? osize * 2 : 0x1000;
+		cw->map = calloc(cw->mapsize, sizeof *cw->map);
+		cw->mapnum = 0;
+		for (i = 0; i < osize; i++)
+			if (omap[i].ptr)
+				cw_remember(cw, omap[i].ptr, omap[i].off);
+		free(omap);
+	}
+	for (i = cw_hash(ptr, cw->mapsize); cw->map[i].ptr; i = (i + 1) & (cw->mapsize - 1));
+	cw->map[i].ptr = ptr;
+	cw->map[i].off = off;
+	cw->mapnum++;
+}
+
+/* copies an object verbatim; every pointer in it must then be set with cw_ptr */
+static uint64_t cw_copy(struct cachewriter *cw, const void *ptr, size_t size) {
+	uint64_t off = cw_reserve(cw, size, 8);
+	memcpy(cw->data + off, ptr, size);
+	cw_remember(cw, ptr, off);
+	return off;
+}
+
+static void cw_ptr(struct cachewriter *cw, uint64_t slot, uint64_t target) {
+	uintptr_t val = target;
+	memcpy(cw->data + slot, &val, sizeof val);
+	if (target)
+		ADDARRAY(cw->relocs, slot);
+}
+
+static uint64_t cw_array(struct cachewriter *cw, const void *arr, int num) {
+	if (!arr || !num)
+		return 0;
+	return cw_reserve(cw, num * sizeof(void *), 8);
+}
+
+#define CW_FIELD(cw, off, type, field, val) cw_ptr(cw, (off) + offsetof(type, field), val)
+
+static size_t cw_blobhash(const void *data, size_t len, size_t size) {
+	const uint8_t *p = data;
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i = 0; i < len; i++)
+		h = (h ^ p[i]) * 16777619;
+	return h & (size - 1);
+}
+
+static size_t cw_findblob(struct cachewriter *cw, const void *data, size_t len) {
+	size_t i;
+	for (i = cw_blobhash(data, len, cw->blobssize); cw->blobs[i].off; i = (i + 1) & (cw->blobssize - 1))
+		if (cw->blobs[i].len == len && !memcmp(cw->data + cw->blobs[i].off, data, len))
+			break;
+	return i;
+}
+
+/* stores a chunk of plain data, sharing it with an identical earlier one */
+static uint64_t cw_blob(struct cachewriter *cw, const void *data, size_t len, size_t align) {
+	size_t i;
+	if (cw->blobsnum * 2 >= cw->blobssize) {
+		size_t osize = cw->blobssize;
+		__typeof__(cw->blobs) oblobs = cw->blobs;
+		cw->blobssize = osize ? osize * 2 : 0x1000;
+		cw->blobs = calloc(cw->blobssize, sizeof *cw->blobs);
+		for (i = 0; i < osize; i++)
+			if (oblobs[i].off)
+				cw->blobs[cw_findblob(cw, cw->data + oblobs[i].off, oblobs[i].len)] = oblobs[i];
+		free(oblobs);
+	}
+	i = cw_findblob(cw, data, len);
+	if (!cw->blobs[i].off) {
+		uint64_t off = cw_reserve(cw, len, align);
+		memcpy(cw->data + off, data, len);
+		cw->blobs[i].off = off;
+		cw->blobs[i].len = len;
+		cw->blobsnum++;
+	}
+	return cw->blobs[i].off;
+}
+
+static uint64_t put_str(struct cachewriter *cw, const char *str) {
+	uint64_t off;
+	if (!str)
+		return 0;
+	if (cw_find(cw, str, &off))
+		return off;
+	off = cw_blob(cw, str, strlen(str) + 1, 1);
+	cw_remember(cw, str, off);
+	return off;
+}
+
+/*
+ * Writes out an array of object pointers, storing its offset in the given
+ * slot.  The slot is only written after the elements, since putting them
+ * may move the blob.
+ */
+#define PUT_ARRAY(cw, slot, arr, num, put) do { \
+	uint64_t aoff_ = cw_array(cw, arr, num); \
+	int i_; \
+	for (i_ = 0; i_ < (num); i_++) \
+		cw_ptr(cw, aoff_ + i_ * sizeof(void *), put(cw, (arr)[i_])); \
+	cw_ptr(cw, slot, aoff_); \
+} while (0)
+
+static uint64_t put_enum(struct cachewriter *cw, struct rnnenum *en);
+static uint64_t put_bitset(struct cachewriter *cw, struct rnnbitset *bs);
+static uint64_t put_spectype(struct cachewriter *cw, struct rnnspectype *st);
+static uint64_t put_bitfield(struct cachewriter *cw, struct rnnbitfield *bf);
+
+static uint64_t put_varset(struct cachewriter *cw, struct rnnvarset *vs) {
+	uint64_t off, voff = 0;
+	if (cw_find(cw, vs, &off))
+		return off;
+	off = cw_copy(cw, vs, sizeof *vs);
+	CW_FIELD(cw, off, struct rnnvarset, venum, put_enum(cw, vs->venum));
+	if (vs->variants && vs->venum->valsnum)
+		voff = cw_blob(cw, vs->variants, vs->venum->valsnum * sizeof *vs->variants, 8);
+	CW_FIELD(cw, off, struct rnnvarset, variants, voff);
+	return off;
+}
+
+/* varinfo and typeinfo are embedded, so they're patched in place at off */
+static void put_varinfo(struct cachewriter *cw, uint64_t off, struct rnnvarinfo *vi) {
+	CW_FIELD(cw, off, struct rnnvarinfo, prefixstr, put_str(cw, vi->prefixstr));
+	CW_FIELD(cw, off, struct rnnvarinfo, varsetstr, put_str(cw, vi->varsetstr));
+	CW_FIELD(cw, off, struct rnnvarinfo, variantsstr, put_str(cw, vi->variantsstr));
+	CW_FIELD(cw, off, struct rnnvarinfo, prefenum, put_enum(cw, vi->prefenum));
+	CW_FIELD(cw, off, struct rnnvarinfo, prefix, put_str(cw, vi->prefix));
+	PUT_ARRAY(cw, off + offsetof(struct rnnvarinfo, varsets), vi->varsets, vi->varsetsnum, put_varset);
+}
+
+static uint64_t put_value(struct cachewriter *cw, struct rnnvalue *val) {
+	uint64_t off;
+	if (cw_find(cw, val, &off))
+		return off;
+	off = cw_copy(cw, val, sizeof *val);
+	CW_FIELD(cw, off, struct rnnvalue, name, put_str(cw, val->name));
+	put_varinfo(cw, off + offsetof(struct rnnvalue, varinfo), &val->varinfo);
+	CW_FIELD(cw, off, struct rnnvalue, fullname, put_str(cw, val->fullname));
+	CW_FIELD(cw, off, struct rnnvalue, file, put_str(cw, val->file));
+	return off;
+}
+
+static void put_typeinfo(struct cachewriter *cw, uint64_t off, struct rnntypeinfo *ti) {
+	CW_FIELD(cw, off, struct rnntypeinfo, name, put_str(cw, ti->name));
+	CW_FIELD(cw, off, struct rnntypeinfo, eenum, put_enum(cw, ti->eenum));
+	CW_FIELD(cw, off, struct rnntypeinfo, ebitset, put_bitset(cw, ti->ebitset));
+	CW_FIELD(cw, off, struct rnntypeinfo, spectype, put_spectype(cw, ti->spectype));
+	PUT_ARRAY(cw, off + offsetof(struct rnntypeinfo, bitfields), ti->bitfields, ti->bitfieldsnum, put_bitfield);
+	PUT_ARRAY(cw, off + offsetof(struct rnntypeinfo, vals), ti->vals, ti->valsnum, put_value);
+}
+
+static uint64_t put_enum(struct cachewriter *cw, struct rnnenum *en) {
+	uint64_t off;
+	if (!en)
+		return 0;
+	if (cw_find(cw, en, &off))
+		return off;
+	off = cw_copy(cw, en, sizeof *en);
+	CW_FIELD(cw, off, struct rnnenum, name, put_str(cw, en->name));
+	put_varinfo(cw, off + offsetof(struct rnnenum, varinfo), &en->varinfo);
+	PUT_ARRAY(cw, off + offsetof(struct rnnenum, vals), en->vals, en->valsnum, put_value);
+	CW_FIELD(cw, off, struct rnnenum, fullname, put_str(cw, en->fullname));
+	CW_FIELD(cw, off, struct rnnenum, file, put_str(cw, en->file));
+	return off;
+}
+
+static uint64_t put_bitfield(struct cachewriter *cw, struct rnnbitfield *bf) {
+	uint64_t off;
+	if (cw_find(cw, bf, &off))
+		return off;
+	off = cw_copy(cw, bf, sizeof *bf);
+	CW_FIELD(cw, off, struct rnnbitfield, name, put_str(cw, bf->name));
+	put_varinfo(cw, off + offsetof(struct rnnbitfield, varinfo), &bf->varinfo);
+	put_typeinfo(cw, off + offsetof(struct rnnbitfield, typeinfo), &bf->typeinfo);
+	CW_FIELD(cw, off, struct rnnbitfield, fullname, put_str(cw, bf->fullname));
+	CW_FIELD(cw, off, struct rnnbitfield, file, put_str(cw, bf->file));
+	return off;
+}
+
+static uint64_t put_bitset(struct cachewriter *cw, struct rnnbitset *bs) {
+	uint64_t off;
+	if (!bs)
+		return 0;
+	if (cw_find(cw, bs, &off))
+		return off;
+	off = cw_copy(cw, bs, sizeof *bs);
+	CW_FIELD(cw, off, struct rnnbitset, name, put_str(cw, bs->name));
+	put_varinfo(cw, off + offsetof(struct rnnbitset, varinfo), &bs->varinfo);
+	PUT_ARRAY(cw, off + offsetof(struct rnnbitset, bitfields), bs->bitfields, bs->bitfieldsnum, put_bitfield);
+	CW_FIELD(cw, off, struct rnnbitset, fullname, put_str(cw, bs->fullname));
+	CW_FIELD(cw, off, struct rnnbitset, file, put_str(cw, bs->file));
+	return off;
+}
+
+static uint64_t put_spectype(struct cachewriter *cw, struct rnnspectype *st) {
+	uint64_t off;
+	if (!st)
+		return 0;
+	if (cw_find(cw, st, &off))
+		return off;
+	off = cw_copy(cw, st, sizeof *st);
+	CW_FIELD(cw, off, struct rnnspectype, name, put_str(cw, st->name));
+	put_typeinfo(cw, off + offsetof(struct rnnspectype, typeinfo), &st->typeinfo);
+	CW_FIELD(cw, off, struct rnnspectype, file, put_str(cw, st->file));
+	return off;
+}
+
+static uint64_t put_delem(struct cachewriter *cw, struct rnndelem *elem) {
+	uint64_t off;
+	if (cw_find(cw, elem, &off))
+		return off;
+	off = cw_copy(cw, elem, sizeof *elem);
+	CW_FIELD(cw, off, struct rnndelem, name, put_str(cw, elem->name));
+	PUT_ARRAY(cw, off + offsetof(struct rnndelem, subelems), elem->subelems, elem->subelemsnum, put_delem);
+	put_varinfo(cw, off + offsetof(struct rnndelem, varinfo), &elem->varinfo);
+	put_typeinfo(cw, off + offsetof(struct rnndelem, typeinfo), &elem->typeinfo);
+	CW_FIELD(cw, off, struct rnndelem, fullname, put_str(cw, elem->fullname));
+	CW_FIELD(cw, off, struct rnndelem, file, put_str(cw, elem->file));
+	return off;
+}
+
+static uint64_t put_domain(struct cachewriter *cw, struct rnndomain *dom) {
+	uint64_t off;
+	if (cw_find(cw, dom, &off))
+		return off;
+	off = cw_copy(cw, dom, sizeof *dom);
+	CW_FIELD(cw, off, struct rnndomain, name, put_str(cw, dom->name));
+	put_varinfo(cw, off + offsetof(struct rnndomain, varinfo), &dom->varinfo);
+	PUT_ARRAY(cw, off + offsetof(struct rnndomain, subelems), dom->subelems, dom->subelemsnum, put_delem);
+	CW_FIELD(cw, off, struct rnndomain, fullname, put_str(cw, dom->fullname));
+	CW_FIELD(cw, off, struct rnndomain, file, put_str(cw, dom->file));
+	return off;
+}
+
+static uint64_t put_group(struct cachewriter *cw, struct rnngroup *group) {
+	uint64_t off;
+	if (cw_find(cw, group, &off))
+		return off;
+	off = cw_copy(cw, group, sizeof *group);
+	CW_FIELD(cw, off, struct rnngroup, name, put_str(cw, group->name));
+	PUT_ARRAY(cw, off + offsetof(struct rnngroup, subelems), group->subelems, group->subelemsnum, put_delem);
+	return off;
+}
+
+static uint64_t put_author(struct cachewriter *cw, struct rnnauthor *author) {
+	uint64_t off;
+	if (cw_find(cw, author, &off))
+		return off;
+	off = cw_copy(cw, author, sizeof *author);
+	CW_FIELD(cw, off, struct rnnauthor, name, put_str(cw, author->name));
+	CW_FIELD(cw, off, struct rnnauthor, email, put_str(cw, author->email));
+	CW_FIELD(cw, off, struct rnnauthor, contributions, put_str(cw, author->contributions));
+	CW_FIELD(cw, off, struct rnnauthor, license, put_str(cw, author->license));
+	PUT_ARRAY(cw, off + offsetof(struct rnnauthor, nicknames), author->nicknames, author->nicknamesnum, put_str);
+	return off;
+}
+
+static uint64_t put_db(struct cachewriter *cw, struct rnndb *db) {
+	uint64_t off = cw_copy(cw, db, sizeof *db);
+	uint64_t cr = off + offsetof(struct rnndb, copyright);
+	CW_FIELD(cw, cr, struct rnncopyright, license, put_str(cw, db->copyright.license));
+	PUT_ARRAY(cw, cr + offsetof(struct rnncopyright, authors), db->copyright.authors, db->copyright.authorsnum, put_author);
+	/* the file list goes first, so that the sources can refer to it */
+	PUT_ARRAY(cw, off + offsetof(struct rnndb, files), db->files, db->filesnum, put_str);
+	PUT_ARRAY(cw, off + offsetof(struct rnndb, enums), db->enums, db->enumsnum, put_enum);
+	PUT_ARRAY(cw, off + offsetof(struct rnndb, bitsets), db->bitsets, db->bitsetsnum, put_bitset);
+	PUT_ARRAY(cw, off + offsetof(struct rnndb, domains), db->domains, db->domainsnum, put_domain);
+	PUT_ARRAY(cw, off + offsetof(struct rnndb, groups), db->groups, db->groupsnum, put_group);
+	PUT_ARRAY(cw, off + offsetof(struct rnndb, spectypes), db->spectypes, db->spectypesnum, put_spectype);
+	CW_FIELD(cw, off, struct rnndb, cachemap, 0);
+	memset(cw->data + off + offsetof(struct rnndb, cachesize), 0, sizeof db->cachesize);
+	return off;
+}
+
+/* FNV-1a over the whole file */
+static int source_hash(const char *fname, uint64_t *size, uint64_t *hash) {
+	uint8_t buf[0x10000];
+	uint64_t h = 0xcbf29ce484222325ull;
+	uint64_t total = 0;
+	size_t got, i;
+	FILE *f = fopen(fname, "rb");
+	if (!f)
+		return -1;
+	while ((got = fread(buf, 1, sizeof buf, f))) {
+		for (i = 0; i < got; i++)
+			h = (h ^ buf[i]) * 0x100000001b3ull;
+		total += got;
+	}
+	if (ferror(f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	*size = total;
+	*hash = h;
+	return 0;
+}
+
+/* strips the RNN_PATH directory a source was found in off its name */
+static const char *source_name(const char *fname, const char *rnn_path) {
+	while (rnn_path) {
+		const char *npath = strchr(rnn_path, ':');
+		size_t plen = npath ? npath - rnn_path : strlen(rnn_path);
+		if (plen && !strncmp(fname, rnn_path, plen) && fname[plen] == '/')
+			return fname + plen + 1;
+		rnn_path = npath ? npath + 1 : NULL;
+	}
+	return NULL;
+}
+
+static const char *cache_rnnpath(void) {
+	const char *path = getenv("RNN_PATH");
+	return path ? path : RNN_DEF_PATH;
+}
+
+static const char *cache_path(void) {
+	const char *path = getenv("RNN_CACHE");
+	return path ? path : RNN_DEF_CACHE;
+}
+
+int rnn_writecache (struct rnndb *db, const char *cachefile) {
+	struct cachewriter cw = { 0 };
+	struct rnncache_header hdr = { RNNCACHE_MAGIC };
+	struct rnncache_source *src;
+	uint64_t srcoff, reloff;
+	char *tmpname;
+	FILE *out;
+	int i, ret = 0;
+
+	if (db->estatus) {
+		fprintf(stderr, "%s: refusing to cache a broken database\n", cachefile);
+		return -1;
+	}
+
+	/* keeps offset 0 free to stand for NULL */
+	cw_reserve(&cw, sizeof hdr, 8);
+	hdr.db = put_db(&cw, db);
+
+	srcoff = cw_reserve(&cw, db->filesnum * sizeof *src, 8);
+	for (i = 0; i < db->filesnum; i++) {
+		const char *name = source_name(db->files[i], cache_rnnpath());
+		uint64_t size, hash, nameoff;
+		if (!name) {
+			fprintf(stderr, "%s: not in RNN_PATH, can't cache it\n", db->files[i]);
+			ret = -1;
+			goto out;
+		}
+		if (source_hash(db->files[i], &size, &hash)) {
+			perror(db->files[i]);
+			ret = -1;
+			goto out;
+		}
+		nameoff = put_str(&cw, name);
+		src = (struct rnncache_source *)(cw.data + srcoff) + i;
+		src->name = nameoff;
+		src->size = size;
+		src->hash = hash;
+	}
+	hdr.sources = srcoff;
+	hdr.sourcesnum = db->filesnum;
+
+	reloff = cw_reserve(&cw, cw.relocsnum * sizeof *cw.relocs, 8);
+	memcpy(cw.data + reloff, cw.relocs, cw.relocsnum * sizeof *cw.relocs);
+	hdr.relocs = reloff;
+	hdr.relocsnum = cw.relocsnum;
+
+	hdr.version = RNNCACHE_VERSION;
+	hdr.layout = cache_layout();
+	hdr.size = cw.len;
+	memcpy(cw.data, &hdr, sizeof hdr);
+
+	/* write to a temporary and rename, so readers never see half a file */
+	tmpname = aprintf("%s.%d", cachefile, (int)getpid());
+	out = fopen(tmpname, "wb");
+	if (!out) {
+		perror(tmpname);
+		free(tmpname);
+		ret = -1;
+		goto out;
+	}
+	if (fwrite(cw.data, 1, cw.len, out) != cw.len) {
+		perror(tmpname);
+		ret = -1;
+	}
+	if (fclose(out) && !ret) {
+		perror(tmpname);
+		ret = -1;
+	}
+	if (!ret && rename(tmpname, cachefile)) {
+		perror(cachefile);
+		ret = -1;
+	}
+	if (ret)
+		unlink(tmpname);
+	free(tmpname);
+out:
+	free(cw.data);
+	free(cw.relocs);
+	free(cw.map);
+	free(cw.blobs);
+	return ret;
+}
+
+static int cache_fresh(uint8_t *base, struct rnncache_header *hdr, const char *rootfile) {
+	const char *path = cache_rnnpath();
+	struct rnncache_source *src;
+	uint64_t i;
+	if (hdr->sources > hdr->size || hdr->sourcesnum > (hdr->size - hdr->sources) / sizeof *src)
+		return 0;
+	src = (struct rnncache_source *)(base + hdr->sources);
+	if (!hdr->sourcesnum)
+		return 0;
+	for (i = 0; i < hdr->sourcesnum; i++) {
+		const char *name;
+		char *fname;
+		uint64_t size, hash;
+		FILE *f;
+		int bad;
+		if (src[i].name >= hdr->size || !memchr(base + src[i].name, 0, hdr->size - src[i].name))
+			return 0;
+		name = (const char *)base + src[i].name;
+		/* the first source is the file the db was requested as */
+		if (i == 0 && rootfile && strcmp(name, rootfile))
+			return 0;
+		f = find_in_path(name, path, &fname);
+		if (!f)
+			return 0;
+		fclose(f);
+		bad = source_hash(fname, &size, &hash) || size != src[i].size || hash != src[i].hash;
+		free(fname);
+		if (bad)
+			return 0;
+	}
+	return 1;
+}
+
+struct rnndb *rnn_loadcache (const char *cachefile, const char *rootfile) {
+	struct rnncache_header *hdr;
+	struct rnndb *db;
+	struct stat st;
+	uint64_t *relocs;
+	uint8_t *base;
+	uint64_t i;
+	int fd = open(cachefile, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < sizeof *hdr) {
+		close(fd);
+		return NULL;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return NULL;
+	hdr = (struct rnncache_header *)base;
+	if (memcmp(hdr->magic, RNNCACHE_MAGIC, sizeof hdr->magic) ||
+			hdr->version != RNNCACHE_VERSION ||
+			hdr->layout != cache_layout() ||
+			hdr->size != st.st_size ||
+			hdr->db < sizeof *hdr || hdr->db > hdr->size - sizeof *db ||
+			hdr->relocs > hdr->size ||
+			hdr->relocsnum > (hdr->size - hdr->relocs) / sizeof *relocs ||
+			!cache_fresh(base, hdr, rootfile))
+		goto fail;
+	relocs = (uint64_t *)(base + hdr->relocs);
+	for (i = 0; i < hdr->relocsnum; i++) {
+		uintptr_t val;
+		if (relocs[i] > hdr->size - sizeof val)
+			goto fail;
+		memcpy(&val, base + relocs[i], sizeof val);
+		if (val >= hdr->size)
+			goto fail;
+		val += (uintptr_t)base;
+		memcpy(base + relocs[i], &val, sizeof val);
+	}
+	db = (struct rnndb *)(base + hdr->db);
+	db->cachemap = base;
+	db->cachesize = hdr->size;
+	return db;
+fail:
+	munmap(base, st.st_size);
+	return NULL;
+}
+
+/* the cache file for a db in the given directory */
+static char *cache_name(const char *dir, size_t dirlen, const char *file) {
+	char *res = aprintf("%.*s/%s.rnnc", (int)dirlen, dir, file), *p;
+	for (p = res + dirlen + 1; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	return res;
+}
+
+char *rnn_cachefile (const char *file) {
+	const char *dir = cache_path();
+	const char *end = strchr(dir, ':');
+	if (!*dir || end == dir)
+		return NULL;
+	return cache_name(dir, end ? end - dir : strlen(dir), file);
+}
+
+struct rnndb *rnn_loaddb (char *file) {
+	const char *dir = cache_path();
+	struct rnndb *db = NULL;
+
+	while (dir && !db) {
+		const char *end = strchr(dir, ':');
+		size_t len = end ? end - dir : strlen(dir);
+		if (len) {
+			char *cachefile = cache_name(dir, len, file);
+			db = rnn_loadcache(cachefile, file);
+			free(cachefile);
+		}
+		dir = end ? end + 1 : NULL;
+	}
+	if (db)
+		return db;
+
+	db = rnn_newdb();
+	rnn_parsefile(db, file);
+	rnn_prepdb(db);
+	return db;
+}
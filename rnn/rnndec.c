@@ -26,6 +26,7 @@
 #define _GNU_SOURCE // for asprintf
 #include "rnndec.h"
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
 #include <inttypes.h>
@@ -38,8 +39,127 @@ struct rnndeccontext *rnndec_newcontext(struct rnndb *db) {
 	return res;
 }
 
+struct rnndeccontext *rnndec_clonecontext(struct rnndeccontext *ctx) {
+	struct rnndeccontext *res = rnndec_newcontext(ctx->db);
+	int i;
+	res->colors = ctx->colors;
+	for (i = 0; i < ctx->varsnum; i++) {
+		struct rnndecvariant *ci = malloc (sizeof *ci);
+		*ci = *ctx->vars[i];
+		ADDARRAY(res->vars, ci);
+	}
+	return res;
+}
+
+/*
+ * Address decoding state compiled for one combination of variants.
+ *
+ * Every element list that trymatch walks gets an index: the address space
+ * is cut into segments at the boundaries of its elements' ranges, and every
+ * segment lists the (variant-matching) elements that may cover it, in
+ * database order.  A lookup is then a binary search plus a try of the few
+ * candidates instead of a scan of the whole list.
+ */
+struct rnndecindex {
+	struct rnndelem **elems;
+	int dwidth;
+	/* no element matches at or above this relative address */
+	uint64_t extent;
+	uint64_t *starts;
+	int *first;
+	int *cands;
+	int segsnum;
+	struct rnndecindex *next;
+};
+
+struct rnndecstate {
+	int *variants;
+	int varsnum;
+	struct rnndecindex **hash;
+	int hashsize;
+	int indicesnum;
+};
+
+#define RNNDEC_MAX_STATES 16
+
+/*
+ * Direct-mapped cache of rendered values, see rnndec_decodeval_memo.
+ * Entries are keyed by the variant state they were rendered in, so
+ * flipping between a few variants keeps them valid.  The state pointers
+ * are only unique while the states live, so the cache is emptied together
+ * with them.
+ */
+struct rnndecmemoent {
+	struct rnndecstate *state;
+	const struct envy_colors *colors;
+	struct rnntypeinfo *ti;
+	uint64_t value;
+	int width;
+	struct rnndecbuf text;
+};
+
+struct rnndecmemo {
+	struct rnndecmemoent *ents;
+	int size;
+};
+
+static void freestate(struct rnndecstate *st) {
+	int i;
+	for (i = 0; i < st->hashsize; i++) {
+		struct rnndecindex *idx, *next;
+		for (idx = st->hash[i]; idx; idx = next) {
+			next = idx->next;
+			free(idx->starts);
+			free(idx->first);
+			free(idx->cands);
+			free(idx);
+		}
+	}
+	free(st->hash);
+	free(st->variants);
+	free(st);
+}
+
+static void flushmemo(struct rnndeccontext *ctx) {
+	int i;
+	if (!ctx->memo)
+		return;
+	for (i = 0; i < ctx->memo->size; i++)
+		ctx->memo->ents[i].state = NULL;
+}
+
+static void flushstates(struct rnndeccontext *ctx) {
+	int i;
+	for (i = 0; i < ctx->statesnum; i++)
+		freestate(ctx->states[i]);
+	ctx->statesnum = 0;
+	ctx->state = NULL;
+	flushmemo(ctx);
+}
+
+void rnndec_memo_enable(struct rnndeccontext *ctx, int entries) {
+	int i;
+	if (ctx->memo) {
+		for (i = 0; i < ctx->memo->size; i++)
+			free(ctx->memo->ents[i].text.str);
+		free(ctx->memo->ents);
+		free(ctx->memo);
+		ctx->memo = NULL;
+	}
+	if (entries <= 0)
+		return;
+	ctx->memo = calloc(sizeof *ctx->memo, 1);
+	/* round up to a power of two */
+	for (ctx->memo->size = 1; ctx->memo->size < entries; ctx->memo->size <<= 1);
+	ctx->memo->ents = calloc(sizeof *ctx->memo->ents, ctx->memo->size);
+}
+
 void rnndec_freecontext(struct rnndeccontext *ctx) {
 	int i;
+	flushstates(ctx);
+	rnndec_memo_enable(ctx, 0);
+	free(ctx->scratch.str);
+	free(ctx->states);
 	for (i = 0; i < ctx->varsnum; ++i)
 		free(ctx->vars[i]);
 	free(ctx->vars);
@@ -59,6 +179,7 @@ int rnndec_varadd(struct rnndeccontext *ctx, char *varset, char *variant) {
 			ci->en = en;
 			ci->variant = i;
 			ADDARRAY(ctx->vars, ci);
+			flushstates(ctx);
 			return 1;
 		}
 	fprintf (stderr, "Variant %s doesn't exist in enum %s!\n", variant, varset);
@@ -79,6 +200,7 @@ int rnndec_varaddvalue(struct rnndeccontext *ctx, char *varset, uint64_t value)
 			ci->en = en;
 			ci->variant = i;
 			ADDARRAY(ctx->vars, ci);
+			flushstates(ctx);
 			return 1;
 		}
 
@@ -97,7 +219,10 @@ int rnndec_varmod(struct rnndeccontext *ctx, char *varset, char *variant) {
 		if (!strcasecmp(en->vals[i]->name, variant)) {
 			struct rnndecvariant *ci = NULL;
 			FINDARRAY(ctx->vars, ci, ci->en == en);
-			ci->variant = i;
+			if (ci->variant != i) {
+				ci->variant = i;
+				ctx->state = NULL;
+			}
 			return 1;
 		}
 	fprintf (stderr, "Variant %s doesn't exist in enum %s!\n", variant, varset);
@@ -156,15 +281,32 @@ static float float16(uint16_t val)
 	return u.f;
 }
 
-char *rnndec_decodeval(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64_t value, int width) {
-	char *res = 0;
+void rnndec_bufprintf(struct rnndecbuf *buf, const char *fmt, ...) {
+	va_list ap;
+	int len;
+	va_start(ap, fmt);
+	len = vsnprintf(buf->str + buf->len, buf->max - buf->len, fmt, ap);
+	va_end(ap);
+	if (buf->len + len >= buf->max) {
+		buf->max = buf->max ? buf->max * 2 : 256;
+		while (buf->len + len >= buf->max)
+			buf->max *= 2;
+		buf->str = realloc(buf->str, buf->max);
+		va_start(ap, fmt);
+		vsnprintf(buf->str + buf->len, buf->max - buf->len, fmt, ap);
+		va_end(ap);
+	}
+	buf->len += len;
+}
+
+static void decodeval(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64_t value, int width, struct rnndecbuf *buf) {
 	int i;
 	struct rnnvalue **vals;
 	int valsnum;
 	struct rnnbitfield **bitfields;
 	int bitfieldsnum;
-	char *tmp;
 	uint64_t mask;
+	int first;
 	if (!ti)
 		goto failhex;
 	if (ti->shr) value <<= ti->shr;
@@ -181,8 +323,8 @@ char *rnndec_decodeval(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64
 		doenum:
 			for (i = 0; i < valsnum; i++)
 				if (rnndec_varmatch(ctx, &vals[i]->varinfo) && vals[i]->valvalid && vals[i]->value == value) {
-					asprintf (&res, "%s%s%s", ctx->colors->eval, vals[i]->name, ctx->colors->reset);
-					return res;
+					rnndec_bufprintf(buf, "%s%s%s", ctx->colors->eval, vals[i]->name, ctx->colors->reset);
+					return;
 				}
 			goto failhex;
 		case RNN_TTYPE_BITSET:
@@ -195,6 +337,8 @@ char *rnndec_decodeval(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64
 			goto dobitset;
 		dobitset:
 			mask = 0;
+			first = 1;
+			rnndec_bufprintf(buf, "{ ");
 			for (i = 0; i < bitfieldsnum; i++) {
 				if (!rnndec_varmatch(ctx, &bitfields[i]->varinfo))
 					continue;
@@ -204,212 +348,475 @@ char *rnndec_decodeval(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64
 					if (sval == 0)
 						continue;
 					else if (sval == 1) {
-						if (!res)
-							asprintf (&res, "%s%s%s", ctx->colors->mod, bitfields[i]->name, ctx->colors->reset);
-						else {
-							asprintf (&tmp, "%s | %s%s%s", res, ctx->colors->mod, bitfields[i]->name, ctx->colors->reset);
-							free(res);
-							res = tmp;
-						}
+						rnndec_bufprintf(buf, "%s%s%s%s", first ? "" : " | ", ctx->colors->mod, bitfields[i]->name, ctx->colors->reset);
+						first = 0;
 						continue;
 					}
 				}
-				char *subval = rnndec_decodeval(ctx, &bitfields[i]->typeinfo, sval, bitfields[i]->high - bitfields[i]->low + 1);
-				if (!res)
-					asprintf (&res, "%s%s%s = %s", ctx->colors->rname, bitfields[i]->name, ctx->colors->reset, subval);
-				else {
-					asprintf (&tmp, "%s | %s%s%s = %s", res, ctx->colors->rname, bitfields[i]->name, ctx->colors->reset, subval);
-					free(res);
-					res = tmp;
-				}
-				free(subval);
+				rnndec_bufprintf(buf, "%s%s%s%s = ", first ? "" : " | ", ctx->colors->rname, bitfields[i]->name, ctx->colors->reset);
+				decodeval(ctx, &bitfields[i]->typeinfo, sval, bitfields[i]->high - bitfields[i]->low + 1, buf);
+				first = 0;
 			}
 			if (value & ~mask) {
-				if (!res)
-					asprintf (&res, "%s%#"PRIx64"%s", ctx->colors->err, value & ~mask, ctx->colors->reset);
-				else {
-					asprintf (&tmp, "%s | %s%#"PRIx64"%s", res, ctx->colors->err, value & ~mask, ctx->colors->reset);
-					free(res);
-					res = tmp;
-				}
+				rnndec_bufprintf(buf, "%s%s%#"PRIx64"%s", first ? "" : " | ", ctx->colors->err, value & ~mask, ctx->colors->reset);
+				first = 0;
 			}
-			if (!res)
-				asprintf (&res, "%s0%s", ctx->colors->num, ctx->colors->reset);
-			asprintf (&tmp, "{ %s }", res);
-			free(res);
-			return tmp;
+			if (first)
+				rnndec_bufprintf(buf, "%s0%s", ctx->colors->num, ctx->colors->reset);
+			rnndec_bufprintf(buf, " }");
+			return;
 		case RNN_TTYPE_SPECTYPE:
-			return rnndec_decodeval(ctx, &ti->spectype->typeinfo, value, width);
+			decodeval(ctx, &ti->spectype->typeinfo, value, width, buf);
+			return;
 		case RNN_TTYPE_HEX:
-			asprintf (&res, "%s%#"PRIx64"%s", ctx->colors->num, value, ctx->colors->reset);
-			return res;
+			rnndec_bufprintf(buf, "%s%#"PRIx64"%s", ctx->colors->num, value, ctx->colors->reset);
+			return;
 		case RNN_TTYPE_FIXED:
 			if (value & UINT64_C(1) << (width-1)) {
-				asprintf (&res, "%s-%lf%s (%08"PRIx64")", ctx->colors->num,
+				rnndec_bufprintf(buf, "%s-%lf%s (%08"PRIx64")", ctx->colors->num,
 						((double)((UINT64_C(1) << width) - value)) / ((double)(1 << ti->radix)),
 						ctx->colors->reset, value);
-				return res;
+				return;
 			}
 			/* fallthrough */
 		case RNN_TTYPE_UFIXED:
-			asprintf (&res, "%s%lf%s (%08"PRIx64")", ctx->colors->num,
+			rnndec_bufprintf(buf, "%s%lf%s (%08"PRIx64")", ctx->colors->num,
 					((double)value) / ((double)(1 << ti->radix)),
 					ctx->colors->reset, value);
-			return res;
+			return;
 		case RNN_TTYPE_UINT:
-			asprintf (&res, "%s%"PRIu64"%s", ctx->colors->num, value, ctx->colors->reset);
-			return res;
+			rnndec_bufprintf(buf, "%s%"PRIu64"%s", ctx->colors->num, value, ctx->colors->reset);
+			return;
 		case RNN_TTYPE_INT:
 			if (value & UINT64_C(1) << (width-1))
-				asprintf (&res, "%s-%"PRIi64"%s", ctx->colors->num, (UINT64_C(1) << width) - value, ctx->colors->reset);
+				rnndec_bufprintf(buf, "%s-%"PRIi64"%s", ctx->colors->num, (UINT64_C(1) << width) - value, ctx->colors->reset);
 			else
-				asprintf (&res, "%s%"PRIi64"%s", ctx->colors->num, value, ctx->colors->reset);
-			return res;
+				rnndec_bufprintf(buf, "%s%"PRIi64"%s", ctx->colors->num, value, ctx->colors->reset);
+			return;
 		case RNN_TTYPE_BOOLEAN:
 			if (value == 0) {
-				asprintf (&res, "%sFALSE%s", ctx->colors->eval, ctx->colors->reset);
-				return res;
+				rnndec_bufprintf(buf, "%sFALSE%s", ctx->colors->eval, ctx->colors->reset);
+				return;
 			} else if (value == 1) {
-				asprintf (&res, "%sTRUE%s", ctx->colors->eval, ctx->colors->reset);
-				return res;
+				rnndec_bufprintf(buf, "%sTRUE%s", ctx->colors->eval, ctx->colors->reset);
+				return;
 			}
 		case RNN_TTYPE_FLOAT: {
 			union { uint64_t i; float f; double d; } val;
 			val.i = value;
 			if (width == 64)
-				asprintf(&res, "%s%f%s", ctx->colors->num,
+				rnndec_bufprintf(buf, "%s%f%s", ctx->colors->num,
 					val.d, ctx->colors->reset);
 			else if (width == 32)
-				asprintf(&res, "%s%f%s", ctx->colors->num,
+				rnndec_bufprintf(buf, "%s%f%s", ctx->colors->num,
 					val.f, ctx->colors->reset);
 			else if (width == 16)
-				asprintf(&res, "%s%f%s", ctx->colors->num,
+				rnndec_bufprintf(buf, "%s%f%s", ctx->colors->num,
 					float16(value), ctx->colors->reset);
 			else
 				goto failhex;
 
-			return res;
+			return;
 		}
 		failhex:
 		default:
-			asprintf (&res, "%s%#"PRIx64"%s", ctx->colors->num, value, ctx->colors->reset);
-			return res;
+			rnndec_bufprintf(buf, "%s%#"PRIx64"%s", ctx->colors->num, value, ctx->colors->reset);
+			return;
+	}
+}
+
+char *rnndec_decodeval_buf(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64_t value, int width, struct rnndecbuf *buf) {
+	size_t start = buf->len;
+	decodeval(ctx, ti, value, width, buf);
+	return buf->str + start;
+}
+
+char *rnndec_decodeval(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64_t value, int width) {
+	struct rnndecbuf buf = { 0 };
+	decodeval(ctx, ti, value, width, &buf);
+	return buf.str;
+}
+
+static struct rnndecstate *getstate(struct rnndeccontext *ctx);
+
+char *rnndec_decodeval_memo(struct rnndeccontext *ctx, struct rnntypeinfo *ti, uint64_t value, int width) {
+	struct rnndecmemo *memo = ctx->memo;
+	struct rnndecmemoent *ent;
+	struct rnndecstate *st;
+	uint64_t h;
+	if (!memo) {
+		ctx->scratch.len = 0;
+		return rnndec_decodeval_buf(ctx, ti, value, width, &ctx->scratch);
+	}
+	st = getstate(ctx);
+	h = ((uintptr_t)ti >> 4) ^ value ^ (value >> 29) ^ width;
+	h *= UINT64_C(0x9e3779b97f4a7c15);
+	ent = &memo->ents[(h >> 32) & (memo->size - 1)];
+	if (ent->state == st && ent->ti == ti && ent->value == value && ent->width == width && ent->colors == ctx->colors)
+		return ent->text.str;
+	ent->text.len = 0;
+	decodeval(ctx, ti, value, width, &ent->text);
+	ent->state = st;
+	ent->colors = ctx->colors;
+	ent->ti = ti;
+	ent->value = value;
+	ent->width = width;
+	return ent->text.str;
+}
+
+/* rnndec_varmatch without the complaints, for building indices */
+static int varmatch_quiet(struct rnndeccontext *ctx, struct rnnvarinfo *vi) {
+	if (vi->dead)
+		return 0;
+	int i;
+	for (i = 0; i < vi->varsetsnum; i++) {
+		int j;
+		for (j = 0; j < ctx->varsnum; j++)
+			if (vi->varsets[i]->venum == ctx->vars[j]->en)
+				break;
+		if (j != ctx->varsnum && !vi->varsets[i]->variants[ctx->vars[j]->variant])
+			return 0;
+	}
+	return 1;
+}
+
+static struct rnndecstate *getstate(struct rnndeccontext *ctx) {
+	struct rnndecstate *st;
+	int i, j;
+	if (ctx->state)
+		return ctx->state;
+	for (i = 0; i < ctx->statesnum; i++) {
+		st = ctx->states[i];
+		if (st->varsnum != ctx->varsnum)
+			continue;
+		for (j = 0; j < ctx->varsnum; j++)
+			if (st->variants[j] != ctx->vars[j]->variant)
+				break;
+		if (j == ctx->varsnum)
+			return ctx->state = st;
+	}
+	if (ctx->statesnum >= RNNDEC_MAX_STATES)
+		flushstates(ctx);
+	st = calloc(sizeof *st, 1);
+	st->varsnum = ctx->varsnum;
+	st->variants = calloc(sizeof *st->variants, ctx->varsnum);
+	for (j = 0; j < ctx->varsnum; j++)
+		st->variants[j] = ctx->vars[j]->variant;
+	ADDARRAY(ctx->states, st);
+	return ctx->state = st;
+}
+
+static uint64_t satadd(uint64_t a, uint64_t b) {
+	return a + b < a ? UINT64_MAX : a + b;
+}
+
+static uint64_t satmul(uint64_t a, uint64_t b) {
+	return b && a > UINT64_MAX / b ? UINT64_MAX : a * b;
+}
+
+static struct rnndecindex *getindex(struct rnndeccontext *ctx, struct rnndelem **elems, int elemsnum, int dwidth);
+
+/*
+ * Computes the range of relative addresses that elem could possibly match,
+ * returns 0 if it can't match anything.  UINT64_MAX as the end stands for
+ * an unbounded element.
+ */
+static int elemrange(struct rnndeccontext *ctx, struct rnndelem *elem, int dwidth, uint64_t *start, uint64_t *end) {
+	uint64_t size, last;
+	switch (elem->type) {
+		case RNN_ETYPE_REG:
+			size = elem->width / dwidth;
 			break;
+		case RNN_ETYPE_ARRAY:
+			size = elem->stride;
+			break;
+		case RNN_ETYPE_STRIPE:
+			size = getindex(ctx, elem->subelems, elem->subelemsnum, dwidth)->extent;
+			break;
+		default:
+			return 0;
+	}
+	if (!size)
+		return 0;
+	*start = elem->offset;
+	if (!elem->length && elem->stride)
+		*end = UINT64_MAX;
+	else if (!elem->stride)
+		*end = satadd(elem->offset, size);
+	else {
+		last = satmul(elem->stride, elem->length - 1);
+		*end = satadd(satadd(elem->offset, last), size);
 	}
+	return *end > *start;
 }
 
-static char *appendidx (struct rnndeccontext *ctx, char *name, uint64_t idx) {
-	char *res;
-	asprintf (&res, "%s[%s%#"PRIx64"%s]", name, ctx->colors->num, idx, ctx->colors->reset);
-	free (name);
-	return res;
+static int cmpaddr(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* index of the segment containing addr, -1 if there's none */
+static int findseg(struct rnndecindex *idx, uint64_t addr) {
+	int lo = 0, hi = idx->segsnum;
+	if (!idx->segsnum || addr < idx->starts[0])
+		return -1;
+	while (hi - lo > 1) {
+		int mid = (lo + hi) / 2;
+		if (idx->starts[mid] <= addr)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
 }
 
-static struct rnndecaddrinfo *trymatch (struct rnndeccontext *ctx, struct rnndelem **elems, int elemsnum, uint64_t addr, int write, int dwidth, uint64_t *indices, int indicesnum) {
-	struct rnndecaddrinfo *res;
+static struct rnndecindex *buildindex(struct rnndeccontext *ctx, struct rnndelem **elems, int elemsnum, int dwidth) {
+	struct rnndecindex *res = calloc(sizeof *res, 1);
+	uint64_t *ranges = calloc(sizeof *ranges, 2 * elemsnum + 1);
+	uint64_t *bounds = calloc(sizeof *bounds, 2 * elemsnum + 1);
+	int *valid = calloc(sizeof *valid, elemsnum + 1);
+	int boundsnum = 0;
 	int i, j;
+	res->elems = elems;
+	res->dwidth = dwidth;
+	for (i = 0; i < elemsnum; i++) {
+		if (!varmatch_quiet(ctx, &elems[i]->varinfo))
+			continue;
+		if (!elemrange(ctx, elems[i], dwidth, &ranges[2*i], &ranges[2*i+1]))
+			continue;
+		valid[i] = 1;
+		bounds[boundsnum++] = ranges[2*i];
+		bounds[boundsnum++] = ranges[2*i+1];
+		if (ranges[2*i+1] > res->extent)
+			res->extent = ranges[2*i+1];
+	}
+	qsort(bounds, boundsnum, sizeof *bounds, cmpaddr);
+	for (i = 0, j = 0; i < boundsnum; i++)
+		if (!j || bounds[i] != bounds[j-1])
+			bounds[j++] = bounds[i];
+	/* the last boundary only closes the last segment */
+	res->segsnum = j ? j - 1 : 0;
+	res->starts = bounds;
+	res->first = calloc(sizeof *res->first, res->segsnum + 1);
 	for (i = 0; i < elemsnum; i++) {
-		if (!rnndec_varmatch(ctx, &elems[i]->varinfo))
+		if (!valid[i])
 			continue;
-		uint64_t offset, idx;
-		char *tmp, *name;
-		switch (elems[i]->type) {
-			case RNN_ETYPE_REG:
-				if (addr < elems[i]->offset)
+		int s = findseg(res, ranges[2*i]);
+		for (; s < res->segsnum && res->starts[s] < ranges[2*i+1]; s++)
+			res->first[s+1]++;
+	}
+	for (i = 0; i < res->segsnum; i++)
+		res->first[i+1] += res->first[i];
+	res->cands = calloc(sizeof *res->cands, res->first[res->segsnum] + 1);
+	int *fill = calloc(sizeof *fill, res->segsnum + 1);
+	for (i = 0; i < elemsnum; i++) {
+		if (!valid[i])
+			continue;
+		int s = findseg(res, ranges[2*i]);
+		for (; s < res->segsnum && res->starts[s] < ranges[2*i+1]; s++)
+			res->cands[res->first[s] + fill[s]++] = i;
+	}
+	free(fill);
+	free(valid);
+	free(ranges);
+	return res;
+}
+
+static struct rnndecindex *getindex(struct rnndeccontext *ctx, struct rnndelem **elems, int elemsnum, int dwidth) {
+	struct rnndecstate *st = getstate(ctx);
+	struct rnndecindex *idx;
+	int i, h;
+	if (st->hashsize) {
+		h = (((uintptr_t)elems >> 3) ^ dwidth) & (st->hashsize - 1);
+		for (idx = st->hash[h]; idx; idx = idx->next)
+			if (idx->elems == elems && idx->dwidth == dwidth)
+				return idx;
+	}
+	idx = buildindex(ctx, elems, elemsnum, dwidth);
+	if (st->indicesnum >= st->hashsize) {
+		int nsize = st->hashsize ? st->hashsize * 2 : 64;
+		struct rnndecindex **nhash = calloc(sizeof *nhash, nsize);
+		for (i = 0; i < st->hashsize; i++) {
+			struct rnndecindex *cur, *next;
+			for (cur = st->hash[i]; cur; cur = next) {
+				next = cur->next;
+				h = (((uintptr_t)cur->elems >> 3) ^ cur->dwidth) & (nsize - 1);
+				cur->next = nhash[h];
+				nhash[h] = cur;
+			}
+		}
+		free(st->hash);
+		st->hash = nhash;
+		st->hashsize = nsize;
+	}
+	h = (((uintptr_t)elems >> 3) ^ dwidth) & (st->hashsize - 1);
+	idx->next = st->hash[h];
+	st->hash[h] = idx;
+	st->indicesnum++;
+	return idx;
+}
+
+static void appendidx (struct rnndeccontext *ctx, struct rnndecbuf *buf, struct rnndecaddr *res, uint64_t idx) {
+	rnndec_bufprintf(buf, "[%s%#"PRIx64"%s]", ctx->colors->num, idx, ctx->colors->reset);
+	if (res->indicesnum < RNNDEC_MAX_INDICES)
+		res->indices[res->indicesnum] = idx;
+	res->indicesnum++;
+}
+
+/*
+ * Names are built outside in: each level appends its part to buf before
+ * descending, and a level that turns out not to match truncates buf and
+ * the index list back to where it started.  Indices of unnamed stripes
+ * are carried down to be printed on the next named element.
+ */
+static int trymatch (struct rnndeccontext *ctx, struct rnndelem **elems, int elemsnum, uint64_t addr, int write, int dwidth, uint64_t *indices, int indicesnum, struct rnndecbuf *buf, struct rnndecaddr *res);
+
+static void putname (struct rnndeccontext *ctx, struct rnndelem *elem, uint64_t *indices, int indicesnum, struct rnndecbuf *buf) {
+	int j;
+	rnndec_bufprintf(buf, "%s%s%s", ctx->colors->rname, elem->name, ctx->colors->reset);
+	for (j = 0; j < indicesnum; j++)
+		rnndec_bufprintf(buf, "[%s%#"PRIx64"%s]", ctx->colors->num, indices[j], ctx->colors->reset);
+}
+
+static int trymatch_elem (struct rnndeccontext *ctx, struct rnndelem *elem, uint64_t addr, int write, int dwidth, uint64_t *indices, int indicesnum, struct rnndecbuf *buf, struct rnndecaddr *res) {
+	struct rnndecindex *sub;
+	uint64_t offset, idx;
+	size_t mark;
+	int imark;
+	int j;
+	switch (elem->type) {
+		case RNN_ETYPE_REG:
+			if (addr < elem->offset)
+				break;
+			if (elem->stride) {
+				idx = (addr-elem->offset)/elem->stride;
+				offset = (addr-elem->offset)%elem->stride;
+			} else {
+				idx = 0;
+				offset = addr-elem->offset;
+			}
+			if (offset >= elem->width/dwidth)
+				break;
+			if (elem->length && idx >= elem->length)
+				break;
+			res->reg = elem;
+			res->typeinfo = &elem->typeinfo;
+			res->width = elem->width;
+			res->offset = offset;
+			putname(ctx, elem, indices, indicesnum, buf);
+			if (elem->length != 1)
+				appendidx(ctx, buf, res, idx);
+			if (offset)
+				rnndec_bufprintf(buf, "+%s%#"PRIx64"%s", ctx->colors->err, offset, ctx->colors->reset);
+			return 1;
+		case RNN_ETYPE_STRIPE:
+			/* skip the instances that end before addr */
+			sub = getindex(ctx, elem->subelems, elem->subelemsnum, dwidth);
+			idx = 0;
+			if (elem->stride && addr >= elem->offset && addr - elem->offset >= sub->extent)
+				idx = (addr - elem->offset - sub->extent) / elem->stride + 1;
+			for (; idx < elem->length || !elem->length; idx++) {
+				if (addr < elem->offset + elem->stride * idx)
 					break;
-				if (elems[i]->stride) {
-					idx = (addr-elems[i]->offset)/elems[i]->stride;
-					offset = (addr-elems[i]->offset)%elems[i]->stride;
+				offset = addr - (elem->offset + elem->stride * idx);
+				int extraidx = (elem->length != 1);
+				mark = buf->len;
+				imark = res->indicesnum;
+				if (elem->name) {
+					putname(ctx, elem, indices, indicesnum, buf);
+					if (extraidx)
+						appendidx(ctx, buf, res, idx);
+					rnndec_bufprintf(buf, ".");
+					if (trymatch (ctx, elem->subelems, elem->subelemsnum, offset, write, dwidth, 0, 0, buf, res))
+						return 1;
 				} else {
-					idx = 0;
-					offset = addr-elems[i]->offset;
-				}
-				if (offset >= elems[i]->width/dwidth)
-					break;
-				if (elems[i]->length && idx >= elems[i]->length)
-					break;
-				res = calloc (sizeof *res, 1);
-				res->typeinfo = &elems[i]->typeinfo;
-				res->width = elems[i]->width;
-				asprintf (&res->name, "%s%s%s", ctx->colors->rname, elems[i]->name, ctx->colors->reset);
-				for (j = 0; j < indicesnum; j++)
-					res->name = appendidx(ctx, res->name, indices[j]);
-				if (elems[i]->length != 1)
-					res->name = appendidx(ctx, res->name, idx);
-				if (offset) {
-					asprintf (&tmp, "%s+%s%#"PRIx64"%s", res->name, ctx->colors->err, offset, ctx->colors->reset);
-					free(res->name);
-					res->name = tmp;
-				}
-				return res;
-			case RNN_ETYPE_STRIPE:
-				for (idx = 0; idx < elems[i]->length || !elems[i]->length; idx++) {
-					if (addr < elems[i]->offset + elems[i]->stride * idx)
-						break;
-					offset = addr - (elems[i]->offset + elems[i]->stride * idx);
-					int extraidx = (elems[i]->length != 1);
-					int nindnum = (elems[i]->name ? 0 : indicesnum + extraidx);
-					uint64_t nind[nindnum];
-					if (!elems[i]->name) {
-						for (j = 0; j < indicesnum; j++)
-							nind[j] = indices[j];
-						if (extraidx)
-							nind[indicesnum] = idx;
-					}
-					res = trymatch (ctx, elems[i]->subelems, elems[i]->subelemsnum, offset, write, dwidth, nind, nindnum);
-					if (!res)
-						continue;
-					if (!elems[i]->name)
-						return res;
-					asprintf (&name, "%s%s%s", ctx->colors->rname, elems[i]->name, ctx->colors->reset);
+					int nindnum = indicesnum + extraidx;
+					uint64_t nind[nindnum + 1];
 					for (j = 0; j < indicesnum; j++)
-						name = appendidx(ctx, name, indices[j]);
-					if (elems[i]->length != 1)
-						name = appendidx(ctx, name, idx);
-					asprintf (&tmp, "%s.%s", name, res->name);
-					free(name);
-					free(res->name);
-					res->name = tmp;
-					return res;
+						nind[j] = indices[j];
+					if (extraidx) {
+						nind[indicesnum] = idx;
+						/* printed further down, but recorded here */
+						if (res->indicesnum < RNNDEC_MAX_INDICES)
+							res->indices[res->indicesnum] = idx;
+						res->indicesnum++;
+					}
+					if (trymatch (ctx, elem->subelems, elem->subelemsnum, offset, write, dwidth, nind, nindnum, buf, res))
+						return 1;
 				}
+				buf->len = mark;
+				res->indicesnum = imark;
+			}
+			break;
+		case RNN_ETYPE_ARRAY:
+			if (addr < elem->offset)
 				break;
-			case RNN_ETYPE_ARRAY:
-				if (addr < elems[i]->offset)
-					break;
-				idx = (addr-elems[i]->offset)/elems[i]->stride;
-				offset = (addr-elems[i]->offset)%elems[i]->stride;
-				if (elems[i]->length && idx >= elems[i]->length)
-					break;
-				asprintf (&name, "%s%s%s", ctx->colors->rname, elems[i]->name, ctx->colors->reset);
-				for (j = 0; j < indicesnum; j++)
-					name = appendidx(ctx, name, indices[j]);
-				if (elems[i]->length != 1)
-					name = appendidx(ctx, name, idx);
-				if ((res = trymatch (ctx, elems[i]->subelems, elems[i]->subelemsnum, offset, write, dwidth, 0, 0))) {
-					asprintf (&tmp, "%s.%s", name, res->name);
-					free(name);
-					free(res->name);
-					res->name = tmp;
-					return res;
-				}
-				res = calloc (sizeof *res, 1);
-				asprintf (&tmp, "%s+%s%#"PRIx64"%s", name, ctx->colors->err, offset, ctx->colors->reset);
-				free(name);
-				res->name = tmp;
-				return res;
-			default:
+			idx = (addr-elem->offset)/elem->stride;
+			offset = (addr-elem->offset)%elem->stride;
+			if (elem->length && idx >= elem->length)
 				break;
-		}
+			putname(ctx, elem, indices, indicesnum, buf);
+			if (elem->length != 1)
+				appendidx(ctx, buf, res, idx);
+			mark = buf->len;
+			imark = res->indicesnum;
+			rnndec_bufprintf(buf, ".");
+			if (trymatch (ctx, elem->subelems, elem->subelemsnum, offset, write, dwidth, 0, 0, buf, res))
+				return 1;
+			buf->len = mark;
+			res->indicesnum = imark;
+			res->reg = NULL;
+			res->typeinfo = NULL;
+			res->width = 0;
+			res->offset = offset;
+			rnndec_bufprintf(buf, "+%s%#"PRIx64"%s", ctx->colors->err, offset, ctx->colors->reset);
+			return 1;
+		default:
+			break;
+	}
+	return 0;
+}
+
+static int trymatch (struct rnndeccontext *ctx, struct rnndelem **elems, int elemsnum, uint64_t addr, int write, int dwidth, uint64_t *indices, int indicesnum, struct rnndecbuf *buf, struct rnndecaddr *res) {
+	struct rnndecindex *idx = getindex(ctx, elems, elemsnum, dwidth);
+	int s = findseg(idx, addr);
+	int i;
+	if (s < 0)
+		return 0;
+	for (i = idx->first[s]; i < idx->first[s+1]; i++) {
+		int e = idx->cands[i];
+		if (!rnndec_varmatch(ctx, &elems[e]->varinfo))
+			continue;
+		if (trymatch_elem(ctx, elems[e], addr, write, dwidth, indices, indicesnum, buf, res))
+			return 1;
+	}
+	return 0;
+}
+
+int rnndec_decodeaddr_buf(struct rnndeccontext *ctx, struct rnndomain *domain, uint64_t addr, int write, struct rnndecbuf *buf, struct rnndecaddr *res) {
+	size_t start = buf->len;
+	memset(res, 0, sizeof *res);
+	/* make sure the name has a home even if nothing gets appended yet */
+	rnndec_bufprintf(buf, "%s", "");
+	if (trymatch(ctx, domain->subelems, domain->subelemsnum, addr, write, domain->width, 0, 0, buf, res)) {
+		res->name = buf->str + start;
+		return 1;
 	}
+	buf->len = start;
+	res->offset = addr;
+	rnndec_bufprintf(buf, "%s%#"PRIx64"%s", ctx->colors->err, addr, ctx->colors->reset);
+	res->name = buf->str + start;
 	return 0;
 }
 
 struct rnndecaddrinfo *rnndec_decodeaddr(struct rnndeccontext *ctx, struct rnndomain *domain, uint64_t addr, int write) {
-	struct rnndecaddrinfo *res = trymatch(ctx, domain->subelems, domain->subelemsnum, addr, write, domain->width, 0, 0);
-	if (res)
-		return res;
-	res = calloc (sizeof *res, 1);
-	asprintf (&res->name, "%s%#"PRIx64"%s", ctx->colors->err, addr, ctx->colors->reset);
+	struct rnndecaddrinfo *res = calloc (sizeof *res, 1);
+	struct rnndecbuf buf = { 0 };
+	struct rnndecaddr dec;
+	rnndec_decodeaddr_buf(ctx, domain, addr, write, &buf, &dec);
+	res->typeinfo = dec.typeinfo;
+	res->width = dec.width;
+	res->name = buf.str;
 	return res;
 }
 
@@ -138,7 +138,7 @@ const char * const seq_wait_status[] = {
 	"!HEAD1_HBLANK",
 };
 
-#define seq_out(p,s,...) printf("%06x: "s,((p) << 2), ##__VA_ARGS__)
+#define seq_out(p,s,...) fprintf(out, "%06x: "s,((p) << 2), ##__VA_ARGS__)
 #define seq_out_op(p,op,s,...) seq_out(p,"%-14s"s, seq_ops[op].txt, ##__VA_ARGS__)
 #define seq_outlast(p,op,val) \
 	seq_out_op(p,op,"%s      %s 0x%08x\n", \
@@ -147,13 +147,15 @@ const char * const seq_wait_status[] = {
 			(val))
 
 /**
- * Print a SEQ script to stdout in human-readable format.
+ * Print a SEQ script in human-readable format.
+ * @param out Stream to print to.
  * @param script Script to print, native endianness, in 32-bit words.
  * @param len Length of the script in 32-bit words.
  */
 void
-seq_print(uint32_t *script, uint32_t len, struct rnndeccontext *ctx, struct rnndomain *mmiodom)
+seq_print(FILE *out, uint32_t *script, uint32_t len, struct rnndeccontext *ctx, struct rnndomain *mmiodom)
 {
+	static struct rnndecbuf namebuf;
 	unsigned int pc, op, size;
 	char *reg0;
 	unsigned int reg1, i;
@@ -171,7 +173,7 @@ seq_print(uint32_t *script, uint32_t len, struct rnndeccontext *ctx, struct rnnd
 			return;
 	}
 
-	printf("SEQ script, size: %uB\n", len << 2);
+	fprintf(out, "SEQ script, size: %uB\n", len << 2);
 
 	for(pc = 0; pc < len; pc += size) {
 		op = script[pc] & 0xffff;
@@ -299,8 +301,10 @@ seq_print(uint32_t *script, uint32_t len, struct rnndeccontext *ctx, struct rnnd
 		case 0x21:
 			seq_out(pc,"SET REGISTERS:\n");
 			for (i = 1; i < size; i += 2) {
-				struct rnndecaddrinfo *ai = rnndec_decodeaddr(ctx, mmiodom, script[pc+i], 1);
-				seq_out(pc+i,"              R[0x%06x]   :=  0x%08x     # %s\n", script[pc+i], script[pc+i+1], ai->name);
+				struct rnndecaddr ai;
+				namebuf.len = 0;
+				rnndec_decodeaddr_buf(ctx, mmiodom, script[pc+i], 1, &namebuf, &ai);
+				seq_out(pc+i,"              R[0x%06x]   :=  0x%08x     # %s\n", script[pc+i], script[pc+i+1], ai.name);
 			}
 			seq_out(pc+i-2,"              reg_last      :=  0x%08x\n", script[pc+i-2]);
 			seq_out(pc+i-2,"              val_last      :=  0x%08x\n", script[pc+i-1]);
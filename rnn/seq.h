@@ -25,15 +25,18 @@
 #ifndef SEQ_H
 #define SEQ_H
 
+#include <stdio.h>
+
 struct rnndomain;
 struct rnndeccontext;
 
 /**
- * Print a SEQ script to stdout in human-readable format.
+ * Print a SEQ script in human-readable format.
+ * @param out Stream to print to.
  * @param script Script to print, native endianness, in 32-bit words.
  * @param len Length of the script in 32-bit words.
  */
-extern void seq_print(uint32_t *script, uint32_t len, struct rnndeccontext *ctx,
-				struct rnndomain *mmiodom);
+extern void seq_print(FILE *out, uint32_t *script, uint32_t len,
+				struct rnndeccontext *ctx, struct rnndomain *mmiodom);
 
 #endif /* SEQ_H */
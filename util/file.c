@@ -22,25 +22,337 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 
-FILE *open_input(const char *filename) {
-	const char * const tab[][2] = {
-		{ ".gz", "zcat" },
-		{ ".Z", "zcat" },
-		{ ".bz2", "bzcat" },
-		{ ".xz", "xzcat" },
+#ifdef ZLIB_AVAILABLE
+#include <zlib.h>
+#define ZLIB_BUILTIN 1
+#else
+#define ZLIB_BUILTIN 0
+#endif
+#ifdef BZIP2_AVAILABLE
+#include <bzlib.h>
+#define BZIP2_BUILTIN 1
+#else
+#define BZIP2_BUILTIN 0
+#endif
+#ifdef LZMA_AVAILABLE
+#include <lzma.h>
+#define LZMA_BUILTIN 1
+#else
+#define LZMA_BUILTIN 0
+#endif
+#ifdef ZSTD_AVAILABLE
+#include <zstd.h>
+#define ZSTD_BUILTIN 1
+#else
+#define ZSTD_BUILTIN 0
+#endif
+
+enum zformat {
+	ZFMT_GZIP,
+	ZFMT_BZIP2,
+	ZFMT_XZ,
+	ZFMT_ZSTD,
+	ZFMT_NONE,
+};
+
+static const char *const zformat_names[] = { "gzip", "bzip2", "xz", "zstd", "none" };
+
+/*
+ * Streaming decompressor hidden behind a stdio FILE, so that callers can
+ * keep using fgets/getline/fread on compressed traces.
+ */
+struct zinput {
+	FILE *raw;
+	enum zformat fmt;
+	int eof;
+	/* inside a compressed stream, the raw data may not end here */
+	int instream;
+	/* the raw data ended inside a compressed stream, 2 once reported */
+	int truncated;
+	size_t inpos;
+	size_t inlen;
+	union {
+#ifdef ZLIB_AVAILABLE
+		z_stream gz;
+#endif
+#ifdef BZIP2_AVAILABLE
+		bz_stream bz;
+#endif
+#ifdef LZMA_AVAILABLE
+		lzma_stream xz;
+#endif
+#ifdef ZSTD_AVAILABLE
+		ZSTD_DStream *zstd;
+#endif
+		int dummy;
+	};
+	unsigned char inbuf[256 * 1024];
+};
+
+/* refills the input buffer if it is empty, returns 0 at the end of raw data */
+static int zinput_fill(struct zinput *z) {
+	if (z->inpos < z->inlen)
+		return 1;
+	z->inpos = 0;
+	z->inlen = fread(z->inbuf, 1, sizeof z->inbuf, z->raw);
+	return z->inlen != 0;
+}
+
+/*
+ * The raw data may only end between compressed streams.  If it ends inside
+ * one, whatever was decoded so far is still returned, and the next read
+ * fails.
+ */
+static ssize_t zinput_read(void *cookie, char *buf, size_t size) {
+	struct zinput *z = cookie;
+	size_t done = 0, before;
+	while (done < size && !z->eof && !z->truncated) {
+		int more = zinput_fill(z);
+		if (!more && !z->instream && z->fmt != ZFMT_XZ) {
+			z->eof = 1;
+			break;
+		}
+		before = done;
+		switch (z->fmt) {
+#ifdef ZLIB_AVAILABLE
+		case ZFMT_GZIP: {
+			int ret;
+			z->gz.next_in = z->inbuf + z->inpos;
+			z->gz.avail_in = z->inlen - z->inpos;
+			z->gz.next_out = (unsigned char *)buf + done;
+			z->gz.avail_out = size - done;
+			ret = inflate(&z->gz, Z_NO_FLUSH);
+			z->inpos = z->inlen - z->gz.avail_in;
+			done = size - z->gz.avail_out;
+			if (ret == Z_STREAM_END) {
+				/* gzip files may consist of several members */
+				inflateReset(&z->gz);
+				z->instream = 0;
+			} else if (ret == Z_BUF_ERROR && !more) {
+				z->truncated = 1;
+			} else if (ret != Z_OK) {
+				fprintf(stderr, "gzip: %s\n", z->gz.msg ? z->gz.msg : "decompression failed");
+				return -1;
+			} else {
+				z->instream = 1;
+			}
+			break;
+		}
+#endif
+#ifdef BZIP2_AVAILABLE
+		case ZFMT_BZIP2: {
+			int ret;
+			z->bz.next_in = (char *)z->inbuf + z->inpos;
+			z->bz.avail_in = z->inlen - z->inpos;
+			z->bz.next_out = buf + done;
+			z->bz.avail_out = size - done;
+			ret = BZ2_bzDecompress(&z->bz);
+			z->inpos = z->inlen - z->bz.avail_in;
+			done = size - z->bz.avail_out;
+			if (ret == BZ_STREAM_END) {
+				/* concatenated streams, as produced by pbzip2 */
+				BZ2_bzDecompressEnd(&z->bz);
+				if (BZ2_bzDecompressInit(&z->bz, 0, 0) != BZ_OK)
+					return -1;
+				z->instream = 0;
+			} else if (ret != BZ_OK) {
+				fprintf(stderr, "bzip2: decompression failed (%d)\n", ret);
+				return -1;
+			} else if (!more && done == before) {
+				z->truncated = 1;
+			} else {
+				z->instream = 1;
+			}
+			break;
+		}
+#endif
+#ifdef LZMA_AVAILABLE
+		case ZFMT_XZ: {
+			lzma_ret ret;
+			z->xz.next_in = z->inbuf + z->inpos;
+			z->xz.avail_in = z->inlen - z->inpos;
+			z->xz.next_out = (unsigned char *)buf + done;
+			z->xz.avail_out = size - done;
+			ret = lzma_code(&z->xz, more ? LZMA_RUN : LZMA_FINISH);
+			z->inpos = z->inlen - z->xz.avail_in;
+			done = size - z->xz.avail_out;
+			if (ret == LZMA_STREAM_END) {
+				z->eof = 1;
+			} else if (ret == LZMA_BUF_ERROR && !more) {
+				z->truncated = 1;
+			} else if (ret != LZMA_OK) {
+				fprintf(stderr, "xz: decompression failed (%d)\n", ret);
+				return -1;
+			}
+			break;
+		}
+#endif
+#ifdef ZSTD_AVAILABLE
+		case ZFMT_ZSTD: {
+			ZSTD_inBuffer in = { z->inbuf, z->inlen, z->inpos };
+			ZSTD_outBuffer out = { buf, size, done };
+			size_t ret;
+			/* with no input left, this still flushes buffered output */
+			ret = ZSTD_decompressStream(z->zstd, &out, &in);
+			z->inpos = in.pos;
+			done = out.pos;
+			if (ZSTD_isError(ret)) {
+				fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+				return -1;
+			}
+			if (!ret)
+				z->instream = 0;
+			else if (!more && done == before)
+				z->truncated = 1;
+			else
+				z->instream = 1;
+			break;
+		}
+#endif
+		default:
+			return -1;
+		}
+	}
+	if (z->truncated && !done) {
+		if (z->truncated == 1)
+			fprintf(stderr, "%s: unexpected end of compressed data\n", zformat_names[z->fmt]);
+		z->truncated = 2;
+		return -1;
+	}
+	return done;
+}
+
+static int zinput_close(void *cookie) {
+	struct zinput *z = cookie;
+	switch (z->fmt) {
+#ifdef ZLIB_AVAILABLE
+	case ZFMT_GZIP:
+		inflateEnd(&z->gz);
+		break;
+#endif
+#ifdef BZIP2_AVAILABLE
+	case ZFMT_BZIP2:
+		BZ2_bzDecompressEnd(&z->bz);
+		break;
+#endif
+#ifdef LZMA_AVAILABLE
+	case ZFMT_XZ:
+		lzma_end(&z->xz);
+		break;
+#endif
+#ifdef ZSTD_AVAILABLE
+	case ZFMT_ZSTD:
+		ZSTD_freeDStream(z->zstd);
+		break;
+#endif
+	default:
+		break;
+	}
+	fclose(z->raw);
+	free(z);
+	return 0;
+}
+
+static int zinput_init(struct zinput *z, int threads) {
+	switch (z->fmt) {
+#ifdef ZLIB_AVAILABLE
+	case ZFMT_GZIP:
+		/* 15 + 32: max window, autodetect gzip or zlib header */
+		return inflateInit2(&z->gz, 15 + 32) == Z_OK;
+#endif
+#ifdef BZIP2_AVAILABLE
+	case ZFMT_BZIP2:
+		return BZ2_bzDecompressInit(&z->bz, 0, 0) == BZ_OK;
+#endif
+#ifdef LZMA_AVAILABLE
+	case ZFMT_XZ: {
+		lzma_stream init = LZMA_STREAM_INIT;
+		z->xz = init;
+#if LZMA_VERSION >= 50040002
+		/*
+		 * The threaded decoder only spawns its workers on the first
+		 * lzma_code call, so it is still safe to fork before reading.
+		 */
+		if (threads != 1) {
+			lzma_mt mt = { 0 };
+			mt.flags = LZMA_CONCATENATED;
+			mt.threads = threads ? threads : lzma_cputhreads();
+			if (!mt.threads)
+				mt.threads = 1;
+			mt.memlimit_threading = lzma_physmem() / 4;
+			mt.memlimit_stop = UINT64_MAX;
+			return lzma_stream_decoder_mt(&z->xz, &mt) == LZMA_OK;
+		}
+#endif
+		return lzma_stream_decoder(&z->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+	}
+#endif
+#ifdef ZSTD_AVAILABLE
+	case ZFMT_ZSTD:
+		z->zstd = ZSTD_createDStream();
+		if (!z->zstd)
+			return 0;
+		return !ZSTD_isError(ZSTD_initDStream(z->zstd));
+#endif
+	default:
+		return 0;
+	}
+}
+
+static FILE *open_decompressed(const char *filename, enum zformat fmt, int threads) {
+	cookie_io_functions_t io = { zinput_read, NULL, NULL, zinput_close };
+	struct zinput *z = calloc(1, sizeof *z);
+	FILE *res;
+	if (!z)
+		return NULL;
+	z->fmt = fmt;
+	z->raw = fopen(filename, "r");
+	if (!z->raw) {
+		free(z);
+		return NULL;
+	}
+	if (!zinput_init(z, threads)) {
+		fprintf(stderr, "%s: failed to initialize decompressor\n", filename);
+		fclose(z->raw);
+		free(z);
+		return NULL;
+	}
+	res = fopencookie(z, "r", io);
+	if (!res)
+		zinput_close(z);
+	return res;
+}
+
+FILE *open_input_threaded(const char *filename, int threads) {
+	const struct {
+		const char *ext;
+		const char *cmd;
+		enum zformat fmt;
+		int builtin;
+	} tab[] = {
+		{ ".gz", "zcat", ZFMT_GZIP, ZLIB_BUILTIN },
+		{ ".Z", "zcat", ZFMT_NONE, 0 },
+		{ ".bz2", "bzcat", ZFMT_BZIP2, BZIP2_BUILTIN },
+		{ ".xz", "xzcat", ZFMT_XZ, LZMA_BUILTIN },
+		{ ".zst", "zstdcat", ZFMT_ZSTD, ZSTD_BUILTIN },
 	};
 	int i;
 	int flen = strlen(filename);
 	for (i = 0; i < sizeof tab / sizeof tab[0]; i++) {
-		int elen = strlen(tab[i][0]);
-		if (flen > elen && !strcmp(filename + flen - elen, tab[i][0])) {
-			char *cmd = malloc(flen + strlen(tab[i][1]) + 2);
+		int elen = strlen(tab[i].ext);
+		if (flen > elen && !strcmp(filename + flen - elen, tab[i].ext)) {
+			char *cmd;
 			FILE *res;
-			strcpy(cmd, tab[i][1]);
+			if (tab[i].builtin)
+				return open_decompressed(filename, tab[i].fmt, threads);
+			cmd = malloc(flen + strlen(tab[i].cmd) + 2);
+			strcpy(cmd, tab[i].cmd);
 			strcat(cmd, " ");
 			strcat(cmd, filename);
 			res = popen(cmd, "r");
@@ -50,3 +362,7 @@ FILE *open_input(const char *filename) {
 	}
 	return fopen(filename, "r");
 }
+
+FILE *open_input(const char *filename) {
+	return open_input_threaded(filename, 1);
+}
@@ -0,0 +1,614 @@
+/*
+ * Copyright (C) 2010-2011 Marcelina Kościelnicka <mwk@0x04.net>
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "mmiotrace.h"
+#include "util.h"
+#include <string.h>
+
+/*
+ * Binary format.  All integers are little endian.  The file starts with
+ * the 8-byte magic, followed by blocks, each starting with a u32 type and
+ * a u32 count:
+ *
+ *  - MTB_TEXT: count bytes of text, whole lines passed through as they are.
+ *  - MTB_BARS: count u64 base, u64 length pairs, appended to the BAR table.
+ *    The writer fills it from the PCIDEV lines.
+ *  - MTB_ACCESS: count reads and writes, as columns: a u64 timestamp of the
+ *    first one in microseconds, u32 number of addresses outside the known
+ *    BARs, u32 number of values above 32 bits, then
+ *	u8 flags[count]		bits 0-1: log2 of width, bit 2: write
+ *	u32 tsdelta[count]	microseconds since the previous access
+ *	u8 bar[count]		BAR table index, 0xff if none
+ *	u32 offset[count]	address within the BAR
+ *	u32 value[count]	low 32 bits of the value
+ *	u64 addr[...]		full addresses of the accesses outside BARs
+ *	u32 valhi[...]		high 32 bits of the 64-bit values that need them
+ *
+ * Accesses the format can't represent exactly (odd width, timestamp not in
+ * whole microseconds, ...) go into a text block instead.
+ */
+
+static const char mtb_magic[8] = "MMIOBIN\1";
+
+enum {
+	MTB_TEXT = 1,
+	MTB_BARS = 2,
+	MTB_ACCESS = 3,
+};
+
+#define MTB_MAX_ACCESS 0x10000
+#define MTB_MAX_BARS 0xff
+#define TEXT_BLOCK (1 << 20)
+/* a sanity limit, the writer only goes over TEXT_BLOCK for a very long line */
+#define MTB_MAX_TEXT (1 << 28)
+
+struct mtb_bar {
+	uint64_t base;
+	uint64_t len;
+};
+
+struct mmiotrace {
+	FILE *f;
+	int binary;
+	int eof;
+	/* text: buf[pos..len) is unparsed input, buf[len] is always 0 */
+	char *buf;
+	size_t pos, len, max;
+	double timestamp;
+	/* binary: the current access block */
+	struct mtb_bar *bars;
+	int barsnum, barsmax;
+	uint8_t *data;
+	size_t datamax;
+	int acnt, apos, rawpos, hipos;
+	uint64_t ts;
+	uint8_t *flags, *bar;
+	uint8_t *tsdelta, *offset, *value, *raw, *valhi;
+};
+
+static uint32_t get32(const uint8_t *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t get64(const uint8_t *p) {
+	return get32(p) | (uint64_t)get32(p + 4) << 32;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+	put32(p, v);
+	put32(p + 4, v >> 32);
+}
+
+/* text parsing */
+
+static const double pow10tab[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static const char *skipspace(const char *p) {
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return p;
+}
+
+static int parse_dec(const char **pp, uint64_t *res) {
+	const char *p = *pp;
+	uint64_t v = 0;
+	while (*p >= '0' && *p <= '9' && p - *pp < 18)
+		v = v * 10 + (*p++ - '0');
+	if (p == *pp || (*p >= '0' && *p <= '9'))
+		return 0;
+	*pp = p;
+	*res = v;
+	return 1;
+}
+
+static int parse_hex(const char **pp, uint64_t *res) {
+	const char *p = *pp, *start;
+	uint64_t v = 0;
+	if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+		p += 2;
+	start = p;
+	while (p - start < 16) {
+		int d;
+		if (*p >= '0' && *p <= '9')
+			d = *p - '0';
+		else if ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f')
+			d = (*p | 0x20) - 'a' + 10;
+		else
+			break;
+		v = v << 4 | d;
+		p++;
+	}
+	if (p == start || (*p >= '0' && *p <= '9') || ((*p | 0x20) >= 'a' && (*p | 0x20) <= 'f'))
+		return 0;
+	*pp = p;
+	*res = v;
+	return 1;
+}
+
+/*
+ * The usual "seconds.micros" is handled exactly: the digits as an integer
+ * and the power of ten both fit a double, so a single division rounds the
+ * same way strtod does.  Anything else goes to strtod.
+ */
+static int parse_time(const char **pp, double *res) {
+	const char *p = *pp;
+	uint64_t m = 0;
+	int digits = 0, frac = 0;
+	while (*p >= '0' && *p <= '9' && digits < 16)
+		m = m * 10 + (*p++ - '0'), digits++;
+	if (*p == '.') {
+		p++;
+		while (*p >= '0' && *p <= '9' && digits < 16)
+			m = m * 10 + (*p++ - '0'), digits++, frac++;
+	}
+	if (digits && digits < 16 && *p != 'e' && *p != 'E' && !(*p >= '0' && *p <= '9')) {
+		*res = (double)m / pow10tab[frac];
+	} else {
+		char *end;
+		*res = strtod(*pp, &end);
+		if (end == *pp)
+			return 0;
+		p = end;
+	}
+	*pp = p;
+	return 1;
+}
+
+static void parse_access(struct mmiotrace *mt, const char *line, size_t len, struct mmiotrace_rec *rec) {
+	const char *p = line + 2;
+	uint64_t width, mapid;
+	rec->type = line[0] == 'W' ? MMIOTRACE_WRITE : MMIOTRACE_READ;
+	if ((p = skipspace(p), parse_dec(&p, &width)) && width < 0x10000000 &&
+			(p = skipspace(p), parse_time(&p, &rec->timestamp)) &&
+			(p = skipspace(p), parse_dec(&p, &mapid)) &&
+			(p = skipspace(p), parse_hex(&p, &rec->addr)) &&
+			(p = skipspace(p), parse_hex(&p, &rec->value))) {
+		rec->width = width;
+	} else {
+		/* something unusual, leave it to sscanf */
+		char tmp[1024];
+		if (len >= sizeof tmp)
+			len = sizeof tmp - 1;
+		memcpy(tmp, line, len);
+		tmp[len] = 0;
+		rec->width = 0;
+		rec->timestamp = mt->timestamp;
+		rec->addr = rec->value = 0;
+		sscanf (tmp, "%*s %d %lf %*d %"SCNx64" %"SCNx64, &rec->width, &rec->timestamp, &rec->addr, &rec->value);
+	}
+	mt->timestamp = rec->timestamp;
+}
+
+static char *next_line(struct mmiotrace *mt, size_t *plen) {
+	char *res = mt->buf + mt->pos;
+	char *nl = memchr(res, '\n', mt->len - mt->pos);
+	*plen = nl ? nl + 1 - res : mt->len - mt->pos;
+	mt->pos += *plen;
+	return res;
+}
+
+/* refills the buffer until it has a whole line or all that's left */
+static char *text_line(struct mmiotrace *mt, size_t *plen) {
+	while (!memchr(mt->buf + mt->pos, '\n', mt->len - mt->pos) && !mt->eof) {
+		size_t n;
+		memmove(mt->buf, mt->buf + mt->pos, mt->len - mt->pos);
+		mt->len -= mt->pos;
+		mt->pos = 0;
+		if (mt->max < mt->len + TEXT_BLOCK + 1) {
+			mt->max = mt->len + TEXT_BLOCK + 1;
+			mt->buf = realloc(mt->buf, mt->max);
+		}
+		n = fread(mt->buf + mt->len, 1, TEXT_BLOCK, mt->f);
+		if (!n)
+			mt->eof = 1;
+		mt->len += n;
+		mt->buf[mt->len] = 0;
+	}
+	if (mt->pos == mt->len)
+		return NULL;
+	return next_line(mt, plen);
+}
+
+static void parse_line(struct mmiotrace *mt, const char *line, size_t len, struct mmiotrace_rec *rec) {
+	rec->line = line;
+	rec->linelen = len;
+	if ((line[0] == 'W' || line[0] == 'R') && line[1] == ' ')
+		parse_access(mt, line, len, rec);
+	else
+		rec->type = MMIOTRACE_LINE;
+}
+
+static int read_text(struct mmiotrace *mt, struct mmiotrace_rec *rec) {
+	size_t len;
+	char *line = text_line(mt, &len);
+	if (!line)
+		return ferror(mt->f) ? -1 : 0;
+	parse_line(mt, line, len, rec);
+	return 1;
+}
+
+/* binary reading */
+
+static uint8_t *read_data(struct mmiotrace *mt, size_t size) {
+	if (size > mt->datamax) {
+		mt->datamax = size;
+		mt->data = realloc(mt->data, size);
+	}
+	if (fread(mt->data, 1, size, mt->f) != size)
+		return NULL;
+	return mt->data;
+}
+
+static int read_block(struct mmiotrace *mt) {
+	uint8_t hdr[8];
+	uint8_t *p;
+	uint32_t type, cnt, nraw, nhi;
+	int i;
+	size_t got = fread(hdr, 1, 8, mt->f);
+	/* a clean end of trace only between blocks */
+	if (got != 8)
+		return got || ferror(mt->f) ? -1 : 0;
+	type = get32(hdr);
+	cnt = get32(hdr + 4);
+	switch (type) {
+		case MTB_TEXT:
+			if (cnt > MTB_MAX_TEXT)
+				return -1;
+			if (mt->max < cnt + 1) {
+				mt->max = cnt + 1;
+				mt->buf = realloc(mt->buf, mt->max);
+			}
+			if (fread(mt->buf, 1, cnt, mt->f) != cnt)
+				return -1;
+			mt->buf[cnt] = 0;
+			mt->pos = 0;
+			mt->len = cnt;
+			return 1;
+		case MTB_BARS:
+			if (cnt > MTB_MAX_BARS || !(p = read_data(mt, cnt * 16)))
+				return -1;
+			for (i = 0; i < cnt; i++) {
+				struct mtb_bar bar = { get64(p + i * 16), get64(p + i * 16 + 8) };
+				ADDARRAY(mt->bars, bar);
+			}
+			return 1;
+		case MTB_ACCESS:
+			if (cnt > MTB_MAX_ACCESS || fread(hdr, 1, 8, mt->f) != 8)
+				return -1;
+			mt->ts = get64(hdr);
+			if (fread(hdr, 1, 8, mt->f) != 8)
+				return -1;
+			nraw = get32(hdr);
+			nhi = get32(hdr + 4);
+			if (nraw > cnt || nhi > cnt || !(p = read_data(mt, cnt * 14 + nraw * 8 + nhi * 4)))
+				return -1;
+			mt->flags = p;
+			mt->tsdelta = mt->flags + cnt;
+			mt->bar = mt->tsdelta + cnt * 4;
+			mt->offset = mt->bar + cnt;
+			mt->value = mt->offset + cnt * 4;
+			mt->raw = mt->value + cnt * 4;
+			mt->valhi = mt->raw + nraw * 8;
+			mt->acnt = cnt;
+			mt->apos = mt->rawpos = mt->hipos = 0;
+			/* validate the references up front, so reading can't overrun */
+			for (i = 0; i < cnt; i++) {
+				if (mt->bar[i] == 0xff)
+					mt->rawpos++;
+				else if (mt->bar[i] >= mt->barsnum)
+					return -1;
+				if ((mt->flags[i] & 3) == 3)
+					mt->hipos++;
+			}
+			if (mt->rawpos != nraw || mt->hipos != nhi)
+				return -1;
+			mt->rawpos = mt->hipos = 0;
+			return 1;
+		default:
+			return -1;
+	}
+}
+
+static int read_binary(struct mmiotrace *mt, struct mmiotrace_rec *rec) {
+	while (mt->apos == mt->acnt && mt->pos == mt->len) {
+		int res = read_block(mt);
+		if (res <= 0)
+			return res;
+	}
+	if (mt->pos < mt->len) {
+		/* may also be an access the binary format couldn't hold */
+		size_t len;
+		char *line = next_line(mt, &len);
+		parse_line(mt, line, len, rec);
+		return 1;
+	}
+	int i = mt->apos++;
+	uint8_t flags = mt->flags[i];
+	mt->ts += get32(mt->tsdelta + i * 4);
+	rec->type = flags & 4 ? MMIOTRACE_WRITE : MMIOTRACE_READ;
+	rec->width = 1 << (flags & 3);
+	rec->timestamp = (double)mt->ts / 1e6;
+	if (mt->bar[i] == 0xff)
+		rec->addr = get64(mt->raw + mt->rawpos++ * 8);
+	else
+		rec->addr = mt->bars[mt->bar[i]].base + get32(mt->offset + i * 4);
+	rec->value = get32(mt->value + i * 4);
+	if ((flags & 3) == 3)
+		rec->value |= (uint64_t)get32(mt->valhi + mt->hipos++ * 4) << 32;
+	rec->line = NULL;
+	rec->linelen = 0;
+	mt->timestamp = rec->timestamp;
+	return 1;
+}
+
+struct mmiotrace *mmiotrace_open(const char *file, int threads) {
+	struct mmiotrace *mt;
+	FILE *f = file ? open_input_threaded(file, threads) : stdin;
+	if (!f)
+		return NULL;
+	mt = calloc(sizeof *mt, 1);
+	mt->f = f;
+	mt->max = TEXT_BLOCK + 1;
+	mt->buf = malloc(mt->max);
+	mt->len = fread(mt->buf, 1, sizeof mtb_magic, f);
+	if (mt->len == sizeof mtb_magic && !memcmp(mt->buf, mtb_magic, sizeof mtb_magic)) {
+		mt->binary = 1;
+		mt->len = 0;
+	}
+	mt->buf[mt->len] = 0;
+	return mt;
+}
+
+int mmiotrace_read(struct mmiotrace *mt, struct mmiotrace_rec *rec) {
+	if (mt->binary)
+		return read_binary(mt, rec);
+	return read_text(mt, rec);
+}
+
+void mmiotrace_close(struct mmiotrace *mt) {
+	if (mt->f != stdin)
+		fclose(mt->f);
+	free(mt->buf);
+	free(mt->bars);
+	free(mt->data);
+	free(mt);
+}
+
+/* writing */
+
+struct mmiotrace_writer {
+	FILE *out;
+	int err;
+	char *text;
+	size_t textnum, textmax;
+	struct mtb_bar *bars;
+	int barsnum, barsmax;
+	int lastbar;
+	/* pending accesses */
+	int acnt;
+	uint64_t firstts, lastts;
+	uint8_t flags[MTB_MAX_ACCESS];
+	uint32_t tsdelta[MTB_MAX_ACCESS];
+	uint8_t bar[MTB_MAX_ACCESS];
+	uint32_t offset[MTB_MAX_ACCESS];
+	uint32_t value[MTB_MAX_ACCESS];
+	uint64_t raw[MTB_MAX_ACCESS];
+	int rawnum;
+	uint32_t valhi[MTB_MAX_ACCESS];
+	int valhinum;
+};
+
+static void wr(struct mmiotrace_writer *w, const void *data, size_t size) {
+	if (fwrite(data, 1, size, w->out) != size)
+		w->err = 1;
+}
+
+static void wr_hdr(struct mmiotrace_writer *w, uint32_t type, uint32_t cnt) {
+	uint8_t hdr[8];
+	put32(hdr, type);
+	put32(hdr + 4, cnt);
+	wr(w, hdr, 8);
+}
+
+static void wr_col32(struct mmiotrace_writer *w, const uint32_t *col, int num) {
+	uint8_t buf[4096];
+	int i, n = 0;
+	for (i = 0; i < num; i++) {
+		put32(buf + n, col[i]);
+		n += 4;
+		if (n == sizeof buf || i == num - 1) {
+			wr(w, buf, n);
+			n = 0;
+		}
+	}
+}
+
+static void flush_text(struct mmiotrace_writer *w) {
+	if (!w->textnum)
+		return;
+	wr_hdr(w, MTB_TEXT, w->textnum);
+	wr(w, w->text, w->textnum);
+	w->textnum = 0;
+}
+
+static void flush_access(struct mmiotrace_writer *w) {
+	uint8_t hdr[8];
+	int i;
+	if (!w->acnt)
+		return;
+	wr_hdr(w, MTB_ACCESS, w->acnt);
+	put64(hdr, w->firstts);
+	wr(w, hdr, 8);
+	put32(hdr, w->rawnum);
+	put32(hdr + 4, w->valhinum);
+	wr(w, hdr, 8);
+	wr(w, w->flags, w->acnt);
+	wr_col32(w, w->tsdelta, w->acnt);
+	wr(w, w->bar, w->acnt);
+	wr_col32(w, w->offset, w->acnt);
+	wr_col32(w, w->value, w->acnt);
+	for (i = 0; i < w->rawnum; i++) {
+		put64(hdr, w->raw[i]);
+		wr(w, hdr, 8);
+	}
+	wr_col32(w, w->valhi, w->valhinum);
+	w->acnt = w->rawnum = w->valhinum = 0;
+}
+
+static void add_text(struct mmiotrace_writer *w, const char *text, size_t len) {
+	flush_access(w);
+	if (w->textnum + len > w->textmax) {
+		w->textmax = w->textnum + len + TEXT_BLOCK;
+		w->text = realloc(w->text, w->textmax);
+	}
+	memcpy(w->text + w->textnum, text, len);
+	w->textnum += len;
+	if (w->textnum >= TEXT_BLOCK)
+		flush_text(w);
+}
+
+/* the BARs of a PCIDEV line go to the table, the line itself stays text */
+static void add_pcidev(struct mmiotrace_writer *w, const char *line, size_t len) {
+	uint64_t bar[4], blen[4];
+	char tmp[1024];
+	uint8_t buf[16];
+	int i, n = 0;
+	if (len >= sizeof tmp)
+		len = sizeof tmp - 1;
+	memcpy(tmp, line, len);
+	tmp[len] = 0;
+	if (sscanf (tmp, "%*s %*s %*s %*s %"SCNx64" %"SCNx64" %"SCNx64" %"SCNx64" %*s %*s %*s %"SCNx64" %"SCNx64" %"SCNx64" %"SCNx64"", &bar[0], &bar[1], &bar[2], &bar[3], &blen[0], &blen[1], &blen[2], &blen[3]) != 8)
+		return;
+	for (i = 0; i < 4; i++)
+		if (bar[i] && blen[i] && w->barsnum + n < MTB_MAX_BARS)
+			n++;
+	if (!n)
+		return;
+	flush_text(w);
+	wr_hdr(w, MTB_BARS, n);
+	for (i = 0; i < 4 && n; i++) {
+		if (bar[i] && blen[i]) {
+			/* low bits are flags, keep lengths within the offset column */
+			struct mtb_bar b = { bar[i] & ~0xfull, min(blen[i], (uint64_t)1 << 32) };
+			put64(buf, b.base);
+			put64(buf + 8, b.len);
+			wr(w, buf, 16);
+			ADDARRAY(w->bars, b);
+			n--;
+		}
+	}
+}
+
+static int find_bar(struct mmiotrace_writer *w, uint64_t addr) {
+	int i;
+	if (w->lastbar < w->barsnum && addr - w->bars[w->lastbar].base < w->bars[w->lastbar].len)
+		return w->lastbar;
+	for (i = 0; i < w->barsnum; i++)
+		if (addr - w->bars[i].base < w->bars[i].len)
+			return w->lastbar = i;
+	return 0xff;
+}
+
+static int add_access(struct mmiotrace_writer *w, const struct mmiotrace_rec *rec) {
+	int lw, i, b;
+	double us = rec->timestamp * 1e6;
+	uint64_t ts;
+	for (lw = 0; lw < 4 && rec->width != 1 << lw; lw++);
+	if (lw == 4 || (lw < 3 && rec->value >> 32))
+		return 0;
+	/* only timestamps that read back bit-exact */
+	if (!(us >= 0 && us < 0x1p53))
+		return 0;
+	ts = us + 0.5;
+	if ((double)ts / 1e6 != rec->timestamp)
+		return 0;
+	if (w->acnt == MTB_MAX_ACCESS || (w->acnt && (ts < w->lastts || ts - w->lastts > 0xffffffff)))
+		flush_access(w);
+	flush_text(w);
+	i = w->acnt++;
+	if (!i)
+		w->firstts = w->lastts = ts;
+	w->flags[i] = lw | (rec->type == MMIOTRACE_WRITE) << 2;
+	w->tsdelta[i] = ts - w->lastts;
+	w->lastts = ts;
+	b = find_bar(w, rec->addr);
+	w->bar[i] = b;
+	if (b == 0xff) {
+		w->offset[i] = 0;
+		w->raw[w->rawnum++] = rec->addr;
+	} else {
+		w->offset[i] = rec->addr - w->bars[b].base;
+	}
+	w->value[i] = rec->value;
+	if (lw == 3)
+		w->valhi[w->valhinum++] = rec->value >> 32;
+	return 1;
+}
+
+struct mmiotrace_writer *mmiotrace_writer_new(FILE *out) {
+	struct mmiotrace_writer *w = calloc(sizeof *w, 1);
+	w->out = out;
+	wr(w, mtb_magic, sizeof mtb_magic);
+	return w;
+}
+
+void mmiotrace_write(struct mmiotrace_writer *w, const struct mmiotrace_rec *rec) {
+	if (rec->type == MMIOTRACE_LINE) {
+		if (!strncmp(rec->line, "PCIDEV ", 7))
+			add_pcidev(w, rec->line, rec->linelen);
+		add_text(w, rec->line, rec->linelen);
+	} else if (!add_access(w, rec)) {
+		if (rec->line) {
+			add_text(w, rec->line, rec->linelen);
+		} else {
+			char *line = aprintf("%c %d %.6f 0 0x%"PRIx64" 0x%"PRIx64"\n", rec->type == MMIOTRACE_WRITE ? 'W' : 'R', rec->width, rec->timestamp, rec->addr, rec->value);
+			add_text(w, line, strlen(line));
+			free(line);
+		}
+	}
+}
+
+int mmiotrace_writer_finish(struct mmiotrace_writer *w) {
+	int err;
+	flush_access(w);
+	flush_text(w);
+	if (fflush(w->out))
+		w->err = 1;
+	err = w->err;
+	free(w->text);
+	free(w->bars);
+	free(w);
+	return err;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2026 envytools contributors
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Round trip of the text mmiotrace format through the binary one: a
+ * generated text trace is converted with mmiotrace_write and both are read
+ * back, which must give the same records.  Also checks that a binary trace
+ * cut inside a block header is reported as corrupt, not as a clean end.
+ */
+
+#include "mmiotrace.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ACCESSES 150000
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(uint32_t max) {
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % max;
+}
+
+static void gen_text(FILE *f) {
+	static const int widths[] = { 1, 2, 4, 8 };
+	uint64_t us = 1000000;
+	int i;
+	fprintf(f, "VERSION 20070824\n");
+	fprintf(f, "PCIDEV 0100 10de0fc6 16 f2000000 e000000c f000000c 0 0 0 0 1000000 10000000 2000000 0 nvidia\n");
+	for (i = 0; i < ACCESSES; i++) {
+		int width = widths[rnd(4)];
+		uint64_t addr, value = rnd(0x1000000);
+		us += rnd(100);
+		if (width == 8)
+			value |= (uint64_t)rnd(0x1000000) << 40;
+		switch (rnd(8)) {
+			case 0:
+				/* outside of all BARs */
+				addr = 0x100000000ull + rnd(0x100000) * 4;
+				break;
+			case 1:
+				addr = 0xe0000000 + rnd(0x100000) * 4;
+				break;
+			default:
+				addr = 0xf2000000 + rnd(0x1000000) * 4;
+				break;
+		}
+		if (rnd(1000) == 0)
+			fprintf(f, "MARK %d.%06d marker %d\n", (int)(us / 1000000), (int)(us % 1000000), i);
+		if (rnd(5000) == 0)
+			/* not whole microseconds, has to stay text */
+			fprintf(f, "W %d %d.%07d 1 %"PRIx64" %"PRIx64" 0\n", width,
+				(int)(us / 1000000), (int)(us % 1000000) * 10 + 5, addr, value);
+		else
+			fprintf(f, "%c %d %d.%06d 1 %"PRIx64" %"PRIx64" 0\n", rnd(3) ? 'R' : 'W', width,
+				(int)(us / 1000000), (int)(us % 1000000), addr, value);
+	}
+}
+
+static int compare(const char *textfile, const char *binfile) {
+	struct mmiotrace *text = mmiotrace_open(textfile, 0);
+	struct mmiotrace *bin = mmiotrace_open(binfile, 0);
+	struct mmiotrace_rec a, b;
+	int n = 0, ra, rb;
+	if (!text || !bin) {
+		perror("mmiotrace_open");
+		return 1;
+	}
+	while (1) {
+		ra = mmiotrace_read(text, &a);
+		rb = mmiotrace_read(bin, &b);
+		if (ra != rb) {
+			fprintf(stderr, "record %d: read returned %d for text, %d for binary\n", n, ra, rb);
+			return 1;
+		}
+		if (ra <= 0)
+			break;
+		if (a.type != b.type) {
+			fprintf(stderr, "record %d: type mismatch\n", n);
+			return 1;
+		}
+		if (a.type == MMIOTRACE_LINE) {
+			if (a.linelen != b.linelen || memcmp(a.line, b.line, a.linelen)) {
+				fprintf(stderr, "record %d: line mismatch\n", n);
+				return 1;
+			}
+		} else if (a.width != b.width || a.timestamp != b.timestamp || a.addr != b.addr || a.value != b.value) {
+			fprintf(stderr, "record %d: access mismatch: %d %f %"PRIx64" %"PRIx64" vs %d %f %"PRIx64" %"PRIx64"\n",
+				n, a.width, a.timestamp, a.addr, a.value, b.width, b.timestamp, b.addr, b.value);
+			return 1;
+		}
+		n++;
+	}
+	mmiotrace_close(text);
+	mmiotrace_close(bin);
+	if (ra < 0) {
+		fprintf(stderr, "read error\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int check_truncated(const char *binfile) {
+	struct mmiotrace *mt;
+	struct mmiotrace_rec rec;
+	FILE *f = fopen(binfile, "ab");
+	int res;
+	if (!f) {
+		perror(binfile);
+		return 1;
+	}
+	/* half of a block header */
+	fwrite("\1\0\0\0", 1, 4, f);
+	fclose(f);
+	mt = mmiotrace_open(binfile, 0);
+	if (!mt) {
+		perror(binfile);
+		return 1;
+	}
+	while ((res = mmiotrace_read(mt, &rec)) > 0);
+	mmiotrace_close(mt);
+	if (res != -1) {
+		fprintf(stderr, "truncated block header not reported\n");
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *dir = argc > 1 ? argv[1] : ".";
+	char textfile[4096], binfile[4096];
+	struct mmiotrace *mt;
+	struct mmiotrace_writer *w;
+	struct mmiotrace_rec rec;
+	FILE *f;
+	int res;
+	snprintf(textfile, sizeof textfile, "%s/mmiotracetest.txt", dir);
+	snprintf(binfile, sizeof binfile, "%s/mmiotracetest.bin", dir);
+
+	f = fopen(textfile, "w");
+	if (!f) {
+		perror(textfile);
+		return 1;
+	}
+	gen_text(f);
+	fclose(f);
+
+	mt = mmiotrace_open(textfile, 0);
+	f = fopen(binfile, "wb");
+	if (!mt || !f) {
+		perror("open");
+		return 1;
+	}
+	w = mmiotrace_writer_new(f);
+	while ((res = mmiotrace_read(mt, &rec)) > 0)
+		mmiotrace_write(w, &rec);
+	mmiotrace_close(mt);
+	if (res < 0 || mmiotrace_writer_finish(w) || fclose(f)) {
+		fprintf(stderr, "conversion failed\n");
+		return 1;
+	}
+
+	if (compare(textfile, binfile) || check_truncated(binfile))
+		return 1;
+
+	remove(textfile);
+	remove(binfile);
+	return 0;
+}
@@ -26,13 +26,283 @@
 #include "util.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define VS_READ_CHUNK 0x10000
+
+/* reads more data from the source, returns 0 if there's none */
+static int vs_refill(struct bitstream *str) {
+	int res;
+	if (!str->readfn)
+		return 0;
+	if (str->bytesmax - str->bytesnum < VS_READ_CHUNK) {
+		while (str->bytesmax - str->bytesnum < VS_READ_CHUNK)
+			str->bytesmax = str->bytesmax ? str->bytesmax * 2 : VS_READ_CHUNK;
+		str->bytes = realloc(str->bytes, str->bytesmax);
+	}
+	res = str->readfn(str->readarg, str->bytes + str->bytesnum, str->bytesmax - str->bytesnum);
+	if (res <= 0) {
+		str->readfn = 0;
+		return 0;
+	}
+	str->bytesnum += res;
+	return 1;
+}
+
+/* makes sure bytes[pos] is there if the stream is long enough */
+static inline int vs_have(struct bitstream *str, int pos) {
+	while (pos >= str->bytesnum)
+		if (!vs_refill(str))
+			return 0;
+	return 1;
+}
+
+/* drops the window data before bytepos, only called where nothing else
+ * points into it */
+static void vs_compact(struct bitstream *str) {
+	int drop = str->bytepos;
+	if (!str->readfn || str->rbspvalid)
+		return;
+	if (str->keepoff < str->bytesbase + drop)
+		drop = str->keepoff > str->bytesbase ? str->keepoff - str->bytesbase : 0;
+	if (drop < VS_READ_CHUNK)
+		return;
+	memmove(str->bytes, str->bytes + drop, str->bytesnum - drop);
+	str->bytesnum -= drop;
+	str->bytesbase += drop;
+	str->bytepos -= drop;
+}
+
+/* strips the NAL starting at bytepos into rbsp, stopping exactly where
+ * vs_byte would fail */
+static void vs_rbsp_fill(struct bitstream *str) {
+	int pos = str->bytepos;
+	int zero_bytes = str->zero_bytes;
+	int i;
+	str->rbspnum = 0;
+	str->escapesnum = 0;
+	str->rbspstart = pos;
+	str->rbspbit = 0;
+	while (vs_have(str, pos)) {
+		uint8_t byte = str->bytes[pos];
+		if (zero_bytes >= 2) {
+			if (byte < 2)
+				break;
+			if (str->type == VS_H264) {
+				if (byte == 2)
+					break;
+				if (byte == 3) {
+					if (!vs_have(str, pos + 1) || str->bytes[pos + 1] > 3)
+						break;
+					ADDARRAY(str->escapes, str->rbspnum);
+					byte = str->bytes[++pos];
+					zero_bytes = 0;
+				}
+			}
+		}
+		ADDARRAY(str->rbsp, byte);
+		if (!byte)
+			zero_bytes++;
+		else
+			zero_bytes = 0;
+		pos++;
+	}
+	/* padding for the 64-bit window loads */
+	for (i = 0; i < 8; i++)
+		ADDARRAY(str->rbsp, 0);
+	str->rbspnum -= 8;
+	str->rbspvalid = 1;
+}
+
+/* brings bytepos, curbyte and zero_bytes up to the rbsp read position */
+static void vs_rbsp_sync(struct bitstream *str) {
+	int n = (str->rbspbit + 7) >> 3;
+	int lo = 0, hi = str->escapesnum;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (str->escapes[mid] < n)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	str->bytepos = str->rbspstart + n + lo;
+	if (n) {
+		int start = lo ? str->escapes[lo - 1] : 0;
+		int i = n - 1;
+		str->curbyte = str->rbsp[i];
+		str->zero_bytes = 0;
+		while (i >= start && !str->rbsp[i]) {
+			str->zero_bytes++;
+			i--;
+		}
+	}
+}
+
+/* falls back to reading the raw bytes from the current position on */
+static void vs_rbsp_leave(struct bitstream *str) {
+	vs_rbsp_sync(str);
+	str->rbspvalid = 0;
+}
+
+static inline int vs_rbsp_avail(struct bitstream *str, int bits) {
+	return str->rbspbit + bits <= (uint64_t)str->rbspnum * 8;
+}
+
+/* at least 57 valid bits, msb-aligned */
+static inline uint64_t vs_rbsp_peek(struct bitstream *str) {
+	const uint8_t *p = str->rbsp + (str->rbspbit >> 3);
+	uint64_t res = (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 | (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+		(uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 | (uint64_t)p[6] << 8 | p[7];
+	return res << (str->rbspbit & 7);
+}
+
+static inline void vs_rbsp_skip(struct bitstream *str, int bits) {
+	str->rbspbit += bits;
+	str->hasbyte = (str->rbspbit & 7) != 0;
+	str->bitpos = 7 - (str->rbspbit & 7);
+}
+
+/*
+ * For decoding, each vs_vlc_val table gets turned into a lookup table
+ * indexed by the next VS_VLC_BITS bits of the stream, with subtables for
+ * the longer codes, so that a symbol takes a lookup or two instead of a
+ * scan of the whole table.  Invalid codes, and codes running past the end
+ * of the NAL, are left to the scan, so that it reports them as before.
+ * Since the scan consumes every bit it compares, a table where an entry
+ * extends a later one can consume more than the matching code, and is
+ * always scanned.  The lookup tables are kept per bitstream, keyed by
+ * the table address.
+ */
+
+#define VS_VLC_BITS 8
+#define VS_VLC_CACHE 256
+
+struct vs_vlc_ent {
+	/* > 0: code length, 0: invalid code, -1: subtable */
+	int len;
+	/* subtable index bits */
+	int bits;
+	/* decoded value, or subtable start */
+	uint32_t val;
+};
+
+struct vs_vlc_lut {
+	const struct vs_vlc_val *tab;
+	/* NULL if the table has to be scanned */
+	struct vs_vlc_ent *ents;
+	int entsnum;
+	int entsmax;
+	int rootbits;
+};
+
+struct vs_vlc_cache {
+	struct vs_vlc_lut luts[VS_VLC_CACHE];
+};
+
+static int vs_vlc_match(const struct vs_vlc_val *a, const struct vs_vlc_val *b, int len) {
+	int i;
+	for (i = 0; i < len; i++)
+		if (a->bits[i] != b->bits[i])
+			return 0;
+	return 1;
+}
+
+static int vs_vlc_newtab(struct vs_vlc_lut *lut, int bits) {
+	struct vs_vlc_ent empty = { 0 };
+	int start = lut->entsnum;
+	int i;
+	for (i = 0; i < 1 << bits; i++)
+		ADDARRAY(lut->ents, empty);
+	return start;
+}
+
+/* index bits for the subtable of codes starting like e's first depth bits */
+static int vs_vlc_subbits(const struct vs_vlc_val *tab, const struct vs_vlc_val *e, int depth) {
+	int res = 1;
+	int i;
+	for (i = 0; tab[i].blen; i++)
+		if (tab[i].blen - depth > res && vs_vlc_match(&tab[i], e, depth))
+			res = tab[i].blen - depth;
+	return res < VS_VLC_BITS ? res : VS_VLC_BITS;
+}
+
+static void vs_vlc_insert(struct vs_vlc_lut *lut, const struct vs_vlc_val *e, int start, int bits, int depth) {
+	int rem = e->blen - depth;
+	uint32_t idx = 0;
+	int i;
+	for (i = 0; i < bits && i < rem; i++)
+		idx = idx << 1 | e->bits[depth + i];
+	if (rem <= bits) {
+		idx <<= bits - rem;
+		for (i = 0; i < 1 << (bits - rem); i++) {
+			struct vs_vlc_ent *ent = &lut->ents[start + idx + i];
+			/* an earlier entry with the same code wins */
+			if (!ent->len) {
+				ent->len = e->blen;
+				ent->val = e->val;
+			}
+		}
+	} else {
+		struct vs_vlc_ent *ent = &lut->ents[start + idx];
+		/* shadowed by an earlier, shorter code */
+		if (ent->len > 0)
+			return;
+		if (!ent->len) {
+			int sbits = vs_vlc_subbits(lut->tab, e, depth + bits);
+			int sstart = vs_vlc_newtab(lut, sbits);
+			ent = &lut->ents[start + idx];
+			ent->len = -1;
+			ent->bits = sbits;
+			ent->val = sstart;
+		}
+		vs_vlc_insert(lut, e, ent->val, ent->bits, depth + bits);
+	}
+}
+
+static void vs_vlc_build(struct vs_vlc_lut *lut, const struct vs_vlc_val *tab) {
+	int maxlen = 0;
+	int i, j;
+	lut->tab = tab;
+	for (i = 0; tab[i].blen; i++) {
+		for (j = i + 1; tab[j].blen; j++)
+			if (tab[j].blen < tab[i].blen && vs_vlc_match(&tab[i], &tab[j], tab[j].blen))
+				return;
+		if (tab[i].blen > maxlen)
+			maxlen = tab[i].blen;
+	}
+	if (!maxlen)
+		return;
+	lut->rootbits = maxlen < VS_VLC_BITS ? maxlen : VS_VLC_BITS;
+	vs_vlc_newtab(lut, lut->rootbits);
+	for (i = 0; tab[i].blen; i++)
+		vs_vlc_insert(lut, &tab[i], 0, lut->rootbits, 0);
+}
+
+static struct vs_vlc_lut *vs_vlc_lut(struct bitstream *str, const struct vs_vlc_val *tab) {
+	uint32_t hash = (uintptr_t)tab / sizeof *tab;
+	int i;
+	if (!str->vlccache)
+		str->vlccache = calloc(sizeof *str->vlccache, 1);
+	for (i = 0; i < VS_VLC_CACHE; i++) {
+		struct vs_vlc_lut *lut = &str->vlccache->luts[(hash + i) % VS_VLC_CACHE];
+		if (lut->tab == tab)
+			return lut;
+		if (!lut->tab) {
+			vs_vlc_build(lut, tab);
+			return lut;
+		}
+	}
+	return 0;
+}
 
 int vs_byte(struct bitstream *str) {
 	if (str->dir == VS_ENCODE) {
 		switch (str->type) {
 			case VS_H262:
 				if (str->curbyte < 2 && str->zero_bytes >= 2) {
-					fprintf(stderr, "00 00 0%d emitted!\n", str->curbyte);
+					fprintf(vs_errfile(), "00 00 0%d emitted!\n", str->curbyte);
 					return 1;
 				}
 				break;
@@ -57,15 +327,16 @@ int vs_byte(struct bitstream *str) {
 			str->zero_bytes = 0;
 		str->curbyte = 0;
 	} else {
-		if (str->bytepos >= str->bytesnum) {
-			fprintf(stderr, "End of bitstream in a NAL!\n");
+		vs_compact(str);
+		if (!vs_have(str, str->bytepos)) {
+			fprintf(vs_errfile(), "End of bitstream in a NAL!\n");
 			return 1;
 		}
 		str->curbyte = str->bytes[str->bytepos++];
 		switch (str->type) {
 			case VS_H262:
 				if (str->curbyte < 2 && str->zero_bytes >= 2) {
-					fprintf(stderr, "00 00 0%d read in a NAL!\n", str->curbyte);
+					fprintf(vs_errfile(), "00 00 0%d read in a NAL!\n", str->curbyte);
 					return 1;
 				}
 				break;
@@ -75,17 +346,17 @@ int vs_byte(struct bitstream *str) {
 						case 0:
 						case 1:
 						case 2:
-							fprintf(stderr, "00 00 0%d read in a NAL!\n", str->curbyte);
+							fprintf(vs_errfile(), "00 00 0%d read in a NAL!\n", str->curbyte);
 							return 1;
 						case 3:
-							if (str->bytepos >= str->bytesnum) {
-								fprintf(stderr, "End of bitstream in a NAL!\n");
+							if (!vs_have(str, str->bytepos)) {
+								fprintf(vs_errfile(), "End of bitstream in a NAL!\n");
 								return 1;
 							}
 							str->zero_bytes = 0;
 							str->curbyte = str->bytes[str->bytepos++];
 							if (str->curbyte > 3) {
-								fprintf(stderr, "Invalid escape sequence: 00 00 03 %02x!\n", str->curbyte);
+								fprintf(vs_errfile(), "Invalid escape sequence: 00 00 03 %02x!\n", str->curbyte);
 								return 1;
 							}
 							break;
@@ -142,6 +413,19 @@ int vs_bit(struct bitstream *str, uint32_t *val) {
 int vs_u(struct bitstream *str, uint32_t *val, int size) {
 	int i;
 	uint32_t bit;
+	if (str->rbspvalid) {
+		if (!size) {
+			*val = 0;
+			return 0;
+		}
+		if (vs_rbsp_avail(str, size)) {
+			*val = vs_rbsp_peek(str) >> (64 - size);
+			vs_rbsp_skip(str, size);
+			return 0;
+		}
+		/* let the raw reader hit the end and complain */
+		vs_rbsp_leave(str);
+	}
 	if (str->dir == VS_DECODE)
 		*val = 0;
 	for (i = 0; i < size; i++) {
@@ -151,13 +435,13 @@ int vs_u(struct bitstream *str, uint32_t *val, int size) {
 		switch (str->type) {
 			case VS_H261:
 				if (str->zero_bits >= 15) {
-					fprintf(stderr, "Too many zero bits in a row\n");
+					fprintf(vs_errfile(), "Too many zero bits in a row\n");
 					return 1;
 				}
 				break;
 			case VS_H263:
 				if (str->zero_bits >= 16) {
-					fprintf(stderr, "Too many zero bits in a row\n");
+					fprintf(vs_errfile(), "Too many zero bits in a row\n");
 					return 1;
 				}
 				break;
@@ -168,13 +452,25 @@ int vs_u(struct bitstream *str, uint32_t *val, int size) {
 	return 0;
 }
 
+int vs_try_u(struct bitstream *str, uint32_t *val, int size) {
+	if (!str->rbspvalid || !size || !vs_rbsp_avail(str, size))
+		return 0;
+	*val = vs_rbsp_peek(str) >> (64 - size);
+	vs_rbsp_skip(str, size);
+	return 1;
+}
+
+void vs_unread(struct bitstream *str, int size) {
+	vs_rbsp_skip(str, -size);
+}
+
 int vs_ue(struct bitstream *str, uint32_t *val) {
 	int lzb = 0;
 	uint32_t tmp;
 	if (str->dir == VS_ENCODE) {
 		tmp = 0;
 		if (*val >= (uint32_t)0xffffffff) {
-			fprintf (stderr, "Exp-Golomb number larger than 2^32-2\n");
+			fprintf (vs_errfile(), "Exp-Golomb number larger than 2^32-2\n");
 			return 1;
 		}
 		while (*val >= (uint32_t)(1u << (lzb + 1)) - 1) {
@@ -190,6 +486,20 @@ int vs_ue(struct bitstream *str, uint32_t *val) {
 			return 1;
 		return 0;
 	} else {
+		if (str->rbspvalid) {
+			uint64_t bits = vs_rbsp_peek(str);
+			if (bits) {
+				lzb = __builtin_clzll(bits);
+				if (lzb <= 31 && vs_rbsp_avail(str, 2 * lzb + 1)) {
+					vs_rbsp_skip(str, lzb + 1);
+					tmp = lzb ? vs_rbsp_peek(str) >> (64 - lzb) : 0;
+					vs_rbsp_skip(str, lzb);
+					*val = tmp + (1u << lzb) - 1;
+					return 0;
+				}
+				lzb = 0;
+			}
+		}
 		do {
 			if (vs_u(str, &tmp, 1))
 				return 1;
@@ -197,7 +507,7 @@ int vs_ue(struct bitstream *str, uint32_t *val) {
 		} while (!tmp);
 		lzb--;
 		if (lzb > 31) {
-			fprintf (stderr, "Exp-Golomb number larger than 2^32-2\n");
+			fprintf (vs_errfile(), "Exp-Golomb number larger than 2^32-2\n");
 			return 1;
 		}
 		if (vs_u(str, &tmp, lzb))
@@ -211,7 +521,7 @@ int vs_se(struct bitstream *str, int32_t *val) {
 	uint32_t tmp;
 	if (str->dir == VS_ENCODE) {
 		if (*val == (int32_t)(-0x7fffffff-1)) {
-			fprintf (stderr, "Exp-Golomb signed number equal to -2^31\n");
+			fprintf (vs_errfile(), "Exp-Golomb signed number equal to -2^31\n");
 			return 1;
 		}
 		if (*val > 0) {
@@ -246,12 +556,30 @@ int vs_vlc(struct bitstream *str, uint32_t *val, const struct vs_vlc_val *tab) {
 				return 0;
 			}
 		}
-		fprintf(stderr, "No VLC code for a value\n");
+		fprintf(vs_errfile(), "No VLC code for a value\n");
 		return 1;
 	} else {
 		int i, j;
 		uint32_t bit[32];
 		int n = 0;
+		if (str->rbspvalid) {
+			struct vs_vlc_lut *lut = vs_vlc_lut(str, tab);
+			if (lut && lut->ents) {
+				uint64_t bits = vs_rbsp_peek(str);
+				const struct vs_vlc_ent *ent = &lut->ents[bits >> (64 - lut->rootbits)];
+				int depth = lut->rootbits;
+				while (ent->len < 0) {
+					int sbits = ent->bits;
+					ent = &lut->ents[ent->val + (bits << depth >> (64 - sbits))];
+					depth += sbits;
+				}
+				if (ent->len > 0 && vs_rbsp_avail(str, ent->len)) {
+					*val = ent->val;
+					vs_rbsp_skip(str, ent->len);
+					return 0;
+				}
+			}
+		}
 		for (i = 0; tab[i].blen; i++) {
 			for (j = 0; j < tab[i].blen; j++) {
 				if (j == n) {
@@ -266,7 +594,7 @@ int vs_vlc(struct bitstream *str, uint32_t *val, const struct vs_vlc_val *tab) {
 				return 0;
 			}
 		}
-		fprintf(stderr, "Invalid VLC code\n");
+		fprintf(vs_errfile(), "Invalid VLC code\n");
 		return 1;
 	}
 }
@@ -279,7 +607,7 @@ int vs_start(struct bitstream *str, uint32_t *val) {
 		while (str->zero_bits < nzbit) {
 			if (vs_bit(str, &bit)) return 1;
 			if (bit != 0) {
-				fprintf(stderr, "Found premature 1 bit when searching for a start code!\n");
+				fprintf(vs_errfile(), "Found premature 1 bit when searching for a start code!\n");
 				return 1;
 			}
 		}
@@ -291,7 +619,7 @@ int vs_start(struct bitstream *str, uint32_t *val) {
 		return 0;
 	} else {
 		if (str->bitpos != 7) {
-			fprintf (stderr, "Start code attempted at non-bytealigned position\n");
+			fprintf (vs_errfile(), "Start code attempted at non-bytealigned position\n");
 			return 1;
 		}
 		if (str->dir == VS_ENCODE) {
@@ -300,30 +628,34 @@ int vs_start(struct bitstream *str, uint32_t *val) {
 			ADDARRAY(str->bytes, 1);
 			ADDARRAY(str->bytes, *val);
 		} else {
+			if (str->rbspvalid)
+				vs_rbsp_leave(str);
 			str->zero_bytes--;
 			do {
 				str->zero_bytes++;
-				if (str->bytepos >= str->bytesnum) {
-					fprintf(stderr, "End of bitstream when searching for a start code!\n");
+				vs_compact(str);
+				if (!vs_have(str, str->bytepos)) {
+					fprintf(vs_errfile(), "End of bitstream when searching for a start code!\n");
 					return 1;
 				}
 				str->curbyte = str->bytes[str->bytepos++];
 			} while (str->curbyte == 0);
 			if (str->curbyte != 1) {
-				fprintf(stderr, "Found byte %08x when searching for a start code!\n", str->curbyte);
+				fprintf(vs_errfile(), "Found byte %08x when searching for a start code!\n", str->curbyte);
 				return 1;
 			}
 			if (str->zero_bytes < 2) {
-				fprintf(stderr, "Found premature byte %08x when searching for a start code!\n", str->curbyte);
+				fprintf(vs_errfile(), "Found premature byte %08x when searching for a start code!\n", str->curbyte);
 				return 1;
 			}
-			if (str->bytepos >= str->bytesnum) {
-				fprintf(stderr, "End of bitstream when searching for a start code!\n");
+			if (!vs_have(str, str->bytepos)) {
+				fprintf(vs_errfile(), "End of bitstream when searching for a start code!\n");
 				return 1;
 			}
 			str->curbyte = str->bytes[str->bytepos++];
 			str->zero_bytes = 0;
 			*val = str->curbyte;
+			vs_rbsp_fill(str);
 		}
 	}
 	return 0;
@@ -331,7 +663,7 @@ int vs_start(struct bitstream *str, uint32_t *val) {
 
 int vs_search_start(struct bitstream *str) {
 	if (str->dir != VS_DECODE) {
-		fprintf (stderr, "vs_search_start called in encode mode!\n");
+		fprintf (vs_errfile(), "vs_search_start called in encode mode!\n");
 		return -1;
 	}
 	if (str->type == VS_H261 || str->type == VS_H263) {
@@ -339,17 +671,20 @@ int vs_search_start(struct bitstream *str) {
 		uint32_t bit = 0;
 
 		while (1) {
-			if (!str->hasbyte && str->bytepos >= str->bytesnum)
+			if (!str->hasbyte && !vs_have(str, str->bytepos))
 				return 0;
 			if (str->zero_bits >= nzbit)
 				return 1;
 			if (vs_bit(str, &bit)) return 0;
 		}
 	} else {
+		if (str->rbspvalid)
+			vs_rbsp_leave(str);
 		str->hasbyte = 0;
 		str->bitpos = 7;
 		while (1) {
-			if (str->bytepos >= str->bytesnum)
+			vs_compact(str);
+			if (!vs_have(str, str->bytepos))
 				return 0;
 			if (str->zero_bytes == 2 && str->bytes[str->bytepos] == 1)
 				return 1;
@@ -391,12 +726,14 @@ int vs_align_byte(struct bitstream *str, enum vs_align_byte_mode mode) {
 			if (vs_u(str, &tmp, str->bitpos + 1))
 				return 1;
 			if (tmp != pad) {
-				fprintf(stderr, "Byte alignment bits don't match!\n");
+				fprintf(vs_errfile(), "Byte alignment bits don't match!\n");
 				return 1;
 			}
 		}
 		str->hasbyte = 0;
 		str->bitpos = 7;
+		if (str->rbspvalid)
+			vs_rbsp_sync(str);
 	}
 	return 0;
 }
@@ -410,7 +747,7 @@ int vs_end(struct bitstream *str) {
 			if (vs_u(str, &one, 1))
 				return 1;
 			if (one != 1) {
-				fprintf (stderr, "Wrong RBSP trailing bit!\n");
+				fprintf (vs_errfile(), "Wrong RBSP trailing bit!\n");
 				return 1;
 			}
 			return vs_align_byte(str, VS_ALIGN_0);
@@ -422,16 +759,20 @@ int vs_end(struct bitstream *str) {
 
 int vs_has_more_data(struct bitstream *str) {
 	if (str->dir == VS_ENCODE) {
-		fprintf (stderr, "vs_has_more_data called in encode mode\n");
+		fprintf (vs_errfile(), "vs_has_more_data called in encode mode\n");
 		return -1;
 	}
 	int byte;
 	int offs = 0;
+	if (str->rbspvalid)
+		vs_rbsp_sync(str);
+	/* for the next start code */
+	vs_have(str, str->bytepos + 3);
 	switch (str->type) {
 		case VS_H264:
 			if (!str->hasbyte) {
 				if (str->bytepos == str->bytesnum) {
-					fprintf (stderr, "no RBSP trailer byte\n");
+					fprintf (vs_errfile(), "no RBSP trailer byte\n");
 					return -1;
 				}
 				offs = 1;
@@ -480,14 +821,137 @@ struct bitstream *vs_new_decode(enum vs_type type, uint8_t *bytes, int bytesnum)
 	res->bytes = bytes;
 	res->bytesnum = bytesnum;
 	res->bitpos = 7;
+	res->keepoff = UINT64_MAX;
+	return res;
+}
+
+struct bitstream *vs_new_decode_source(enum vs_type type, int (*readfn)(void *arg, uint8_t *buf, int len), void *arg) {
+	struct bitstream *res = vs_new_decode(type, 0, 0);
+	res->readfn = readfn;
+	res->readarg = arg;
 	return res;
 }
 
+static int vs_read_fd(void *arg, uint8_t *buf, int len) {
+	int fd = (intptr_t)arg;
+	int res;
+	do {
+		res = read(fd, buf, len);
+	} while (res < 0 && errno == EINTR);
+	if (res < 0)
+		perror("read");
+	return res;
+}
+
+struct bitstream *vs_new_decode_fd(enum vs_type type, int fd) {
+	return vs_new_decode_source(type, vs_read_fd, (void *)(intptr_t)fd);
+}
+
+/* raw position of the byte the rbsp stripper stopped at */
+static int vs_rbsp_stop(struct bitstream *str) {
+	return str->rbspstart + str->rbspnum + str->escapesnum;
+}
+
+struct bitstream *vs_fork(struct bitstream *str) {
+	struct bitstream *res;
+	uint8_t *bytes;
+	int stop, end;
+	if (!str->rbspvalid)
+		return 0;
+	vs_rbsp_sync(str);
+	stop = vs_rbsp_stop(str);
+	/* the failing read takes up to two bytes, vs_has_more_data peeks at
+	 * up to four */
+	vs_have(str, stop + 3);
+	end = stop + 4 < str->bytesnum ? stop + 4 : str->bytesnum;
+	bytes = malloc(end - str->rbspstart);
+	memcpy(bytes, str->bytes + str->rbspstart, end - str->rbspstart);
+	res = vs_new_decode(str->type, bytes, end - str->rbspstart);
+	res->bytesbase = str->bytesbase + str->rbspstart;
+	res->forkcut = end < str->bytesnum || str->readfn;
+	res->curbyte = str->curbyte;
+	res->bitpos = str->bitpos;
+	res->bytepos = str->bytepos - str->rbspstart;
+	res->zero_bytes = str->zero_bytes;
+	res->zero_bits = str->zero_bits;
+	res->hasbyte = str->hasbyte;
+	res->rbspmax = str->rbspnum + 8;
+	res->rbsp = malloc(res->rbspmax);
+	memcpy(res->rbsp, str->rbsp, res->rbspmax);
+	res->rbspnum = str->rbspnum;
+	res->rbspbit = str->rbspbit;
+	if (str->escapesnum) {
+		res->escapesmax = str->escapesnum;
+		res->escapes = malloc(res->escapesmax * sizeof *res->escapes);
+		memcpy(res->escapes, str->escapes, str->escapesnum * sizeof *res->escapes);
+		res->escapesnum = str->escapesnum;
+	}
+	res->rbspvalid = 1;
+	return res;
+}
+
+void vs_skip_nal(struct bitstream *str) {
+	int pos;
+	if (!str->rbspvalid)
+		return;
+	pos = vs_rbsp_stop(str);
+	while (pos > str->rbspstart && !str->bytes[pos - 1])
+		pos--;
+	str->rbspvalid = 0;
+	str->bytepos = pos;
+	str->curbyte = str->bytes[pos - 1];
+	str->zero_bytes = 0;
+	str->hasbyte = 0;
+	str->bitpos = 7;
+}
+
+int vs_nal_done(struct bitstream *str) {
+	int pos, stop;
+	if (!str->rbspvalid)
+		return 0;
+	vs_rbsp_sync(str);
+	if (str->hasbyte)
+		return 0;
+	stop = vs_rbsp_stop(str);
+	for (pos = str->bytepos; pos < stop; pos++)
+		if (str->bytes[pos])
+			return 0;
+	return 1;
+}
+
+int vs_fork_cut(struct bitstream *fork) {
+	if (fork->rbspvalid)
+		vs_rbsp_sync(fork);
+	return fork->forkcut && fork->bytepos >= fork->bytesnum;
+}
+
+void vs_join(struct bitstream *str, struct bitstream *fork) {
+	if (fork->rbspvalid)
+		vs_rbsp_sync(fork);
+	str->rbspvalid = 0;
+	str->bytepos = fork->bytesbase + fork->bytepos - str->bytesbase;
+	str->curbyte = fork->curbyte;
+	str->bitpos = fork->bitpos;
+	str->zero_bytes = fork->zero_bytes;
+	str->zero_bits = fork->zero_bits;
+	str->hasbyte = fork->hasbyte;
+}
+
+static __thread FILE *vs_errout;
+
+FILE *vs_errfile(void) {
+	return vs_errout ? vs_errout : stderr;
+}
+
+void vs_set_errfile(FILE *file) {
+	vs_errout = file;
+}
+
 int vs_mark(struct bitstream *str, uint32_t val, int size) {
 	uint32_t tmp = val;
 	if (vs_u(str, &tmp, size)) return 1;
 	if (tmp != val) {
-		fprintf(stderr, "Marker value invalid: %d vs %d\n", tmp, val);
+		fprintf(vs_errfile(), "Marker value invalid: %d vs %d\n", tmp, val);
 		return 1;
 	}
 	return 0;
@@ -496,7 +960,7 @@ int vs_mark(struct bitstream *str, uint32_t val, int size) {
 int vs_infer(struct bitstream *str, uint32_t *val, uint32_t ival) {
 	if (str->dir == VS_ENCODE) {
 		if (*val != ival) {
-			fprintf (stderr, "Wrong infered value: %d != %d\n", *val, ival);
+			fprintf (vs_errfile(), "Wrong infered value: %d != %d\n", *val, ival);
 			return 1;
 		}
 	} else {
@@ -508,7 +972,7 @@ int vs_infer(struct bitstream *str, uint32_t *val, uint32_t ival) {
 int vs_infers(struct bitstream *str, int32_t *val, int32_t ival) {
 	if (str->dir == VS_ENCODE) {
 		if (*val != ival) {
-			fprintf (stderr, "Wrong infered value: %d != %d\n", *val, ival);
+			fprintf (vs_errfile(), "Wrong infered value: %d != %d\n", *val, ival);
 			return 1;
 		}
 	} else {
@@ -519,5 +983,13 @@ int vs_infers(struct bitstream *str, int32_t *val, int32_t ival) {
 
 void vs_destroy(struct bitstream *str) {
 	free(str->bytes);
+	free(str->rbsp);
+	free(str->escapes);
+	if (str->vlccache) {
+		int i;
+		for (i = 0; i < VS_VLC_CACHE; i++)
+			free(str->vlccache->luts[i].ents);
+		free(str->vlccache);
+	}
 	free(str);
 }
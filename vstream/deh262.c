@@ -29,15 +29,8 @@
 #include <stdlib.h>
 
 int main() {
-	uint8_t *bytes = 0;
-	int bytesnum = 0;
-	int bytesmax = 0;
-	int c;
 	int res;
-	while ((c = getchar()) != EOF) {
-		ADDARRAY(bytes, c);
-	}
-	struct bitstream *str = vs_new_decode(VS_H262, bytes, bytesnum);
+	struct bitstream *str = vs_new_decode_fd(VS_H262, 0);
 	struct h262_seqparm *seqparm = calloc(sizeof *seqparm, 1);
 	struct h262_picparm *picparm = calloc(sizeof *picparm, 1);
 	struct h262_gop *gop = calloc(sizeof *gop, 1);
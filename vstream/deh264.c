@@ -26,33 +26,301 @@
 #include "vstream.h"
 #include "util.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 
-int main() {
-	uint8_t *bytes = 0;
-	int bytesnum = 0;
-	int bytesmax = 0;
-	int c;
-	while ((c = getchar()) != EOF) {
-		ADDARRAY(bytes, c);
+/*
+ * With -j, slice data is parsed on worker threads.  The main thread goes
+ * through the stream as usual, but hands each slice off to a fork of the
+ * bitstream right after its header, and carries on as if the slice data
+ * ended cleanly at its trailing bits.  The slices are printed in stream
+ * order, each with the error messages collected while parsing it.  If one
+ * of them didn't end as assumed, the slices after it are thrown away and
+ * decoding goes on from where it really stopped, as it would without -j.
+ * Other NALs wait for all pending slices, since they can change the
+ * parameter sets.
+ */
+
+struct slicejob {
+	uint32_t nal_ref_idc;
+	uint32_t nal_unit_type;
+	int last_idr;
+	struct h264_slice *slice;
+	struct bitstream *str;
+	/* where str started, to parse the slice again if it ran out of data */
+	struct bitstream start;
+	int res;
+	int done;
+	FILE *errfile;
+	char *err;
+	size_t errlen;
+	/* how much of err came before the slice data */
+	size_t errhead;
+};
+
+struct slicepool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* a ring of the pending slices, in stream order */
+	struct slicejob **jobs;
+	int jobsmax;
+	int first;
+	int num;
+	/* how many of them were taken by the workers */
+	int taken;
+	int quit;
+	pthread_t *threads;
+	int threadsnum;
+	/* the job for the next slice, with the main thread's error messages
+	 * since the last pending one */
+	struct slicejob *next;
+};
+
+static void print_nal_unit(uint32_t nal_ref_idc, uint32_t nal_unit_type) {
+	printf("NAL unit:\n");
+	printf("\tnal_ref_idc = %d\n", nal_ref_idc);
+	printf("\tnal_unit_type = %d\n", nal_unit_type);
+}
+
+static void job_reset_err(struct slicejob *job) {
+	if (job->errfile) {
+		fclose(job->errfile);
+		free(job->err);
+	}
+	job->err = 0;
+	job->errlen = 0;
+	job->errfile = open_memstream(&job->err, &job->errlen);
+}
+
+static void job_del(struct slicejob *job) {
+	fclose(job->errfile);
+	free(job->err);
+	if (job->slice)
+		h264_del_slice(job->slice);
+	if (job->str)
+		vs_destroy(job->str);
+	free(job);
+}
+
+static void *slice_worker(void *arg) {
+	struct slicepool *pool = arg;
+	/* holds the vs_vlc tables between the slices */
+	struct bitstream *cache = vs_new_decode(VS_H264, 0, 0);
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->quit && pool->taken == pool->num)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if (pool->quit)
+			break;
+		struct slicejob *job = pool->jobs[(pool->first + pool->taken++) % pool->jobsmax];
+		pthread_mutex_unlock(&pool->lock);
+		job->str->vlccache = cache->vlccache;
+		vs_set_errfile(job->errfile);
+		job->res = h264_slice_data(job->str, job->slice);
+		cache->vlccache = job->str->vlccache;
+		job->str->vlccache = 0;
+		pthread_mutex_lock(&pool->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	vs_destroy(cache);
+	return 0;
+}
+
+static struct slicepool *pool_new(int threads) {
+	struct slicepool *pool = calloc(sizeof *pool, 1);
+	int i;
+	pthread_mutex_init(&pool->lock, 0);
+	pthread_cond_init(&pool->cond, 0);
+	pool->jobsmax = threads * 2;
+	pool->jobs = calloc(sizeof *pool->jobs, pool->jobsmax);
+	pool->threads = calloc(sizeof *pool->threads, threads);
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&pool->threads[i], 0, slice_worker, pool))
+			break;
+		pool->threadsnum++;
 	}
-	struct bitstream *str = vs_new_decode(VS_H264, bytes, bytesnum);
+	if (!pool->threadsnum) {
+		fprintf(stderr, "Failed to start the slice threads\n");
+		exit(1);
+	}
+	pool->next = calloc(sizeof *pool->next, 1);
+	job_reset_err(pool->next);
+	return pool;
+}
+
+static void pool_del(struct slicepool *pool) {
+	int i;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->threadsnum; i++)
+		pthread_join(pool->threads[i], 0);
+	job_del(pool->next);
+	free(pool->threads);
+	free(pool->jobs);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+/* hands the slice data after the header str just read to the workers */
+static int pool_add(struct slicepool *pool, struct bitstream *str, struct h264_slice *slice, uint32_t nal_ref_idc, uint32_t nal_unit_type, int last_idr) {
+	struct slicejob *job = pool->next;
+	job->str = vs_fork(str);
+	if (!job->str)
+		return 1;
+	job->nal_ref_idc = nal_ref_idc;
+	job->nal_unit_type = nal_unit_type;
+	job->last_idr = last_idr;
+	job->slice = slice;
+	job->start = *job->str;
+	job->start.rbspvalid = 0;
+	vs_skip_nal(str);
+	fflush(job->errfile);
+	job->errhead = job->errlen;
+	pool->next = calloc(sizeof *pool->next, 1);
+	job_reset_err(pool->next);
+	vs_set_errfile(pool->next->errfile);
+	pthread_mutex_lock(&pool->lock);
+	if (!pool->num)
+		str->keepoff = job->str->bytesbase;
+	pool->jobs[(pool->first + pool->num++) % pool->jobsmax] = job;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+/* drops the main thread's messages, and the slices after a mispredicted one */
+static void pool_discard(struct slicepool *pool) {
+	int num = pool->num;
+	int i;
+	job_reset_err(pool->next);
+	pthread_mutex_lock(&pool->lock);
+	pool->num = pool->taken;
+	for (i = 0; i < pool->taken; i++)
+		while (!pool->jobs[(pool->first + i) % pool->jobsmax]->done)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+	for (i = 0; i < num; i++)
+		job_del(pool->jobs[(pool->first + i) % pool->jobsmax]);
+	pool->num = pool->taken = 0;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Prints the oldest pending slice.  Returns 0 if the main thread can carry
+ * on, otherwise str is moved to where the slice really ended, and it's 1
+ * if that was the slice end, 2 if an error.
+ */
+static int pool_retire(struct slicepool *pool, struct bitstream *str, int *last_idr) {
+	struct slicejob *job;
+	int res = 0;
+	pthread_mutex_lock(&pool->lock);
+	job = pool->jobs[pool->first];
+	while (!job->done)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	pool->first = (pool->first + 1) % pool->jobsmax;
+	pool->num--;
+	pool->taken--;
+	pthread_mutex_unlock(&pool->lock);
+	print_nal_unit(job->nal_ref_idc, job->nal_unit_type);
+	h264_print_slice_header(job->slice);
+	fflush(job->errfile);
+	if (vs_fork_cut(job->str)) {
+		/* it read past the NAL, only str has what's there */
+		fwrite(job->err, 1, job->errhead, stderr);
+		pool_discard(pool);
+		vs_set_errfile(0);
+		vs_join(str, &job->start);
+		*last_idr = job->last_idr;
+		memset(job->slice->mbs, 0, sizeof *job->slice->mbs * job->slice->pic_size_in_mbs);
+		job->res = h264_slice_data(str, job->slice);
+		res = 1;
+	} else {
+		fwrite(job->err, 1, job->errlen, stderr);
+		if (job->res || !vs_nal_done(job->str)) {
+			pool_discard(pool);
+			vs_set_errfile(0);
+			vs_join(str, job->str);
+			*last_idr = job->last_idr;
+			res = 1;
+		}
+	}
+	h264_print_slice_data(job->slice);
+	if (job->res)
+		res = 2;
+	else
+		printf("NAL decoded successfully\n\n");
+	str->keepoff = pool->num ? pool->jobs[pool->first]->str->bytesbase : UINT64_MAX;
+	job_del(job);
+	return res;
+}
+
+/* prints everything pending, for when the main thread has to print */
+static int pool_drain(struct slicepool *pool, struct bitstream *str, int *last_idr) {
+	int res;
+	while (pool->num)
+		if ((res = pool_retire(pool, str, last_idr)))
+			return res;
+	fflush(pool->next->errfile);
+	fwrite(pool->next->err, 1, pool->next->errlen, stderr);
+	job_reset_err(pool->next);
+	vs_set_errfile(0);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	struct bitstream *str = vs_new_decode_fd(VS_H264, 0);
 	struct h264_seqparm *seqparms[32] = { 0 };
 	struct h264_seqparm *subseqparms[32] = { 0 };
 	struct h264_picparm *picparms[256] = { 0 };
+	struct slicepool *pool = 0;
 	int res;
 	int last_idr = 0;
+	int c;
+	while ((c = getopt(argc, argv, "j:")) != -1) {
+		switch (c) {
+			case 'j': {
+				int threads = strtol(optarg, 0, 0);
+				if (threads < 0) {
+					fprintf(stderr, "-j accepts only non-negative numbers\n");
+					return 1;
+				}
+				/* 0 - one per CPU, like envydis and demmt */
+				if (threads == 0)
+					threads = sysconf(_SC_NPROCESSORS_ONLN);
+				if (threads > 1 && !pool)
+					pool = pool_new(threads);
+				break;
+			}
+			default:
+				fprintf(stderr, "Usage: deh264 [-j threads] < stream\n");
+				return 1;
+		}
+	}
 	while (1) {
 		uint32_t start_code;
-		if (vs_start(str, &start_code)) goto err;
+		if (pool) {
+			if (pool->num == pool->jobsmax && (res = pool_retire(pool, str, &last_idr)))
+				goto rollback;
+			vs_set_errfile(pool->next->errfile);
+		}
+		if (vs_start(str, &start_code)) goto fail;
 		if (start_code & 0x80) {
-			fprintf(stderr, "forbidden_zero_bit not 0\n");
-			goto err;
+			fprintf(vs_errfile(), "forbidden_zero_bit not 0\n");
+			goto fail;
 		}
 		uint32_t nal_ref_idc = start_code >> 5;
 		uint32_t nal_unit_type = start_code & 0x1f;
-		printf("NAL unit:\n");
-		printf("\tnal_ref_idc = %d\n", nal_ref_idc);
-		printf("\tnal_unit_type = %d\n", nal_unit_type);
+		int is_slice = nal_unit_type == H264_NAL_UNIT_TYPE_SLICE_NONIDR || nal_unit_type == H264_NAL_UNIT_TYPE_SLICE_IDR || nal_unit_type == H264_NAL_UNIT_TYPE_SLICE_AUX;
+		if (pool && !is_slice && (res = pool_drain(pool, str, &last_idr)))
+			goto rollback;
+		if (!pool || !is_slice)
+			print_nal_unit(nal_ref_idc, nal_unit_type);
 		struct h264_seqparm *sp;
 		struct h264_picparm *pp;
 		struct h264_slice *slice;
@@ -73,10 +341,25 @@ int main() {
 				slice->idr_pic_flag = last_idr;
 				if (h264_slice_header(str, seqparms, picparms, slice)) {
 					h264_del_slice(slice);
+					if (pool) {
+						if ((res = pool_drain(pool, str, &last_idr)))
+							goto rollback;
+						print_nal_unit(nal_ref_idc, nal_unit_type);
+					}
 					goto err;
 				}
-				h264_print_slice_header(slice);
 				slice->mbs = calloc (sizeof *slice->mbs, slice->pic_size_in_mbs);
+				if (pool) {
+					if (!pool_add(pool, str, slice, nal_ref_idc, nal_unit_type, last_idr))
+						continue;
+					/* the header already went past the NAL */
+					if ((res = pool_drain(pool, str, &last_idr))) {
+						h264_del_slice(slice);
+						goto rollback;
+					}
+					print_nal_unit(nal_ref_idc, nal_unit_type);
+				}
+				h264_print_slice_header(slice);
 				if (h264_slice_data(str, slice)) {
 					h264_print_slice_data(slice);
 					h264_del_slice(slice);
@@ -213,6 +496,13 @@ int main() {
 		}
 		printf("NAL decoded successfully\n\n");
 		continue;
+fail:
+		if (pool && (res = pool_drain(pool, str, &last_idr)))
+			goto rollback;
+		goto err;
+rollback:
+		if (res == 1)
+			continue;
 err:
 		res = vs_search_start(str);
 		if (res == -1)
@@ -221,5 +511,7 @@ err:
 			break;
 		printf("\n");
 	}
+	if (pool)
+		pool_del(pool);
 	return 0;
 }
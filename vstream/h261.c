@@ -39,7 +39,7 @@ int h261_picparm(struct bitstream *str, struct h261_picparm *picparm) {
 	if (vs_u(str, &picparm->tr, 5)) return 1;
 	if (vs_u(str, &picparm->ptype, 6)) return 1;
 	if (!(picparm->ptype & 1)) {
-		fprintf(stderr, "Spare bit unset - H.263 stream?\n");
+		fprintf(vs_errfile(), "Spare bit unset - H.263 stream?\n");
 		return 1;
 	}
 	uint32_t pei = 0;
@@ -194,7 +194,7 @@ int h261_block(struct bitstream *str, int32_t *block, int intra) {
 		uint32_t val = block[0];
 		if (str->dir == VS_ENCODE) {
 			if (val >= 0xff || val == 0) {
-				fprintf(stderr, "Invalid INTRA DC coeff\n");
+				fprintf(vs_errfile(), "Invalid INTRA DC coeff\n");
 				return 1;
 			}
 			if (val == 0x80)
@@ -203,7 +203,7 @@ int h261_block(struct bitstream *str, int32_t *block, int intra) {
 		if (vs_u(str, &val, 8)) return 1;
 		if (str->dir == VS_DECODE) {
 			if (val == 0 || val == 0x80) {
-				fprintf(stderr, "Invalid INTRA DC coeff\n");
+				fprintf(vs_errfile(), "Invalid INTRA DC coeff\n");
 				return 1;
 			}
 			if (val == 0xff)
@@ -229,7 +229,7 @@ int h261_block(struct bitstream *str, int32_t *block, int intra) {
 			} else {
 				coeff = block[i];
 				if (abs(coeff) > 127) {
-					fprintf(stderr, "Coeff too large\n");
+					fprintf(vs_errfile(), "Coeff too large\n");
 					return 1;
 				}
 				tmp = abs(coeff) | run << 12;
@@ -259,7 +259,7 @@ int h261_block(struct bitstream *str, int32_t *block, int intra) {
 			if (vs_u(str, &run, 6)) return 1;
 			if (vs_u(str, &eb, 8)) return 1;
 			if (eb == 0 || eb == 0x80) {
-				fprintf(stderr, "Invalid escape code\n");
+				fprintf(vs_errfile(), "Invalid escape code\n");
 				return 1;
 			}
 			coeff = eb;
@@ -276,12 +276,12 @@ int h261_block(struct bitstream *str, int32_t *block, int intra) {
 		}
 		if (str->dir == VS_DECODE) {
 			if (i >= 64) {
-				fprintf(stderr, "block overflow\n");
+				fprintf(vs_errfile(), "block overflow\n");
 				return 1;
 			}
 			while (run--) {
 				if (i >= 64) {
-					fprintf(stderr, "block overflow\n");
+					fprintf(vs_errfile(), "block overflow\n");
 					return 1;
 				}
 				block[i++] = 0;
@@ -500,7 +500,7 @@ int h261_gob(struct bitstream *str, struct h261_gob *gob) {
 				mbi++, mba--;
 			}
 			if (mbi == H261_GOB_MBS) {
-				fprintf(stderr, "Macroblock address overrun\n");
+				fprintf(vs_errfile(), "Macroblock address overrun\n");
 				return 1;
 			}
 		}
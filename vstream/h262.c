@@ -35,19 +35,19 @@ int h262_seqparm(struct bitstream *str, struct h262_seqparm *seqparm) {
 	int i;
 	if (str->dir == VS_ENCODE && !seqparm->is_ext) {
 		if (hs != seqparm->horizontal_size) {
-			fprintf(stderr, "horizontal_size too big for MPEG1\n");
+			fprintf(vs_errfile(), "horizontal_size too big for MPEG1\n");
 			return 1;
 		}
 		if (vs != seqparm->vertical_size) {
-			fprintf(stderr, "vertical_size too big for MPEG1\n");
+			fprintf(vs_errfile(), "vertical_size too big for MPEG1\n");
 			return 1;
 		}
 		if (br != seqparm->bit_rate) {
-			fprintf(stderr, "bit_rate too big for MPEG1\n");
+			fprintf(vs_errfile(), "bit_rate too big for MPEG1\n");
 			return 1;
 		}
 		if (vbv != seqparm->vbv_buffer_size) {
-			fprintf(stderr, "vbv_buffer_size too big for MPEG1\n");
+			fprintf(vs_errfile(), "vbv_buffer_size too big for MPEG1\n");
 			return 1;
 		}
 	}
@@ -131,7 +131,7 @@ int h262_picparm(struct bitstream *str, struct h262_seqparm *seqparm, struct h26
 		case H262_PIC_TYPE_D:
 			break;
 		default:
-			fprintf(stderr, "Invalid picture_coding_type\n");
+			fprintf(vs_errfile(), "Invalid picture_coding_type\n");
 			return 1;
 	}
 	if (f) {
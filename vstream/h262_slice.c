@@ -310,7 +310,7 @@ int h262_coded_block_pattern(struct bitstream *str, int chroma_format, uint32_t
 			cbphs = 6;
 			break;
 		default:
-			fprintf(stderr, "Invalid chroma format\n");
+			fprintf(vs_errfile(), "Invalid chroma format\n");
 			return 1;
 	}
 	if (vs_vlc(str, &cbplo, cbp_vlc)) return 1;
@@ -757,7 +757,7 @@ int h262_block(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 			} else {
 				coeff = block[i];
 				if (coeff <= -0x800 || coeff >= 0x800) {
-					fprintf(stderr, "Coeff too large\n");
+					fprintf(vs_errfile(), "Coeff too large\n");
 					return 1;
 				}
 				el = coeff & 0xfff;
@@ -782,7 +782,7 @@ int h262_block(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 							eb1 = 0;
 						eb2 = coeff & 0xff;
 					} else {
-						fprintf(stderr, "Coeff too large\n");
+						fprintf(vs_errfile(), "Coeff too large\n");
 						return 1;
 					}
 				}
@@ -807,7 +807,7 @@ int h262_block(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 				else
 					coeff = el;
 				if (!(el & 0x7ff)) {
-					fprintf(stderr, "Invalid escape code\n");
+					fprintf(vs_errfile(), "Invalid escape code\n");
 					return 1;
 				}
 			} else {
@@ -816,14 +816,14 @@ int h262_block(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 				if (eb1 == 0) {
 					if (vs_u(str, &eb2, 8)) return 1;
 					if (eb2 < 0x80) {
-						fprintf(stderr, "Invalid escape code\n");
+						fprintf(vs_errfile(), "Invalid escape code\n");
 						return 1;
 					}
 					coeff = eb2;
 				} else if (eb1 == 0x80) {
 					if (vs_u(str, &eb2, 8)) return 1;
 					if (eb2 == 0 || eb2 > 0x80) {
-						fprintf(stderr, "Invalid escape code\n");
+						fprintf(vs_errfile(), "Invalid escape code\n");
 						return 1;
 					}
 					coeff = eb2 | -0x100;
@@ -844,12 +844,12 @@ int h262_block(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 		}
 		if (str->dir == VS_DECODE) {
 			if (i >= 64) {
-				fprintf(stderr, "block overflow\n");
+				fprintf(vs_errfile(), "block overflow\n");
 				return 1;
 			}
 			while (run--) {
 				if (i >= 64) {
-					fprintf(stderr, "block overflow\n");
+					fprintf(vs_errfile(), "block overflow\n");
 					return 1;
 				}
 				block[i++] = 0;
@@ -916,7 +916,7 @@ int h262_macroblock(struct bitstream *str, struct h262_seqparm *seqparm, struct
 			if (vs_vlc(str, &mb_flags, mbf_d_vlc)) return 1;
 			break;
 		default:
-			fprintf(stderr, "Invalid picture type\n");
+			fprintf(vs_errfile(), "Invalid picture type\n");
 			return 1;
 	}
 	if (str->dir == VS_DECODE) {
@@ -934,14 +934,14 @@ int h262_macroblock(struct bitstream *str, struct h262_seqparm *seqparm, struct
 			} else {
 				if (vs_u(str, &mb->frame_motion_type, 2)) return 1;
 				if (!mb->frame_motion_type) {
-					fprintf(stderr, "Invalid frame_motion_type\n");
+					fprintf(vs_errfile(), "Invalid frame_motion_type\n");
 					return 1;
 				}
 			}
 		} else {
 			if (vs_u(str, &mb->field_motion_type, 2)) return 1;
 			if (!mb->field_motion_type) {
-				fprintf(stderr, "Invalid field_motion_type\n");
+				fprintf(vs_errfile(), "Invalid field_motion_type\n");
 				return 1;
 			}
 		}
@@ -1008,7 +1008,7 @@ int h262_slice(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 	uint32_t tmp = slice->first_mb_in_slice % picparm->pic_width_in_mbs;
 	if (h262_mb_addr_inc(str, &tmp)) return 1;
 	if (tmp >= picparm->pic_width_in_mbs) {
-		fprintf(stderr, "Initial mb_addr_inc too large\n");
+		fprintf(vs_errfile(), "Initial mb_addr_inc too large\n");
 		return 1;
 	}
 	slice->first_mb_in_slice = slice->slice_vertical_position * picparm->pic_width_in_mbs + tmp;
@@ -1023,7 +1023,7 @@ int h262_slice(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 				return 0;
 			if (h262_mb_addr_inc(str, &tmp)) return 1;
 			if (curr_mb_addr >= picparm->pic_size_in_mbs) {
-				fprintf(stderr, "MB index overflow\n");
+				fprintf(vs_errfile(), "MB index overflow\n");
 				return 1;
 			}
 			while (tmp) {
@@ -1037,7 +1037,7 @@ int h262_slice(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 				if (h262_infer_vectors(str, seqparm, picparm, &slice->mbs[curr_mb_addr], 1)) return 1;
 				curr_mb_addr++;
 				if (curr_mb_addr >= picparm->pic_size_in_mbs) {
-					fprintf(stderr, "MB index overflow\n");
+					fprintf(vs_errfile(), "MB index overflow\n");
 					return 1;
 				}
 				tmp--;
@@ -1052,7 +1052,7 @@ int h262_slice(struct bitstream *str, struct h262_seqparm *seqparm, struct h262_
 				curr_mb_addr++;
 			}
 			if (slice->last_mb_in_slice == curr_mb_addr) {
-				fprintf(stderr, "Last MB in slice is skipped\n");
+				fprintf(vs_errfile(), "Last MB in slice is skipped\n");
 				return 1;
 			}
 			if (h262_mb_addr_inc(str, &tmp)) return 1;
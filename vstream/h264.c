@@ -100,7 +100,7 @@ int h264_scaling_list(struct bitstream *str, uint32_t *scaling_list, int size, u
 int h264_hrd_parameters(struct bitstream *str, struct h264_hrd_parameters *hrd) {
 	if (vs_ue(str, &hrd->cpb_cnt_minus1)) return 1;
 	if (hrd->cpb_cnt_minus1 > 31) {
-		fprintf(stderr, "cpb_cnt_minus1 out of range\n");
+		fprintf(vs_errfile(), "cpb_cnt_minus1 out of range\n");
 		return 1;
 	}
 	if (vs_u(str, &hrd->bit_rate_scale, 4)) return 1;
@@ -150,7 +150,7 @@ int h264_vui_parameters(struct bitstream *str, struct h264_vui *vui) {
 				if (vs_infer(str, &vui->sar_width, aspect_ratios[vui->aspect_ratio_idc][0])) return 1;
 				if (vs_infer(str, &vui->sar_width, aspect_ratios[vui->aspect_ratio_idc][1])) return 1;
 			} else {
-				fprintf(stderr, "WARNING: unknown aspect_ratio_idc %d\n", vui->aspect_ratio_idc);
+				fprintf(vs_errfile(), "WARNING: unknown aspect_ratio_idc %d\n", vui->aspect_ratio_idc);
 				if (vs_infer(str, &vui->sar_width, 0)) return 1;
 				if (vs_infer(str, &vui->sar_width, 0)) return 1;
 			}
@@ -290,7 +290,7 @@ int h264_seqparm(struct bitstream *str, struct h264_seqparm *seqparm) {
 			}
 			break;
 		default:
-			fprintf (stderr, "Unknown profile\n");
+			fprintf (vs_errfile(), "Unknown profile\n");
 			return 1;
 	}
 	if (vs_ue(str, &seqparm->log2_max_frame_num_minus4)) return 1;
@@ -419,7 +419,7 @@ int h264_seqparm_mvc(struct bitstream *str, struct h264_seqparm *seqparm) {
 		seqparm->is_mvc = 1;
 	if (vs_u(str, &bit_equal_to_one, 1)) return 1;
 	if (!bit_equal_to_one) {
-		fprintf(stderr, "bit_equal_to_one invalid\n");
+		fprintf(vs_errfile(), "bit_equal_to_one invalid\n");
 		return 1;
 	}
 	if (vs_ue(str, &seqparm->num_views_minus1)) return 1;
@@ -430,14 +430,14 @@ int h264_seqparm_mvc(struct bitstream *str, struct h264_seqparm *seqparm) {
 	for (i = 1; i <= seqparm->num_views_minus1; i++) {
 		if (vs_ue(str, &seqparm->views[i].num_anchor_refs_l0)) return 1;
 		if (seqparm->views[i].num_anchor_refs_l0 > 15) {
-			fprintf (stderr, "num_anchor_refs_l0 over limit\n");
+			fprintf (vs_errfile(), "num_anchor_refs_l0 over limit\n");
 			return 1;
 		}
 		for (j = 0; j < seqparm->views[i].num_anchor_refs_l0; j++)
 			if (vs_ue(str, &seqparm->views[i].anchor_ref_l0[j])) return 1;
 		if (vs_ue(str, &seqparm->views[i].num_anchor_refs_l1)) return 1;
 		if (seqparm->views[i].num_anchor_refs_l1 > 15) {
-			fprintf (stderr, "num_anchor_refs_l1 over limit\n");
+			fprintf (vs_errfile(), "num_anchor_refs_l1 over limit\n");
 			return 1;
 		}
 		for (j = 0; j < seqparm->views[i].num_anchor_refs_l1; j++)
@@ -446,14 +446,14 @@ int h264_seqparm_mvc(struct bitstream *str, struct h264_seqparm *seqparm) {
 	for (i = 1; i <= seqparm->num_views_minus1; i++) {
 		if (vs_ue(str, &seqparm->views[i].num_non_anchor_refs_l0)) return 1;
 		if (seqparm->views[i].num_non_anchor_refs_l0 > 15) {
-			fprintf (stderr, "num_non_anchor_refs_l0 over limit\n");
+			fprintf (vs_errfile(), "num_non_anchor_refs_l0 over limit\n");
 			return 1;
 		}
 		for (j = 0; j < seqparm->views[i].num_non_anchor_refs_l0; j++)
 			if (vs_ue(str, &seqparm->views[i].non_anchor_ref_l0[j])) return 1;
 		if (vs_ue(str, &seqparm->views[i].num_non_anchor_refs_l1)) return 1;
 		if (seqparm->views[i].num_non_anchor_refs_l1 > 15) {
-			fprintf (stderr, "num_non_anchor_refs_l1 over limit\n");
+			fprintf (vs_errfile(), "num_non_anchor_refs_l1 over limit\n");
 			return 1;
 		}
 		for (j = 0; j < seqparm->views[i].num_non_anchor_refs_l1; j++)
@@ -493,12 +493,12 @@ int h264_seqparm_mvc(struct bitstream *str, struct h264_seqparm *seqparm) {
 int h264_seqparm_ext(struct bitstream *str, struct h264_seqparm **seqparms, uint32_t *pseq_parameter_set_id) {
 	if (vs_ue(str, pseq_parameter_set_id)) return 1;
 	if (*pseq_parameter_set_id > 31) {
-		fprintf(stderr, "seq_parameter_set_id out of bounds\n");
+		fprintf(vs_errfile(), "seq_parameter_set_id out of bounds\n");
 		return 1;
 	}
 	struct h264_seqparm *seqparm = seqparms[*pseq_parameter_set_id];
 	if (!seqparm) {
-		fprintf(stderr, "seqparm extension for nonexistent seqparm\n");
+		fprintf(vs_errfile(), "seqparm extension for nonexistent seqparm\n");
 		return 1;
 	}
 	if (vs_ue(str, &seqparm->aux_format_idc)) return 1;
@@ -511,7 +511,7 @@ int h264_seqparm_ext(struct bitstream *str, struct h264_seqparm **seqparms, uint
 	uint32_t additional_extension_flag = 0;
 	if (vs_u(str, &additional_extension_flag, 1)) return 1;
 	if (additional_extension_flag) {
-		fprintf(stderr, "WARNING: additional data in seqparm extension\n");
+		fprintf(vs_errfile(), "WARNING: additional data in seqparm extension\n");
 		while (vs_has_more_data(str)) {
 			if (vs_u(str, &additional_extension_flag, 1)) return 1;
 		}
@@ -526,7 +526,7 @@ int h264_picparm(struct bitstream *str, struct h264_seqparm **seqparms, struct h
 	if (vs_ue(str, &picparm->pic_parameter_set_id)) return 1;
 	if (vs_ue(str, &picparm->seq_parameter_set_id)) return 1;
 	if (picparm->seq_parameter_set_id > 31) {
-		fprintf(stderr, "seq_parameter_set_id out of bounds\n");
+		fprintf(vs_errfile(), "seq_parameter_set_id out of bounds\n");
 		return 1;
 	}
 	if (vs_u(str, &picparm->entropy_coding_mode_flag, 1)) return 1;
@@ -534,7 +534,7 @@ int h264_picparm(struct bitstream *str, struct h264_seqparm **seqparms, struct h
 	if (vs_ue(str, &picparm->num_slice_groups_minus1)) return 1;
 	if (picparm->num_slice_groups_minus1) {
 		if (picparm->num_slice_groups_minus1 > 7) {
-			fprintf(stderr, "num_slice_groups_minus1 over limit\n");
+			fprintf(vs_errfile(), "num_slice_groups_minus1 over limit\n");
 			return 1;
 		}
 		if (vs_ue(str, &picparm->slice_group_map_type)) return 1;
@@ -568,7 +568,7 @@ int h264_picparm(struct bitstream *str, struct h264_seqparm **seqparms, struct h
 					if (vs_u(str, &picparm->slice_group_id[i], sizes[picparm->num_slice_groups_minus1])) return 1;
 				break;
 			default:
-				fprintf(stderr, "Unknown slice_group_map_type %d!\n", picparm->slice_group_map_type);
+				fprintf(vs_errfile(), "Unknown slice_group_map_type %d!\n", picparm->slice_group_map_type);
 				return 1;
 		}
 	}
@@ -598,14 +598,14 @@ int h264_picparm(struct bitstream *str, struct h264_seqparm **seqparms, struct h
 				picparm->chroma_format_idc = seqparm->chroma_format_idc;
 				if (subseqparm) {
 					if (subseqparm->chroma_format_idc != picparm->chroma_format_idc) {
-						fprintf(stderr, "conflicting chroma_format_idc between seqparm and subseqparm, please complain to ITU/ISO about retarded spec and to bitstream source about retarded bitstream.\n");
+						fprintf(vs_errfile(), "conflicting chroma_format_idc between seqparm and subseqparm, please complain to ITU/ISO about retarded spec and to bitstream source about retarded bitstream.\n");
 						return 1;
 					}
 				}
 			} else if (subseqparm) {
 				picparm->chroma_format_idc = subseqparm->chroma_format_idc;
 			} else {
-				fprintf(stderr, "picparm for nonexistent seqparm/subseqparm!\n");
+				fprintf(vs_errfile(), "picparm for nonexistent seqparm/subseqparm!\n");
 				return 1;
 			}
 			/* brain damage workaround end */
@@ -640,7 +640,7 @@ int h264_ref_pic_list_modification(struct bitstream *str, struct h264_slice *sli
 			if (list->list[i].op != 3) {
 				if (vs_ue(str, &list->list[i].param)) return 1;
 				if (i == 32) {
-					fprintf(stderr, "Too many ref_pic_list_modification entries\n");
+					fprintf(vs_errfile(), "Too many ref_pic_list_modification entries\n");
 					return 1;
 				}
 			}
@@ -686,7 +686,7 @@ int h264_dec_ref_pic_marking(struct bitstream *str, int idr_pic_flag, struct h26
 						if (vs_ue(str, &mmco.long_term_frame_idx)) return 1;
 						break;
 					default:
-						fprintf (stderr, "Unknown MMCO %d\n", mmco.memory_management_control_operation);
+						fprintf (vs_errfile(), "Unknown MMCO %d\n", mmco.memory_management_control_operation);
 						return 1;
 				}
 				if (str->dir == VS_DECODE) 
@@ -719,7 +719,7 @@ int h264_dec_ref_base_pic_marking(struct bitstream *str, struct h264_nal_svc_hea
 						if (vs_ue(str, &mmco.long_term_pic_num)) return 1;
 						break;
 					default:
-						fprintf (stderr, "Unknown MMCO %d\n", mmco.memory_management_control_operation);
+						fprintf (vs_errfile(), "Unknown MMCO %d\n", mmco.memory_management_control_operation);
 						return 1;
 				}
 				if (str->dir == VS_DECODE) 
@@ -787,7 +787,7 @@ int h264_prep_sgmap(struct h264_slice *slice) {
 				break;
 			case H264_SLICE_GROUP_MAP_EXPLICIT:
 				if (width * height != slice->picparm->pic_size_in_map_units_minus1 + 1) {
-					fprintf(stderr, "pic_size_in_map_units_minus1 mismatch!\n");
+					fprintf(vs_errfile(), "pic_size_in_map_units_minus1 mismatch!\n");
 					return 1;
 				}
 				slice->sgmap[i] = slice->picparm->slice_group_id[i];
@@ -853,17 +853,17 @@ int h264_slice_header(struct bitstream *str, struct h264_seqparm **seqparms, str
 	if (vs_ue(str, &pic_parameter_set_id)) return 1;
 	if (str->dir == VS_DECODE) {
 		if (pic_parameter_set_id > 255) {
-			fprintf(stderr, "pic_parameter_set_id out of range\n");
+			fprintf(vs_errfile(), "pic_parameter_set_id out of range\n");
 			return 1;
 		}
 		slice->picparm = picparms[pic_parameter_set_id];
 		if (!slice->picparm) {
-			fprintf(stderr, "pic_parameter_set_id doesn't specify a picparm\n");
+			fprintf(vs_errfile(), "pic_parameter_set_id doesn't specify a picparm\n");
 			return 1;
 		}
 		slice->seqparm = seqparms[slice->picparm->seq_parameter_set_id];
 		if (!slice->seqparm) {
-			fprintf(stderr, "seq_parameter_set_id doesn't specify a seqparm\n");
+			fprintf(vs_errfile(), "seq_parameter_set_id doesn't specify a seqparm\n");
 			return 1;
 		}
 		if (slice->nal_unit_type == H264_NAL_UNIT_TYPE_SLICE_AUX) {
@@ -946,11 +946,11 @@ int h264_slice_header(struct bitstream *str, struct h264_seqparm **seqparms, str
 
 			}
 			if (slice->num_ref_idx_l0_active_minus1 > 31) {
-				fprintf(stderr, "num_ref_idx_l0_active_minus1 out of range\n");
+				fprintf(vs_errfile(), "num_ref_idx_l0_active_minus1 out of range\n");
 				return 1;
 			}
 			if (slice->num_ref_idx_l1_active_minus1 > 31) {
-				fprintf(stderr, "num_ref_idx_l1_active_minus1 out of range\n");
+				fprintf(vs_errfile(), "num_ref_idx_l1_active_minus1 out of range\n");
 				return 1;
 			}
 			/* ref_pic_list_modification */
@@ -980,7 +980,7 @@ int h264_slice_header(struct bitstream *str, struct h264_seqparm **seqparms, str
 	if (slice->picparm->entropy_coding_mode_flag && slice->slice_type != H264_SLICE_TYPE_I && slice->slice_type != H264_SLICE_TYPE_SI) {
 		if (vs_ue(str, &slice->cabac_init_idc)) return 1;
 		if (slice->cabac_init_idc > 2) {
-			fprintf(stderr, "cabac_init_idc out of range!\n");
+			fprintf(vs_errfile(), "cabac_init_idc out of range!\n");
 			return 1;
 		}
 	}
@@ -1010,7 +1010,7 @@ int h264_slice_header(struct bitstream *str, struct h264_seqparm **seqparms, str
 		if (h264_prep_sgmap(slice)) return 1;
 	if (slice->seqparm->is_svc) {
 		/* XXX */
-		fprintf(stderr, "SVC\n");
+		fprintf(vs_errfile(), "SVC\n");
 		return 1;
 	}
 	return 0;
@@ -1316,7 +1316,7 @@ int h264_cabac_init_arith (struct bitstream *str, struct h264_cabac_context *cab
 	if (!cabac)
 		return 0;
 	if (str->bitpos != 7) {
-		fprintf (stderr, "Trying to init CABAC when not byte aligned\n");
+		fprintf (vs_errfile(), "Trying to init CABAC when not byte aligned\n");
 		return 1;
 	}
 	if (str->dir == VS_ENCODE) {
@@ -1329,19 +1329,149 @@ int h264_cabac_init_arith (struct bitstream *str, struct h264_cabac_context *cab
 		if (vs_u(str, &cabac->codIOffset, 9))
 			return 1;
 		if (cabac->codIOffset >= 510) {
-			fprintf (stderr, "Initial codIOffset >= 510\n");
+			fprintf (vs_errfile(), "Initial codIOffset >= 510\n");
 			return 1;
 		}
+		cabac->str = str;
+		cabac->window = cabac->codIOffset;
+		cabac->windowbits = 0;
 	}
 	return 0;
 }
 
+/*
+ * The decoder keeps codIOffset in a 64-bit window, followed by up to 32
+ * more bits read ahead from the stream at once, so renormalization is just
+ * a shift.  The bits read ahead are put back whenever something else could
+ * look at the stream: when terminate decodes a 1, and on destroy.  When
+ * there aren't enough bits left in the NAL to read ahead, the bits are put
+ * back and read one by one as before, so that running out of them, and
+ * whatever comes after that, goes exactly the same.
+ */
+
+static int dec_fill(struct bitstream *str, struct h264_cabac_context *cabac) {
+	uint32_t tmp;
+	if (!vs_try_u(str, &tmp, 32))
+		return 0;
+	cabac->window = cabac->window << 32 | tmp;
+	cabac->windowbits += 32;
+	return 1;
+}
+
+static void dec_flush(struct h264_cabac_context *cabac) {
+	if (cabac->windowbits) {
+		vs_unread(cabac->str, cabac->windowbits);
+		cabac->window >>= cabac->windowbits;
+		cabac->windowbits = 0;
+	}
+	cabac->codIOffset = cabac->window;
+}
+
+static int dec_renorm_slow(struct bitstream *str, struct h264_cabac_context *cabac) {
+	int res = 0;
+	dec_flush(cabac);
+	while (cabac->codIRange < 256) {
+		uint32_t tmp;
+		cabac->codIRange <<= 1;
+		cabac->codIOffset <<= 1;
+		if (vs_u(str, &tmp, 1)) {
+			res = 1;
+			break;
+		}
+		cabac->codIOffset |= tmp;
+	}
+	cabac->window = cabac->codIOffset;
+	return res;
+}
+
+static inline int dec_renorm(struct bitstream *str, struct h264_cabac_context *cabac) {
+	int shift;
+	if (cabac->codIRange >= 256)
+		return 0;
+	if (!cabac->codIRange)
+		return dec_renorm_slow(str, cabac);
+	shift = __builtin_clz(cabac->codIRange) - 23;
+	if (cabac->windowbits < shift && !dec_fill(str, cabac))
+		return dec_renorm_slow(str, cabac);
+	cabac->codIRange <<= shift;
+	cabac->windowbits -= shift;
+	return 0;
+}
+
+static inline int dec_decision(struct bitstream *str, struct h264_cabac_context *cabac, int ctxIdx, uint32_t *binVal) {
+	int pStateIdx = cabac->pStateIdx[ctxIdx];
+	int codIRangeLPS = rangeTabLPS[pStateIdx][cabac->codIRange >> 6 & 3];
+	uint64_t scaled;
+	cabac->codIRange -= codIRangeLPS;
+	scaled = (uint64_t)cabac->codIRange << cabac->windowbits;
+	if (cabac->window >= scaled) {
+		*binVal = !cabac->valMPS[ctxIdx];
+		cabac->window -= scaled;
+		cabac->codIRange = codIRangeLPS;
+		if (pStateIdx == 0)
+			cabac->valMPS[ctxIdx] = *binVal;
+		cabac->pStateIdx[ctxIdx] = transIdxLPS[pStateIdx];
+	} else {
+		*binVal = cabac->valMPS[ctxIdx];
+		cabac->pStateIdx[ctxIdx] = transIdxMPS[pStateIdx];
+	}
+	if (dec_renorm(str, cabac))
+		return 1;
+	cabac->BinCount++;
+	return 0;
+}
+
+static inline int dec_bypass(struct bitstream *str, struct h264_cabac_context *cabac, uint32_t *binVal) {
+	uint64_t scaled;
+	if (cabac->windowbits || dec_fill(str, cabac)) {
+		cabac->windowbits--;
+	} else {
+		uint32_t tmp;
+		cabac->codIOffset = cabac->window << 1;
+		cabac->window = cabac->codIOffset;
+		if (vs_u(str, &tmp, 1))
+			return 1;
+		cabac->window |= tmp;
+	}
+	scaled = (uint64_t)cabac->codIRange << cabac->windowbits;
+	if (cabac->window >= scaled) {
+		*binVal = 1;
+		cabac->window -= scaled;
+	} else {
+		*binVal = 0;
+	}
+	cabac->BinCount++;
+	return 0;
+}
+
+static int dec_terminate(struct bitstream *str, struct h264_cabac_context *cabac, uint32_t *binVal) {
+	cabac->codIRange -= 2;
+	if (cabac->window >= (uint64_t)cabac->codIRange << cabac->windowbits) {
+		*binVal = 1;
+		dec_flush(cabac);
+	} else {
+		*binVal = 0;
+		if (dec_renorm(str, cabac))
+			return 1;
+	}
+	cabac->BinCount++;
+	return 0;
+}
+
+static inline int dec_bin(struct bitstream *str, struct h264_cabac_context *cabac, int ctxIdx, uint32_t *binVal) {
+	if (ctxIdx == -1)
+		return dec_bypass(str, cabac, binVal);
+	if (ctxIdx == H264_CABAC_CTXIDX_TERMINATE)
+		return dec_terminate(str, cabac, binVal);
+	return dec_decision(str, cabac, ctxIdx, binVal);
+}
+
 static int put_bit(struct bitstream *str, struct h264_cabac_context *cabac, uint32_t bit) {
 	uint32_t nbit = !bit;
 	if (cabac->firstBitFlag) {
 		cabac->firstBitFlag = 0;
 		if (bit != 0) {
-			fprintf (stderr, "CABAC initial skipped bit not 0\n");
+			fprintf (vs_errfile(), "CABAC initial skipped bit not 0\n");
 			return 1;
 		}
 	} else {
@@ -1357,6 +1487,8 @@ static int put_bit(struct bitstream *str, struct h264_cabac_context *cabac, uint
 }
 
 int h264_cabac_renorm(struct bitstream *str, struct h264_cabac_context *cabac) {
+	if (str->dir == VS_DECODE)
+		return dec_renorm(str, cabac);
 	while (cabac->codIRange < 256) {
 		cabac->codIRange <<= 1;
 		cabac->codIOffset <<= 1;
@@ -1372,17 +1504,14 @@ int h264_cabac_renorm(struct bitstream *str, struct h264_cabac_context *cabac) {
 				cabac->bitsOutstanding++;
 				cabac->codIOffset -= 512;
 			}
-		} else {
-			uint32_t tmp;
-			if (vs_u(str, &tmp, 1))
-				return 1;
-			cabac->codIOffset |= tmp;
 		}
 	}
 	return 0;
 }
 
 int h264_cabac_decision(struct bitstream *str, struct h264_cabac_context *cabac, int ctxIdx, uint32_t *binVal) {
+	if (str->dir == VS_DECODE)
+		return dec_bin(str, cabac, ctxIdx, binVal);
 	if (ctxIdx == -1)
 		return h264_cabac_bypass(str, cabac, binVal);
 	if (ctxIdx == H264_CABAC_CTXIDX_TERMINATE)
@@ -1390,19 +1519,9 @@ int h264_cabac_decision(struct bitstream *str, struct h264_cabac_context *cabac,
 	int qCodIRangeIdx = cabac->codIRange >> 6 & 3;
 	int codIRangeLPS = rangeTabLPS[cabac->pStateIdx[ctxIdx]][qCodIRangeIdx];
 	cabac->codIRange -= codIRangeLPS;
-	if (str->dir == VS_ENCODE) {
-		if (*binVal != cabac->valMPS[ctxIdx]) {
-			cabac->codIOffset += cabac->codIRange;
-			cabac->codIRange = codIRangeLPS;
-		}
-	} else {
-		if (cabac->codIOffset >= cabac->codIRange) {
-			*binVal = !cabac->valMPS[ctxIdx];
-			cabac->codIOffset -= cabac->codIRange;
-			cabac->codIRange = codIRangeLPS;
-		} else {
-			*binVal = cabac->valMPS[ctxIdx];
-		}
+	if (*binVal != cabac->valMPS[ctxIdx]) {
+		cabac->codIOffset += cabac->codIRange;
+		cabac->codIRange = codIRangeLPS;
 	}
 	if (*binVal == cabac->valMPS[ctxIdx]) {
 		cabac->pStateIdx[ctxIdx] = transIdxMPS[cabac->pStateIdx[ctxIdx]];
@@ -1418,64 +1537,45 @@ int h264_cabac_decision(struct bitstream *str, struct h264_cabac_context *cabac,
 }
 
 int h264_cabac_bypass(struct bitstream *str, struct h264_cabac_context *cabac, uint32_t *binVal) {
+	if (str->dir == VS_DECODE)
+		return dec_bypass(str, cabac, binVal);
 	cabac->codIOffset <<= 1;
-	if (str->dir == VS_ENCODE) {
-		if (*binVal)
-			cabac->codIOffset += cabac->codIRange;
-		if (cabac->codIOffset < 512) {
-			if (put_bit(str, cabac, 0))
-				return 1;
-		} else if (cabac->codIOffset >= 1024) {
-			if (put_bit(str, cabac, 1))
-				return 1;
-			cabac->codIOffset -= 1024;
-		} else {
-			cabac->bitsOutstanding++;
-			cabac->codIOffset -= 512;
-		}
-	} else {
-		uint32_t tmp;
-		if (vs_u(str, &tmp, 1))
+	if (*binVal)
+		cabac->codIOffset += cabac->codIRange;
+	if (cabac->codIOffset < 512) {
+		if (put_bit(str, cabac, 0))
 			return 1;
-		cabac->codIOffset |= tmp;
-		if (cabac->codIOffset >= cabac->codIRange) {
-			*binVal = 1;
-			cabac->codIOffset -= cabac->codIRange;
-		} else {
-			*binVal = 0;
-		}
+	} else if (cabac->codIOffset >= 1024) {
+		if (put_bit(str, cabac, 1))
+			return 1;
+		cabac->codIOffset -= 1024;
+	} else {
+		cabac->bitsOutstanding++;
+		cabac->codIOffset -= 512;
 	}
 	cabac->BinCount++;
 	return 0;
 }
 
 int h264_cabac_terminate(struct bitstream *str, struct h264_cabac_context *cabac, uint32_t *binVal) {
+	if (str->dir == VS_DECODE)
+		return dec_terminate(str, cabac, binVal);
 	cabac->codIRange -= 2;
-	if (str->dir == VS_ENCODE) {
-		if (*binVal) {
-			cabac->codIOffset += cabac->codIRange;
-			/* end of the road */
-			cabac->codIRange = 2;
-			if (h264_cabac_renorm(str, cabac))
-				return 1;
-			if (put_bit(str, cabac, cabac->codIOffset >> 9 & 1))
-				return 1;
-			if (put_bit(str, cabac, cabac->codIOffset >> 8 & 1))
-				return 1;
-			if (put_bit(str, cabac, 1)) /* the last bit, doubling as RBSP terminator if terminating due to end of slice */
-				return 1;
-		} else {
-			if (h264_cabac_renorm(str, cabac))
-				return 1;
-		}
+	if (*binVal) {
+		cabac->codIOffset += cabac->codIRange;
+		/* end of the road */
+		cabac->codIRange = 2;
+		if (h264_cabac_renorm(str, cabac))
+			return 1;
+		if (put_bit(str, cabac, cabac->codIOffset >> 9 & 1))
+			return 1;
+		if (put_bit(str, cabac, cabac->codIOffset >> 8 & 1))
+			return 1;
+		if (put_bit(str, cabac, 1)) /* the last bit, doubling as RBSP terminator if terminating due to end of slice */
+			return 1;
 	} else {
-		if (cabac->codIOffset >= cabac->codIRange) {
-			*binVal = 1;
-		} else {
-			*binVal = 0;
-			if (h264_cabac_renorm(str, cabac))
-				return 1;
-		}
+		if (h264_cabac_renorm(str, cabac))
+			return 1;
 	}
 	cabac->BinCount++;
 	return 0;
@@ -1512,7 +1612,7 @@ int h264_cabac_se(struct bitstream *str, struct h264_cabac_context *cabac, const
 					return 0;
 			}
 		}
-		fprintf(stderr, "No binarization for a value\n");
+		fprintf(vs_errfile(), "No binarization for a value\n");
 		return 1;
 	} else {
 		int i, j;
@@ -1524,11 +1624,11 @@ int h264_cabac_se(struct bitstream *str, struct h264_cabac_context *cabac, const
 			for (j = 0; j < tab[i].blen; j++) {
 				if (bidx[j] == -1) {
 					bidx[j] = tab[i].bits[j].bidx;
-					if (h264_cabac_decision(str, cabac, ctxIdx[bidx[j]], &bit[j]))
+					if (dec_bin(str, cabac, ctxIdx[bidx[j]], &bit[j]))
 						return 1;
 				}
 				if (bidx[j] != tab[i].bits[j].bidx) {
-					fprintf(stderr, "Inconsistent CABAC se table!\n");
+					fprintf(vs_errfile(), "Inconsistent CABAC se table!\n");
 					return 1;
 				}
 				if (bit[j] != tab[i].bits[j].val)
@@ -1543,7 +1643,7 @@ int h264_cabac_se(struct bitstream *str, struct h264_cabac_context *cabac, const
 				}
 			}
 		}
-		fprintf(stderr, "No value for a binarization\n");
+		fprintf(vs_errfile(), "No value for a binarization\n");
 		return 1;
 	}
 }
@@ -1552,7 +1652,7 @@ int h264_cabac_tu(struct bitstream *str, struct h264_cabac_context *cabac, int *
 	if (str->dir == VS_ENCODE) {
 		int i;
 		if (*val > cMax) {
-			fprintf(stderr, "TU value over limit\n");
+			fprintf(vs_errfile(), "TU value over limit\n");
 			return 1;
 		}
 		for (i = 0; i <= *val && i < cMax; i++) {
@@ -1564,7 +1664,7 @@ int h264_cabac_tu(struct bitstream *str, struct h264_cabac_context *cabac, int *
 		int i;
 		uint32_t tmp = 1;
 		for (i = 0; i < cMax; i++) {
-			if (h264_cabac_decision(str, cabac, ctxIdx[i >= numidx ? numidx - 1 : i], &tmp)) return 1;
+			if (dec_bin(str, cabac, ctxIdx[i >= numidx ? numidx - 1 : i], &tmp)) return 1;
 			if (!tmp)
 				break;
 		}
@@ -1598,14 +1698,14 @@ int h264_cabac_ueg(struct bitstream *str, struct h264_cabac_context *cabac, int
 		} else {
 			uint32_t tmp;
 			while (1) {
-				if (h264_cabac_bypass(str, cabac, &tmp)) return 1;
+				if (dec_bypass(str, cabac, &tmp)) return 1;
 				if (!tmp)
 					break;
 				rval += 1 << k;
 				k++;
 			}
 			while (k--) {
-				if (h264_cabac_bypass(str, cabac, &tmp)) return 1;
+				if (dec_bypass(str, cabac, &tmp)) return 1;
 				rval += tmp << k;
 			}
 		}
@@ -1627,5 +1727,7 @@ int h264_cabac_ueg(struct bitstream *str, struct h264_cabac_context *cabac, int
 }
 
 void h264_cabac_destroy(struct h264_cabac_context *cabac) {
+	if (cabac && cabac->str)
+		dec_flush(cabac);
 	free(cabac);
 }
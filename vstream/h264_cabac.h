@@ -183,6 +183,10 @@ struct h264_cabac_context {
 	int firstBitFlag;
 	int bitsOutstanding;
 	int BinCount;
+	/* decode: codIOffset followed by windowbits bits read ahead from str */
+	struct bitstream *str;
+	uint64_t window;
+	int windowbits;
 };
 
 struct h264_cabac_se_val {
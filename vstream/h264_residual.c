@@ -42,7 +42,7 @@ int h264_residual_cavlc(struct bitstream *str, struct h264_slice *slice, int32_t
 		for (i = 0; i < maxnumcoeff; i++)
 			if (block[i]) {
 				if (i < start || i > end) {
-					fprintf(stderr, "Non-zero coord outside of start..end\n");
+					fprintf(vs_errfile(), "Non-zero coord outside of start..end\n");
 					return 1;
 				}
 				total_coeff++;
@@ -103,7 +103,7 @@ int h264_residual_cavlc(struct bitstream *str, struct h264_slice *slice, int32_t
 			if (h264_run_before(str, zerosLeft, &run[i])) return 1;
 			zerosLeft -= run[i];
 			if (zerosLeft < 0) {
-				fprintf(stderr, "zerosLeft underflow\n");
+				fprintf(vs_errfile(), "zerosLeft underflow\n");
 				return 1;
 			}
 		}
@@ -193,7 +193,7 @@ int h264_residual_cabac(struct bitstream *str, struct h264_cabac_context *cabac,
 			for (i = 0; i < maxnumcoeff; i++) {
 				if (block[i]) {
 					if (i < start || i > end) {
-						fprintf (stderr, "Non-zero coordinate outside start..end!\n");
+						fprintf (vs_errfile(), "Non-zero coordinate outside start..end!\n");
 						return 1;
 					}
 					significant_coeff_flag[i] = 1;
@@ -240,7 +240,7 @@ int h264_residual_cabac(struct bitstream *str, struct h264_cabac_context *cabac,
 		for (i = 0; i < maxnumcoeff; i++) {
 			if (str->dir == VS_ENCODE) {
 				if (block[i]) {
-					fprintf(stderr, "Non-zero coordinate in a skipped block!\n");
+					fprintf(vs_errfile(), "Non-zero coordinate in a skipped block!\n");
 					return 1;
 				}
 			} else {
@@ -258,7 +258,7 @@ int h264_residual_block(struct bitstream *str, struct h264_cabac_context *cabac,
 			for (i = 0; i < maxnumcoeff; i++) {
 				if (str->dir == VS_ENCODE) {
 					if (block[i]) {
-						fprintf(stderr, "Non-zero coordinate in a skipped block!\n");
+						fprintf(vs_errfile(), "Non-zero coordinate in a skipped block!\n");
 						return 1;
 					}
 				} else {
@@ -29,7 +29,7 @@
 
 int h264_mb_skip_flag(struct bitstream *str, struct h264_cabac_context *cabac, uint32_t *binVal) {
 	if (!cabac) {
-		fprintf (stderr, "mb_skip_flag used in CAVLC mode\n");
+		fprintf (vs_errfile(), "mb_skip_flag used in CAVLC mode\n");
 		return 1;
 	}
 	int ctxIdxOffset, ctxIdxInc;
@@ -38,7 +38,7 @@ int h264_mb_skip_flag(struct bitstream *str, struct h264_cabac_context *cabac, u
 	} else if (cabac->slice->slice_type == H264_SLICE_TYPE_B) {
 		ctxIdxOffset = H264_CABAC_CTXIDX_MB_SKIP_FLAG_B;
 	} else {
-		fprintf (stderr, "mb_skip_flag used in I/SI slice\n");
+		fprintf (vs_errfile(), "mb_skip_flag used in I/SI slice\n");
 		return 1;
 	}
 	const struct h264_macroblock *mbA = h264_mb_nb(cabac->slice, H264_MB_A, 0);
@@ -189,7 +189,7 @@ int h264_mb_type(struct bitstream *str, struct h264_cabac_context *cabac, uint32
 			} else if (*val < H264_MB_TYPE_I_END) {
 				rval = *val + rend - rstart;
 			} else {
-				fprintf (stderr, "Invalid mb_type for this slice_type\n");
+				fprintf (vs_errfile(), "Invalid mb_type for this slice_type\n");
 				return 1;
 			}
 		}
@@ -201,7 +201,7 @@ int h264_mb_type(struct bitstream *str, struct h264_cabac_context *cabac, uint32
 			} else if (rval < rend - rstart + H264_MB_TYPE_I_END) {
 				*val = rval - (rend - rstart);
 			} else {
-				fprintf (stderr, "Invalid mb_type for this slice_type\n");
+				fprintf (vs_errfile(), "Invalid mb_type for this slice_type\n");
 				return 1;
 			}
 		}
@@ -289,7 +289,7 @@ int h264_sub_mb_type(struct bitstream *str, struct h264_cabac_context *cabac, ui
 				rend = H264_SUB_MB_TYPE_B_END;
 				break;
 			default:
-				fprintf(stderr, "sub_mb_type requested for invalid slice type\n");
+				fprintf(vs_errfile(), "sub_mb_type requested for invalid slice type\n");
 				return 1;
 		}
 		uint32_t tmp = *val - rbase;
@@ -297,7 +297,7 @@ int h264_sub_mb_type(struct bitstream *str, struct h264_cabac_context *cabac, ui
 			return 1;
 		*val = tmp + rbase;
 		if (*val < rbase || *val >= rend) {
-			fprintf(stderr, "Invalid sub_mb_type for this slice_type\n");
+			fprintf(vs_errfile(), "Invalid sub_mb_type for this slice_type\n");
 			return 1;
 		}
 		return 0;
@@ -318,7 +318,7 @@ int h264_sub_mb_type(struct bitstream *str, struct h264_cabac_context *cabac, ui
 			};
 			return h264_cabac_se(str, cabac, sub_mb_type_b, bidx, val);
 		} else {
-			fprintf(stderr, "sub_mb_type requested for invalid slice type\n");
+			fprintf(vs_errfile(), "sub_mb_type requested for invalid slice type\n");
 			return 1;
 		}
 	}
@@ -413,7 +413,7 @@ int h264_coded_block_pattern(struct bitstream *str, struct h264_cabac_context *c
 			which = 1;
 		if (str->dir == VS_ENCODE) {
 			if (*val >= maxval) {
-				fprintf(stderr, "coded_block_pattern too large\n");
+				fprintf(vs_errfile(), "coded_block_pattern too large\n");
 				return 1;
 			}
 			int i;
@@ -426,7 +426,7 @@ int h264_coded_block_pattern(struct bitstream *str, struct h264_cabac_context *c
 			return 1;
 		if (str->dir == VS_DECODE) {
 			if (tmp >= maxval) {
-				fprintf(stderr, "coded_block_pattern too large\n");
+				fprintf(vs_errfile(), "coded_block_pattern too large\n");
 				return 1;
 			}
 			*val = tab[tmp][which];
@@ -445,7 +445,7 @@ int h264_coded_block_pattern(struct bitstream *str, struct h264_cabac_context *c
 		mbB = h264_mb_nb(cabac->slice, H264_MB_B, 0);
 		if (str->dir == VS_ENCODE) {
 			if (*val >= (has_chroma?48:16)) {
-				fprintf(stderr, "coded_block_pattern too large\n");
+				fprintf(vs_errfile(), "coded_block_pattern too large\n");
 				return 1;
 			}
 			bit[0] = *val >> 0 & 1;
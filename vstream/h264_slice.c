@@ -761,7 +761,8 @@ int h264_slice_data(struct bitstream *str, struct h264_slice *slice) {
 				slice->last_mb_in_slice = slice->curr_mb_addr;
 			slice->curr_mb_addr = h264_next_mb_addr(slice, slice->curr_mb_addr);
 			if (slice->curr_mb_addr >= slice->pic_size_in_mbs) {
-				fprintf(stderr, "MB index out of range!\n");
+				fprintf(vs_errfile(), "MB index out of range!\n");
+				h264_cabac_destroy(cabac);
 				return 1;
 			}
 		}
@@ -789,7 +790,7 @@ int h264_slice_data(struct bitstream *str, struct h264_slice *slice) {
 					if (vs_ue(str, &mb_skip_run)) return 1;
 					while (mb_skip_run--) {
 						if (slice->curr_mb_addr >= slice->pic_size_in_mbs) {
-							fprintf(stderr, "MB index out of range!\n");
+							fprintf(vs_errfile(), "MB index out of range!\n");
 							return 1;
 						}
 						slice->last_mb_in_slice = slice->curr_mb_addr;
@@ -807,7 +808,7 @@ int h264_slice_data(struct bitstream *str, struct h264_slice *slice) {
 				}
 			}
 			if (slice->curr_mb_addr >= slice->pic_size_in_mbs) {
-				fprintf(stderr, "MB index out of range!\n");
+				fprintf(vs_errfile(), "MB index out of range!\n");
 				return 1;
 			}
 			if (slice->mbaff_frame_flag) {
@@ -839,7 +840,7 @@ int h264_slice_data(struct bitstream *str, struct h264_slice *slice) {
 				slice->last_mb_in_slice = slice->curr_mb_addr;
 			slice->curr_mb_addr = h264_next_mb_addr(slice, slice->curr_mb_addr);
 			if (slice->curr_mb_addr >= slice->pic_size_in_mbs) {
-				fprintf(stderr, "MB index out of range!\n");
+				fprintf(vs_errfile(), "MB index out of range!\n");
 				return 1;
 			}
 		}
@@ -1,5 +1,98 @@
 #include "vstream.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * vs_vlc decodes through lookup tables while the RBSP buffer is valid, and
+ * scans the table otherwise.  Both have to give the same values and consume
+ * the same bits, for invalid codes and codes cut off by the end of the NAL
+ * too.
+ */
+
+/* Exp-Golomb-like codes up to 19 bits, with some left out */
+static struct vs_vlc_val vlc_long[1024];
+
+/* the first entry extends the second, so the scan reads 3 bits for a 01 */
+static const struct vs_vlc_val vlc_ext[] = {
+	{ 1, 3, 0,1,1 },
+	{ 2, 2, 0,1 },
+	{ 3, 1, 1 },
+	{ 0 }
+};
+
+static const struct vs_vlc_val vlc_short[] = {
+	{ 0, 1, 1 },
+	{ 1, 3, 0,1,1 },
+	{ 2, 3, 0,1,0 },
+	{ 3, 5, 0,0,1,1,1 },
+	{ 4, 6, 0,0,1,1,0,1 },
+	{ 5, 9, 0,0,0,0,0,0,0,1,1 },
+	{ 0 }
+};
+
+static int check_vlc_stream(const struct vs_vlc_val *tab, uint8_t *bytes, int len) {
+	uint8_t *b1 = malloc(len), *b2 = malloc(len);
+	struct bitstream *s1, *s2;
+	uint32_t v1, v2;
+	int r1, r2, res = 0;
+	memcpy(b1, bytes, len);
+	memcpy(b2, bytes, len);
+	s1 = vs_new_decode(VS_H264, b1, len);
+	s2 = vs_new_decode(VS_H264, b2, len);
+	if (!vs_start(s1, &v1) && !vs_start(s2, &v2)) {
+		/* make this one scan */
+		s2->rbspvalid = 0;
+		do {
+			v1 = v2 = 0;
+			r1 = vs_vlc(s1, &v1, tab);
+			r2 = vs_vlc(s2, &v2, tab);
+			if (r1 != r2 || v1 != v2 || s1->bitpos != s2->bitpos || s1->hasbyte != s2->hasbyte) {
+				fprintf (stderr, "VLC lookup mismatch: %d %x at bit %d vs %d %x at bit %d\n", r1, v1, s1->bitpos, r2, v2, s2->bitpos);
+				res = 1;
+				break;
+			}
+		} while (!r1);
+	}
+	vs_destroy(s1);
+	vs_destroy(s2);
+	return res;
+}
+
+static int check_vlc(void) {
+	const struct vs_vlc_val *tabs[] = { vlc_long, vlc_ext, vlc_short };
+	uint8_t bytes[48];
+	int i, j, k, t, n = 0, m = 0;
+	for (k = 0; k < 10; k++) {
+		for (i = 0; i < 1 << k; i++, n++) {
+			if (n % 7 == 6)
+				continue;
+			vlc_long[m].val = n;
+			vlc_long[m].blen = 2 * k + 1;
+			vlc_long[m].bits[k] = 1;
+			for (j = 0; j < k; j++)
+				vlc_long[m].bits[k + 1 + j] = i >> (k - 1 - j) & 1;
+			m++;
+		}
+	}
+	srand(1);
+	for (t = 0; t < 3; t++) {
+		for (i = 0; i < 1000; i++) {
+			int len = 4 + rand() % 40;
+			bytes[0] = 0;
+			bytes[1] = 0;
+			bytes[2] = 1;
+			bytes[3] = 0x21;
+			for (j = 4; j < len; j++) {
+				int r = rand() % 4;
+				bytes[j] = r == 0 ? 0 : r == 1 ? rand() & 7 : rand();
+			}
+			if (check_vlc_stream(tabs[t], bytes, len))
+				return 1;
+		}
+	}
+	return 0;
+}
 
 int main() {
 	struct bitstream *str = vs_new_encode(VS_H264);
@@ -105,6 +198,11 @@ int main() {
 		fprintf (stderr, "Bitstream not fully consumed!\n");
 		return 1;
 	}
+	/* the streams end in errors, keep them quiet */
+	vs_set_errfile(fopen("/dev/null", "w"));
+	if (check_vlc())
+		return 1;
+	vs_set_errfile(0);
 	fprintf (stderr, "All ok!\n");
 
 	return 0;